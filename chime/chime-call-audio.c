@@ -34,73 +34,405 @@
 #include <string.h>
 #include <ctype.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct audio_work {
+	ChimeCallAudio *audio;
+	chime_audio_work_fn fn;
+	gsize len;
+	guint8 data[];
+};
+
+static struct audio_work *new_work(ChimeCallAudio *audio, chime_audio_work_fn fn,
+				   gconstpointer data, gsize len)
+{
+	struct audio_work *w = g_malloc(sizeof(*w) + len);
+
+	w->audio = audio;
+	w->fn = fn;
+	w->len = len;
+	if (len)
+		memcpy(w->data, data, len);
+	return w;
+}
+
+/* Any work function may end up closing the call, e.g. by setting the
+ * state to FAILED. If it does, @audio is gone and we must stop. */
+static gboolean run_main_queue(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	gboolean closed = FALSE;
+	struct audio_work *w;
+
+	g_mutex_lock(&audio->main_lock);
+	audio->main_idle = 0;
+	audio->main_closed = &closed;
+	while ((w = g_queue_pop_head(&audio->main_queue))) {
+		g_mutex_unlock(&audio->main_lock);
+		w->fn(audio, w->data, w->len);
+		g_free(w);
+		if (closed)
+			return G_SOURCE_REMOVE;
+		g_mutex_lock(&audio->main_lock);
+	}
+	audio->main_closed = NULL;
+	g_mutex_unlock(&audio->main_lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Queued rather than using g_main_context_invoke() so that anything
+ * still pending can be dropped when the call is closed. */
+void chime_call_audio_run_on_main(ChimeCallAudio *audio, chime_audio_work_fn fn,
+				  gconstpointer data, gsize len)
+{
+	struct audio_work *w = new_work(audio, fn, data, len);
+
+	g_mutex_lock(&audio->main_lock);
+	g_queue_push_tail(&audio->main_queue, w);
+	if (!audio->main_idle)
+		audio->main_idle = g_idle_add(run_main_queue, audio);
+	g_mutex_unlock(&audio->main_lock);
+}
+
+static gboolean run_rt_work(gpointer _w)
+{
+	struct audio_work *w = _w;
+
+	w->fn(w->audio, w->data, w->len);
+	return G_SOURCE_REMOVE;
+}
+
+static void rt_idle_add(ChimeCallAudio *audio, GSourceFunc func, gpointer data,
+			GDestroyNotify notify)
+{
+	GSource *source = g_idle_source_new();
+
+	g_source_set_priority(source, G_PRIORITY_HIGH);
+	g_source_set_callback(source, func, data, notify);
+	g_source_attach(source, audio->rt_context);
+	g_source_unref(source);
+}
+
+/* Always queued, never run directly as g_main_context_invoke() might if
+ * the thread isn't running. Anything still pending when the thread stops
+ * is freed along with rt_context. */
+void chime_call_audio_run_on_rt(ChimeCallAudio *audio, chime_audio_work_fn fn,
+				gconstpointer data, gsize len)
+{
+	rt_idle_add(audio, run_rt_work, new_work(audio, fn, data, len), g_free);
+}
+
+GSource *chime_call_audio_rt_timeout(ChimeCallAudio *audio, guint ms, GSourceFunc func)
+{
+	GSource *source = g_timeout_source_new(ms);
+
+	g_source_set_callback(source, func, audio, NULL);
+	g_source_attach(source, audio->rt_context);
+	return source;
+}
+
+static gboolean ticker_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	return callback(user_data);
+}
+
+static GSourceFuncs ticker_funcs = {
+	.dispatch = ticker_dispatch,
+};
+
+/* Fires at an absolute monotonic time. The callback should move that on
+ * with g_source_set_ready_time(), so a late tick doesn't delay the next. */
+GSource *chime_call_audio_rt_ticker(ChimeCallAudio *audio, gint64 ready_time, GSourceFunc func)
+{
+	GSource *source = g_source_new(&ticker_funcs, sizeof(GSource));
+
+	g_source_set_callback(source, func, audio, NULL);
+	g_source_set_ready_time(source, ready_time);
+	g_source_attach(source, audio->rt_context);
+	return source;
+}
+
+void chime_call_audio_rt_source_clear(GSource **source)
+{
+	if (*source) {
+		g_source_destroy(*source);
+		g_source_unref(*source);
+		*source = NULL;
+	}
+}
+
+/* Best effort; this needs CAP_SYS_NICE or an RLIMIT_RTPRIO grant on Linux */
+static void raise_thread_priority(void)
+{
+#ifdef _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+	struct sched_param sp = { .sched_priority = sched_get_priority_min(SCHED_RR) };
+	int ret = pthread_setschedparam(pthread_self(), SCHED_RR, &sp);
+
+	if (ret)
+		chime_debug("Audio thread stays at normal priority: %s\n", strerror(ret));
+#endif
+}
+
+static gpointer audio_rt_thread(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+
+	raise_thread_priority();
+
+	g_main_context_push_thread_default(audio->rt_context);
+	g_main_loop_run(audio->rt_loop);
+	g_main_context_pop_thread_default(audio->rt_context);
+
+	return NULL;
+}
+
+static void audio_rt_start(ChimeCallAudio *audio)
+{
+	audio->rt_context = g_main_context_new();
+	audio->rt_loop = g_main_loop_new(audio->rt_context, FALSE);
+	audio->rt_thread = g_thread_new("chime-audio", audio_rt_thread, audio);
+}
+
+static gboolean audio_rt_quit(gpointer loop)
+{
+	g_main_loop_quit(loop);
+	return G_SOURCE_REMOVE;
+}
+
+static void audio_rt_stop(ChimeCallAudio *audio)
+{
+	/* Quitting directly would be lost if the loop hasn't started yet */
+	rt_idle_add(audio, audio_rt_quit, audio->rt_loop, NULL);
+	g_thread_join(audio->rt_thread);
+	audio->rt_thread = NULL;
+}
+
+static void *arena_alloc(void *_arena, size_t size)
+{
+	struct chime_arena *arena = _arena;
+	gsize aligned = (size + sizeof(guint64) - 1) & ~(sizeof(guint64) - 1);
+	void *ret;
+
+	if (aligned > sizeof(arena->buf) - arena->used)
+		return g_malloc(size);
+
+	ret = (guint8 *)arena->buf + arena->used;
+	arena->used += aligned;
+	return ret;
+}
+
+static void arena_free(void *_arena, void *ptr)
+{
+	struct chime_arena *arena = _arena;
+
+	if ((guint8 *)ptr >= (guint8 *)arena->buf &&
+	    (guint8 *)ptr < (guint8 *)arena->buf + sizeof(arena->buf))
+		return;
+
+	g_free(ptr);
+}
+
+/* The pool's buffers are big enough for any payload we'll see, and they
+ * are sized down to fit. Only a pathological packet gets a fresh one. */
+GstBuffer *chime_call_audio_new_rx_buffer(ChimeCallAudio *audio, gsize payload_len)
+{
+	/* RTPv2, no padding, extension or CSRCs; the rest is filled in later */
+	static const guint8 rtp_hdr[2] = { 0x80, 0x00 };
+	gsize len = gst_rtp_buffer_calc_packet_len(payload_len, 0, 0);
+	GstBuffer *buffer = NULL;
+
+	if (len <= gst_rtp_buffer_calc_packet_len(XRP_MAX_PAYLOAD, 0, 0) &&
+	    gst_buffer_pool_acquire_buffer(audio->rx_pool, &buffer, NULL) == GST_FLOW_OK) {
+		gst_buffer_set_size(buffer, len);
+		gst_buffer_fill(buffer, 0, rtp_hdr, sizeof(rtp_hdr));
+		return buffer;
+	}
 
+	return gst_rtp_buffer_new_allocate(payload_len, 0, 0);
+}
+
+static void remote_mute(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	chime_call_audio_local_mute(audio, TRUE);
+}
+
+struct profile_stats {
+	guint32 stream_id;
+	gint vol;
+	gint signal_strength;
+};
+
+/* The profiles table belongs to the main thread, as does the call itself */
+static void update_profile_stats(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	const struct profile_stats *stats = data;
+	gsize i;
+
+	for (i = 0; i < len / sizeof(*stats); i++) {
+		const gchar *profile_id = g_hash_table_lookup(audio->profiles,
+							      GUINT_TO_POINTER(stats[i].stream_id));
+		if (!profile_id) {
+			chime_debug("no profile for stream id %d\n", stats[i].stream_id);
+			continue;
+		}
+
+		chime_debug("Participant %s vol %d\n", profile_id, stats[i].vol);
+		chime_call_participant_audio_stats(audio->call, profile_id, stats[i].vol,
+						   stats[i].signal_strength);
+	}
+}
+
+/*
+ * The E-model of ITU-T G.107, reduced to the usual VoIP rule of thumb.
+ * The jitter buffer turns jitter into delay, so it's the playout depth
+ * that counts towards latency rather than the jitter itself.
+ */
+static gdouble estimate_mos(gdouble delay_ms, gdouble loss_percent)
+{
+	gdouble r = 93.2, mos;
+
+	if (delay_ms < 160)
+		r -= delay_ms / 40;
+	else
+		r -= (delay_ms - 120) / 10;
+	r -= 2.5 * loss_percent;
+
+	if (r <= 0)
+		return 1.0;
+
+	mos = 1 + 0.035 * r + 7e-6 * r * (r - 60) * (100 - r);
+	return CLAMP(mos, 1.0, 4.5);
+}
+
+static void report_stats(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	chime_call_set_audio_stats(audio->call, data);
+}
+
+static gboolean audio_sample_stats(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	struct chime_jitter *jb = &audio->jb;
+	ChimeCallAudioStats stats = { 0 };
+	guint lost = g_atomic_int_get(&jb->lost);
+	guint d_received = jb->received - audio->stats_received;
+	guint d_lost = lost - audio->stats_lost;
+	ChimeAudioState state = g_atomic_int_get(&audio->state);
+	gdouble delay_ms;
+
+	if (state != CHIME_AUDIO_STATE_AUDIO &&
+	    state != CHIME_AUDIO_STATE_AUDIO_MUTED)
+		return G_SOURCE_CONTINUE;
+
+	audio->stats_received = jb->received;
+	audio->stats_lost = lost;
+
+	stats.frames_received = jb->received;
+	stats.frames_lost = lost;
+	if (d_received + d_lost)
+		stats.loss_percent = 100.0 * d_lost / (d_received + d_lost);
+	stats.jitter_ms = jb->jitter / 1000.0;
+	stats.rtt_ms = audio->rtt_us ? audio->rtt_us / 1000.0 : -1;
+
+	delay_ms = jb->target * FRAME_US / 1000.0;
+	if (audio->rtt_us)
+		delay_ms += stats.rtt_ms / 2;
+	stats.mos = estimate_mos(delay_ms, stats.loss_percent);
+
+	chime_debug("Audio stats: %u rx, %u lost (%.1f%%), jitter %.1fms, rtt %.0fms, MOS %.2f\n",
+		    stats.frames_received, stats.frames_lost, stats.loss_percent,
+		    stats.jitter_ms, stats.rtt_ms, stats.mos);
+
+	chime_call_audio_run_on_main(audio, report_stats, &stats, sizeof(stats));
+	return G_SOURCE_CONTINUE;
+}
+
+/* The server echoes back the server_time we last sent it, which was its
+ * own clock as we estimate it. So the difference from our estimate of
+ * that clock now is the round trip. */
+static void update_rtt(ChimeCallAudio *audio, guint64 echo_time, gint64 now)
+{
+	gint64 rtt;
+
+	if (!audio->last_server_time_offset)
+		return;
+
+	rtt = audio->last_server_time_offset + now - (gint64)echo_time;
+	if (rtt < 0 || rtt > 10 * G_USEC_PER_SEC)
+		return;
+
+	if (audio->rtt_us)
+		audio->rtt_us += (rtt - audio->rtt_us) / 8;
+	else
+		audio->rtt_us = rtt;
+}
 
 static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
-	RTMessage *msg = rtmessage__unpack(NULL, len, pkt);
-	if (!msg)
-		return FALSE;
+	struct chime_rt_rx rx;
+	RTMessage *msg;
+	gboolean fast = chime_call_xrp_rt_unpack(&rx, len, pkt);
+
+	if (fast) {
+		msg = &rx.rt;
+	} else {
+		audio->rx_arena.used = 0;
+		msg = rtmessage__unpack(&audio->rx_allocator, len, pkt);
+		if (!msg)
+			return FALSE;
+	}
 	gint64 now = g_get_monotonic_time();
 
 	if (msg->client_status) {
 		/* This never seems to happen in practice. We just get a Juggernaut message
 		 * about the call roster, with a 'muter' node in our own participant information. */
+		g_mutex_lock(&audio->rt_lock);
 		if (msg->client_status->has_remote_muted && msg->client_status->remote_muted) {
-			chime_call_audio_local_mute(audio, TRUE);
-
 			audio->rt_msg.client_status = &audio->client_status_msg;
 			audio->client_status_msg.has_remote_mute_ack = TRUE;
 			audio->client_status_msg.remote_mute_ack = TRUE;
 		} else {
 			audio->rt_msg.client_status = NULL;
 		}
+		g_mutex_unlock(&audio->rt_lock);
 
+		if (audio->rt_msg.client_status)
+			chime_call_audio_run_on_main(audio, remote_mute, NULL, 0);
 	}
 	if (msg->audio) {
+		if (msg->audio->has_echo_time)
+			update_rtt(audio, msg->audio->echo_time, now);
 		if (msg->audio->has_server_time) {
+			g_mutex_lock(&audio->rt_lock);
 			audio->last_server_time_offset = msg->audio->server_time - now;
 			audio->echo_server_time = TRUE;
+			g_mutex_unlock(&audio->rt_lock);
 		}
-		if (msg->audio->has_audio && audio->audio_src && audio->appsrc_need_data) {
-			GstBuffer *buffer = gst_rtp_buffer_new_allocate(msg->audio->audio.len, 0, 0);
-			GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
-			if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
-
-				chime_debug("Audio RX seq %d ts %u\n", msg->audio->seq, msg->audio->sample_time);
-
-				gst_rtp_buffer_set_ssrc(&rtp, audio->recv_ssrc);
-				gst_rtp_buffer_set_payload_type(&rtp, 97);
-				gst_rtp_buffer_set_seq(&rtp, msg->audio->seq);
-				gst_rtp_buffer_set_timestamp(&rtp, msg->audio->sample_time);
-				gst_rtp_buffer_unmap(&rtp);
-
-				gst_buffer_fill(buffer, gst_rtp_buffer_calc_header_len(0),
-						msg->audio->audio.data, msg->audio->audio.len);
-
-				gst_app_src_push_buffer(GST_APP_SRC(audio->audio_src), buffer);
-			}
+		if (msg->audio->has_audio && audio->audio_src) {
+			chime_call_jitter_insert(audio, msg->audio->seq, msg->audio->sample_time,
+						 msg->audio->audio.data, msg->audio->audio.len);
 		} else if (msg->audio->has_audio && msg->audio->audio.len) {
-			chime_debug("Audio drop (%p %d) seq %d ts %u\n",
-				    audio->audio_src, audio->appsrc_need_data,
+			chime_debug("Audio drop (no appsrc) seq %d ts %u\n",
 				    msg->audio->seq, msg->audio->sample_time);
 		}
 
 	}
-	gboolean send_sig = FALSE;
-	int i;
-	for (i=0; i < msg->n_profiles; i++) {
+	/* No more than the fast unpacker would take; the protobuf-c
+	 * fallback path has no limit of its own. */
+	struct profile_stats stats[XRP_RX_PROFILES];
+	int i, n = 0;
+	for (i=0; i < msg->n_profiles && n < XRP_RX_PROFILES; i++) {
 		if (!msg->profiles[i]->has_stream_id)
 			continue;
 
-		const gchar *profile_id = g_hash_table_lookup(audio->profiles,
-							      GUINT_TO_POINTER(msg->profiles[i]->stream_id));
-		if (!profile_id) {
-			chime_debug("no profile for stream id %d\n",
-			       msg->profiles[i]->stream_id);
-			continue;
-		}
-
 		int vol;
 		if (msg->profiles[i]->has_muted && msg->profiles[i]->muted)
 			vol = -128;
@@ -109,126 +441,142 @@ static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, g
 		else /* We should have one or the other */
 			continue;
 
-		int signal_strength = -1;
+		stats[n].stream_id = msg->profiles[i]->stream_id;
+		stats[n].vol = vol;
+		stats[n].signal_strength = -1;
 		if (msg->profiles[i]->has_signal_strength)
-			signal_strength = msg->profiles[i]->signal_strength;
-		chime_debug("Participant %s vol %d\n", profile_id, vol);
-		if (chime_call_participant_audio_stats(audio->call, profile_id, vol, signal_strength))
-			send_sig = TRUE;
+			stats[n].signal_strength = msg->profiles[i]->signal_strength;
+		n++;
 	}
-	if (send_sig)
-		chime_call_emit_participants(audio->call);
+	if (n)
+		chime_call_audio_run_on_main(audio, update_profile_stats, stats, n * sizeof(stats[0]));
 
-	rtmessage__free_unpacked(msg, NULL);
+	if (!fast)
+		rtmessage__free_unpacked(msg, &audio->rx_allocator);
 	return TRUE;
 }
 
-static gboolean audio_reconnect(gpointer _audio)
+/* Queued from whichever thread noticed; a disconnect cancels it */
+static void audio_reconnect(ChimeCallAudio *audio, gconstpointer data, gsize len)
 {
-	ChimeCallAudio *audio = _audio;
+	gboolean queued;
 
-	audio->timeout_source = 0;
+	g_mutex_lock(&audio->rt_lock);
+	queued = audio->reconnect_queued;
+	audio->reconnect_queued = FALSE;
+	g_mutex_unlock(&audio->rt_lock);
 
-	chime_call_transport_disconnect(audio, TRUE);
-	chime_call_transport_connect(audio, audio->silent);
+	if (queued) {
+		chime_call_transport_disconnect(audio, TRUE);
+		chime_call_transport_connect(audio, audio->silent);
+	}
+}
 
-	return G_SOURCE_REMOVE;
+/* Media time runs at 16kHz from when the call was opened, whether or
+ * not we actually have any audio to send. */
+static guint32 media_time(ChimeCallAudio *audio, gint64 now)
+{
+	return audio->media_base + (now - audio->media_epoch) * 16 / 1000;
 }
 
-static gboolean timed_send_rt_packet(ChimeCallAudio *audio);
+/*
+ * Sends either the encoded frame in @buffer, or an empty RT message to
+ * keep the stream alive when there isn't one. Only the sequence and
+ * timeline bookkeeping happens under rt_lock; we send from a copy.
+ */
 static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 {
 	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
-	guint nr_samples; /* This is added *after* sending the frame */
+	gboolean mapped = FALSE;
+	guint nr_samples = FRAME_SAMPLES;
+	AudioMessage audio_msg;
+	RTMessage rt_msg;
+
+	if (buffer && GST_BUFFER_DURATION_IS_VALID(buffer) &&
+	    gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+		mapped = TRUE;
+		nr_samples = GST_BUFFER_DURATION(buffer) / NS_PER_SAMPLE;
+	}
 
 	g_mutex_lock(&audio->rt_lock);
 	gint64 now = g_get_monotonic_time();
-	if (!audio->timeout_source && audio->last_rx + 10000000 < now) {
+	if (!audio->reconnect_queued && audio->last_rx + 10000000 < now) {
 		chime_debug("RX timeout, reconnect audio\n");
-		audio->timeout_source = g_timeout_add(0, audio_reconnect, audio);
+		audio->reconnect_queued = TRUE;
+		chime_call_audio_run_on_main(audio, audio_reconnect, NULL, 0);
 	}
-	if (buffer && GST_BUFFER_DURATION_IS_VALID(buffer) &&
-	    GST_BUFFER_DTS_IS_VALID(buffer) && gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
-		GstClockTime dts, pts, dur;
-
-		dts = GST_BUFFER_DTS(buffer);
-		pts = GST_BUFFER_PTS(buffer);
-		dur = GST_BUFFER_DURATION(buffer);
-
-		nr_samples = GST_BUFFER_DURATION(buffer) / NS_PER_SAMPLE;
-		chime_debug("buf dts %ld pts %ld dur %ld samples %d\n", dts, pts, dur, nr_samples);
-		if (audio->next_dts) {
-			int frames_missed;
-
-			if (dts < audio->next_dts) {
-				chime_debug("Out of order frame %ld < %ld\n", dts, audio->next_dts);
-				goto drop;
-			}
-			frames_missed = (dts - audio->next_dts) / dur;
-			if (frames_missed) {
-				chime_debug("Missed %d frames\n", frames_missed);
-				audio->audio_msg.sample_time += frames_missed * nr_samples;
-				audio->next_dts += frames_missed * dur;
-			}
-			audio->next_dts += dur;
-		} else {
-			audio->next_dts = dts + dur;
-		}
-
-		if (audio->state == CHIME_AUDIO_STATE_AUDIO) {
-//			printf ("State %d, send audio\n", audio->state);
-			audio->audio_msg.audio.len = gst_rtp_buffer_get_payload_len(&rtp);
-			audio->audio_msg.audio.data = gst_rtp_buffer_get_payload(&rtp);
-		} else {
-//			printf ("State %d, send no audio\n", audio->state);
-			audio->audio_msg.audio.len = 0;
-		}
-	} else {
-		int delta_samples = (now - audio->last_send_local_time) / NS_PER_SAMPLE;
-		if (delta_samples > 480)
-			audio->audio_msg.sample_time += delta_samples - 320;
-		audio->next_dts = 0;
-		nr_samples = 320;
-		audio->audio_msg.audio.len = 0;
+	audio_msg = audio->audio_msg;
+	rt_msg = audio->rt_msg;
+
+	audio_msg.seq = audio->audio_msg.seq = (audio_msg.seq + 1) & 0xffff;
+
+	/* Never run backwards, but skip over any time in which we sent
+	 * nothing. Encoded frames may arrive a little bunched up, so only
+	 * resync those if they've fallen well behind. */
+	guint32 clock = media_time(audio, now);
+	if ((gint32)(clock - audio_msg.sample_time) > (mapped ? SEND_SLACK_SAMPLES : 0)) {
+		if (mapped)
+			chime_debug("Audio TX resync, %d samples behind\n",
+				    (gint32)(clock - audio_msg.sample_time));
+		audio_msg.sample_time = clock;
 	}
-	audio->audio_msg.seq = (audio->audio_msg.seq + 1) & 0xffff;
+	audio->audio_msg.sample_time = audio_msg.sample_time + nr_samples;
 
 	if (audio->last_server_time_offset) {
 		gint64 t = audio->last_server_time_offset + now;
 		if (audio->echo_server_time) {
-			audio->audio_msg.has_echo_time = 1;
-			audio->audio_msg.echo_time = t;
+			audio_msg.has_echo_time = 1;
+			audio_msg.echo_time = t;
 			audio->echo_server_time = FALSE;
 		}
-		audio->audio_msg.has_server_time = TRUE;
-		audio->audio_msg.server_time = t;
-	} else
-		audio->audio_msg.has_echo_time = 0;
+		audio_msg.has_server_time = TRUE;
+		audio_msg.server_time = t;
+	}
+	audio->last_send_local_time = now;
+	g_mutex_unlock(&audio->rt_lock);
 
-	audio->audio_msg.has_total_frames_lost = TRUE;
-	audio->audio_msg.total_frames_lost = 0;
+	audio_msg.has_total_frames_lost = TRUE;
+	audio_msg.total_frames_lost = g_atomic_int_get(&audio->jb.lost);
 
-	audio->audio_msg.has_ntp_time = TRUE;
-	audio->audio_msg.ntp_time = g_get_real_time();
+	audio_msg.has_ntp_time = TRUE;
+	audio_msg.ntp_time = g_get_real_time();
 
-	audio->audio_msg.has_audio = TRUE;
+	audio_msg.has_audio = TRUE;
+	if (mapped && g_atomic_int_get(&audio->state) == CHIME_AUDIO_STATE_AUDIO) {
+		audio_msg.audio.len = gst_rtp_buffer_get_payload_len(&rtp);
+		audio_msg.audio.data = gst_rtp_buffer_get_payload(&rtp);
+	} else {
+		audio_msg.audio.len = 0;
+		audio_msg.audio.data = NULL;
+	}
 
-	audio->last_send_local_time = now;
-	chime_call_transport_send_packet(audio, XRP_RT_MESSAGE, &audio->rt_msg.base);
-	if (audio->audio_msg.audio.data) {
-		audio->audio_msg.audio.data = NULL;
+	rt_msg.audio = &audio_msg;
+	chime_call_transport_send_packet(audio, XRP_RT_MESSAGE, &rt_msg.base);
+
+	if (mapped)
 		gst_rtp_buffer_unmap(&rtp);
-	}
-	audio->audio_msg.sample_time += nr_samples;
- drop:
-	g_mutex_unlock(&audio->rt_lock);
 }
 
-static gboolean timed_send_rt_packet(ChimeCallAudio *audio)
+/*
+ * Runs every KEEPALIVE_US on the audio thread from when we're authorised,
+ * and fills in whenever nothing else has been sent for that long: when
+ * muted, when audioless, or when the encoder goes quiet.
+ */
+static gboolean timed_send_rt_packet(gpointer _audio)
 {
-	if (audio->state >= CHIME_AUDIO_STATE_AUDIOLESS)
+	ChimeCallAudio *audio = _audio;
+	gint64 now = g_get_monotonic_time();
+
+	if (g_atomic_int_get(&audio->state) >= CHIME_AUDIO_STATE_AUDIOLESS &&
+	    now - audio->last_send_local_time >= KEEPALIVE_US - FRAME_US)
 		do_send_rt_packet(audio, NULL);
-	return TRUE;
+
+	audio->next_keepalive += KEEPALIVE_US;
+	if (audio->next_keepalive < now)
+		audio->next_keepalive = now + KEEPALIVE_US;
+	g_source_set_ready_time(g_main_current_source(), audio->next_keepalive);
+
+	return G_SOURCE_CONTINUE;
 }
 
 static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
@@ -243,71 +591,92 @@ static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt,
 		chime_call_audio_set_state(audio, audio->silent ? CHIME_AUDIO_STATE_AUDIOLESS :
 					   (audio->local_mute ? CHIME_AUDIO_STATE_AUDIO_MUTED : CHIME_AUDIO_STATE_AUDIO),
 					   NULL);
-		if ((audio->silent || audio->local_mute) &&
-		    !audio->send_rt_source)
-			audio->send_rt_source = g_timeout_add(100, (GSourceFunc)timed_send_rt_packet, audio);
+		if (!audio->send_rt_source) {
+			audio->next_keepalive = g_get_monotonic_time() + KEEPALIVE_US;
+			audio->send_rt_source = chime_call_audio_rt_ticker(audio, audio->next_keepalive,
+									   timed_send_rt_packet);
+		}
 	}
 
 	auth_message__free_unpacked(msg, NULL);
 	return TRUE;
 }
-struct message_frag {
-	struct message_frag *next;
-	gint32 start;
-	gint32 end;
-};
+#define MAP_BITS (8 * sizeof(gulong))
 
-struct message_buf {
-	gint32 msg_id;
-	gint32 len;
-	uint8_t *buf;
-	struct message_frag *frags;
-};
-
-static struct message_buf *find_msgbuf(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
+/* Returns the slot for @msg_id, or NULL if it can't be held */
+static struct chime_data_slot *find_data_slot(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
 {
-	GSList **l = &audio->data_messages;
-	struct message_buf *m;
-
-	while (*l) {
-		m = (*l)->data;
-		if (m->msg_id == msg_id)
-			return m;
-		else if (m->msg_id > msg_id)
-			break;
-		else
-			l = &((*l)->next);
+	struct chime_data_slot *slot;
+
+	if (msg_len <= 0 || msg_len > DATA_MAX_MSG_LEN)
+		return NULL;
+
+	/* Anything beyond the window pushes it forward, abandoning the
+	 * oldest messages rather than holding them indefinitely. */
+	if ((guint32)(msg_id - audio->data_next_logical_msg) >= DATA_SLOTS) {
+		gint32 new_base = msg_id - DATA_SLOTS + 1;
+		int i;
+
+		for (i = 0; i < DATA_SLOTS; i++) {
+			slot = &audio->data_slots[i];
+			if (slot->len && slot->msg_id < new_base) {
+				chime_debug("Abandon incomplete data msg %d\n", slot->msg_id);
+				slot->len = 0;
+			}
+		}
+		audio->data_next_logical_msg = new_base;
 	}
-	m = g_new0(struct message_buf, 1);
 
-	m->msg_id = msg_id;
-	m->len = msg_len;
-	m->buf = g_malloc0(msg_len);
-	/* Insert into the correct place in the sorted list */
-	*l = g_slist_prepend(*l, m);
-	return m;
+	slot = &audio->data_slots[msg_id & (DATA_SLOTS - 1)];
+	if (slot->len)
+		return slot->msg_id == msg_id ? slot : NULL;
+
+	if (slot->alloc < msg_len) {
+		g_free(slot->buf);
+		g_free(slot->map);
+		slot->buf = g_malloc(msg_len);
+		slot->map = g_new(gulong, (msg_len + MAP_BITS - 1) / MAP_BITS);
+		slot->alloc = msg_len;
+	}
+	memset(slot->map, 0, ((msg_len + MAP_BITS - 1) / MAP_BITS) * sizeof(gulong));
+	slot->msg_id = msg_id;
+	slot->len = msg_len;
+	slot->received = 0;
+	return slot;
 }
 
-static void free_msgbuf(struct message_buf *m)
+/* Returns TRUE when the message is complete */
+static gboolean insert_frag(struct chime_data_slot *slot, gint32 start, gint32 end)
 {
-	while (m->frags) {
-		struct message_frag *f = m->frags;
-		m->frags = f->next;
-		g_free(f);
+	gint32 i;
+
+	for (i = start; i < end; i++) {
+		gulong bit = 1UL << (i % MAP_BITS);
+
+		if (!(slot->map[i / MAP_BITS] & bit)) {
+			slot->map[i / MAP_BITS] |= bit;
+			slot->received++;
+		}
 	}
-	g_free(m->buf);
-	g_free(m);
+	return slot->received == slot->len;
 }
 
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio)
 {
+	int i;
+
 	if (audio->data_ack_source) {
 		g_source_remove(audio->data_ack_source);
 		audio->data_ack_source = 0;
 	}
 
-	g_slist_free_full(audio->data_messages, (GDestroyNotify) free_msgbuf);
-	audio->data_messages = NULL;
+	for (i = 0; i < DATA_SLOTS; i++) {
+		struct chime_data_slot *slot = &audio->data_slots[i];
+
+		g_free(slot->buf);
+		g_free(slot->map);
+		memset(slot, 0, sizeof(*slot));
+	}
 
 	audio->data_next_seq = 0;
 	audio->data_ack_mask = 0;
@@ -338,45 +707,6 @@ static gboolean idle_send_ack(gpointer _audio)
 	return FALSE;
 }
 
-static gboolean insert_frag(struct message_buf *m, gint32 start, gint32 end)
-{
-	struct message_frag **f = &m->frags, *nf;
-//	printf("Insert frag %d-%d\n", start, end);
-	while (*f) {
-		if (end < (*f)->start) {
-			/* Insert before *f */
-			break;
-		} else if (start <= (*f)->end) {
-			/* Overlap / touching *f so merge */
-			if (start < (*f)->start)
-				(*f)->start = start;
-			/* ... and merge subsequent frags that we now touch */
-			if (end > (*f)->end) {
-				(*f)->end = end;
-				while ((nf = (*f)->next) &&
-				       nf->start <= (*f)->end) {
-					(*f)->end = nf->end;
-					(*f)->next = nf->next;
-					g_free(nf);
-				}
-			}
-			goto done;
-		} else {
-			/* New frag lives after *f */
-			f = &(*f)->next;
-		}
-	}
-	nf = g_new0(struct message_frag, 1);
-	nf->start = start;
-	nf->end = end;
-	nf->next = *f;
-	*f = nf;
- done:
-	return (m->frags->start == 0 &&
-		m->frags->end == m->len);
-}
-
-
 static gboolean audio_receive_stream_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	StreamMessage *msg = stream_message__unpack(NULL, len, pkt);
@@ -447,9 +777,9 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	if (msg->msg_id < audio->data_next_logical_msg)
 		goto drop;
 
-	struct message_buf *m = find_msgbuf(audio, msg->msg_id, msg->msg_len);
-	if (msg->msg_len != m->len ||
-	    msg->offset + msg->data.len > m->len)
+	struct chime_data_slot *m = find_data_slot(audio, msg->msg_id, msg->msg_len);
+	if (!m || msg->msg_len != m->len ||
+	    (gsize)msg->offset + msg->data.len > m->len)
 		goto fail;
 
 	memcpy(m->buf + msg->offset, msg->data.data, msg->data.len);
@@ -458,18 +788,16 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 		if (m->len > sizeof(*hdr) && ntohs(hdr->len) == m->len &&
 		    ntohs(hdr->type) == XRP_STREAM_MESSAGE) {
 			audio_receive_stream_msg(audio, m->buf + sizeof(*hdr), m->len - sizeof(*hdr));
-			audio->data_next_logical_msg = m->msg_id + 1;
-		}
-		/* Now kill *all* pending messagse up to and including this one */
-		while (audio->data_messages) {
-			struct message_buf *m = audio->data_messages->data;
 
-			if (m->msg_id >= audio->data_next_logical_msg)
-				break;
-
-			audio->data_messages = g_slist_remove(audio->data_messages, m);
-			free_msgbuf(m);
+			/* Now kill *all* pending messages up to and including this one */
+			int i;
+			for (i = 0; i < DATA_SLOTS; i++) {
+				if (audio->data_slots[i].msg_id <= m->msg_id)
+					audio->data_slots[i].len = 0;
+			}
+			audio->data_next_logical_msg = m->msg_id + 1;
 		}
+		m->len = 0;
 	}
  drop:
 	ret = TRUE;
@@ -478,6 +806,11 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	return ret;
 }
 
+static void receive_packet_work(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+{
+	audio_receive_packet(audio, pkt, len);
+}
+
 gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	if (len < sizeof(struct xrp_header))
@@ -487,6 +820,17 @@ gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize le
 	if (len != ntohs(hdr->len))
 		return FALSE;
 
+	/* RT messages are handled on the audio thread, everything else on
+	 * the main thread. Whichever transport they arrived on. */
+	gboolean is_rt = ntohs(hdr->type) == XRP_RT_MESSAGE;
+	if (is_rt != g_main_context_is_owner(audio->rt_context)) {
+		if (is_rt)
+			chime_call_audio_run_on_rt(audio, receive_packet_work, pkt, len);
+		else
+			chime_call_audio_run_on_main(audio, receive_packet_work, pkt, len);
+		return TRUE;
+	}
+
 	audio->last_rx = g_get_monotonic_time();
 
 	/* Point to the payload, without (void *) arithmetic */
@@ -518,10 +862,30 @@ void chime_call_audio_close(ChimeCallAudio *audio, gboolean hangup)
 	if (audio->audio_sink)
 		gst_app_sink_set_callbacks(audio->audio_sink, &no_appsink_callbacks, NULL, NULL);
 
+	/* Everything from here on happens on this thread */
+	audio_rt_stop(audio);
+	chime_call_audio_rt_source_clear(&audio->stats_source);
+
 	chime_call_transport_disconnect(audio, hangup);
+	chime_call_transport_cleanup(audio);
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_HANGUP, NULL);
 
+	g_mutex_lock(&audio->main_lock);
+	if (audio->main_idle)
+		g_source_remove(audio->main_idle);
+	if (audio->main_closed)
+		*audio->main_closed = TRUE;
+	g_queue_clear_full(&audio->main_queue, g_free);
+	g_mutex_unlock(&audio->main_lock);
+
+	g_main_loop_unref(audio->rt_loop);
+	g_main_context_unref(audio->rt_context);
+
 	g_hash_table_destroy(audio->profiles);
+	/* Buffers still downstream hold their own ref on the pool */
+	gst_buffer_pool_set_active(audio->rx_pool, FALSE);
+	gst_object_unref(audio->rx_pool);
+	g_free(audio->tx_buf);
 	g_free(audio);
 }
 
@@ -533,7 +897,7 @@ static GstFlowReturn chime_appsink_new_sample(GstAppSink* self, gpointer data)
 	if (!sample)
 		return GST_FLOW_OK;
 
-	if (audio->state == CHIME_AUDIO_STATE_AUDIO) {
+	if (g_atomic_int_get(&audio->state) == CHIME_AUDIO_STATE_AUDIO) {
 		GstBuffer *buffer = gst_sample_get_buffer(sample);
 
 		do_send_rt_packet(audio, buffer);
@@ -597,9 +961,24 @@ ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gbo
 	audio->profiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 	g_mutex_init(&audio->transport_lock);
 	g_mutex_init(&audio->rt_lock);
+	g_mutex_init(&audio->main_lock);
+	g_queue_init(&audio->main_queue);
 
 	audio->session_id = ((guint64)g_random_int() << 32) | g_random_int();
 
+	audio->rx_allocator.alloc = arena_alloc;
+	audio->rx_allocator.free = arena_free;
+	audio->rx_allocator.allocator_data = &audio->rx_arena;
+
+	/* Preallocate enough to fill the jitter buffer; it grows if need be */
+	audio->rx_pool = gst_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(audio->rx_pool);
+	gst_buffer_pool_config_set_params(config, NULL,
+					  gst_rtp_buffer_calc_packet_len(XRP_MAX_PAYLOAD, 0, 0),
+					  JB_SLOTS, 0);
+	gst_buffer_pool_set_config(audio->rx_pool, config);
+	gst_buffer_pool_set_active(audio->rx_pool, TRUE);
+
 	rtmessage__init(&audio->rt_msg);
 	audio_message__init(&audio->audio_msg);
 	client_status_message__init(&audio->client_status_msg);
@@ -607,8 +986,12 @@ ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gbo
 	audio->audio_msg.has_seq = 1;
 	audio->audio_msg.seq = g_random_int_range(0, 0x10000);
 	audio->audio_msg.has_sample_time = 1;
-	audio->audio_msg.sample_time = g_random_int();
+	audio->audio_msg.sample_time = audio->media_base = g_random_int();
+	audio->media_epoch = g_get_monotonic_time();
 
+	audio_rt_start(audio);
+	audio->stats_source = chime_call_audio_rt_timeout(audio, STATS_INTERVAL_MS,
+							  audio_sample_stats);
 	chime_call_transport_connect(audio, silent);
 
 	return audio;
@@ -636,14 +1019,8 @@ void chime_call_audio_local_mute(ChimeCallAudio *audio, gboolean muted)
 	if (muted) {
 		if (audio->state == CHIME_AUDIO_STATE_AUDIO)
 			chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_AUDIO_MUTED, NULL);
-		if (!audio->send_rt_source)
-			audio->send_rt_source = g_timeout_add(100, (GSourceFunc)timed_send_rt_packet, audio);
 	} else {
 		if (audio->state == CHIME_AUDIO_STATE_AUDIO_MUTED)
 			chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_AUDIO, NULL);
-		if (audio->send_rt_source) {
-			g_source_remove(audio->send_rt_source);
-			audio->send_rt_source = 0;
-		}
 	}
 }
@@ -33,9 +33,98 @@
 
 #define NS_PER_SAMPLE (1000000000 / 16000)
 
+/* Audio frames are 20ms in each direction */
+#define FRAME_SAMPLES 320
+#define FRAME_US (FRAME_SAMPLES * NS_PER_SAMPLE / 1000)
+
+/* Empty RT messages keep the stream alive when we have no audio */
+#define KEEPALIVE_US 100000
+
+/* How far outgoing frames may lag the media clock before we skip ahead */
+#define SEND_SLACK_SAMPLES (4 * FRAME_SAMPLES)
+#define JB_SLOTS 64 /* Must be a power of two */
+
+/* How often receive quality is reported to the ChimeCall */
+#define STATS_INTERVAL_MS 5000
+
+/* Largest payload carried by a single XRP packet */
+#define XRP_MAX_PAYLOAD 1500
+
+/*
+ * Scratch space for unpacking incoming protobufs. Nothing unpacked
+ * outlives the handling of the packet it came from, so the arena is
+ * simply rewound for each one. Anything too big falls back to the heap.
+ */
+#define XRP_ARENA_SIZE 8192
+
+struct chime_arena {
+	gsize used;
+	guint64 buf[XRP_ARENA_SIZE / sizeof(guint64)];
+};
+
+/*
+ * Reassembly of fragmented DataMessages happens in a fixed window of
+ * slots following data_next_logical_msg, so the most we'll ever hold is
+ * DATA_SLOTS * DATA_MAX_MSG_LEN however the peer behaves.
+ */
+#define DATA_SLOTS 8 /* Must be a power of two */
+#define DATA_MAX_MSG_LEN 65536
+
+struct chime_data_slot {
+	gint32 msg_id;
+	gint32 len;		/* Zero if the slot is unused */
+	gint32 received;	/* Distinct bytes seen so far */
+	gint32 alloc;
+	guint8 *buf;
+	gulong *map;		/* One bit per byte of buf */
+};
+
+struct chime_jitter {
+	GstBuffer *slots[JB_SLOTS];
+	guint16 slot_seq[JB_SLOTS];
+	guint32 slot_ts[JB_SLOTS];
+
+	gboolean started;
+	guint16 play_seq;	/* Next sequence number to be played out */
+	guint16 high_seq;	/* Highest sequence number received */
+	guint32 play_ts;	/* Expected RTP timestamp of play_seq */
+	guint target;		/* Playout delay, in frames */
+	guint idle_ticks;	/* Consecutive ticks with nothing to play */
+	guint adapt_ticks;
+
+	/* RFC3550 interarrival jitter, in µs */
+	gint64 jitter;
+	gint64 last_arrival;
+	guint32 last_ts;
+
+	GSource *timer;
+	gint64 next_tick;
+
+	/* Statistics */
+	guint received;
+	guint played;
+	guint lost;		/* Atomic; also reported to the server */
+	guint late;
+	guint dups;
+	guint overflows;
+
+	guint gen;		/* The transport_gen of the last reset */
+};
+
+/* Incoming RT messages decoded in place by chime_call_xrp_rt_unpack() */
+#define XRP_RX_PROFILES 32
+
+struct chime_rt_rx {
+	RTMessage rt;
+	AudioMessage audio;
+	ClientStatusMessage client_status;
+	ProfileMessage *profiles[XRP_RX_PROFILES];
+	ProfileMessage profile_msgs[XRP_RX_PROFILES];
+};
+
 struct _ChimeCallAudio {
 	ChimeCall *call;
-	ChimeAudioState state;
+	ChimeAudioState state;	/* Set on the main context; g_atomic_int_get() elsewhere */
 	gboolean local_mute; /* Listening but not sending from mic */
 	gboolean silent; /* No audio; only participant data */
 	GMutex transport_lock;
@@ -45,30 +134,69 @@ struct _ChimeCallAudio {
 	guint recv_ssrc;	/* Fake SSRC on incoming generated RTP */
 
 	time_t last_rx;
-	guint timeout_source;
-	gboolean dtls_handshaked;
+	gboolean reconnect_queued;	/* Protected by rt_lock */
+	gboolean dtls_handshaked;	/* Protected by transport_lock */
 	GSocket *dtls_sock;
-	GSource *dtls_source;
+	GSource *dtls_source;	/* On rt_context, as is dtls_timer */
+	GSource *dtls_timer;
 	gnutls_session_t dtls_sess;
 	gchar *dtls_hostname;
 	gnutls_certificate_credentials_t dtls_cred;
+	gnutls_datum_t dtls_resume;	/* Kept for the life of the call */
+	guint ws_race_source;
+	gboolean ws_pending;
 	GCancellable *cancel;
 
 	guint data_ack_source;
 	guint32 data_next_seq;
 	guint64 data_ack_mask;
 	gint32 data_next_logical_msg;
-	GSList *data_messages;
+	struct chime_data_slot data_slots[DATA_SLOTS];
 	GHashTable *profiles;
 
-	GstClockTime next_dts;
+	ProtobufCAllocator rx_allocator;
+	struct chime_arena rx_arena;
+	guint8 *tx_buf;		/* Protected by transport_lock */
+	gsize tx_buf_len;
+	GstBufferPool *rx_pool;
+
+	/* The outgoing media clock read media_base at media_epoch */
+	gint64 media_epoch;
+	guint32 media_base;
 	gint64 last_send_local_time;
+	gint64 next_keepalive;
 	GstAppSrc *audio_src;
 	GstAppSink *audio_sink;
 	gboolean appsrc_need_data;
+	struct chime_jitter jb;
+
+	/* Receive quality, sampled on the audio thread */
+	GSource *stats_source;
+	gint64 rtt_us;		/* Smoothed; zero until known */
+	guint stats_received;	/* Counters as of the last report */
+	guint stats_lost;
+
+	/*
+	 * The media path (DTLS socket, RT messages, jitter buffer playout and
+	 * the idle send timer) runs in its own thread so that it isn't held
+	 * up by the UI. Anything which touches the call, the websocket or
+	 * main context sources, or emits signals, is handed back to the main
+	 * context via main_queue.
+	 */
+	GThread *rt_thread;
+	GMainContext *rt_context;
+	GMainLoop *rt_loop;
+	GMutex main_lock;
+	GQueue main_queue;
+	guint main_idle;
+	gboolean *main_closed;	/* Set if we're closed from run_main_queue() */
+
+	/* Bumped atomically at each disconnect, so that the jitter buffer
+	 * knows to start afresh and a late reset can tell it's stale */
+	guint transport_gen;
 
 	GMutex rt_lock;
-	guint send_rt_source;
+	GSource *send_rt_source;
 	gint64 last_server_time_offset;
 	gboolean echo_server_time;
 	RTMessage rt_msg;
@@ -99,10 +227,32 @@ void chime_call_audio_local_mute(ChimeCallAudio *audio, gboolean muted);
 /* Called from audio code */
 void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent);
 void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup);
+void chime_call_transport_cleanup(ChimeCallAudio *audio);
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message);
 
+/* Fast path for the per-frame RT messages, in chime-call-xrp.c */
+gssize chime_call_xrp_rt_packed_size(const RTMessage *msg);
+gsize chime_call_xrp_rt_pack(const RTMessage *msg, guint8 *out);
+gboolean chime_call_xrp_rt_unpack(struct chime_rt_rx *rx, gsize len, const guint8 *data);
+
 /* Callbacks into audio code from transport */
 gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len);
 
+/* Running things on the right thread */
+typedef void (*chime_audio_work_fn)(ChimeCallAudio *audio, gconstpointer data, gsize len);
+void chime_call_audio_run_on_main(ChimeCallAudio *audio, chime_audio_work_fn fn,
+				  gconstpointer data, gsize len);
+void chime_call_audio_run_on_rt(ChimeCallAudio *audio, chime_audio_work_fn fn,
+				gconstpointer data, gsize len);
+GSource *chime_call_audio_rt_timeout(ChimeCallAudio *audio, guint ms, GSourceFunc func);
+GSource *chime_call_audio_rt_ticker(ChimeCallAudio *audio, gint64 ready_time, GSourceFunc func);
+void chime_call_audio_rt_source_clear(GSource **source);
+
+/* Jitter buffer between the transport and the appsrc */
+GstBuffer *chime_call_audio_new_rx_buffer(ChimeCallAudio *audio, gsize payload_len);
+void chime_call_jitter_insert(ChimeCallAudio *audio, guint16 seq, guint32 sample_time,
+			      gconstpointer data, gsize len);
+void chime_call_jitter_reset(ChimeCallAudio *audio);
+
 void chime_call_audio_install_gst_app_callbacks(ChimeCallAudio *audio, GstAppSrc *appsrc, GstAppSink *appsink);
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio);
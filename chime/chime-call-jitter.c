@@ -0,0 +1,302 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "chime-connection.h"
+#include "chime-call.h"
+#include "chime-connection-private.h"
+#include "chime-call-audio.h"
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+/*
+ * Incoming audio used to go straight into the appsrc as it arrived, so
+ * the playout timing was exactly as bursty as the network. Instead we
+ * hold frames in a small ring indexed by sequence number, and release
+ * them on a steady 20ms clock once enough have built up to cover the
+ * measured arrival jitter. The depth grows quickly when frames arrive
+ * too late or we run dry, and shrinks back slowly when things calm down.
+ *
+ * A missing frame is played out as an RTP packet with an empty payload,
+ * which rtpchimedepay passes on as an empty buffer and opusdec turns into
+ * packet loss concealment. That also means rtpbin's own jitter buffer
+ * never sees a gap to wait for; call_media_setup() in prpl/chat.c turns
+ * its latency down so that it doesn't add a second playout delay.
+ */
+
+#define JB_MIN_TARGET 2
+#define JB_MAX_TARGET 10
+#define JB_IDLE_STOP 10		/* Empty ticks before we stop the clock */
+#define JB_ADAPT_TICKS 250	/* Re-evaluate the depth every 5 seconds */
+
+#define seq_before(a, b) ((gint16)((guint16)(a) - (guint16)(b)) < 0)
+
+static void jb_stop(ChimeCallAudio *audio);
+
+static guint jb_depth(struct chime_jitter *jb)
+{
+	return (guint16)(jb->high_seq - jb->play_seq) + 1;
+}
+
+static void jb_grow(struct chime_jitter *jb)
+{
+	if (jb->target < JB_MAX_TARGET) {
+		jb->target++;
+		chime_debug("Jitter buffer target now %u frames\n", jb->target);
+	}
+	jb->adapt_ticks = 0;
+}
+
+/* Let the depth fall back towards what the measured jitter needs */
+static void jb_adapt(struct chime_jitter *jb)
+{
+	guint want = (2 * jb->jitter + FRAME_US - 1) / FRAME_US + 1;
+
+	if (want < JB_MIN_TARGET)
+		want = JB_MIN_TARGET;
+
+	if (++jb->adapt_ticks >= JB_ADAPT_TICKS) {
+		jb->adapt_ticks = 0;
+		if (jb->target > want) {
+			jb->target--;
+			chime_debug("Jitter buffer target now %u frames\n", jb->target);
+		}
+	}
+}
+
+static void jb_push(ChimeCallAudio *audio, GstBuffer *buffer)
+{
+	struct chime_jitter *jb = &audio->jb;
+
+	if (audio->audio_src && audio->appsrc_need_data) {
+		gst_app_src_push_buffer(GST_APP_SRC(audio->audio_src), buffer);
+		jb->played++;
+	} else {
+		chime_debug("Audio drop (%p %d) seq %d\n",
+			    audio->audio_src, audio->appsrc_need_data,
+			    jb->play_seq);
+		gst_buffer_unref(buffer);
+	}
+}
+
+/* Everything but the payload, which the caller has already filled in */
+static gboolean jb_set_rtp_header(ChimeCallAudio *audio, GstBuffer *buffer,
+				  guint16 seq, guint32 sample_time)
+{
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+	if (!gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp))
+		return FALSE;
+
+	gst_rtp_buffer_set_ssrc(&rtp, audio->recv_ssrc);
+	gst_rtp_buffer_set_payload_type(&rtp, 97);
+	gst_rtp_buffer_set_seq(&rtp, seq);
+	gst_rtp_buffer_set_timestamp(&rtp, sample_time);
+	gst_rtp_buffer_unmap(&rtp);
+	return TRUE;
+}
+
+/* An empty frame in place of a lost one, for opusdec to conceal */
+static void jb_push_lost(ChimeCallAudio *audio)
+{
+	struct chime_jitter *jb = &audio->jb;
+	GstBuffer *buffer = chime_call_audio_new_rx_buffer(audio, 0);
+
+	if (jb_set_rtp_header(audio, buffer, jb->play_seq, jb->play_ts))
+		jb_push(audio, buffer);
+	else
+		gst_buffer_unref(buffer);
+}
+
+/* Returns TRUE if a frame (or a known loss) was consumed */
+static gboolean jb_play_one(ChimeCallAudio *audio)
+{
+	struct chime_jitter *jb = &audio->jb;
+	guint idx = jb->play_seq & (JB_SLOTS - 1);
+
+	if (seq_before(jb->high_seq, jb->play_seq))
+		return FALSE;
+
+	if (jb->slots[idx] && jb->slot_seq[idx] == jb->play_seq) {
+		GstBuffer *buffer = jb->slots[idx];
+
+		jb->slots[idx] = NULL;
+		jb->play_ts = jb->slot_ts[idx];
+		jb_push(audio, buffer);
+	} else {
+		chime_debug("Audio lost seq %d\n", jb->play_seq);
+		g_atomic_int_inc(&jb->lost);
+		jb_push_lost(audio);
+	}
+	jb->play_seq++;
+	jb->play_ts += FRAME_SAMPLES;
+	return TRUE;
+}
+
+static gboolean jb_tick(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	struct chime_jitter *jb = &audio->jb;
+	gint64 now = g_get_monotonic_time();
+
+	if (!jb_play_one(audio)) {
+		/* Ran dry. Wait for more, and keep a deeper buffer next time. */
+		if (jb->idle_ticks++ == 0)
+			jb_grow(jb);
+		if (jb->idle_ticks >= JB_IDLE_STOP) {
+			jb_stop(audio);
+			return G_SOURCE_REMOVE;
+		}
+	} else {
+		jb->idle_ticks = 0;
+		/* Well over target; catch up by playing an extra frame */
+		if (jb_depth(jb) > jb->target + 2)
+			jb_play_one(audio);
+	}
+
+	jb_adapt(jb);
+
+	/* Schedule against the ideal timeline, not against 'now', so we
+	 * don't drift. If we've fallen badly behind, just resync. */
+	jb->next_tick += FRAME_US;
+	if (jb->next_tick < now - FRAME_US * JB_MAX_TARGET)
+		jb->next_tick = now + FRAME_US;
+	g_source_set_ready_time(jb->timer, jb->next_tick);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void jb_start(ChimeCallAudio *audio)
+{
+	struct chime_jitter *jb = &audio->jb;
+
+	jb->next_tick = g_get_monotonic_time() + jb->target * FRAME_US;
+	jb->idle_ticks = 0;
+
+	jb->timer = chime_call_audio_rt_ticker(audio, jb->next_tick, jb_tick);
+}
+
+static void jb_flush(struct chime_jitter *jb)
+{
+	int i;
+
+	for (i = 0; i < JB_SLOTS; i++) {
+		if (jb->slots[i]) {
+			gst_buffer_unref(jb->slots[i]);
+			jb->slots[i] = NULL;
+		}
+	}
+}
+
+static void jb_stop(ChimeCallAudio *audio)
+{
+	struct chime_jitter *jb = &audio->jb;
+
+	if (jb->timer) {
+		g_source_destroy(jb->timer);
+		g_source_unref(jb->timer);
+		jb->timer = NULL;
+	}
+	jb_flush(jb);
+	jb->started = FALSE;
+}
+
+/* RFC3550 §6.4.1 interarrival jitter, in µs rather than in samples */
+static void jb_update_jitter(struct chime_jitter *jb, guint32 sample_time, gint64 now)
+{
+	if (jb->last_arrival) {
+		gint64 transit = (now - jb->last_arrival) -
+			(gint64)(gint32)(sample_time - jb->last_ts) * NS_PER_SAMPLE / 1000;
+
+		if (transit < 0)
+			transit = -transit;
+		jb->jitter += (transit - jb->jitter) / 16;
+	}
+	jb->last_arrival = now;
+	jb->last_ts = sample_time;
+}
+
+void chime_call_jitter_insert(ChimeCallAudio *audio, guint16 seq, guint32 sample_time,
+			      gconstpointer data, gsize len)
+{
+	struct chime_jitter *jb = &audio->jb;
+	GstBuffer *buffer;
+	guint idx;
+
+	/* First packet since a disconnect; whatever we hold is from before */
+	if (jb->gen != g_atomic_int_get(&audio->transport_gen))
+		chime_call_jitter_reset(audio);
+
+	jb->received++;
+
+	if (!jb->started) {
+		jb->started = TRUE;
+		jb->play_seq = jb->high_seq = seq;
+		jb->play_ts = sample_time;
+		if (!jb->target)
+			jb->target = JB_MIN_TARGET;
+		jb_start(audio);
+	} else if (seq_before(seq, jb->play_seq)) {
+		chime_debug("Audio late seq %d (playing %d)\n", seq, jb->play_seq);
+		jb->late++;
+		jb_grow(jb);
+		return;
+	} else if ((guint16)(seq - jb->play_seq) >= JB_SLOTS) {
+		/* Too far ahead to hold; the sender must have restarted */
+		chime_debug("Audio seq jump %d -> %d; resetting\n", jb->play_seq, seq);
+		jb->overflows++;
+		jb_flush(jb);
+		jb->play_seq = jb->high_seq = seq;
+		jb->play_ts = sample_time;
+	}
+
+	jb_update_jitter(jb, sample_time, g_get_monotonic_time());
+
+	idx = seq & (JB_SLOTS - 1);
+	if (jb->slots[idx] && jb->slot_seq[idx] == seq) {
+		jb->dups++;
+		return;
+	}
+
+	buffer = chime_call_audio_new_rx_buffer(audio, len);
+	gst_buffer_fill(buffer, gst_buffer_get_size(buffer) - len, data, len);
+	if (!jb_set_rtp_header(audio, buffer, seq, sample_time)) {
+		gst_buffer_unref(buffer);
+		return;
+	}
+
+	chime_debug("Audio RX seq %d ts %u\n", seq, sample_time);
+
+	if (jb->slots[idx])
+		gst_buffer_unref(jb->slots[idx]);
+	jb->slots[idx] = buffer;
+	jb->slot_seq[idx] = seq;
+	jb->slot_ts[idx] = sample_time;
+
+	if (seq_before(jb->high_seq, seq))
+		jb->high_seq = seq;
+}
+
+/* Drop everything and forget the stream timing, e.g. on reconnect */
+void chime_call_jitter_reset(ChimeCallAudio *audio)
+{
+	struct chime_jitter *jb = &audio->jb;
+
+	jb_stop(audio);
+	jb->last_arrival = 0;
+	jb->jitter = 0;
+	jb->target = JB_MIN_TARGET;
+	jb->adapt_ticks = 0;
+	jb->gen = g_atomic_int_get(&audio->transport_gen);
+}
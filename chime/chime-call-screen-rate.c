@@ -0,0 +1,292 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "chime-connection-private.h"
+#include "chime-call.h"
+#include "chime-call-screen.h"
+
+/*
+ * The encoder used to run at a fixed 256kb/s and 3 frames/s however good
+ * or bad the uplink was. While presenting, we now look once a second at
+ * how much is still queued on the websocket, the round trip time of our
+ * own pings, and how often viewers are asking for key frames. Any sign
+ * of congestion cuts the bitrate multiplicatively; a few clear seconds
+ * in a row raise it again gradually. The quantizer range follows the
+ * bitrate, and the frame rate gives way once the bitrate is at its floor.
+ *
+ * If the queue backs up badly anyway, delta frames are dropped instead
+ * of being queued behind it, and a key frame is requested once it has
+ * drained so that viewers can pick up again from there.
+ */
+
+#define RATE_TICK_MS 1000
+#define RATE_GOOD_TICKS 3	/* Clear ticks before we try a higher rate */
+
+#define MIN_BITRATE 64000
+#define START_BITRATE 256000
+#define MAX_BITRATE 1500000
+
+#define MIN_FPS 1
+#define START_FPS 3
+#define MAX_FPS 5
+
+#define BEST_MIN_QUANTIZER 15
+#define BEST_MAX_QUANTIZER 25
+#define WORST_MAX_QUANTIZER 50
+
+#define PING_TIMEOUT_US (2 * G_USEC_PER_SEC)
+
+/* Frames to drop before forcing a key frame again, in case the encoder
+ * ignored the last request */
+#define KEY_RETRY_FRAMES (2 * MAX_FPS)
+
+/* Walk upstream from @element, looking for one with @prop */
+static GstElement *find_upstream(GstElement *element, const gchar *prop, int depth)
+{
+	GstElement *ret = NULL;
+	GstPad *pad, *peer;
+
+	if (!element || !depth)
+		return NULL;
+
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), prop))
+		return gst_object_ref(element);
+
+	pad = gst_element_get_static_pad(element, "sink");
+	if (!pad)
+		return NULL;
+
+	peer = gst_pad_get_peer(pad);
+	gst_object_unref(pad);
+	if (peer) {
+		GstElement *parent = gst_pad_get_parent_element(peer);
+
+		gst_object_unref(peer);
+		if (parent) {
+			ret = find_upstream(parent, prop, depth - 1);
+			gst_object_unref(parent);
+		}
+	}
+	return ret;
+}
+
+/* Upstream of the appsink's own sink pad, not the appsink itself */
+static GstElement *find_upstream_of_sink(ChimeCallScreen *screen, const gchar *prop)
+{
+	GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(screen->screen_sink), "sink");
+	GstElement *ret = NULL;
+	GstPad *peer;
+
+	peer = gst_pad_get_peer(pad);
+	gst_object_unref(pad);
+	if (peer) {
+		GstElement *parent = gst_pad_get_parent_element(peer);
+
+		gst_object_unref(peer);
+		if (parent) {
+			ret = find_upstream(parent, prop, 4);
+			gst_object_unref(parent);
+		}
+	}
+	return ret;
+}
+
+static void rate_apply(ChimeCallScreen *screen)
+{
+	struct chime_screen_rate *rc = &screen->rate;
+	guint max_q = BEST_MAX_QUANTIZER;
+
+	/* Let the quality fall with the bitrate, rather than the encoder
+	 * overshooting its target to stay within a tight quantizer range */
+	if (rc->bitrate < START_BITRATE)
+		max_q += (WORST_MAX_QUANTIZER - BEST_MAX_QUANTIZER) *
+			(START_BITRATE - rc->bitrate) / (START_BITRATE - MIN_BITRATE);
+
+	chime_debug("Screen rate: %u b/s, %u fps, quantizer %u-%u\n",
+		    rc->bitrate, rc->fps, BEST_MIN_QUANTIZER, max_q);
+
+	if (rc->encoder)
+		g_object_set(rc->encoder, "target-bitrate", rc->bitrate,
+			     "min-quantizer", BEST_MIN_QUANTIZER,
+			     "max-quantizer", max_q, NULL);
+	if (rc->videorate)
+		g_object_set(rc->videorate, "max-rate", rc->fps, NULL);
+}
+
+static void rate_decrease(struct chime_screen_rate *rc)
+{
+	/* Below the starting bitrate, fewer frames first and then fewer bits */
+	if (rc->bitrate <= START_BITRATE && rc->fps > START_FPS)
+		rc->fps--;
+	else if (rc->bitrate > MIN_BITRATE)
+		rc->bitrate = MAX(rc->bitrate * 7 / 10, MIN_BITRATE);
+	else if (rc->fps > MIN_FPS)
+		rc->fps--;
+}
+
+static void rate_increase(struct chime_screen_rate *rc)
+{
+	if (rc->fps < START_FPS)
+		rc->fps++;
+	else if (rc->bitrate < MAX_BITRATE)
+		rc->bitrate = MIN(rc->bitrate + rc->bitrate / 10 + 16000, MAX_BITRATE);
+	else if (rc->fps < MAX_FPS)
+		rc->fps++;
+}
+
+static gboolean rate_tick(gpointer _screen)
+{
+	ChimeCallScreen *screen = _screen;
+	struct chime_screen_rate *rc = &screen->rate;
+	gint64 now = g_get_monotonic_time();
+	gboolean congested = FALSE;
+	guint old_bitrate = rc->bitrate, old_fps = rc->fps;
+	gsize backlog;
+
+	if (screen->state != CHIME_SCREEN_STATE_SENDING || !screen->ws) {
+		rc->timer = 0;
+		chime_call_screen_rate_stop(screen);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* Nobody watching yet; nothing to measure */
+	if (!screen->viewer_present)
+		return G_SOURCE_CONTINUE;
+
+	/* More than half a second's worth still waiting to go out */
+	backlog = chime_websocket_get_buffered_amount(screen->ws);
+	if (backlog > rc->bitrate / 16)
+		congested = TRUE;
+
+	if (rc->ping_sent && now - rc->ping_sent > PING_TIMEOUT_US)
+		congested = TRUE;
+	else if (rc->min_rtt && rc->rtt > 2 * rc->min_rtt + 100000)
+		congested = TRUE;
+
+	/* Viewers ask for a key frame when they've lost track */
+	if (rc->key_requests > 1)
+		congested = TRUE;
+	rc->key_requests = 0;
+
+	if (congested) {
+		rc->good_ticks = 0;
+		rate_decrease(rc);
+	} else if (++rc->good_ticks >= RATE_GOOD_TICKS) {
+		rc->good_ticks = 0;
+		rate_increase(rc);
+	}
+
+	if (rc->bitrate != old_bitrate || rc->fps != old_fps) {
+		chime_debug("Screen uplink %s: backlog %" G_GSIZE_FORMAT ", rtt %" G_GINT64_FORMAT "us\n",
+			    congested ? "congested" : "clear", backlog, rc->rtt);
+		rate_apply(screen);
+	}
+
+	if (!rc->ping_sent || now - rc->ping_sent > PING_TIMEOUT_US) {
+		rc->ping_sent = now;
+		chime_call_screen_send_ping(screen);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+void chime_call_screen_rate_start(ChimeCallScreen *screen)
+{
+	struct chime_screen_rate *rc = &screen->rate;
+
+	chime_call_screen_rate_stop(screen);
+
+	rc->encoder = find_upstream_of_sink(screen, "target-bitrate");
+	rc->videorate = find_upstream_of_sink(screen, "max-rate");
+	rc->bitrate = START_BITRATE;
+	rc->fps = START_FPS;
+	rc->min_rtt = rc->rtt = 0;
+	rc->ping_sent = 0;
+	rc->dropping = FALSE;
+
+	if (!rc->encoder)
+		chime_debug("No encoder found for screen rate control\n");
+
+	rate_apply(screen);
+	rc->timer = g_timeout_add(RATE_TICK_MS, rate_tick, screen);
+}
+
+void chime_call_screen_rate_stop(ChimeCallScreen *screen)
+{
+	struct chime_screen_rate *rc = &screen->rate;
+
+	if (rc->timer) {
+		g_source_remove(rc->timer);
+		rc->timer = 0;
+	}
+	g_clear_object(&rc->encoder);
+	g_clear_object(&rc->videorate);
+}
+
+void chime_call_screen_rate_ping_response(ChimeCallScreen *screen)
+{
+	struct chime_screen_rate *rc = &screen->rate;
+
+	if (!rc->ping_sent)
+		return;
+
+	rc->rtt = g_get_monotonic_time() - rc->ping_sent;
+	rc->ping_sent = 0;
+	if (!rc->min_rtt || rc->rtt < rc->min_rtt)
+		rc->min_rtt = rc->rtt;
+}
+
+void chime_call_screen_rate_key_request(ChimeCallScreen *screen)
+{
+	screen->rate.key_requests++;
+}
+
+/*
+ * Called from the streaming thread for each encoded frame. Returns FALSE
+ * if it should be dropped. Once one delta frame is dropped, the rest
+ * must be until the next key frame, or viewers would decode garbage.
+ */
+gboolean chime_call_screen_rate_filter(ChimeCallScreen *screen, GstBuffer *buffer)
+{
+	struct chime_screen_rate *rc = &screen->rate;
+	gsize backlog = chime_websocket_get_buffered_amount(screen->ws);
+	/* A second's worth queued is as far behind as we'll let it get */
+	gsize limit = MAX(rc->bitrate, START_BITRATE) / 8;
+
+	if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+		rc->dropping = FALSE;
+		return TRUE;
+	}
+
+	if (!rc->dropping && backlog > limit) {
+		chime_debug("Screen uplink backlog %" G_GSIZE_FORMAT "; dropping delta frames\n",
+			    backlog);
+		rc->dropping = TRUE;
+		rc->key_pending = FALSE;
+	}
+
+	if (rc->dropping && rc->key_pending && ++rc->key_wait >= KEY_RETRY_FRAMES) {
+		chime_debug("Screen encoder ignored key frame request; asking again\n");
+		rc->key_pending = FALSE;
+	}
+
+	if (rc->dropping && !rc->key_pending && backlog < limit / 2) {
+		rc->key_pending = TRUE;
+		rc->key_wait = 0;
+		chime_call_screen_force_keyframe(screen);
+	}
+
+	return !rc->dropping;
+}
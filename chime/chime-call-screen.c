@@ -22,12 +22,13 @@
 #include <string.h>
 #include <ctype.h>
 
-#include <gst/rtp/gstrtpbuffer.h>
 #include <gst/video/video.h>
 
 static GstAppSrcCallbacks no_appsrc_callbacks;
 static GstAppSinkCallbacks no_appsink_callbacks;
 
+static void screen_release_appsrc(ChimeCallScreen *screen);
+
 struct screen_pkt {
 	unsigned char type;
 	unsigned char flag;
@@ -116,6 +117,28 @@ static void screen_send_packet(ChimeCallScreen *screen, enum screen_pkt_type typ
 	g_mutex_unlock(&screen->transport_lock);
 }
 
+void chime_call_screen_send_ping(ChimeCallScreen *screen)
+{
+	screen_send_packet(screen, SCREEN_PKT_TYPE_PING_REQUEST, NULL, 0);
+}
+
+void chime_call_screen_force_keyframe(ChimeCallScreen *screen)
+{
+	GstAppSink *sink = screen->screen_sink;
+	GstPad *pad, *peer;
+
+	if (!sink)
+		return;
+
+	pad = gst_element_get_static_pad(GST_ELEMENT(sink), "sink");
+	peer = gst_pad_get_peer(pad);
+	gst_object_unref(pad);
+	if (peer) {
+		gst_pad_send_event(peer, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, FALSE, 0));
+		gst_object_unref(peer);
+	}
+}
+
 static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
@@ -127,10 +150,7 @@ static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 	/* This provokes the UI to tear down the GStreamer pipeline */
 	chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_FAILED, "Websocket closed unexpectedly");
 
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_release_appsrc(screen);
 
 	if (screen->screen_sink) {
 		gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
@@ -138,6 +158,183 @@ static void on_screenws_closed(SoupWebsocketConnection *ws, gpointer _screen)
 	}
 }
 
+/* A VP8 key frame has the P bit clear, and a start code after the tag */
+static gboolean vp8_is_keyframe(const guint8 *frame, gsize len)
+{
+	return len >= 10 && !(frame[0] & 1) &&
+		frame[3] == 0x9d && frame[4] == 0x01 && frame[5] == 0x2a;
+}
+
+/*
+ * Received frames used to go into the appsrc as fast as they arrived, so
+ * a viewer which couldn't keep up would play an ever-growing backlog. We
+ * now hold them in our own queue and only feed the appsrc when it asks.
+ * If the oldest queued frame gets too stale, we ask the presenter for a
+ * key frame; when one arrives, everything queued before it is discarded
+ * since the key frame alone is enough to show the current screen.
+ */
+#define SCREEN_RX_APPSRC_BYTES	65536
+#define SCREEN_RX_MAX_DELAY_US	(G_USEC_PER_SEC / 2)
+#define SCREEN_RX_KEY_RETRY_US	G_USEC_PER_SEC
+#define SCREEN_RX_MAX_FRAMES	64
+
+struct screen_rx_frame {
+	GstBuffer *buffer;
+	gint64 arrival;
+};
+
+static void screen_rx_frame_free(gpointer _frame)
+{
+	struct screen_rx_frame *frame = _frame;
+
+	gst_buffer_unref(frame->buffer);
+	g_free(frame);
+}
+
+/* Called with rx_lock held */
+static void screen_rx_flush(ChimeCallScreen *screen)
+{
+	if (!g_queue_is_empty(&screen->rx_queue)) {
+		chime_debug("Screen RX dropping %u queued frames\n",
+			    g_queue_get_length(&screen->rx_queue));
+		g_queue_free_full(&screen->rx_queue, screen_rx_frame_free);
+		g_queue_init(&screen->rx_queue);
+		screen->rx_discont = TRUE;
+	}
+}
+
+/*
+ * Called with rx_lock held, but drops it around each push: once the
+ * appsrc fills up it calls screen_appsrc_enough_data() from within
+ * gst_app_src_push_buffer(). Only one thread pushes at a time, so the
+ * frames stay in order; any other just leaves its frame in the queue.
+ */
+static void screen_rx_drain(ChimeCallScreen *screen)
+{
+	if (screen->rx_draining)
+		return;
+
+	screen->rx_draining = TRUE;
+	while (screen->screen_src && screen->appsrc_need_data &&
+	       !g_queue_is_empty(&screen->rx_queue)) {
+		struct screen_rx_frame *frame = g_queue_pop_head(&screen->rx_queue);
+		GstAppSrc *src = gst_object_ref(screen->screen_src);
+		GstBuffer *buffer = frame->buffer;
+
+		g_free(frame);
+		if (screen->rx_discont) {
+			GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+			screen->rx_discont = FALSE;
+		}
+
+		g_mutex_unlock(&screen->rx_lock);
+		gst_app_src_push_buffer(src, buffer);
+		gst_object_unref(src);
+		g_mutex_lock(&screen->rx_lock);
+	}
+	screen->rx_draining = FALSE;
+}
+
+/* Detach from the appsrc, dropping anything still queued for it */
+static void screen_release_appsrc(ChimeCallScreen *screen)
+{
+	GstAppSrc *src;
+
+	g_mutex_lock(&screen->rx_lock);
+	src = screen->screen_src;
+	screen->screen_src = NULL;
+	screen->appsrc_need_data = FALSE;
+	screen_rx_flush(screen);
+	g_mutex_unlock(&screen->rx_lock);
+
+	/* Outside the lock, as this may call screen_appsrc_destroy() */
+	if (src)
+		gst_app_src_set_callbacks(src, &no_appsrc_callbacks, NULL, NULL);
+}
+
+/*
+ * The VP8 frame follows the packet header in the websocket message,
+ * so the buffer just wraps the message's own memory and holds a
+ * reference on it until the decoder is done.
+ */
+static void screen_push_frame(ChimeCallScreen *screen, GBytes *message, gsize len)
+{
+	const guint8 *data = g_bytes_get_data(message, NULL);
+	GstElement *src = GST_ELEMENT(screen->screen_src);
+	GstBuffer *buffer = gst_buffer_new();
+	gint64 now = g_get_monotonic_time();
+	gboolean request_key = FALSE;
+	guint queued = 0;
+	GstClock *clock;
+
+	gst_buffer_append_memory(buffer,
+				 gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+							(gpointer)data, len,
+							sizeof(struct screen_pkt),
+							len - sizeof(struct screen_pkt),
+							g_bytes_ref(message),
+							(GDestroyNotify)g_bytes_unref));
+
+	/* Stamp it with its arrival in the pipeline's running time. VP8
+	 * has no B-frames, so decode order is presentation order. */
+	clock = gst_element_get_clock(src);
+	if (clock) {
+		GstClockTime now = gst_clock_get_time(clock);
+		GstClockTime base = gst_element_get_base_time(src);
+
+		if (now >= base)
+			GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = now - base;
+		gst_object_unref(clock);
+	}
+
+	if (!vp8_is_keyframe(data + sizeof(struct screen_pkt), len - sizeof(struct screen_pkt)))
+		GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+	g_mutex_lock(&screen->rx_lock);
+	if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+		/* Nothing queued before a key frame is needed any more */
+		screen_rx_flush(screen);
+		screen->rx_wait_key = FALSE;
+		screen->rx_key_requested = 0;
+	} else if (screen->rx_wait_key) {
+		gst_buffer_unref(buffer);
+		buffer = NULL;
+	} else if (g_queue_get_length(&screen->rx_queue) >= SCREEN_RX_MAX_FRAMES) {
+		/* Hopelessly behind. Give up on the deltas and wait for a key frame */
+		screen_rx_flush(screen);
+		screen->rx_wait_key = TRUE;
+		gst_buffer_unref(buffer);
+		buffer = NULL;
+	}
+
+	if (buffer) {
+		struct screen_rx_frame *frame = g_new(struct screen_rx_frame, 1);
+
+		frame->buffer = buffer;
+		frame->arrival = now;
+		g_queue_push_tail(&screen->rx_queue, frame);
+		screen_rx_drain(screen);
+	}
+
+	if (!g_queue_is_empty(&screen->rx_queue) || screen->rx_wait_key) {
+		struct screen_rx_frame *oldest = g_queue_peek_head(&screen->rx_queue);
+
+		if ((screen->rx_wait_key || now - oldest->arrival > SCREEN_RX_MAX_DELAY_US) &&
+		    (!screen->rx_key_requested || now - screen->rx_key_requested > SCREEN_RX_KEY_RETRY_US)) {
+			queued = g_queue_get_length(&screen->rx_queue);
+			screen->rx_key_requested = now;
+			request_key = TRUE;
+		}
+	}
+	g_mutex_unlock(&screen->rx_lock);
+
+	if (request_key) {
+		chime_debug("Screen RX behind by %u frames (%" G_GUINT64_FORMAT " bytes in appsrc); requesting key frame\n",
+			    queued, gst_app_src_get_current_level_bytes(GST_APP_SRC(src)));
+		screen_send_packet(screen, SCREEN_PKT_TYPE_KEY_REQUEST, NULL, 0);
+	}
+}
+
 static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 			       GBytes *message, gpointer _screen)
 {
@@ -164,16 +361,26 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 		screen_send_packet(screen, SCREEN_PKT_TYPE_PING_RESPONSE, NULL, 0);
 		break;
 
+	case SCREEN_PKT_TYPE_PING_RESPONSE:
+		if (screen->state == CHIME_SCREEN_STATE_SENDING)
+			chime_call_screen_rate_ping_response(screen);
+		break;
+
 	case SCREEN_PKT_TYPE_KEY_REQUEST:
 		if (screen->screen_sink) {
 			screen->viewer_present = 1;
-			GstEvent *ev = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, FALSE, 0);
-			GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(screen->screen_sink), "sink");
-			GstPad *peer = gst_pad_get_peer(pad);
-			gst_pad_send_event(peer, ev);
+			chime_call_screen_rate_key_request(screen);
+			chime_call_screen_force_keyframe(screen);
 		}
 		break;
 
+	case SCREEN_PKT_TYPE_RR:
+	case SCREEN_PKT_TYPE_PRESENTER_UPLINK_PROBE:
+		/* We don't know what's in these yet */
+		chime_debug("Incoming screen packet type %d, %" G_GSIZE_FORMAT " bytes\n",
+			    pkt->type, s);
+		break;
+
 	case SCREEN_PKT_TYPE_STREAM_STOP:
 		if (screen->screen_sink) {
 			screen_send_packet(screen, SCREEN_PKT_TYPE_PRESENTER_END, NULL, 0);
@@ -185,11 +392,8 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 		break;
 
 	case SCREEN_PKT_TYPE_CAPTURE:
-		if (screen->screen_src) {
-			GstBuffer *buffer = gst_rtp_buffer_new_allocate(s - 4, 0, 0);
-			gst_buffer_fill(buffer, 0, &pkt[1], s - sizeof(*pkt));
-			gst_app_src_push_buffer(GST_APP_SRC(screen->screen_src), buffer);
-		}
+		if (screen->screen_src && s > sizeof(*pkt))
+			screen_push_frame(screen, message, s);
 		break;
 
 	default:
@@ -243,10 +447,7 @@ ChimeCallScreen *chime_call_screen_open(ChimeConnection *cxn, ChimeCall *call, C
 		g_object_unref(screen->ws);
 		screen->ws = NULL;
 
-		if (screen->screen_src) {
-			gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-			screen->screen_src = NULL;
-		}
+		screen_release_appsrc(screen);
 		if (screen->screen_sink) {
 			gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
 			screen->screen_sink = NULL;
@@ -257,6 +458,8 @@ ChimeCallScreen *chime_call_screen_open(ChimeConnection *cxn, ChimeCall *call, C
 		screen = g_new0(ChimeCallScreen, 1);
 
 		g_mutex_init(&screen->transport_lock);
+		g_mutex_init(&screen->rx_lock);
+		g_queue_init(&screen->rx_queue);
 
 		screen->call = call;
 		screen->cancel = g_cancellable_new();
@@ -302,6 +505,7 @@ void chime_call_screen_close(ChimeCallScreen *screen)
 	}
 
 	chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_HANGUP, NULL);
+	chime_call_screen_rate_stop(screen);
 
 	if (screen->cancel) {
 		g_cancellable_cancel(screen->cancel);
@@ -314,27 +518,33 @@ void chime_call_screen_close(ChimeCallScreen *screen)
 		soup_websocket_connection_close(screen->ws, 0, NULL);
 		screen->ws = NULL;
 	}
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_release_appsrc(screen);
 	if (screen->screen_sink) {
 		gst_app_sink_set_callbacks(screen->screen_sink, &no_appsink_callbacks, NULL, NULL);
 		screen->screen_sink = NULL;
 	}
+	g_mutex_clear(&screen->rx_lock);
+	g_mutex_clear(&screen->transport_lock);
 	g_free(screen);
 }
 
 static void screen_appsrc_need_data(GstAppSrc *src, guint length, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
+
+	g_mutex_lock(&screen->rx_lock);
 	screen->appsrc_need_data = TRUE;
+	screen_rx_drain(screen);
+	g_mutex_unlock(&screen->rx_lock);
 }
 
 static void screen_appsrc_enough_data(GstAppSrc *src, gpointer _screen)
 {
 	ChimeCallScreen *screen = _screen;
+
+	g_mutex_lock(&screen->rx_lock);
 	screen->appsrc_need_data = FALSE;
+	g_mutex_unlock(&screen->rx_lock);
 }
 
 static void screen_appsrc_destroy(gpointer _screen)
@@ -358,7 +568,18 @@ static GstAppSrcCallbacks screen_appsrc_callbacks = {
 
 void chime_call_screen_install_appsrc(ChimeCallScreen *screen, GstAppSrc *appsrc)
 {
+	g_mutex_lock(&screen->rx_lock);
+	screen_rx_flush(screen);
 	screen->screen_src = appsrc;
+	screen->rx_discont = TRUE;
+	screen->rx_wait_key = FALSE;
+	screen->rx_key_requested = 0;
+	/* Until it says otherwise, in case we missed its first need-data */
+	screen->appsrc_need_data = TRUE;
+	g_mutex_unlock(&screen->rx_lock);
+
+	/* Keep the backlog in our queue, where we can discard it */
+	gst_app_src_set_max_bytes(appsrc, SCREEN_RX_APPSRC_BYTES);
 	gst_app_src_set_callbacks(appsrc, &screen_appsrc_callbacks, screen, screen_appsrc_destroy);
 
 	if (screen->state == CHIME_SCREEN_STATE_SENDING)
@@ -389,6 +610,15 @@ static GstFlowReturn screen_appsink_new_sample(GstAppSink* self, gpointer data)
 	if (screen->state == CHIME_SCREEN_STATE_SENDING && screen->viewer_present) {
 		GstBuffer *buffer = gst_sample_get_buffer(sample);
 		gsize len = gst_buffer_get_size(buffer);
+		gboolean send;
+
+		g_mutex_lock(&screen->transport_lock);
+		send = screen->ws && chime_call_screen_rate_filter(screen, buffer);
+		g_mutex_unlock(&screen->transport_lock);
+		if (!send) {
+			gst_sample_unref(sample);
+			return GST_FLOW_OK;
+		}
 
 		/* Ick, we need to fix websockets to take iovecs */
 		struct screen_pkt *buf = g_malloc0(sizeof(*buf) + len);
@@ -435,14 +665,12 @@ void chime_call_screen_install_appsink(ChimeCallScreen *screen, GstAppSink *apps
 	if (screen->state == CHIME_SCREEN_STATE_VIEWING)
 		screen_send_packet(screen, SCREEN_PKT_TYPE_VIEWER_END, NULL, 0);
 
-	if (screen->screen_src) {
-		gst_app_src_set_callbacks(screen->screen_src, &no_appsrc_callbacks, NULL, NULL);
-		screen->screen_src = NULL;
-	}
+	screen_release_appsrc(screen);
 
 	if (screen->ws) {
 		screen->viewer_present = 0;
 		screen_send_packet(screen, SCREEN_PKT_TYPE_PRESENTER_BEGIN, NULL, 0);
 		chime_call_screen_set_state(screen, CHIME_SCREEN_STATE_SENDING, NULL);
+		chime_call_screen_rate_start(screen);
 	}
 }
@@ -24,6 +24,25 @@
 #include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
 
+/* Uplink rate control while presenting; see chime-call-screen-rate.c */
+struct chime_screen_rate {
+	guint timer;
+	GstElement *encoder, *videorate;
+
+	guint bitrate;		/* b/s */
+	guint fps;
+
+	gint64 ping_sent;	/* Monotonic time of outstanding ping, or 0 */
+	gint64 rtt, min_rtt;	/* µs */
+	guint key_requests;	/* Since last tick */
+	guint good_ticks;
+
+	/* Touched only from the streaming thread */
+	gboolean dropping;	/* Discarding delta frames until a key frame */
+	gboolean key_pending;
+	guint key_wait;		/* Frames dropped since the key frame was forced */
+};
+
 struct _ChimeCallScreen {
 	ChimeCall *call;
 	GCancellable *cancel;
@@ -32,8 +51,17 @@ struct _ChimeCallScreen {
 
 	GstAppSrc *screen_src;
 	gboolean appsrc_need_data, viewer_present;
+	gboolean rx_discont;	/* Next frame starts a new stream */
+
+	/* Frames waiting for the appsrc to ask for more */
+	GMutex rx_lock;
+	GQueue rx_queue;
+	gboolean rx_wait_key;	/* Dropping delta frames until a key frame */
+	gboolean rx_draining;	/* A thread is pushing to the appsrc */
+	gint64 rx_key_requested;
 
 	GstAppSink *screen_sink;
+	struct chime_screen_rate rate;
 
 	SoupWebsocketConnection *ws;
 };
@@ -47,3 +75,13 @@ void chime_call_screen_set_state(ChimeCallScreen *audio, ChimeScreenState state,
 
 void chime_call_screen_install_appsrc(ChimeCallScreen *screen, GstAppSrc *appsrc);
 void chime_call_screen_install_appsink(ChimeCallScreen *screen, GstAppSink *appsink);
+
+/* Used by chime-call-screen-rate.c */
+void chime_call_screen_send_ping(ChimeCallScreen *screen);
+void chime_call_screen_force_keyframe(ChimeCallScreen *screen);
+
+void chime_call_screen_rate_start(ChimeCallScreen *screen);
+void chime_call_screen_rate_stop(ChimeCallScreen *screen);
+void chime_call_screen_rate_ping_response(ChimeCallScreen *screen);
+void chime_call_screen_rate_key_request(ChimeCallScreen *screen);
+gboolean chime_call_screen_rate_filter(ChimeCallScreen *screen, GstBuffer *buffer);
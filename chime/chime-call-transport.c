@@ -27,6 +27,9 @@
 
 #define CHIME_DTLS_MTU 1196
 
+/* Head start that DTLS gets before we also try the websocket */
+#define DTLS_HEAD_START_MS 250
+
 static void hexdump(const void *buf, int len)
 {
 	char linechars[17];
@@ -50,6 +53,12 @@ static void hexdump(const void *buf, int len)
 	printf("\n");
 }
 
+static void on_final_audiows_close(SoupWebsocketConnection *ws, gpointer _unused)
+{
+	chime_debug("audio ws close\n");
+	g_object_unref(ws);
+}
+
 static void on_audiows_closed(SoupWebsocketConnection *ws, gpointer _audio)
 {
 	ChimeCallAudio *audio = _audio;
@@ -156,29 +165,70 @@ static void audio_ws_connect_cb(GObject *obj, GAsyncResult *res, gpointer _audio
 	ChimeCallAudio *audio = _audio;
 	ChimeConnection *cxn = CHIME_CONNECTION(obj);
 	GError *error = NULL;
+	gboolean dtls_up;
 	SoupWebsocketConnection *ws = chime_connection_websocket_connect_finish(cxn, res, &error);
 	if (!ws) {
 		/* If it was cancelled, 'audio' may have been freed. */
 		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
 			chime_debug("audio ws error %s\n", error->message);
-			audio->state = CHIME_AUDIO_STATE_FAILED;
+			audio->ws_pending = FALSE;
+
+			/* It's only fatal if DTLS has given up too. The audio
+			 * thread clears dtls_sess when the handshake fails. */
+			g_mutex_lock(&audio->transport_lock);
+			gboolean dtls_alive = audio->dtls_sess != NULL;
+			g_mutex_unlock(&audio->transport_lock);
+
+			/* This may close the call, and free 'audio' */
+			if (!dtls_alive)
+				chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_FAILED,
+							   error->message);
 		}
 		g_clear_error(&error);
 		g_object_unref(cxn);
 		return;
 	}
+	audio->ws_pending = FALSE;
+	g_object_unref(cxn);
+
+	g_mutex_lock(&audio->transport_lock);
+	dtls_up = audio->dtls_handshaked;
+	g_mutex_unlock(&audio->transport_lock);
+	if (dtls_up) {
+		chime_debug("audio ws connected after DTLS; dropping it\n");
+		g_signal_connect(G_OBJECT(ws), "closed", G_CALLBACK(on_final_audiows_close), NULL);
+		soup_websocket_connection_close(ws, 0, NULL);
+		return;
+	}
+
 	chime_debug("audio ws connected!\n");
 	g_signal_connect(G_OBJECT(ws), "closed", G_CALLBACK(on_audiows_closed), audio);
 	g_signal_connect(G_OBJECT(ws), "message", G_CALLBACK(on_audiows_message), audio);
 	audio->ws = ws;
 
 	audio_send_auth_packet(audio);
-	g_object_unref(cxn);
 }
 
+static void close_ws(ChimeCallAudio *audio)
+{
+	g_signal_handlers_disconnect_matched(G_OBJECT(audio->ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
+	g_signal_connect(G_OBJECT(audio->ws), "closed", G_CALLBACK(on_final_audiows_close), NULL);
+	soup_websocket_connection_close(audio->ws, 0, NULL);
+	audio->ws = NULL;
+}
 
+/* Called both when DTLS gives up and when it's had its head start */
 static void chime_call_transport_connect_ws(ChimeCallAudio *audio)
 {
+	if (audio->ws_race_source) {
+		g_source_remove(audio->ws_race_source);
+		audio->ws_race_source = 0;
+	}
+	if (audio->ws || audio->ws_pending)
+		return;
+
+	audio->ws_pending = TRUE;
+
 	SoupURI *uri = soup_uri_new_printf(chime_call_get_audio_ws_url(audio->call), "/audio");
 	SoupMessage *msg = soup_message_new_from_uri("GET", uri);
 
@@ -380,20 +430,46 @@ g_tls_connection_gnutls_pull_timeout_func (gnutls_transport_ptr_t transport_data
 
 static gboolean dtls_timeout(ChimeCallAudio *audio);
 
+static void dtls_failed(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	chime_call_transport_connect_ws(audio);
+}
+
+/* If the websocket won the race, move over to DTLS now that it's up */
+static void dtls_established(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	if (audio->ws_race_source) {
+		g_source_remove(audio->ws_race_source);
+		audio->ws_race_source = 0;
+	}
+	if (audio->ws) {
+		chime_debug("Switching audio from websocket to DTLS\n");
+		close_ws(audio);
+	}
+	audio_send_auth_packet(audio);
+}
+
+/* Runs on the audio thread. Holds transport_lock against a concurrent
+ * disconnect from the main thread, except while handling the packet. */
 static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, ChimeCallAudio *audio)
 {
+	g_mutex_lock(&audio->transport_lock);
+	if (!audio->dtls_sess) {
+		g_mutex_unlock(&audio->transport_lock);
+		return G_SOURCE_REMOVE;
+	}
+
 	if (!audio->dtls_handshaked) {
 		int ret = gnutls_handshake(audio->dtls_sess);
 
 		if (ret == GNUTLS_E_AGAIN) {
-			if (audio->timeout_source)
-				g_source_remove(audio->timeout_source);
+			chime_call_audio_rt_source_clear(&audio->dtls_timer);
 
 			int timeo = gnutls_dtls_get_timeout(audio->dtls_sess);
-			audio->timeout_source = g_timeout_add(timeo,
-							      G_SOURCE_FUNC(dtls_timeout),
-							      audio);
+			audio->dtls_timer = chime_call_audio_rt_timeout(audio, timeo,
+									G_SOURCE_FUNC(dtls_timeout));
 
+			g_mutex_unlock(&audio->transport_lock);
 			return G_SOURCE_CONTINUE;
 		}
 
@@ -405,24 +481,32 @@ static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, Chime
 			audio->dtls_source = NULL;
 			g_object_unref(audio->dtls_sock);
 			audio->dtls_sock = NULL;
-			if (audio->timeout_source)
-				g_source_remove(audio->timeout_source);
-			audio->timeout_source = 0;
+			chime_call_audio_rt_source_clear(&audio->dtls_timer);
+			g_mutex_unlock(&audio->transport_lock);
 
-			chime_call_transport_connect_ws(audio);
+			chime_call_audio_run_on_main(audio, dtls_failed, NULL, 0);
 			return G_SOURCE_REMOVE;
 		}
 
-		chime_debug("DTLS established\n");
-		g_source_remove(audio->timeout_source);
-		audio->timeout_source = 0;
+		chime_debug("DTLS established%s\n",
+			    gnutls_session_is_resumed(audio->dtls_sess) ? " (resumed)" : "");
+		chime_call_audio_rt_source_clear(&audio->dtls_timer);
 		audio->dtls_handshaked = TRUE;
-		audio_send_auth_packet(audio);
+
+		/* Keep the session so a reconnect can skip the full handshake */
+		gnutls_free(audio->dtls_resume.data);
+		if (gnutls_session_get_data2(audio->dtls_sess, &audio->dtls_resume)) {
+			audio->dtls_resume.data = NULL;
+			audio->dtls_resume.size = 0;
+		}
+		chime_call_audio_run_on_main(audio, dtls_established, NULL, 0);
 		/* Fall through and receive data, not that it should be there */
 	}
 
 	unsigned char pkt[CHIME_DTLS_MTU];
 	ssize_t len = gnutls_record_recv(audio->dtls_sess, pkt, sizeof(pkt));
+	g_mutex_unlock(&audio->transport_lock);
+
 	if (len > 0) {
 		if (getenv("CHIME_AUDIO_DEBUG")) {
 			printf("incoming:\n");
@@ -436,8 +520,6 @@ static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, Chime
 
 static gboolean dtls_timeout(ChimeCallAudio *audio)
 {
-	audio->timeout_source = 0;
-
 	dtls_src_cb(NULL, 0, audio);
 
 	return G_SOURCE_REMOVE;
@@ -469,11 +551,13 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 	/* Not that "connected" means anything except that we think we can route to it. */
 	chime_debug("UDP socket connected\n");
 
+	g_mutex_lock(&audio->transport_lock);
+
 	audio->dtls_source = g_datagram_based_create_source(G_DATAGRAM_BASED(s), G_IO_IN, audio->cancel);
 	audio->dtls_sock = s;
 	g_source_set_callback(audio->dtls_source, G_SOURCE_FUNC(dtls_src_cb),
 			      audio, NULL);
-	g_source_attach(audio->dtls_source, NULL);
+	g_source_attach(audio->dtls_source, audio->rt_context);
 
 	gnutls_init(&audio->dtls_sess, GNUTLS_CLIENT|GNUTLS_DATAGRAM|GNUTLS_NONBLOCK);
 	gnutls_set_default_priority(audio->dtls_sess);
@@ -483,9 +567,17 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 		gnutls_certificate_set_x509_system_trust(audio->dtls_cred);
 		gnutls_certificate_set_x509_trust_dir(audio->dtls_cred,
 						      CHIME_CERTS_DIR, GNUTLS_X509_FMT_PEM);
+		/* For the stand-in server in tests/, with its own certificate */
+		if (getenv("CHIME_DTLS_CAFILE"))
+			gnutls_certificate_set_x509_trust_file(audio->dtls_cred,
+							       getenv("CHIME_DTLS_CAFILE"),
+							       GNUTLS_X509_FMT_PEM);
 		gnutls_certificate_set_verify_function(audio->dtls_cred, dtls_verify_cb);
 	}
 	gnutls_credentials_set(audio->dtls_sess, GNUTLS_CRD_CERTIFICATE, audio->dtls_cred);
+	if (audio->dtls_resume.data)
+		gnutls_session_set_data(audio->dtls_sess, audio->dtls_resume.data,
+					audio->dtls_resume.size);
 
 	if (!audio->dtls_hostname) {
 		gchar *hostname = g_strdup(chime_call_get_media_host(audio->call));
@@ -529,12 +621,14 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 	}
 
 	int timeo = gnutls_dtls_get_timeout(audio->dtls_sess);
-	audio->timeout_source = g_timeout_add(timeo, (GSourceFunc)dtls_timeout, audio);
+	audio->dtls_timer = chime_call_audio_rt_timeout(audio, timeo, (GSourceFunc)dtls_timeout);
 
+	g_mutex_unlock(&audio->transport_lock);
 	return;
 
  err:
 	g_clear_object(&audio->dtls_sock);
+	g_mutex_unlock(&audio->transport_lock);
 	chime_call_transport_connect_ws(audio);
 }
 
@@ -588,15 +682,39 @@ static void audio_dtls_one(GObject *obj, GAsyncResult *res, gpointer user_data)
 					       (GAsyncReadyCallback)audio_dtls_one, audio);
 }
 
+static gboolean ws_race_cb(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+
+	gboolean dtls_up;
+
+	audio->ws_race_source = 0;
+
+	g_mutex_lock(&audio->transport_lock);
+	dtls_up = audio->dtls_handshaked;
+	g_mutex_unlock(&audio->transport_lock);
+	if (!dtls_up)
+		chime_call_transport_connect_ws(audio);
+
+	return G_SOURCE_REMOVE;
+}
+
 void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
 {
 	audio->silent = silent;
 	audio->cancel = g_cancellable_new();
+	g_mutex_lock(&audio->transport_lock);
 	audio->dtls_handshaked = FALSE;
+	g_mutex_unlock(&audio->transport_lock);
 	audio->recv_ssrc = g_random_int();
 
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_CONNECTING, NULL);
 
+	/* Happy eyeballs: if DTLS isn't up shortly, race the websocket
+	 * against it. Whichever finishes first carries the call, and we
+	 * move over to DTLS if it completes later. */
+	audio->ws_race_source = g_timeout_add(DTLS_HEAD_START_MS, ws_race_cb, audio);
+
 	GSocketConnectable *addr = g_network_address_parse(chime_call_get_media_host(audio->call),
 							   0, NULL);
 	if (!addr) {
@@ -611,23 +729,30 @@ void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
 }
 
 
-static void on_final_audiows_close(SoupWebsocketConnection *ws, gpointer _unused)
+
+/* Stale if audio from a later connection has already reset it */
+static void jitter_reset(ChimeCallAudio *audio, gconstpointer data, gsize len)
 {
-	chime_debug("audio ws close\n");
-	g_object_unref(ws);
-}
+	const guint *gen = data;
 
+	if ((gint)(*gen - audio->jb.gen) > 0)
+		chime_call_jitter_reset(audio);
+}
 
 void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 {
-	if (audio->send_rt_source) {
-		g_source_remove(audio->send_rt_source);
-		audio->send_rt_source = 0;
-	}
+	guint gen;
+
+	chime_call_audio_rt_source_clear(&audio->send_rt_source);
 
 	g_hash_table_remove_all(audio->profiles);
 
 	chime_call_audio_cleanup_datamsgs(audio);
+	gen = g_atomic_int_add(&audio->transport_gen, 1) + 1;
+	if (audio->rt_thread)
+		chime_call_audio_run_on_rt(audio, jitter_reset, &gen, sizeof(gen));
+	else
+		chime_call_jitter_reset(audio);
 
 	if (hangup && audio->state >= CHIME_AUDIO_STATE_AUDIOLESS)
 		audio_send_hangup_packet(audio);
@@ -639,12 +764,14 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 		g_object_unref(audio->cancel);
 		audio->cancel = NULL;
 	}
-	if (audio->ws) {
-		g_signal_handlers_disconnect_matched(G_OBJECT(audio->ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
-		g_signal_connect(G_OBJECT(audio->ws), "closed", G_CALLBACK(on_final_audiows_close), NULL);
-		soup_websocket_connection_close(audio->ws, 0, NULL);
-		audio->ws = NULL;
-	} else if (audio->dtls_sess) {
+	if (audio->ws_race_source) {
+		g_source_remove(audio->ws_race_source);
+		audio->ws_race_source = 0;
+	}
+	audio->ws_pending = FALSE;
+	if (audio->ws)
+		close_ws(audio);
+	if (audio->dtls_sess) {
 		gnutls_deinit(audio->dtls_sess);
 		audio->dtls_sess = NULL;
 
@@ -660,17 +787,32 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 		audio->dtls_hostname = NULL;
 	}
 
-	if (audio->timeout_source) {
-		g_source_remove(audio->timeout_source);
-		audio->timeout_source = 0;
-	}
+	chime_call_audio_rt_source_clear(&audio->dtls_timer);
 
-	if (hangup && audio->dtls_cred) {
+	g_mutex_unlock(&audio->transport_lock);
+
+	g_mutex_lock(&audio->rt_lock);
+	audio->reconnect_queued = FALSE;
+	g_mutex_unlock(&audio->rt_lock);
+}
+
+/* Credentials and session data outlive reconnects, but not the call */
+void chime_call_transport_cleanup(ChimeCallAudio *audio)
+{
+	if (audio->dtls_cred) {
 		gnutls_certificate_free_credentials(audio->dtls_cred);
 		audio->dtls_cred = NULL;
 	}
+	gnutls_free(audio->dtls_resume.data);
+	audio->dtls_resume.data = NULL;
+	audio->dtls_resume.size = 0;
+}
 
-	g_mutex_unlock(&audio->transport_lock);
+/* The websocket belongs to the main context and isn't thread-safe */
+static void ws_send_work(ChimeCallAudio *audio, gconstpointer data, gsize len)
+{
+	if (audio->ws)
+		soup_websocket_connection_send_binary(audio->ws, data, len);
 }
 
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message)
@@ -678,22 +820,42 @@ void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type t
 	if (!audio->ws && !audio->dtls_sess)
 		return;
 
-	size_t len = protobuf_c_message_get_packed_size(message);
+	gssize fast_len = -1;
+	size_t len;
+
+	if (type == XRP_RT_MESSAGE)
+		fast_len = chime_call_xrp_rt_packed_size((const RTMessage *)message);
+	if (fast_len >= 0)
+		len = fast_len;
+	else
+		len = protobuf_c_message_get_packed_size(message);
 
 	len += sizeof(struct xrp_header);
-	struct xrp_header *hdr = g_malloc0(len);
+
+	/* Both transports copy the data before returning, so one buffer
+	 * which only ever grows serves every packet we send. */
+	g_mutex_lock(&audio->transport_lock);
+	if (len > audio->tx_buf_len) {
+		g_free(audio->tx_buf);
+		audio->tx_buf_len = MAX(len, XRP_MAX_PAYLOAD);
+		audio->tx_buf = g_malloc(audio->tx_buf_len);
+	}
+	struct xrp_header *hdr = (void *)audio->tx_buf;
 	hdr->type = htons(type);
 	hdr->len = htons(len);
-	protobuf_c_message_pack(message, (void *)(hdr + 1));
+	if (fast_len >= 0)
+		chime_call_xrp_rt_pack((const RTMessage *)message, (void *)(hdr + 1));
+	else
+		protobuf_c_message_pack(message, (void *)(hdr + 1));
 	if (getenv("CHIME_AUDIO_DEBUG")) {
 		printf("sending protobuf of len %"G_GSIZE_FORMAT"\n", len);
 		hexdump(hdr, len);
 	}
-	g_mutex_lock(&audio->transport_lock);
-	if (audio->dtls_sess)
+	if (audio->dtls_sess && audio->dtls_handshaked)
 		gnutls_record_send(audio->dtls_sess, hdr, len);
+	else if (audio->ws && !g_main_context_is_owner(g_main_context_default()))
+		chime_call_audio_run_on_main(audio, ws_send_work, hdr, len);
 	else if (audio->ws)
 		soup_websocket_connection_send_binary(audio->ws, hdr, len);
 	g_mutex_unlock(&audio->transport_lock);
-	g_free(hdr);
 }
@@ -0,0 +1,438 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "chime-connection.h"
+#include "chime-call.h"
+#include "chime-connection-private.h"
+#include "chime-call-audio.h"
+
+#include <string.h>
+
+/*
+ * An RTMessage goes each way for every 20ms audio frame, and the generic
+ * protobuf-c engine walks the field descriptors to size it and then again
+ * to pack it. The handful of fields that these messages actually carry
+ * are encoded and decoded directly here instead.
+ *
+ * The encoder emits fields in ascending order of field number, just as
+ * protobuf-c does, so the output is byte-for-byte the same, as
+ * tests/test-rt-pack checks. Anything else (profiles, stats, poly info
+ * or unknown fields) goes the generic way.
+ *
+ * The decoder leaves the audio payload pointing into the packet, and
+ * falls back to rtmessage__unpack() for anything it doesn't understand.
+ */
+
+enum {
+	WT_VARINT = 0,
+	WT_FIXED64 = 1,
+	WT_LEN = 2,
+	WT_FIXED32 = 5,
+};
+
+/* With p == NULL, just counts the bytes that would be written */
+struct xrp_out {
+	guint8 *p;
+	gsize len;
+};
+
+static void emit_varint(struct xrp_out *o, guint64 v)
+{
+	do {
+		guint8 b = v & 0x7f;
+
+		v >>= 7;
+		if (v)
+			b |= 0x80;
+		if (o->p)
+			*o->p++ = b;
+		o->len++;
+	} while (v);
+}
+
+static void emit_tag(struct xrp_out *o, guint num, guint wt)
+{
+	emit_varint(o, (num << 3) | wt);
+}
+
+static void emit_fixed32(struct xrp_out *o, guint num, guint32 v)
+{
+	emit_tag(o, num, WT_FIXED32);
+	if (o->p) {
+		v = GUINT32_TO_LE(v);
+		memcpy(o->p, &v, sizeof(v));
+		o->p += sizeof(v);
+	}
+	o->len += sizeof(v);
+}
+
+static void emit_fixed64(struct xrp_out *o, guint num, guint64 v)
+{
+	emit_tag(o, num, WT_FIXED64);
+	if (o->p) {
+		v = GUINT64_TO_LE(v);
+		memcpy(o->p, &v, sizeof(v));
+		o->p += sizeof(v);
+	}
+	o->len += sizeof(v);
+}
+
+static void emit_bytes(struct xrp_out *o, guint num, const ProtobufCBinaryData *b)
+{
+	emit_tag(o, num, WT_LEN);
+	emit_varint(o, b->len);
+	if (o->p && b->len) {
+		memcpy(o->p, b->data, b->len);
+		o->p += b->len;
+	}
+	o->len += b->len;
+}
+
+#define EMIT_UINT32(o, m, f, num)				\
+	if ((m)->has_##f) {					\
+		emit_tag(o, num, WT_VARINT);			\
+		emit_varint(o, (guint32)(m)->f);		\
+	}
+
+#define EMIT_BOOL(o, m, f, num)					\
+	if ((m)->has_##f) {					\
+		emit_tag(o, num, WT_VARINT);			\
+		emit_varint(o, !!(m)->f);			\
+	}
+
+#define EMIT_FIXED32(o, m, f, num)				\
+	if ((m)->has_##f)					\
+		emit_fixed32(o, num, (m)->f);
+
+#define EMIT_FIXED64(o, m, f, num)				\
+	if ((m)->has_##f)					\
+		emit_fixed64(o, num, (m)->f);
+
+static void emit_audio_fields(struct xrp_out *o, const AudioMessage *a)
+{
+	EMIT_UINT32(o, a, seq, 1);
+	EMIT_FIXED32(o, a, sample_time, 2);
+	EMIT_UINT32(o, a, codec, 3);
+	if (a->has_audio)
+		emit_bytes(o, 4, &a->audio);
+	EMIT_UINT32(o, a, total_frames_lost, 5);
+	EMIT_UINT32(o, a, flags, 6);
+	EMIT_FIXED64(o, a, server_time, 16);
+	EMIT_FIXED64(o, a, echo_time, 17);
+	EMIT_UINT32(o, a, pong, 18);
+	EMIT_FIXED64(o, a, client_time, 19);
+	EMIT_FIXED64(o, a, playout_delay, 20);
+	EMIT_UINT32(o, a, pong_time_offset, 21);
+	EMIT_FIXED64(o, a, ntp_time, 22);
+}
+
+static void emit_client_status_fields(struct xrp_out *o, const ClientStatusMessage *c)
+{
+	EMIT_BOOL(o, c, remote_muted, 1);
+	EMIT_BOOL(o, c, is_recording, 2);
+	EMIT_BOOL(o, c, remote_mute_ack, 3);
+}
+
+/* Submessages are length-prefixed, so each is sized before it's written */
+#define EMIT_SUBMSG(o, num, fn, m) do {				\
+		struct xrp_out sub = { NULL, 0 };		\
+								\
+		fn(&sub, m);					\
+		emit_tag(o, num, WT_LEN);			\
+		emit_varint(o, sub.len);			\
+		fn(o, m);					\
+	} while (0)
+
+static void emit_rt_fields(struct xrp_out *o, const RTMessage *msg)
+{
+	EMIT_UINT32(o, msg, call_id, 1);
+	EMIT_UINT32(o, msg, locale_id, 2);
+	if (msg->audio)
+		EMIT_SUBMSG(o, 3, emit_audio_fields, msg->audio);
+	if (msg->client_status)
+		EMIT_SUBMSG(o, 19, emit_client_status_fields, msg->client_status);
+}
+
+/* Returns -1 if @msg has anything which needs the generic encoder */
+gssize chime_call_xrp_rt_packed_size(const RTMessage *msg)
+{
+	struct xrp_out o = { NULL, 0 };
+
+	if (msg->n_profiles || msg->n_client_stats || msg->n_qualities ||
+	    msg->poly_info || msg->base.n_unknown_fields ||
+	    (msg->audio && msg->audio->base.n_unknown_fields) ||
+	    (msg->client_status && msg->client_status->base.n_unknown_fields))
+		return -1;
+
+	emit_rt_fields(&o, msg);
+	return o.len;
+}
+
+/* Only for messages which chime_call_xrp_rt_packed_size() accepted */
+gsize chime_call_xrp_rt_pack(const RTMessage *msg, guint8 *out)
+{
+	struct xrp_out o = { out, 0 };
+
+	emit_rt_fields(&o, msg);
+	return o.len;
+}
+
+struct xrp_in {
+	const guint8 *p;
+	const guint8 *end;
+};
+
+static gboolean get_varint(struct xrp_in *in, guint64 *v)
+{
+	guint shift;
+
+	*v = 0;
+	for (shift = 0; shift < 64 && in->p < in->end; shift += 7) {
+		guint8 b = *in->p++;
+
+		*v |= (guint64)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean get_fixed32(struct xrp_in *in, guint32 *v)
+{
+	if ((gsize)(in->end - in->p) < sizeof(*v))
+		return FALSE;
+	memcpy(v, in->p, sizeof(*v));
+	*v = GUINT32_FROM_LE(*v);
+	in->p += sizeof(*v);
+	return TRUE;
+}
+
+static gboolean get_fixed64(struct xrp_in *in, guint64 *v)
+{
+	if ((gsize)(in->end - in->p) < sizeof(*v))
+		return FALSE;
+	memcpy(v, in->p, sizeof(*v));
+	*v = GUINT64_FROM_LE(*v);
+	in->p += sizeof(*v);
+	return TRUE;
+}
+
+/* Splits off the contents of a length-delimited field into @sub */
+static gboolean get_len(struct xrp_in *in, struct xrp_in *sub)
+{
+	guint64 len;
+
+	if (!get_varint(in, &len) || len > (guint64)(in->end - in->p))
+		return FALSE;
+	sub->p = in->p;
+	sub->end = in->p + len;
+	in->p += len;
+	return TRUE;
+}
+
+static gboolean skip_field(struct xrp_in *in, guint wt)
+{
+	struct xrp_in sub;
+	guint64 v64;
+	guint32 v32;
+
+	switch (wt) {
+	case WT_VARINT:
+		return get_varint(in, &v64);
+	case WT_FIXED64:
+		return get_fixed64(in, &v64);
+	case WT_LEN:
+		return get_len(in, &sub);
+	case WT_FIXED32:
+		return get_fixed32(in, &v32);
+	}
+	return FALSE;
+}
+
+static gboolean get_tag(struct xrp_in *in, guint *num, guint *wt)
+{
+	guint64 tag;
+
+	if (!get_varint(in, &tag) || (tag >> 3) == 0 || (tag >> 3) > G_MAXUINT32)
+		return FALSE;
+	*num = tag >> 3;
+	*wt = tag & 7;
+	return TRUE;
+}
+
+/* A known field with the wrong wire type is left to protobuf-c to judge */
+#define GET_UINT32(in, wt, m, f) do {				\
+		guint64 v;					\
+		if (wt != WT_VARINT || !get_varint(in, &v))	\
+			return FALSE;				\
+		(m)->f = (guint32)v;				\
+		(m)->has_##f = TRUE;				\
+	} while (0)
+
+#define GET_BOOL(in, wt, m, f) do {				\
+		guint64 v;					\
+		if (wt != WT_VARINT || !get_varint(in, &v))	\
+			return FALSE;				\
+		(m)->f = !!v;					\
+		(m)->has_##f = TRUE;				\
+	} while (0)
+
+#define GET_FIXED32(in, wt, m, f) do {				\
+		if (wt != WT_FIXED32 || !get_fixed32(in, &(m)->f)) \
+			return FALSE;				\
+		(m)->has_##f = TRUE;				\
+	} while (0)
+
+#define GET_FIXED64(in, wt, m, f) do {				\
+		if (wt != WT_FIXED64 || !get_fixed64(in, &(m)->f)) \
+			return FALSE;				\
+		(m)->has_##f = TRUE;				\
+	} while (0)
+
+static gboolean parse_audio(struct xrp_in *in, AudioMessage *a)
+{
+	struct xrp_in sub;
+	guint num, wt;
+
+	while (in->p < in->end) {
+		if (!get_tag(in, &num, &wt))
+			return FALSE;
+
+		switch (num) {
+		case 1: GET_UINT32(in, wt, a, seq); break;
+		case 2: GET_FIXED32(in, wt, a, sample_time); break;
+		case 3: GET_UINT32(in, wt, a, codec); break;
+		case 4:
+			if (wt != WT_LEN || !get_len(in, &sub))
+				return FALSE;
+			a->audio.data = (guint8 *)sub.p;
+			a->audio.len = sub.end - sub.p;
+			a->has_audio = TRUE;
+			break;
+		case 5: GET_UINT32(in, wt, a, total_frames_lost); break;
+		case 6: GET_UINT32(in, wt, a, flags); break;
+		case 16: GET_FIXED64(in, wt, a, server_time); break;
+		case 17: GET_FIXED64(in, wt, a, echo_time); break;
+		case 18: GET_UINT32(in, wt, a, pong); break;
+		case 19: GET_FIXED64(in, wt, a, client_time); break;
+		case 20: GET_FIXED64(in, wt, a, playout_delay); break;
+		case 21: GET_UINT32(in, wt, a, pong_time_offset); break;
+		case 22: GET_FIXED64(in, wt, a, ntp_time); break;
+		default:
+			if (!skip_field(in, wt))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean parse_profile(struct xrp_in *in, ProfileMessage *pm)
+{
+	guint num, wt;
+
+	while (in->p < in->end) {
+		if (!get_tag(in, &num, &wt))
+			return FALSE;
+
+		switch (num) {
+		case 1: GET_UINT32(in, wt, pm, stream_id); break;
+		case 2: GET_UINT32(in, wt, pm, volume); break;
+		case 3: GET_BOOL(in, wt, pm, muted); break;
+		case 4: GET_UINT32(in, wt, pm, signal_strength); break;
+		case 5: GET_FIXED64(in, wt, pm, ntp_timestamp); break;
+		default:
+			if (!skip_field(in, wt))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean parse_client_status(struct xrp_in *in, ClientStatusMessage *c)
+{
+	guint num, wt;
+
+	while (in->p < in->end) {
+		if (!get_tag(in, &num, &wt))
+			return FALSE;
+
+		switch (num) {
+		case 1: GET_BOOL(in, wt, c, remote_muted); break;
+		case 2: GET_BOOL(in, wt, c, is_recording); break;
+		case 3: GET_BOOL(in, wt, c, remote_mute_ack); break;
+		default:
+			if (!skip_field(in, wt))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Fills in @rx->rt with the fields that audio_receive_rt_msg() looks at,
+ * and skips the rest. Returns FALSE if the packet should be given to
+ * rtmessage__unpack() instead; either because it's malformed, or it
+ * repeats a submessage, or it has more profiles than we have room for.
+ */
+gboolean chime_call_xrp_rt_unpack(struct chime_rt_rx *rx, gsize len, const guint8 *data)
+{
+	struct xrp_in in = { data, data + len };
+	struct xrp_in sub;
+	guint num, wt;
+
+	rtmessage__init(&rx->rt);
+	rx->rt.profiles = rx->profiles;
+
+	while (in.p < in.end) {
+		if (!get_tag(&in, &num, &wt))
+			return FALSE;
+
+		switch (num) {
+		case 1: GET_UINT32(&in, wt, &rx->rt, call_id); break;
+		case 2: GET_UINT32(&in, wt, &rx->rt, locale_id); break;
+		case 3:
+			if (wt != WT_LEN || rx->rt.audio || !get_len(&in, &sub))
+				return FALSE;
+			audio_message__init(&rx->audio);
+			if (!parse_audio(&sub, &rx->audio))
+				return FALSE;
+			rx->rt.audio = &rx->audio;
+			break;
+		case 4:
+			if (wt != WT_LEN || rx->rt.n_profiles == XRP_RX_PROFILES ||
+			    !get_len(&in, &sub))
+				return FALSE;
+			profile_message__init(&rx->profile_msgs[rx->rt.n_profiles]);
+			if (!parse_profile(&sub, &rx->profile_msgs[rx->rt.n_profiles]))
+				return FALSE;
+			rx->profiles[rx->rt.n_profiles] = &rx->profile_msgs[rx->rt.n_profiles];
+			rx->rt.n_profiles++;
+			break;
+		case 19:
+			if (wt != WT_LEN || rx->rt.client_status || !get_len(&in, &sub))
+				return FALSE;
+			client_status_message__init(&rx->client_status);
+			if (!parse_client_status(&sub, &rx->client_status))
+				return FALSE;
+			rx->rt.client_status = &rx->client_status;
+			break;
+		default:
+			/* client_stats, qualities, poly_info; none of which we use */
+			if (!skip_field(&in, wt))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
@@ -23,6 +23,9 @@
 
 #include <glib/gi18n.h>
 
+/* Volume updates arrive with every RT message; pass them on at most 5Hz */
+#define PARTICIPANTS_UPDATE_MS 200
+
 #define BOOL_PROPS(x)							\
 	x(ongoing, ONGOING, "ongoing?", "ongoing", "ongoing", TRUE)	\
 	x(is_recording, IS_RECORDING, "is_recording", "is-recording", "is recording", TRUE)
@@ -49,6 +52,7 @@ enum
 	CHIME_PROPS_ENUM
 
 	PROP_MUTE_ON_JOIN,
+	PROP_AUDIO_STATS,
 	LAST_PROP,
 };
 
@@ -59,7 +63,9 @@ enum {
 	AUDIO_STATE,
 	SCREEN_STATE,
 	PARTICIPANTS_CHANGED,
+	PARTICIPANTS_UPDATED,
 	NEW_PRESENTER,
+	AUDIO_STATS,
 	LAST_SIGNAL,
 };
 
@@ -72,7 +78,11 @@ struct _ChimeCall {
 
 	ChimeContact *mute_on_join;
 	GHashTable *participants;
+	GHashTable *updated_participants;	/* Set, pending PARTICIPANTS_UPDATED */
+	guint participants_update_id;
 	ChimeCallParticipant *presenter;
+	ChimeCallAudioStats audio_stats;
+	gboolean have_audio_stats;
 
 	ChimeCallAudio *audio;
 	ChimeCallScreen *screen;
@@ -81,6 +91,14 @@ struct _ChimeCall {
 
 G_DEFINE_TYPE(ChimeCall, chime_call, CHIME_TYPE_OBJECT)
 
+static ChimeCallAudioStats *audio_stats_copy(const ChimeCallAudioStats *stats)
+{
+	return g_memdup(stats, sizeof(*stats));
+}
+
+G_DEFINE_BOXED_TYPE(ChimeCallAudioStats, chime_call_audio_stats,
+		    audio_stats_copy, g_free)
+
 #define CHIME_PARTICIPATION_VALUES					  \
 	{ CHIME_PARTICIPATION_PRESENT,		"present",	N_("present") }, \
 	{ CHIME_PARTICIPATION_CHECKED_IN,	"checked_in",	N_("checked in") }, \
@@ -117,6 +135,11 @@ chime_call_dispose(GObject *object)
 
 	g_signal_emit(self, signals[ENDED], 0, NULL);
 
+	if (self->participants_update_id) {
+		g_source_remove(self->participants_update_id);
+		self->participants_update_id = 0;
+	}
+	g_clear_pointer(&self->updated_participants, g_hash_table_destroy);
 	g_clear_pointer(&self->participants, g_hash_table_destroy);
 
 	G_OBJECT_CLASS(chime_call_parent_class)->dispose(object);
@@ -145,6 +168,10 @@ static void chime_call_get_property(GObject *object, guint prop_id,
 		g_value_set_object(value, self->mute_on_join);
 		break;
 
+	case PROP_AUDIO_STATS:
+		g_value_set_boxed(value, chime_call_get_audio_stats(self));
+		break;
+
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -191,6 +218,14 @@ static void chime_call_class_init(ChimeCallClass *klass)
 				    G_PARAM_CONSTRUCT_ONLY |
 				    G_PARAM_STATIC_STRINGS);
 
+	props[PROP_AUDIO_STATS] =
+		g_param_spec_boxed("audio-stats",
+				   "audio-stats",
+				   "audio-stats",
+				   CHIME_TYPE_CALL_AUDIO_STATS,
+				   G_PARAM_READABLE |
+				   G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(object_class, LAST_PROP, props);
 
 	signals[ENDED] =
@@ -213,15 +248,28 @@ static void chime_call_class_init(ChimeCallClass *klass)
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
 			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_HASH_TABLE);
 
+	/* Just the participants whose volume or signal strength changed */
+	signals[PARTICIPANTS_UPDATED] =
+		g_signal_new ("participants-updated",
+			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
 	signals[NEW_PRESENTER] =
 		g_signal_new ("new_presenter",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
 			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+	signals[AUDIO_STATS] =
+		g_signal_new ("audio-stats",
+			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 1,
+			      CHIME_TYPE_CALL_AUDIO_STATS | G_SIGNAL_TYPE_STATIC_SCOPE);
 }
 
 static void chime_call_init(ChimeCall *self)
 {
 	self->participants = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_participant);
+	self->updated_participants = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 
@@ -449,35 +497,86 @@ static gboolean call_roster_cb(ChimeConnection *cxn, gpointer _call, JsonNode *d
 		g_signal_emit(call, signals[NEW_PRESENTER], 0, presenter);
 	}
 
-	g_signal_emit(call, signals[PARTICIPANTS_CHANGED], 0, call->participants);
+	chime_call_emit_participants(call);
 
 	return ret;
 }
 
-gboolean chime_call_participant_audio_stats(ChimeCall *call, const gchar *participant_id,
-					    int vol, int signal_strength)
+static gboolean emit_participants_updated(gpointer _call)
+{
+	ChimeCall *call = CHIME_CALL(_call);
+	GPtrArray *updated = g_ptr_array_sized_new(g_hash_table_size(call->updated_participants));
+	GHashTableIter iter;
+	gpointer p;
+
+	call->participants_update_id = 0;
+
+	g_hash_table_iter_init(&iter, call->updated_participants);
+	while (g_hash_table_iter_next(&iter, &p, NULL))
+		g_ptr_array_add(updated, p);
+	g_hash_table_remove_all(call->updated_participants);
+
+	g_signal_emit(call, signals[PARTICIPANTS_UPDATED], 0, updated);
+	g_ptr_array_unref(updated);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Participants are never removed from the table while the call lives,
+ * so it's safe to hold on to them until the update is emitted. */
+void chime_call_participant_audio_stats(ChimeCall *call, const gchar *participant_id,
+					int vol, int signal_strength)
 {
-	g_return_val_if_fail(CHIME_IS_CALL(call), FALSE);
-	g_return_val_if_fail(participant_id != NULL, FALSE);
+	g_return_if_fail(CHIME_IS_CALL(call));
+	g_return_if_fail(participant_id != NULL);
 
 	ChimeCallParticipant *p = g_hash_table_lookup(call->participants, participant_id);
 	if (!p)
-		return FALSE;
+		return;
 
-	if (vol != p->volume || signal_strength != p->signal_strength) {
-		p->volume = vol;
-		p->signal_strength = signal_strength;
-		return TRUE;
-	}
+	if (vol == p->volume && signal_strength == p->signal_strength)
+		return;
+
+	p->volume = vol;
+	p->signal_strength = signal_strength;
 
-	return FALSE;
+	g_hash_table_add(call->updated_participants, p);
+	if (!call->participants_update_id)
+		call->participants_update_id = g_timeout_add(PARTICIPANTS_UPDATE_MS,
+							     emit_participants_updated, call);
 }
 
+/* The full table supersedes any updates which haven't been sent yet */
 void chime_call_emit_participants(ChimeCall *call)
 {
+	if (call->participants_update_id) {
+		g_source_remove(call->participants_update_id);
+		call->participants_update_id = 0;
+	}
+	g_hash_table_remove_all(call->updated_participants);
+
 	g_signal_emit(call, signals[PARTICIPANTS_CHANGED], 0, call->participants);
 }
 
+const ChimeCallAudioStats *chime_call_get_audio_stats(ChimeCall *self)
+{
+	g_return_val_if_fail(CHIME_IS_CALL(self), NULL);
+
+	return self->have_audio_stats ? &self->audio_stats : NULL;
+}
+
+/* Internal only; reported periodically by the audio code */
+void chime_call_set_audio_stats(ChimeCall *call, const ChimeCallAudioStats *stats)
+{
+	g_return_if_fail(CHIME_IS_CALL(call));
+
+	call->audio_stats = *stats;
+	call->have_audio_stats = TRUE;
+
+	g_object_notify_by_pspec(G_OBJECT(call), props[PROP_AUDIO_STATS]);
+	g_signal_emit(call, signals[AUDIO_STATS], 0, &call->audio_stats);
+}
+
 static gboolean call_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *data_node)
 {
 	JsonObject *obj = json_node_get_object(data_node);
@@ -605,6 +704,7 @@ void chime_connection_open_call(ChimeConnection *cxn, ChimeCall *call, gboolean
 
 	if (!call->opens++) {
 		call->presenter = NULL;
+		call->have_audio_stats = FALSE;
 		chime_jugg_subscribe(cxn, call->channel, "Call", call_jugg_cb, NULL);
 		chime_jugg_subscribe(cxn, call->roster_channel, "Roster", call_roster_cb, call);
 		call->audio = chime_call_audio_open(cxn, call, silent);
@@ -640,7 +740,7 @@ void chime_call_audio_set_state(ChimeCallAudio *audio, ChimeAudioState state, co
 	if (audio->state == state)
 		return;
 
-	audio->state = state;
+	g_atomic_int_set(&audio->state, state);
 	g_signal_emit(audio->call, signals[AUDIO_STATE], 0, state, message);
 }
 
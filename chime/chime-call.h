@@ -95,6 +95,26 @@ typedef struct {
 
 GList *chime_call_get_participants(ChimeCall *self);
 
+/*
+ * Quality of the audio we are receiving, refreshed every few seconds
+ * while the call is connected. Loss is over the last interval; the
+ * counters are totals since the call was opened.
+ */
+typedef struct {
+	guint frames_received;
+	guint frames_lost;
+	gdouble loss_percent;
+	gdouble jitter_ms;
+	gdouble rtt_ms;		/* Negative until the server has echoed a timestamp */
+	gdouble mos;		/* Estimated from the above, 1.0 to 4.5 */
+} ChimeCallAudioStats;
+
+#define CHIME_TYPE_CALL_AUDIO_STATS (chime_call_audio_stats_get_type ())
+GType chime_call_audio_stats_get_type (void) G_GNUC_CONST;
+
+/* NULL until the first report */
+const ChimeCallAudioStats *chime_call_get_audio_stats(ChimeCall *self);
+
 struct _ChimeCallAudio;
 typedef struct _ChimeCallAudio ChimeCallAudio;
 
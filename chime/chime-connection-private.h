@@ -46,6 +46,10 @@
 #define soup_websocket_connection_get_close_code chime_websocket_connection_get_close_code
 #define soup_websocket_connection_get_close_data chime_websocket_connection_get_close_data
 #define SoupWebsocketConnection ChimeWebsocketConnection
+#define chime_websocket_get_buffered_amount chime_websocket_connection_get_buffered_amount
+#else
+/* libsoup doesn't say how much is still waiting to be sent */
+#define chime_websocket_get_buffered_amount(ws) ((gsize)0)
 #endif
 
 #define CHIME_ENUM_VALUE(val, nick) { val, #val, nick },
@@ -151,6 +155,7 @@ typedef struct {
 	ChimeSyncState contacts_sync;
 	GSList *contacts_needed;
 	guint contacts_src_id;
+	GQueue contacts_lru;	/* Non-buddies with presence subscriptions */
 
 	/* Rooms */
 	ChimeObjectCollection rooms;
@@ -258,7 +263,8 @@ ChimeConnection *chime_call_get_connection(ChimeCall *self);
 void chime_connection_close_call(ChimeConnection *cxn, ChimeCall *call);
 void chime_connection_open_call(ChimeConnection *cxn, ChimeCall *call, gboolean silent);
 
-gboolean chime_call_participant_audio_stats(ChimeCall *call, const gchar *profile_id, int vol, int signal_strength);
+void chime_call_participant_audio_stats(ChimeCall *call, const gchar *profile_id, int vol, int signal_strength);
+void chime_call_set_audio_stats(ChimeCall *call, const ChimeCallAudioStats *stats);
 
 
 /* chime-login.c */
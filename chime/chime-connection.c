@@ -268,7 +268,7 @@ chime_connection_class_init(ChimeConnectionClass *klass)
 	signals[ROOM_MENTION] =
 		g_signal_new ("room-mention",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
-			      0, NULL, NULL, NULL, G_TYPE_NONE, 2, CHIME_TYPE_ROOM, JSON_TYPE_NODE);
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 2, CHIME_TYPE_ROOM, CHIME_TYPE_MESSAGE);
 
 	signals[NEW_CONVERSATION] =
 		g_signal_new ("new-conversation",
@@ -1050,7 +1050,11 @@ static void send_message_cb(ChimeConnection *self, SoupMessage *msg,
 		JsonNode *msg_node = json_object_get_member(obj, "Message");
 
 		if (msg_node) {
-			g_signal_emit_by_name(CHIME_OBJECT(g_task_get_task_data(task)), "message", msg_node);
+			ChimeMessage *cmsg = chime_message_new_from_node(msg_node);
+			if (cmsg) {
+				g_signal_emit_by_name(CHIME_OBJECT(g_task_get_task_data(task)), "message", cmsg);
+				chime_message_unref(cmsg);
+			}
 			g_task_return_pointer(task, json_node_ref(msg_node), (GDestroyNotify)json_node_unref);
 		} else
 			g_task_return_new_error(task, CHIME_ERROR,
@@ -1190,9 +1194,11 @@ static void fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
 
 		for (i = 0; i < len; i++) {
 			JsonNode *msg_node = json_array_get_element(msgs_array, i);
-			const gchar *id;
-			if (parse_string(msg_node, "MessageId", &id))
-				g_signal_emit_by_name(fmd->obj, "message", msg_node);
+			ChimeMessage *cmsg = chime_message_new_from_node(msg_node);
+			if (cmsg) {
+				g_signal_emit_by_name(fmd->obj, "message", cmsg);
+				chime_message_unref(cmsg);
+			}
 		}
 
 		const gchar *next_token;
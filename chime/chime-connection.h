@@ -22,6 +22,8 @@
 #include <libsoup/soup.h>
 #include <json-glib/json-glib.h>
 
+#include "chime-message.h"
+
 G_BEGIN_DECLS
 
 #define CHIME_TYPE_CONNECTION (chime_connection_get_type ())
@@ -22,6 +22,11 @@
 
 #include <glib/gi18n.h>
 
+/* How many people who aren't in our contacts list we'll track the presence
+ * of at any given time. Anyone beyond that who hasn't been looked at for a
+ * while gets unsubscribed, and resubscribed if they're wanted again. */
+#define CONTACTS_LRU_MAX 256
+
 enum
 {
 	PROP_0,
@@ -40,6 +45,7 @@ struct _ChimeContact {
 
 	gboolean subscribed;
 	ChimeConnection *cxn; /* For unsubscribing from jugg channels */
+	GList *lru_link; /* In priv->contacts_lru, if not a buddy */
 
 	gchar *presence_channel;
 	gchar *profile_channel;
@@ -77,6 +83,7 @@ const gchar *chime_availability_name(ChimeAvailability av)
 }
 
 static void unsubscribe_contact(gpointer key, gpointer val, gpointer data);
+static void touch_contact(ChimeConnection *cxn, ChimeContact *contact);
 static void subscribe_contact(ChimeConnection *cxn, ChimeContact *contact);
 
 static void
@@ -260,8 +267,8 @@ ChimeAvailability chime_contact_get_availability(ChimeContact *contact)
 {
 	g_return_val_if_fail(CHIME_IS_CONTACT(contact), CHIME_AVAILABILITY_UNKNOWN);
 
-	if (!contact->subscribed)
-		subscribe_contact(contact->cxn, contact);
+	if (contact->cxn)
+		touch_contact(contact->cxn, contact);
 
 	return contact->availability;
 }
@@ -279,6 +286,7 @@ subscribe_contact(ChimeConnection *cxn, ChimeContact *contact)
 	ChimeConnectionPrivate *priv = chime_connection_get_private(cxn);
 
 	contact->cxn = cxn;
+	contact->subscribed = TRUE;
 
 	if (contact->presence_channel)
 		chime_jugg_subscribe(cxn, contact->presence_channel, "Presence",
@@ -291,6 +299,61 @@ subscribe_contact(ChimeConnection *cxn, ChimeContact *contact)
 		priv->contacts_src_id = g_idle_add(fetch_presences, g_object_ref(cxn));
 }
 
+static void unsubscribe_presence(ChimeConnection *cxn, ChimeContact *contact)
+{
+	ChimeConnectionPrivate *priv = chime_connection_get_private(cxn);
+
+	priv->contacts_needed = g_slist_remove(priv->contacts_needed, contact);
+
+	if (contact->lru_link) {
+		g_queue_delete_link(&priv->contacts_lru, contact->lru_link);
+		contact->lru_link = NULL;
+	}
+
+	if (contact->subscribed) {
+		if (contact->presence_channel)
+			chime_jugg_unsubscribe(cxn, contact->presence_channel, "Presence",
+					       contact_presence_jugg_cb, contact);
+		contact->subscribed = FALSE;
+		/* So that fetch_presences() will ask again if we resubscribe */
+		contact->avail_revision = 0;
+	}
+}
+
+/* Called whenever someone is interested in the contact's presence. */
+static void touch_contact(ChimeConnection *cxn, ChimeContact *contact)
+{
+	ChimeConnectionPrivate *priv = chime_connection_get_private(cxn);
+
+	if (!contact->subscribed)
+		subscribe_contact(cxn, contact);
+
+	/* Buddies remain subscribed for as long as they're buddies. */
+	if (!chime_object_is_dead(CHIME_OBJECT(contact))) {
+		if (contact->lru_link) {
+			g_queue_delete_link(&priv->contacts_lru, contact->lru_link);
+			contact->lru_link = NULL;
+		}
+		return;
+	}
+
+	if (contact->lru_link) {
+		g_queue_unlink(&priv->contacts_lru, contact->lru_link);
+		g_queue_push_head_link(&priv->contacts_lru, contact->lru_link);
+	} else {
+		g_queue_push_head(&priv->contacts_lru, contact);
+		contact->lru_link = priv->contacts_lru.head;
+	}
+
+	while (priv->contacts_lru.length > CONTACTS_LRU_MAX) {
+		ChimeContact *old = g_queue_peek_tail(&priv->contacts_lru);
+
+		chime_debug("Dropping presence subscription for %s\n",
+			    chime_contact_get_email(old));
+		unsubscribe_presence(cxn, old);
+	}
+}
+
 static ChimeContact *find_or_create_contact(ChimeConnection *cxn, const gchar *id,
 					    const gchar *presence_channel,
 					    const gchar *profile_channel,
@@ -603,6 +666,7 @@ void chime_init_contacts(ChimeConnection *cxn)
 	ChimeConnectionPrivate *priv = chime_connection_get_private (cxn);
 
 	chime_object_collection_init(cxn, &priv->contacts);
+	g_queue_init(&priv->contacts_lru);
 
 	fetch_contacts(cxn, NULL);
 }
@@ -611,15 +675,7 @@ static void unsubscribe_contact(gpointer key, gpointer val, gpointer data)
 {
 	ChimeContact *contact = CHIME_CONTACT (val);
 	if (contact->cxn) {
-		ChimeConnectionPrivate *priv = chime_connection_get_private (contact->cxn);
-
-		priv->contacts_needed = g_slist_remove(priv->contacts_needed,
-						       contact);
-
-		if (contact->subscribed)
-			chime_jugg_unsubscribe(contact->cxn, contact->presence_channel, "Presence",
-					       contact_presence_jugg_cb, contact);
-
+		unsubscribe_presence(contact->cxn, contact);
 		contact->cxn = NULL;
 	}
 }
@@ -639,6 +695,7 @@ void chime_destroy_contacts(ChimeConnection *cxn)
 	}
 	if (priv->contacts.by_id)
 		g_hash_table_foreach(priv->contacts.by_id, unsubscribe_contact, NULL);
+	g_queue_clear(&priv->contacts_lru);
 
 	chime_object_collection_destroy(&priv->contacts);
 }
@@ -200,7 +200,7 @@ static void chime_conversation_class_init(ChimeConversationClass *klass)
 	signals[MESSAGE] =
 		g_signal_new ("message",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
-			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, JSON_TYPE_NODE);
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, CHIME_TYPE_MESSAGE);
 
 	signals[MEMBERSHIP] =
 		g_signal_new ("membership",
@@ -625,11 +625,12 @@ static gboolean conv_msg_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNod
 		return FALSE;
 	}
 
-	const gchar *id;
-	if (!parse_string(record, "MessageId", &id))
+	ChimeMessage *msg = chime_message_new_from_node(record);
+	if (!msg)
 		return FALSE;
 
-	g_signal_emit(conv, signals[MESSAGE], 0, record);
+	g_signal_emit(conv, signals[MESSAGE], 0, msg);
+	chime_message_unref(msg);
 	return TRUE;
 }
 
@@ -643,11 +644,25 @@ static gboolean conv_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *d
 	return !!chime_connection_parse_conversation(cxn, record, NULL);
 }
 
+/* Most recently updated first */
+static gint compare_conv_updated(gconstpointer _a, gconstpointer _b, gpointer _unused)
+{
+	ChimeConversation *a = CHIME_CONVERSATION(_a);
+	ChimeConversation *b = CHIME_CONVERSATION(_b);
+	gint ret = g_strcmp0(b->updated_on, a->updated_on);
+
+	if (!ret)
+		ret = g_strcmp0(chime_object_get_id(CHIME_OBJECT(a)),
+				chime_object_get_id(CHIME_OBJECT(b)));
+	return ret;
+}
+
 void chime_init_conversations(ChimeConnection *cxn)
 {
 	ChimeConnectionPrivate *priv = chime_connection_get_private (cxn);
 
 	chime_object_collection_init(cxn, &priv->conversations);
+	chime_object_collection_set_order(&priv->conversations, compare_conv_updated);
 
 	chime_jugg_subscribe(cxn, priv->device_channel, "Conversation",
 			     conv_jugg_cb, NULL);
@@ -717,6 +732,16 @@ void chime_connection_foreach_conversation(ChimeConnection *cxn, ChimeConversati
 	chime_object_collection_foreach_object(cxn, &priv->conversations, (ChimeObjectCB)cb, cbdata);
 }
 
+void chime_connection_foreach_recent_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
+						  gpointer cbdata)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(cxn));
+
+	ChimeConnectionPrivate *priv = chime_connection_get_private(cxn);
+
+	chime_object_collection_foreach_ordered(cxn, &priv->conversations, (ChimeObjectCB)cb, cbdata);
+}
+
 void chime_conversation_send_typing(ChimeConnection *cxn, ChimeConversation *conv,
 				    gboolean typing)
 {
@@ -56,6 +56,9 @@ ChimeConversation *chime_connection_conversation_by_id(ChimeConnection *cxn,
 typedef void (*ChimeConversationCB) (ChimeConnection *, ChimeConversation *, gpointer);
 void chime_connection_foreach_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
 				   gpointer cbdata);
+/* As above, but most recently updated first */
+void chime_connection_foreach_recent_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
+						  gpointer cbdata);
 
 void chime_conversation_send_typing(ChimeConnection *cxn, ChimeConversation *conv,
 				    gboolean typing);
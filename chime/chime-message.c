@@ -0,0 +1,133 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "chime-connection-private.h"
+#include "chime-message.h"
+
+G_DEFINE_BOXED_TYPE(ChimeMessage, chime_message,
+		    chime_message_ref, chime_message_unref)
+
+static const gchar *opt_string(JsonNode *node, const gchar *member)
+{
+	const gchar *str;
+
+	if (node && !json_node_is_null(node) && parse_string(node, member, &str))
+		return str;
+	return NULL;
+}
+
+static gsize str_space(const gchar *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+static const gchar *copy_str(gchar **p, const gchar *str)
+{
+	gsize len;
+	gchar *ret = *p;
+
+	if (!str)
+		return NULL;
+
+	len = strlen(str) + 1;
+	memcpy(ret, str, len);
+	*p += len;
+	return ret;
+}
+
+ChimeMessage *chime_message_new_from_node(JsonNode *node)
+{
+	const gchar *id, *created_on, *updated_on, *sender, *content;
+	const gchar *filename = NULL, *url = NULL, *content_type = NULL;
+	gint64 created_ms, updated_ms, sys = 0;
+	JsonNode *att_node = NULL;
+	ChimeMessage *msg;
+	gsize len;
+	gchar *p;
+
+	g_return_val_if_fail(node != NULL, NULL);
+
+	if (!parse_string(node, "MessageId", &id) ||
+	    !parse_string(node, "CreatedOn", &created_on) ||
+	    !iso8601_to_ms(created_on, &created_ms))
+		return NULL;
+
+	updated_on = opt_string(node, "UpdatedOn");
+	if (!updated_on || !iso8601_to_ms(updated_on, &updated_ms))
+		updated_ms = created_ms;
+
+	sender = opt_string(node, "Sender");
+	content = opt_string(node, "Content");
+	parse_int(node, "IsSystemMessage", &sys);
+
+	att_node = json_object_get_member(json_node_get_object(node), "Attachment");
+	if (att_node && !json_node_is_null(att_node)) {
+		filename = opt_string(att_node, "FileName");
+		url = opt_string(att_node, "Url");
+		content_type = opt_string(att_node, "ContentType");
+		if (!filename || !url || !content_type)
+			att_node = NULL;
+	} else
+		att_node = NULL;
+
+	/* One allocation for the structure and everything it points to. */
+	len = sizeof(*msg) + str_space(id) + str_space(created_on) +
+		str_space(content);
+	if (att_node)
+		len += sizeof(ChimeMessageAttachment) + str_space(filename) +
+			str_space(url) + str_space(content_type);
+
+	msg = g_malloc(len);
+	p = (gchar *)(msg + 1);
+
+	msg->ref_count = 1;
+	msg->created_ms = created_ms;
+	msg->updated_ms = updated_ms;
+	msg->is_system = !!sys;
+	msg->sender = sender ? g_intern_string(sender) : NULL;
+
+	if (att_node) {
+		msg->attachment = (ChimeMessageAttachment *)p;
+		p += sizeof(ChimeMessageAttachment);
+		msg->attachment->filename = copy_str(&p, filename);
+		msg->attachment->url = copy_str(&p, url);
+		msg->attachment->content_type = copy_str(&p, content_type);
+	} else
+		msg->attachment = NULL;
+
+	msg->id = copy_str(&p, id);
+	msg->created_on = copy_str(&p, created_on);
+	msg->content = copy_str(&p, content);
+
+	return msg;
+}
+
+ChimeMessage *chime_message_ref(ChimeMessage *msg)
+{
+	g_return_val_if_fail(msg != NULL, NULL);
+
+	g_atomic_int_inc(&msg->ref_count);
+	return msg;
+}
+
+void chime_message_unref(ChimeMessage *msg)
+{
+	g_return_if_fail(msg != NULL);
+
+	if (g_atomic_int_dec_and_test(&msg->ref_count))
+		g_free(msg);
+}
@@ -0,0 +1,62 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef __CHIME_MESSAGE_H__
+#define __CHIME_MESSAGE_H__
+
+#include <glib-object.h>
+
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	const gchar *filename;
+	const gchar *url; /* Valid for 1 hour */
+	const gchar *content_type;
+} ChimeMessageAttachment;
+
+/*
+ * A room or conversation message, parsed once from the JSON record as it
+ * arrives and then passed around by reference. All the strings live in
+ * the same allocation as the structure itself, except for the sender
+ * which is interned since the same few profile IDs recur constantly.
+ */
+typedef struct {
+	/*< private >*/
+	gint ref_count;
+
+	/*< public >*/
+	const gchar *id;
+	const gchar *sender;		/* Profile ID; NULL if absent */
+	const gchar *created_on;	/* ISO8601, as sent by the server */
+	gint64 created_ms;
+	gint64 updated_ms;		/* == created_ms if never edited */
+	const gchar *content;		/* NULL for e.g. attachment uploads */
+	gboolean is_system;
+	ChimeMessageAttachment *attachment;
+} ChimeMessage;
+
+#define CHIME_TYPE_MESSAGE (chime_message_get_type ())
+GType chime_message_get_type (void) G_GNUC_CONST;
+
+/* Returns NULL unless the record has at least MessageId and CreatedOn */
+ChimeMessage *chime_message_new_from_node(JsonNode *node);
+ChimeMessage *chime_message_ref(ChimeMessage *msg);
+void chime_message_unref(ChimeMessage *msg);
+
+G_END_DECLS
+
+#endif /* __CHIME_MESSAGE_H__ */
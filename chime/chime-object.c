@@ -37,7 +37,11 @@ typedef struct {
 	 * hash table in its ->dispose()  */
 	gboolean is_dead;
 	ChimeObjectCollection *collection;
+	GSequenceIter *order_iter;
 	ChimeConnection *cxn;
+
+	/* Chains objects to be killed by chime_object_collection_expire_outdated() */
+	ChimeObject *expire_next;
 } ChimeObjectPrivate;
 
 enum
@@ -72,6 +76,10 @@ chime_object_dispose(GObject *object)
 		g_hash_table_remove(priv->collection->by_name, priv->name);
 		g_hash_table_remove(priv->collection->by_id, priv->id);
 	}
+	if (priv->order_iter) {
+		g_sequence_remove(priv->order_iter);
+		priv->order_iter = NULL;
+	}
 
 	chime_debug("Object disposed: %p\n", self);
 
@@ -277,6 +285,15 @@ void chime_object_collection_hash_object(ChimeObjectCollection *collection, Chim
 		g_hash_table_insert(collection->by_name, priv->name, object);
 	}
 
+	/* The caller has just updated whatever the order depends on */
+	if (collection->ordered) {
+		if (priv->order_iter)
+			g_sequence_sort_changed(priv->order_iter, collection->order_cmp, NULL);
+		else
+			priv->order_iter = g_sequence_insert_sorted(collection->ordered, object,
+								    collection->order_cmp, NULL);
+	}
+
 	if (live && priv->is_dead) {
 		g_object_ref(object);
 		priv->is_dead = FALSE;
@@ -290,19 +307,37 @@ void chime_object_collection_hash_object(ChimeObjectCollection *collection, Chim
 
 void chime_object_collection_expire_outdated(ChimeObjectCollection *coll)
 {
-	GList *objects = g_hash_table_get_values(coll->by_id);
-	while (objects) {
-		ChimeObject *object = CHIME_OBJECT(objects->data);
+	ChimeObject *expired = NULL;
+	GHashTableIter iter;
+	gpointer value;
+
+	/* Dropping the last ref removes the object from the hash table in
+	 * its dispose(), which would invalidate the iterator. So just chain
+	 * the victims together in place and kill them afterwards. */
+	g_hash_table_iter_init(&iter, coll->by_id);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		ChimeObject *object = CHIME_OBJECT(value);
 		ChimeObjectPrivate *priv;
 
 		priv = chime_object_get_instance_private (object);
 
 		if (!priv->is_dead && priv->generation != coll->generation) {
-			priv->is_dead = TRUE;
-			g_object_notify(G_OBJECT(object), "dead");
-			g_object_unref(object);
+			priv->expire_next = expired;
+			expired = object;
 		}
-		objects = g_list_remove(objects, object);
+	}
+
+	while (expired) {
+		ChimeObject *object = expired;
+		ChimeObjectPrivate *priv;
+
+		priv = chime_object_get_instance_private (object);
+		expired = priv->expire_next;
+		priv->expire_next = NULL;
+
+		priv->is_dead = TRUE;
+		g_object_notify(G_OBJECT(object), "dead");
+		g_object_unref(object);
 	}
 }
 
@@ -315,6 +350,10 @@ static void unhash_object(gpointer _object)
 
 	/* Now it's unhashed, it doesn't need to unhash itself on dispose() */
 	priv->collection = NULL;
+	if (priv->order_iter) {
+		g_sequence_remove(priv->order_iter);
+		priv->order_iter = NULL;
+	}
 
 	if (!priv->is_dead) {
 		priv->is_dead = TRUE;
@@ -327,6 +366,8 @@ void chime_object_collection_init(ChimeConnection *cxn, ChimeObjectCollection *c
 	coll->by_id = g_hash_table_new_full(g_str_hash, g_str_equal,
 						    NULL, unhash_object);
 	coll->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+	coll->ordered = NULL;
+	coll->order_cmp = NULL;
 	coll->generation = 0;
 	coll->cxn = cxn;
 }
@@ -334,7 +375,19 @@ void chime_object_collection_init(ChimeConnection *cxn, ChimeObjectCollection *c
 void chime_object_collection_destroy(ChimeObjectCollection *coll)
 {
 	g_clear_pointer(&coll->by_name, g_hash_table_unref);
+	/* Unhashing removes each object from ->ordered too */
 	g_clear_pointer(&coll->by_id, g_hash_table_unref);
+	g_clear_pointer(&coll->ordered, g_sequence_free);
+}
+
+/* Must be called before any objects are hashed into the collection. */
+void chime_object_collection_set_order(ChimeObjectCollection *coll, GCompareDataFunc cmp)
+{
+	g_return_if_fail(!coll->ordered);
+	g_return_if_fail(!g_hash_table_size(coll->by_id));
+
+	coll->ordered = g_sequence_new(NULL);
+	coll->order_cmp = cmp;
 }
 
 struct foreach_object_st {
@@ -367,3 +420,25 @@ void chime_object_collection_foreach_object(ChimeConnection *cxn, ChimeObjectCol
 	if (coll->by_id)
 		g_hash_table_foreach(coll->by_id, foreach_object_cb, &data);
 }
+
+void chime_object_collection_foreach_ordered(ChimeConnection *cxn, ChimeObjectCollection *coll,
+					     ChimeObjectCB cb, gpointer cbdata)
+{
+	GSequenceIter *iter;
+
+	if (!coll->ordered) {
+		chime_object_collection_foreach_object(cxn, coll, cb, cbdata);
+		return;
+	}
+
+	for (iter = g_sequence_get_begin_iter(coll->ordered);
+	     !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+		ChimeObject *object = g_sequence_get(iter);
+		ChimeObjectPrivate *priv;
+
+		priv = chime_object_get_instance_private (object);
+
+		if (!priv->is_dead)
+			cb(cxn, object, cbdata);
+	}
+}
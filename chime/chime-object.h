@@ -32,6 +32,10 @@ G_DECLARE_DERIVABLE_TYPE (ChimeObject, chime_object, CHIME, OBJECT, GObject)
 typedef struct {
 	GHashTable *by_id;
 	GHashTable *by_name;
+	/* Optional secondary index, kept sorted by ->order_cmp as objects
+	 * are (re)hashed. See chime_object_collection_set_order(). */
+	GSequence *ordered;
+	GCompareDataFunc order_cmp;
 	gint64 generation;
 	ChimeConnection *cxn;
 } ChimeObjectCollection;
@@ -65,6 +69,10 @@ void chime_object_collection_foreach_object(ChimeConnection *cxn, ChimeObjectCol
 
 void chime_object_collection_expire_outdated(ChimeObjectCollection *coll);
 
+void chime_object_collection_set_order(ChimeObjectCollection *coll, GCompareDataFunc cmp);
+void chime_object_collection_foreach_ordered(ChimeConnection *cxn, ChimeObjectCollection *coll,
+					     ChimeObjectCB cb, gpointer cbdata);
+
 void             chime_connection_send_message_async         (ChimeConnection    *self,
                                                               ChimeObject        *obj,
                                                               const gchar        *message,
@@ -245,7 +245,7 @@ static void chime_room_class_init(ChimeRoomClass *klass)
 	signals[MESSAGE] =
 		g_signal_new ("message",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
-			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, JSON_TYPE_NODE);
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, CHIME_TYPE_MESSAGE);
 
 	signals[MEMBERSHIP] =
 		g_signal_new ("membership",
@@ -574,11 +574,12 @@ static gboolean room_msg_jugg_cb(ChimeConnection *cxn, gpointer _room, JsonNode
 	if (!record)
 		return FALSE;
 
-	const gchar *id;
-	if (!parse_string(record, "MessageId", &id))
+	ChimeMessage *msg = chime_message_new_from_node(record);
+	if (!msg)
 		return FALSE;
 
-	g_signal_emit(room, signals[MESSAGE], 0, record);
+	g_signal_emit(room, signals[MESSAGE], 0, msg);
+	chime_message_unref(msg);
 	return TRUE;
 }
 
@@ -623,7 +624,12 @@ static gboolean demux_room_msg_jugg_cb(ChimeConnection *cxn, gpointer _room, Jso
 	if (room->opens)
 		return room_msg_jugg_cb(cxn, room, data_node);
 
-	g_signal_emit_by_name(cxn, "room-mention", room, record);
+	ChimeMessage *msg = chime_message_new_from_node(record);
+	if (!msg)
+		return FALSE;
+
+	g_signal_emit_by_name(cxn, "room-mention", room, msg);
+	chime_message_unref(msg);
 	return TRUE;
 }
 
@@ -129,6 +129,7 @@ struct _ChimeWebsocketConnectionPrivate {
 	GPollableOutputStream *output;
 	GSource *output_source;
 	GQueue outgoing;
+	guint outgoing_bytes;	/* Queued but not yet written; atomic */
 
 	/* Current message being assembled */
 	guint8 message_opcode;
@@ -963,6 +964,7 @@ on_web_socket_output (GObject *pollable_stream,
 	}
 
 	frame->sent += count;
+	g_atomic_int_add (&pv->outgoing_bytes, -(gint) count);
 	if (frame->sent >= len) {
 		g_debug ("sent frame");
 		g_queue_pop_head (&pv->outgoing);
@@ -1015,6 +1017,7 @@ queue_frame (ChimeWebsocketConnection *self,
 	frame->data = g_bytes_new_take (data, len);
 	frame->amount = amount;
 	frame->last = (flags & CHIME_WEBSOCKET_QUEUE_LAST) ? TRUE : FALSE;
+	g_atomic_int_add (&pv->outgoing_bytes, (gint) len);
 
 	/* If urgent put at front of queue */
 	if (flags & CHIME_WEBSOCKET_QUEUE_URGENT) {
@@ -1811,6 +1814,24 @@ chime_websocket_connection_get_keepalive_interval (ChimeWebsocketConnection *sel
 	return pv->keepalive_interval;
 }
 
+/**
+ * chime_websocket_connection_get_buffered_amount:
+ * @self: the WebSocket
+ *
+ * Gets the number of bytes which have been queued to be sent, but
+ * which have not yet been written to the underlying stream.
+ *
+ * Returns: the number of bytes still queued.
+ */
+gsize
+chime_websocket_connection_get_buffered_amount (ChimeWebsocketConnection *self)
+{
+	g_return_val_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self), 0);
+
+	/* Rate control reads this from the streaming thread */
+	return g_atomic_int_get (&self->pv->outgoing_bytes);
+}
+
 static gboolean
 on_queue_ping (gpointer user_data)
 {
@@ -101,6 +101,8 @@ void                chime_websocket_connection_set_max_incoming_payload_size (Ch
 
 guint               chime_websocket_connection_get_keepalive_interval (ChimeWebsocketConnection *self);
 
+gsize               chime_websocket_connection_get_buffered_amount (ChimeWebsocketConnection *self);
+
 void                chime_websocket_connection_set_keepalive_interval (ChimeWebsocketConnection *self,
                                                                       guint                    interval);
 
@@ -32,6 +32,8 @@
 
 #include <json-glib/json-glib.h>
 
+#include "chime-message.h"
+
 struct conv_data {
 	GList *l;
 };
@@ -118,20 +120,13 @@ conv_seen_cb(PurpleConversation *conv, JsonNode *member)
 }
 
 static void
-got_convmsg_cb(PurpleConversation *conv, gboolean outbound, JsonNode *msgnode)
+got_convmsg_cb(PurpleConversation *conv, gboolean outbound, ChimeMessage *msg)
 {
-	const gchar *created_on, *msgid;
-
-	if (!outbound || !parse_string(msgnode, "MessageId", &msgid) ||
-	    !parse_string(msgnode, "CreatedOn", &created_on))
+	if (!outbound)
 		return;
 
 	struct msg_mark *m = g_new0(struct msg_mark, 1);
-
-	if (!iso8601_to_ms(created_on, &m->created)) {
-		g_free(m);
-		return;
-	}
+	m->created = msg->created_ms;
 
 	GtkIMHtml *imhtml = GTK_IMHTML(PIDGIN_CONVERSATION(conv)->imhtml);
 	GtkTextIter end;
@@ -139,7 +134,7 @@ got_convmsg_cb(PurpleConversation *conv, gboolean outbound, JsonNode *msgnode)
 	gtk_text_buffer_get_end_iter(imhtml->text_buffer, &end);
 
 	m->mark = gtk_text_buffer_create_mark(imhtml->text_buffer,
-					      msgid, &end, TRUE);
+					      msg->id, &end, TRUE);
 
 	struct conv_data *cd = purple_conversation_get_data(conv, "chime-seen");
 	if (!cd) {
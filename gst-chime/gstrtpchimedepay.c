@@ -32,6 +32,9 @@
 GST_DEBUG_CATEGORY_STATIC (rtpchimedepay_debug);
 #define GST_CAT_DEFAULT (rtpchimedepay_debug)
 
+/* Chime always sends 20ms frames */
+#define CHIME_FRAME_DURATION (20 * GST_MSECOND)
+
 static GstStaticPadTemplate gst_rtp_chime_depay_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
@@ -163,6 +166,14 @@ gst_rtp_chime_depay_process (GstRTPBaseDepayload * depayload,
 {
   GstBuffer *outbuf;
 
+  /* The jitter buffer plays out a lost frame as an empty one. Give it a
+   * duration, and opusdec will conceal the loss for that long. */
+  if (gst_rtp_buffer_get_payload_len (rtp_buffer) == 0) {
+    outbuf = gst_buffer_new ();
+    GST_BUFFER_DURATION (outbuf) = CHIME_FRAME_DURATION;
+    return outbuf;
+  }
+
   outbuf = gst_rtp_buffer_get_payload_buffer (rtp_buffer);
 
   /* Filter away all metas that are not sensible to copy */
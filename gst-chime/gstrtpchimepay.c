@@ -19,6 +19,16 @@
  * Boston, MA 02110-1301, USA.
  */
 
+/*
+ * Each Opus packet goes out in an RTP packet of its own, behind a header
+ * from a pool of them rather than a newly allocated one.
+ *
+ * If max-ptime is set, frames are repacketized instead: consecutive ones
+ * are combined into packets of up to max-ptime (or the peer's maxptime,
+ * if shorter), and input packets longer than that are split. When one
+ * input packet produces several RTP packets, they are pushed as a list.
+ */
+
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
 #endif
@@ -60,6 +70,76 @@ static GstCaps *gst_rtp_chime_pay_getcaps (GstRTPBasePayload * payload,
     GstPad * pad, GstCaps * filter);
 static GstFlowReturn gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload *
     payload, GstBuffer * buffer);
+static gboolean gst_rtp_chime_pay_sink_event (GstRTPBasePayload * payload,
+    GstEvent * event);
+static GstStateChangeReturn gst_rtp_chime_pay_change_state (GstElement *
+    element, GstStateChange transition);
+static void gst_rtp_chime_pay_finalize (GObject * object);
+static GstFlowReturn gst_rtp_chime_pay_flush (GstRtpCHIMEPay * pay);
+static void gst_rtp_chime_pay_drop_pending (GstRtpCHIMEPay * pay);
+
+/* Opus samples are counted at 48kHz whatever the RTP clock rate */
+#define OPUS_RATE 48000
+#define OPUS_MAX_SAMPLES (OPUS_RATE * 120 / 1000)
+#define OPUS_MAX_FRAME_SIZE 1275
+
+/* TOC, frame count and a length of up to two bytes for all but the last */
+#define OPUS_MAX_HEADER (2 + 2 * (GST_RTP_CHIME_PAY_MAX_FRAMES - 1))
+
+#define RTP_HEADER_LEN 12
+#define HEADER_POOL_SIZE (RTP_HEADER_LEN + OPUS_MAX_HEADER)
+
+/* A pool of buffers with a single memory, big enough for an RTP header
+ * and a repacketized Opus header. The payload appended to each one is
+ * dropped again when it comes back. */
+typedef struct
+{
+  GstBufferPool parent;
+} GstRtpCHIMEHeaderPool;
+
+typedef struct
+{
+  GstBufferPoolClass parent_class;
+} GstRtpCHIMEHeaderPoolClass;
+
+static GType gst_rtp_chime_header_pool_get_type (void);
+
+G_DEFINE_TYPE (GstRtpCHIMEHeaderPool, gst_rtp_chime_header_pool,
+    GST_TYPE_BUFFER_POOL);
+
+static void
+gst_rtp_chime_header_pool_reset_buffer (GstBufferPool * pool,
+    GstBuffer * buffer)
+{
+  gsize maxsize;
+
+  GST_BUFFER_POOL_CLASS (gst_rtp_chime_header_pool_parent_class)->reset_buffer
+      (pool, buffer);
+
+  if (gst_buffer_n_memory (buffer) > 1)
+    gst_buffer_remove_memory_range (buffer, 1, -1);
+
+  /* One whose memory was replaced by something too small keeps the tag,
+   * and the pool discards it */
+  gst_buffer_get_sizes (buffer, NULL, &maxsize);
+  if (maxsize >= HEADER_POOL_SIZE) {
+    gst_buffer_set_size (buffer, HEADER_POOL_SIZE);
+    GST_BUFFER_FLAG_UNSET (buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+  }
+}
+
+static void
+gst_rtp_chime_header_pool_class_init (GstRtpCHIMEHeaderPoolClass * klass)
+{
+  GstBufferPoolClass *pool_class = (GstBufferPoolClass *) klass;
+
+  pool_class->reset_buffer = gst_rtp_chime_header_pool_reset_buffer;
+}
+
+static void
+gst_rtp_chime_header_pool_init (GstRtpCHIMEHeaderPool * pool)
+{
+}
 
 G_DEFINE_TYPE (GstRtpCHIMEPay, gst_rtp_chime_pay, GST_TYPE_RTP_BASE_PAYLOAD);
 
@@ -68,13 +148,20 @@ gst_rtp_chime_pay_class_init (GstRtpCHIMEPayClass * klass)
 {
   GstRTPBasePayloadClass *gstbasertppayload_class;
   GstElementClass *element_class;
+  GObjectClass *gobject_class;
 
   gstbasertppayload_class = (GstRTPBasePayloadClass *) klass;
   element_class = GST_ELEMENT_CLASS (klass);
+  gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_rtp_chime_pay_finalize;
+
+  element_class->change_state = gst_rtp_chime_pay_change_state;
 
   gstbasertppayload_class->set_caps = gst_rtp_chime_pay_setcaps;
   gstbasertppayload_class->get_caps = gst_rtp_chime_pay_getcaps;
   gstbasertppayload_class->handle_buffer = gst_rtp_chime_pay_handle_buffer;
+  gstbasertppayload_class->sink_event = gst_rtp_chime_pay_sink_event;
 
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_rtp_chime_pay_src_template));
@@ -94,6 +181,73 @@ gst_rtp_chime_pay_class_init (GstRtpCHIMEPayClass * klass)
 static void
 gst_rtp_chime_pay_init (GstRtpCHIMEPay * rtpchimepay)
 {
+  rtpchimepay->peer_max_ptime = -1;
+}
+
+static void
+gst_rtp_chime_pay_release_pool (GstRtpCHIMEPay * pay)
+{
+  if (pay->header_pool) {
+    /* Buffers still out there are freed as they come back */
+    gst_buffer_pool_set_active (pay->header_pool, FALSE);
+    gst_object_unref (pay->header_pool);
+    pay->header_pool = NULL;
+  }
+}
+
+static void
+gst_rtp_chime_pay_finalize (GObject * object)
+{
+  GstRtpCHIMEPay *pay = GST_RTP_CHIME_PAY (object);
+
+  gst_rtp_chime_pay_drop_pending (pay);
+  gst_rtp_chime_pay_release_pool (pay);
+
+  G_OBJECT_CLASS (gst_rtp_chime_pay_parent_class)->finalize (object);
+}
+
+static GstStateChangeReturn
+gst_rtp_chime_pay_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstRtpCHIMEPay *pay = GST_RTP_CHIME_PAY (element);
+  GstStateChangeReturn ret;
+
+  ret =
+      GST_ELEMENT_CLASS (gst_rtp_chime_pay_parent_class)->change_state
+      (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_rtp_chime_pay_drop_pending (pay);
+      gst_rtp_chime_pay_release_pool (pay);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_rtp_chime_pay_sink_event (GstRTPBasePayload * payload, GstEvent * event)
+{
+  GstRtpCHIMEPay *pay = GST_RTP_CHIME_PAY (payload);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+      gst_rtp_chime_pay_flush (pay);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      gst_rtp_chime_pay_drop_pending (pay);
+      break;
+    default:
+      break;
+  }
+
+  return
+      GST_RTP_BASE_PAYLOAD_CLASS (gst_rtp_chime_pay_parent_class)->sink_event
+      (payload, event);
 }
 
 static gboolean
@@ -106,7 +260,14 @@ gst_rtp_chime_pay_setcaps (GstRTPBasePayload * payload, GstCaps * caps)
   gint channels, rate;
   const char *sprop_stereo = NULL;
   char *sprop_maxcapturerate = NULL;
+  GstRtpCHIMEPay *pay = GST_RTP_CHIME_PAY (payload);
+  const char *maxptime;
+  gint max_ptime = 0;
+
+  /* Whatever was held back belongs with the old caps */
+  gst_rtp_chime_pay_flush (pay);
 
+  pay->peer_max_ptime = -1;
   src_caps = gst_pad_get_allowed_caps (GST_RTP_BASE_PAYLOAD_SRCPAD (payload));
   if (src_caps) {
     src_caps = gst_caps_make_writable (src_caps);
@@ -114,6 +275,15 @@ gst_rtp_chime_pay_setcaps (GstRTPBasePayload * payload, GstCaps * caps)
     s = gst_caps_get_structure (src_caps, 0);
     gst_structure_fixate_field_string (s, "encoding-name", "CHIME");
     encoding_name = g_strdup (gst_structure_get_string (s, "encoding-name"));
+
+    /* The SDP maxptime, in milliseconds, if the transport has one */
+    maxptime = gst_structure_get_string (s, "maxptime");
+    if (maxptime)
+      max_ptime = g_ascii_strtoll (maxptime, NULL, 10);
+    else
+      gst_structure_get_int (s, "maxptime", &max_ptime);
+    if (max_ptime > 0)
+      pay->peer_max_ptime = max_ptime * GST_MSECOND;
     gst_caps_unref (src_caps);
   } else {
     encoding_name = g_strdup ("CHIME");
@@ -192,20 +362,431 @@ foreach_metadata (GstBuffer * inbuf, GstMeta ** meta, gpointer user_data)
   return TRUE;
 }
 
+/* An RTP packet with @header, @header_len bytes of the payload, after the
+ * RTP header. The payload itself is left to be appended. */
+static GstBuffer *
+gst_rtp_chime_pay_new_packet (GstRtpCHIMEPay * pay, const guint8 * header,
+    guint header_len)
+{
+  GstBuffer *outbuf = NULL;
+  GstStructure *config;
+  GstMapInfo map;
+
+  if (!pay->header_pool) {
+    pay->header_pool = g_object_new (gst_rtp_chime_header_pool_get_type (),
+        NULL);
+    config = gst_buffer_pool_get_config (pay->header_pool);
+    gst_buffer_pool_config_set_params (config, NULL, HEADER_POOL_SIZE, 0, 0);
+    if (!gst_buffer_pool_set_config (pay->header_pool, config) ||
+        !gst_buffer_pool_set_active (pay->header_pool, TRUE))
+      GST_WARNING_OBJECT (pay, "could not set up RTP header pool");
+  }
+
+  if (gst_buffer_pool_acquire_buffer (pay->header_pool, &outbuf,
+          NULL) != GST_FLOW_OK) {
+    /* Not worth failing over */
+    outbuf = gst_rtp_buffer_new_allocate (header_len, 0, 0);
+    if (header_len)
+      gst_buffer_fill (outbuf, RTP_HEADER_LEN, header, header_len);
+    return outbuf;
+  }
+
+  gst_buffer_set_size (outbuf, RTP_HEADER_LEN + header_len);
+  gst_buffer_map (outbuf, &map, GST_MAP_WRITE);
+  /* Version 2, nothing else; the base class fills in the rest */
+  memset (map.data, 0, RTP_HEADER_LEN);
+  map.data[0] = 0x80;
+  if (header_len)
+    memcpy (map.data + RTP_HEADER_LEN, header, header_len);
+  gst_buffer_unmap (outbuf, &map);
+
+  return outbuf;
+}
+
+static GstFlowReturn
+gst_rtp_chime_pay_push (GstRtpCHIMEPay * pay, GstBufferList * list)
+{
+  GstRTPBasePayload *basepayload = GST_RTP_BASE_PAYLOAD (pay);
+  GstBuffer *outbuf;
+
+  switch (gst_buffer_list_length (list)) {
+    case 0:
+      gst_buffer_list_unref (list);
+      return GST_FLOW_OK;
+    case 1:
+      outbuf = gst_buffer_ref (gst_buffer_list_get (list, 0));
+      gst_buffer_list_unref (list);
+      return gst_rtp_base_payload_push (basepayload, outbuf);
+    default:
+      return gst_rtp_base_payload_push_list (basepayload, list);
+  }
+}
+
+/* Bytes taken to code an Opus frame length (RFC 6716, section 3.2.1) */
+static guint
+opus_length_bytes (guint len)
+{
+  return len < 252 ? 1 : 2;
+}
+
+static gint
+opus_read_length (const guint8 * data, gsize size, gsize * pos)
+{
+  guint b0;
+
+  if (*pos >= size)
+    return -1;
+  b0 = data[(*pos)++];
+  if (b0 < 252)
+    return b0;
+  if (*pos >= size)
+    return -1;
+  return b0 + 4 * data[(*pos)++];
+}
+
+static guint8 *
+opus_write_length (guint8 * p, guint len)
+{
+  if (len < 252) {
+    *p++ = len;
+  } else {
+    *p++ = 252 + (len & 3);
+    *p++ = (len - 252) >> 2;
+  }
+  return p;
+}
+
+/* Samples at 48kHz in each frame of a packet with @toc */
+static guint
+opus_frame_samples (guint8 toc)
+{
+  guint config = toc >> 3;
+
+  if (config < 12)              /* SILK: 10, 20, 40, 60ms */
+    return (config & 3) == 3 ? 2880 : 480 << (config & 3);
+  else if (config < 16)         /* Hybrid: 10, 20ms */
+    return 480 << (config & 1);
+  else                          /* CELT: 2.5, 5, 10, 20ms */
+    return 120 << (config & 3);
+}
+
+/* Find the frames in an Opus packet (RFC 6716, section 3.2). Returns how
+ * many there are, or 0 if it's malformed. */
+static guint
+opus_packet_parse (const guint8 * data, gsize size, gsize * offsets,
+    guint16 * sizes)
+{
+  gsize pos = 1, end = size, total = 0;
+  guint i, n;
+  gint len;
+
+  if (size < 1)
+    return 0;
+
+  switch (data[0] & 3) {
+    case 0:
+      n = 1;
+      sizes[0] = end - pos;
+      break;
+    case 1:
+      if ((end - pos) & 1)
+        return 0;
+      n = 2;
+      sizes[0] = sizes[1] = (end - pos) / 2;
+      break;
+    case 2:
+      n = 2;
+      len = opus_read_length (data, end, &pos);
+      if (len < 0 || len > end - pos)
+        return 0;
+      sizes[0] = len;
+      sizes[1] = end - pos - len;
+      break;
+    default:{
+      gboolean vbr, padded;
+      guint pad = 0, b;
+
+      if (pos >= end)
+        return 0;
+      vbr = data[pos] & 0x80;
+      padded = data[pos] & 0x40;
+      n = data[pos++] & 0x3f;
+      if (!n || n > GST_RTP_CHIME_PAY_MAX_FRAMES ||
+          n * opus_frame_samples (data[0]) > OPUS_MAX_SAMPLES)
+        return 0;
+
+      if (padded) {
+        do {
+          if (pos >= end)
+            return 0;
+          b = data[pos++];
+          pad += b == 255 ? 254 : b;
+        } while (b == 255);
+      }
+      if (pad > end - pos)
+        return 0;
+      end -= pad;
+
+      if (vbr) {
+        for (i = 0; i < n - 1; i++) {
+          len = opus_read_length (data, end, &pos);
+          if (len < 0)
+            return 0;
+          sizes[i] = len;
+          total += len;
+        }
+        if (total > end - pos)
+          return 0;
+        sizes[n - 1] = end - pos - total;
+      } else {
+        if ((end - pos) % n)
+          return 0;
+        for (i = 0; i < n; i++)
+          sizes[i] = (end - pos) / n;
+      }
+      break;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    if (sizes[i] > OPUS_MAX_FRAME_SIZE)
+      return 0;
+    offsets[i] = pos;
+    pos += sizes[i];
+  }
+
+  return n;
+}
+
+static void
+gst_rtp_chime_pay_drop_pending (GstRtpCHIMEPay * pay)
+{
+  guint i;
+
+  for (i = 0; i < pay->n_regions; i++)
+    gst_buffer_unref (pay->regions[i].buffer);
+  pay->n_regions = 0;
+  pay->n_pending = 0;
+  pay->pending_samples = 0;
+  pay->pending_bytes = 0;
+  pay->pending_len_bytes = 0;
+}
+
+/* One RTP packet holding all the frames held back, as a single Opus
+ * packet, or NULL if there are none */
+static GstBuffer *
+gst_rtp_chime_pay_take_pending (GstRtpCHIMEPay * pay)
+{
+  guint8 header[OPUS_MAX_HEADER], *p = header;
+  GstBuffer *outbuf;
+  CopyMetaData data;
+  guint i;
+
+  if (!pay->n_pending)
+    return NULL;
+
+  if (pay->n_pending == 1) {
+    *p++ = pay->pending_toc;
+  } else {
+    /* Code 3, VBR, no padding */
+    *p++ = pay->pending_toc | 3;
+    *p++ = 0x80 | pay->n_pending;
+    for (i = 0; i < pay->n_pending - 1; i++)
+      p = opus_write_length (p, pay->pending_sizes[i]);
+  }
+
+  outbuf = gst_rtp_chime_pay_new_packet (pay, header, p - header);
+  data.pay = pay;
+  data.outbuf = outbuf;
+  gst_buffer_foreach_meta (pay->regions[0].buffer, foreach_metadata, &data);
+
+  for (i = 0; i < pay->n_regions; i++)
+    gst_buffer_copy_into (outbuf, pay->regions[i].buffer,
+        GST_BUFFER_COPY_MEMORY, pay->regions[i].offset,
+        pay->regions[i].size);
+
+  GST_BUFFER_PTS (outbuf) = pay->pending_pts;
+  GST_BUFFER_DTS (outbuf) = pay->pending_dts;
+  GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale_int (pay->pending_samples,
+      GST_SECOND, OPUS_RATE);
+
+  GST_LOG_OBJECT (pay, "packed %u frames, %u samples", pay->n_pending,
+      pay->pending_samples);
+
+  gst_rtp_chime_pay_drop_pending (pay);
+  return outbuf;
+}
+
+static GstFlowReturn
+gst_rtp_chime_pay_flush (GstRtpCHIMEPay * pay)
+{
+  GstBuffer *outbuf = gst_rtp_chime_pay_take_pending (pay);
+
+  if (!outbuf)
+    return GST_FLOW_OK;
+
+  return gst_rtp_base_payload_push (GST_RTP_BASE_PAYLOAD (pay), outbuf);
+}
+
+/* Whether a frame of @size bytes and @samples can join those held back,
+ * given that its data would start at @offset into @buffer */
+static gboolean
+gst_rtp_chime_pay_fits (GstRtpCHIMEPay * pay, guint8 toc, guint samples,
+    guint max_samples, GstBuffer * buffer, gsize offset, guint size)
+{
+  GstRtpCHIMEPayRegion *last = &pay->regions[pay->n_regions - 1];
+  guint header_len, packet_len;
+
+  if ((toc & ~3) != pay->pending_toc ||
+      pay->n_pending == GST_RTP_CHIME_PAY_MAX_FRAMES ||
+      pay->pending_samples + samples > max_samples)
+    return FALSE;
+
+  /* Each region is a memory of its own in the packet */
+  if ((last->buffer != buffer || last->offset + last->size != offset) &&
+      pay->n_regions + 1 >= gst_buffer_get_max_memory ())
+    return FALSE;
+
+  header_len = 2 + pay->pending_len_bytes;
+  packet_len = gst_rtp_buffer_calc_packet_len (header_len +
+      pay->pending_bytes + size, 0, 0);
+
+  return packet_len <= GST_RTP_BASE_PAYLOAD_MTU (pay);
+}
+
+static void
+gst_rtp_chime_pay_add_frame (GstRtpCHIMEPay * pay, GstBuffer * buffer,
+    gsize offset, guint size, guint samples)
+{
+  GstRtpCHIMEPayRegion *last = NULL;
+
+  if (pay->n_regions)
+    last = &pay->regions[pay->n_regions - 1];
+
+  if (last && last->buffer == buffer && last->offset + last->size == offset) {
+    last->size += size;
+  } else {
+    last = &pay->regions[pay->n_regions++];
+    last->buffer = gst_buffer_ref (buffer);
+    last->offset = offset;
+    last->size = size;
+  }
+
+  pay->pending_sizes[pay->n_pending++] = size;
+  pay->pending_samples += samples;
+  pay->pending_bytes += size;
+  pay->pending_len_bytes += opus_length_bytes (size);
+}
+
+/* Longest packet to make, in samples */
+static guint
+gst_rtp_chime_pay_max_samples (GstRtpCHIMEPay * pay)
+{
+  gint64 max_ptime = GST_RTP_BASE_PAYLOAD (pay)->max_ptime;
+
+  if (pay->peer_max_ptime > 0 && pay->peer_max_ptime < max_ptime)
+    max_ptime = pay->peer_max_ptime;
+
+  return MIN (gst_util_uint64_scale_int (max_ptime, OPUS_RATE, GST_SECOND),
+      OPUS_MAX_SAMPLES);
+}
+
+/* Repacketize @buffer's frames into packets of up to max-ptime, combined
+ * with those held back from before and leaving any room at the end for
+ * frames still to come */
+static GstFlowReturn
+gst_rtp_chime_pay_pack (GstRtpCHIMEPay * pay, GstBuffer * buffer)
+{
+  gsize offsets[GST_RTP_CHIME_PAY_MAX_FRAMES];
+  guint16 sizes[GST_RTP_CHIME_PAY_MAX_FRAMES];
+  GstClockTime pts, dts, offset;
+  guint i, n, samples, max_samples;
+  GstBufferList *list;
+  GstBuffer *outbuf;
+  CopyMetaData data;
+  GstMapInfo map;
+  guint8 toc = 0;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    gst_buffer_unref (buffer);
+    return GST_FLOW_ERROR;
+  }
+  n = opus_packet_parse (map.data, map.size, offsets, sizes);
+  if (n)
+    toc = map.data[0];
+  gst_buffer_unmap (buffer, &map);
+
+  pts = GST_BUFFER_PTS (buffer);
+  dts = GST_BUFFER_DTS (buffer);
+  max_samples = gst_rtp_chime_pay_max_samples (pay);
+  samples = n ? opus_frame_samples (toc) : 0;
+  list = gst_buffer_list_new ();
+
+  if (!n)
+    GST_WARNING_OBJECT (pay, "malformed Opus packet; sending it as it is");
+
+  for (i = 0; i < n; i++) {
+    if (pay->n_pending && !gst_rtp_chime_pay_fits (pay, toc, samples,
+            max_samples, buffer, offsets[i], sizes[i])) {
+      outbuf = gst_rtp_chime_pay_take_pending (pay);
+      gst_buffer_list_add (list, outbuf);
+    }
+
+    if (!pay->n_pending) {
+      offset = gst_util_uint64_scale_int (i * samples, GST_SECOND, OPUS_RATE);
+      pay->pending_toc = toc & ~3;
+      pay->pending_pts = GST_CLOCK_TIME_IS_VALID (pts) ? pts + offset : pts;
+      pay->pending_dts = GST_CLOCK_TIME_IS_VALID (dts) ? dts + offset : dts;
+    }
+    gst_rtp_chime_pay_add_frame (pay, buffer, offsets[i], sizes[i], samples);
+
+    /* Don't hold on to a packet with no room for another frame */
+    if (pay->pending_samples + samples > max_samples) {
+      outbuf = gst_rtp_chime_pay_take_pending (pay);
+      gst_buffer_list_add (list, outbuf);
+    }
+  }
+
+  if (!n) {
+    outbuf = gst_rtp_chime_pay_take_pending (pay);
+    if (outbuf)
+      gst_buffer_list_add (list, outbuf);
+    outbuf = gst_rtp_chime_pay_new_packet (pay, NULL, 0);
+    data.pay = pay;
+    data.outbuf = outbuf;
+    gst_buffer_foreach_meta (buffer, foreach_metadata, &data);
+    gst_buffer_copy_into (outbuf, buffer, GST_BUFFER_COPY_MEMORY |
+        GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+    gst_buffer_list_add (list, outbuf);
+  }
+
+  gst_buffer_unref (buffer);
+
+  return gst_rtp_chime_pay_push (pay, list);
+}
+
 static GstFlowReturn
 gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload * basepayload,
     GstBuffer * buffer)
 {
+  GstRtpCHIMEPay *pay = GST_RTP_CHIME_PAY (basepayload);
   GstBuffer *outbuf;
   GstClockTime pts, dts, duration;
   CopyMetaData data;
 
+  if (basepayload->max_ptime > 0)
+    return gst_rtp_chime_pay_pack (pay, buffer);
+
+  /* max-ptime was unset since */
+  if (pay->n_pending)
+    gst_rtp_chime_pay_flush (pay);
+
   pts = GST_BUFFER_PTS (buffer);
   dts = GST_BUFFER_DTS (buffer);
   duration = GST_BUFFER_DURATION (buffer);
 
-  outbuf = gst_rtp_buffer_new_allocate (0, 0, 0);
-  data.pay = GST_RTP_CHIME_PAY (basepayload);
+  outbuf = gst_rtp_chime_pay_new_packet (pay, NULL, 0);
+  data.pay = pay;
   data.outbuf = outbuf;
   gst_buffer_foreach_meta (buffer, foreach_metadata, &data);
   outbuf = gst_buffer_append (outbuf, buffer);
@@ -41,9 +41,38 @@ G_BEGIN_DECLS
 typedef struct _GstRtpCHIMEPay GstRtpCHIMEPay;
 typedef struct _GstRtpCHIMEPayClass GstRtpCHIMEPayClass;
 
+/* An Opus packet holds at most 48 frames (RFC 6716, section 3.2.5) */
+#define GST_RTP_CHIME_PAY_MAX_FRAMES 48
+
+typedef struct
+{
+  GstBuffer *buffer;
+  gsize offset;
+  gsize size;
+} GstRtpCHIMEPayRegion;
+
 struct _GstRtpCHIMEPay
 {
   GstRTPBasePayload payload;
+
+  /* Buffers holding just an RTP header, recycled once sent */
+  GstBufferPool *header_pool;
+
+  /* Largest packet duration the peer asked for, or -1 */
+  gint64 peer_max_ptime;
+
+  /* Opus frames waiting to be sent together, when max-ptime is set. Their
+   * data is in @regions, which are contiguous where the input was. */
+  guint8 pending_toc;
+  guint n_pending;
+  guint16 pending_sizes[GST_RTP_CHIME_PAY_MAX_FRAMES];
+  guint pending_samples;
+  gsize pending_bytes;
+  guint pending_len_bytes;
+  GstClockTime pending_pts;
+  GstClockTime pending_dts;
+  guint n_regions;
+  GstRtpCHIMEPayRegion regions[GST_RTP_CHIME_PAY_MAX_FRAMES];
 };
 
 struct _GstRtpCHIMEPayClass
@@ -28,6 +28,14 @@
  * available to also capture your mouse pointer.  By default it will fixate to
  * 25 frames per second.
  *
+ * When built with xcb-shm, capture goes through XCB directly, into SHM
+ * segments (memfd where the server supports it), without Xlib.
+ *
+ * Where the screen has 8 bits per channel, it also offers I420 and NV12,
+ * ahead of its own format, converting only what changed since the last
+ * frame. Setting #GstXcbImageSrc:downscale shrinks the picture on the way,
+ * and then only those formats are offered.
+ *
  * ## Example pipelines
  * |[
  * gst-launch-1.0 xcbimagesrc ! video/x-raw,framerate=5/1 ! videoconvert ! theoraenc ! oggmux ! filesink location=desktop.ogg
@@ -39,6 +47,9 @@
 #include "config.h"
 #endif
 #include "gstxcbimagesrc.h"
+#include "xcbcapture.h"
+#include "xcbconvert.h"
+#include "xcbimagepool.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -57,7 +68,7 @@
 
 //#include "gst/glib-compat-private.h"
 
-GST_DEBUG_CATEGORY_STATIC (gst_debug_xcbimage_src);
+GST_DEBUG_CATEGORY (gst_debug_xcbimage_src);
 #define GST_CAT_DEFAULT gst_debug_xcbimage_src
 
 static GstStaticPadTemplate t =
@@ -80,44 +91,17 @@ enum
   PROP_REMOTE,
   PROP_XID,
   PROP_XNAME,
+  PROP_DROP_UNCHANGED,
+  PROP_CAPTURE_AHEAD,
+  PROP_DOWNSCALE,
 };
 
 #define gst_xcbimage_src_parent_class parent_class
 G_DEFINE_TYPE (GstXcbImageSrc, gst_xcbimage_src, GST_TYPE_PUSH_SRC);
 
 static GstCaps *gst_xcbimage_src_fixate (GstBaseSrc * bsrc, GstCaps * caps);
-static void gst_xcbimage_src_clear_bufpool (GstXcbImageSrc * xcbimagesrc);
-
-/* Called when a buffer is returned from the pipeline */
-static gboolean
-gst_xcbimage_src_return_buf (GstXcbImageSrc * xcbimagesrc, GstBuffer * xcbimage)
-{
-  GstMetaXcbImage *meta = GST_META_XCBIMAGE_GET (xcbimage);
-  /* True will make dispose free the buffer, while false will keep it */
-  gboolean ret = TRUE;
-
-  /* If our geometry changed we can't reuse that image. */
-  if ((meta->width != xcbimagesrc->width) || (meta->height != xcbimagesrc->height)) {
-    GST_DEBUG_OBJECT (xcbimagesrc,
-        "destroy image %p as its size changed %dx%d vs current %dx%d",
-        xcbimage, meta->width, meta->height, xcbimagesrc->width, xcbimagesrc->height);
-    g_mutex_lock (&xcbimagesrc->x_lock);
-    gst_xcbimageutil_xcbimage_destroy (xcbimagesrc->xcontext, xcbimage);
-    g_mutex_unlock (&xcbimagesrc->x_lock);
-  } else {
-    /* In that case we can reuse the image and add it to our image pool. */
-    GST_LOG_OBJECT (xcbimagesrc, "recycling image %p in pool", xcbimage);
-    /* need to increment the refcount again to recycle */
-    gst_buffer_ref (xcbimage);
-    g_mutex_lock (&xcbimagesrc->pool_lock);
-    GST_BUFFER_FLAGS (GST_BUFFER (xcbimage)) = 0; /* clear out any flags from the previous use */
-    xcbimagesrc->buffer_pool = g_slist_prepend (xcbimagesrc->buffer_pool, xcbimage);
-    g_mutex_unlock (&xcbimagesrc->pool_lock);
-    ret = FALSE;
-  }
-
-  return ret;
-}
+static void gst_xcbimage_src_stop_capture_thread (GstXcbImageSrc * s);
+static void gst_xcbimage_src_clear_image_pool (GstXcbImageSrc * s);
 
 static Window
 gst_xcbimage_src_find_window (GstXcbImageSrc * src, Window root, const char *name)
@@ -228,6 +212,13 @@ gst_xcbimage_src_open_display (GstXcbImageSrc * s, const gchar * name)
   }
 use_root_window:
 
+#ifdef HAVE_XCB_SHM
+  /* The XCB engine does its own damage and cursor handling */
+  s->xcb = gst_xcb_capture_new (s);
+  if (s->xcb)
+    goto xcb_done;
+#endif
+
 #ifdef HAVE_XFIXES
   /* check if xfixes is supported */
   if (xcb_get_extension_data (s->xcontext->conn, &xcb_xfixes_id)->present) {
@@ -277,6 +268,9 @@ use_root_window:
 #endif
 #endif
 
+#ifdef HAVE_XCB_SHM
+xcb_done:
+#endif
   g_mutex_unlock (&s->x_lock);
 
   if (s->xcontext == NULL)
@@ -291,6 +285,11 @@ gst_xcbimage_src_start (GstBaseSrc * basesrc)
   GstXcbImageSrc *s = GST_XCBIMAGE_SRC (basesrc);
 
   s->last_frame_no = -1;
+  s->ahead_ret = GST_FLOW_OK;
+#ifdef HAVE_XCB_SHM
+  if (s->xcb)
+    gst_xcb_capture_reset (s->xcb);
+#endif
 #ifdef HAVE_XDAMAGE
   if (s->last_ximage)
     gst_buffer_unref (GST_BUFFER_CAST (s->last_ximage));
@@ -303,6 +302,15 @@ static gboolean
 gst_xcbimage_src_stop (GstBaseSrc * basesrc)
 {
   GstXcbImageSrc *src = GST_XCBIMAGE_SRC (basesrc);
+  GstBufferPool *pool;
+
+  gst_xcbimage_src_stop_capture_thread (src);
+
+#ifdef HAVE_XCB_SHM
+  if (src->xcb)
+    gst_xcb_capture_free (src->xcb);
+  src->xcb = NULL;
+#endif
 
 #ifdef HAVE_XDAMAGE
   if (src->last_ximage)
@@ -310,12 +318,26 @@ gst_xcbimage_src_stop (GstBaseSrc * basesrc)
   src->last_ximage = NULL;
 #endif
 
-  gst_xcbimage_src_clear_bufpool (src);
+  if (src->last_output)
+    gst_buffer_unref (src->last_output);
+  src->last_output = NULL;
+  if (src->conv)
+    gst_xcb_convert_free (src->conv);
+  src->conv = NULL;
+
+  /* Free the idle images while we still have a display to free them on */
+  gst_xcbimage_src_clear_image_pool (src);
+  pool = gst_base_src_get_buffer_pool (basesrc);
+  if (pool) {
+    gst_buffer_pool_set_active (pool, FALSE);
+    gst_object_unref (pool);
+  }
 
 #ifdef HAVE_XFIXES
   if (src->cursor_image)
     XFree (src->cursor_image);
   src->cursor_image = NULL;
+  xcbimageutil_cursor_clear (&src->cursor);
 #endif
 
   if (src->xcontext) {
@@ -357,6 +379,32 @@ gst_xcbimage_src_unlock (GstBaseSrc * basesrc)
   }
   GST_OBJECT_UNLOCK (src);
 
+  /* ... or for the capture thread */
+  g_mutex_lock (&src->ahead_lock);
+  src->ahead_flushing = TRUE;
+  g_cond_broadcast (&src->ahead_cond);
+  g_mutex_unlock (&src->ahead_lock);
+
+  return TRUE;
+}
+
+static gboolean
+gst_xcbimage_src_unlock_stop (GstBaseSrc * basesrc)
+{
+  GstXcbImageSrc *src = GST_XCBIMAGE_SRC (basesrc);
+  gboolean failed;
+
+  g_mutex_lock (&src->ahead_lock);
+  src->ahead_flushing = FALSE;
+  failed = src->ahead_ret != GST_FLOW_OK;
+  g_cond_broadcast (&src->ahead_cond);
+  g_mutex_unlock (&src->ahead_lock);
+
+  /* A capture thread which gave up has exited; reap it and clear its
+   * error, so that the next create() starts another */
+  if (failed)
+    gst_xcbimage_src_stop_capture_thread (src);
+
   return TRUE;
 }
 
@@ -390,86 +438,6 @@ gst_xcbimage_is_pointer_in_region (GstXcbImageSrc * src)
 }
 #endif
 
-#ifdef HAVE_XFIXES
-static void
-composite_pixel (GstXContext * xcontext, guchar * dest, guchar * src)
-{
-  guint8 r = src[2];
-  guint8 g = src[1];
-  guint8 b = src[0];
-  guint8 a = src[3];
-  guint8 dr, dg, db;
-  guint32 color;
-  gint r_shift, r_max, r_shift_out;
-  gint g_shift, g_max, g_shift_out;
-  gint b_shift, b_max, b_shift_out;
-
-  switch (xcontext->bpp) {
-    case 8:
-      color = *dest;
-      break;
-    case 16:
-      color = GUINT16_FROM_LE (*(guint16 *) (dest));
-      break;
-    case 32:
-      color = GUINT32_FROM_LE (*(guint32 *) (dest));
-      break;
-    default:
-      /* Should not reach here */
-      g_return_if_reached ();
-  }
-
-  /* possible optimisation:
-   * move the code that finds shift and max in the _link function */
-  for (r_shift = 0; !(xcontext->visual->red_mask & (1 << r_shift)); r_shift++);
-  for (g_shift = 0; !(xcontext->visual->green_mask & (1 << g_shift));
-      g_shift++);
-  for (b_shift = 0; !(xcontext->visual->blue_mask & (1 << b_shift)); b_shift++);
-
-  for (r_shift_out = 0; !(xcontext->visual->red_mask & (1 << r_shift_out));
-      r_shift_out++);
-  for (g_shift_out = 0; !(xcontext->visual->green_mask & (1 << g_shift_out));
-      g_shift_out++);
-  for (b_shift_out = 0; !(xcontext->visual->blue_mask & (1 << b_shift_out));
-      b_shift_out++);
-
-
-  r_max = (xcontext->visual->red_mask >> r_shift);
-  b_max = (xcontext->visual->blue_mask >> b_shift);
-  g_max = (xcontext->visual->green_mask >> g_shift);
-
-#define RGBXXX_R(x)  (((x)>>r_shift) & (r_max))
-#define RGBXXX_G(x)  (((x)>>g_shift) & (g_max))
-#define RGBXXX_B(x)  (((x)>>b_shift) & (b_max))
-
-  dr = (RGBXXX_R (color) * 255) / r_max;
-  dg = (RGBXXX_G (color) * 255) / g_max;
-  db = (RGBXXX_B (color) * 255) / b_max;
-
-  dr = (r * a + (0xff - a) * dr) / 0xff;
-  dg = (g * a + (0xff - a) * dg) / 0xff;
-  db = (b * a + (0xff - a) * db) / 0xff;
-
-  color = (((dr * r_max) / 255) << r_shift_out) +
-      (((dg * g_max) / 255) << g_shift_out) +
-      (((db * b_max) / 255) << b_shift_out);
-
-  switch (xcontext->bpp) {
-    case 8:
-      *dest = color;
-      break;
-    case 16:
-      *(guint16 *) (dest) = color;
-      break;
-    case 32:
-      *(guint32 *) (dest) = color;
-      break;
-    default:
-      g_warning ("bpp %d not supported\n", xcontext->bpp);
-  }
-}
-#endif
-
 #ifdef HAVE_XDAMAGE
 static void
 copy_buffer (GstBuffer * dest, GstBuffer * src)
@@ -482,52 +450,87 @@ copy_buffer (GstBuffer * dest, GstBuffer * src)
 }
 #endif
 
-/* Retrieve an XcbImageSrcBuffer, preferably from our
- * pool of existing images and populate it from the window */
-static GstBuffer *
-gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
+static gboolean
+drop_damage_meta (GstBuffer * buffer, GstMeta ** meta, gpointer user_data)
 {
-  GstBuffer *xcbimage = NULL;
-  GstMetaXcbImage *meta;
+  if ((*meta)->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE &&
+      ((GstVideoRegionOfInterestMeta *) * meta)->roi_type ==
+      GST_XCBIMAGE_SRC_DAMAGE_QUARK)
+    *meta = NULL;
+  return TRUE;
+}
 
-  g_mutex_lock (&xcbimagesrc->pool_lock);
-  while (xcbimagesrc->buffer_pool != NULL) {
-    xcbimage = xcbimagesrc->buffer_pool->data;
+/* Forget which regions changed the last time @buffer went out */
+void
+gst_xcbimage_src_clear_damage (GstBuffer * buffer)
+{
+  gst_buffer_foreach_meta (buffer, drop_damage_meta, NULL);
+}
 
-    meta = GST_META_XCBIMAGE_GET (xcbimage);
+/* Record that the @width x @height rectangle at @x,@y changed */
+void
+gst_xcbimage_src_add_damage (GstBuffer * buffer, guint x, guint y,
+    guint width, guint height)
+{
+  GstVideoRegionOfInterestMeta *roi;
 
-    xcbimagesrc->buffer_pool = g_slist_delete_link (xcbimagesrc->buffer_pool,
-        xcbimagesrc->buffer_pool);
+  roi = gst_buffer_add_video_region_of_interest_meta_id (buffer,
+      GST_XCBIMAGE_SRC_DAMAGE_QUARK, x, y, width, height);
+  if (roi)
+    roi->id = -1;
+}
 
-    if ((meta->width == xcbimagesrc->width) ||
-        (meta->height == xcbimagesrc->height))
-      break;
+/* Retrieve an XcbImageSrcBuffer from the image pool, without filling it */
+GstFlowReturn
+gst_xcbimage_src_acquire_image (GstXcbImageSrc * xcbimagesrc,
+    GstBuffer ** image)
+{
+  GstBuffer *xcbimage = NULL;
+  GstFlowReturn ret;
 
-    gst_xcbimage_buffer_free (xcbimage);
-    xcbimage = NULL;
+  if (!xcbimagesrc->image_pool) {
+    GST_ELEMENT_ERROR (xcbimagesrc, RESOURCE, WRITE, (NULL),
+        ("no image buffer pool negotiated"));
+    return GST_FLOW_ERROR;
   }
-  g_mutex_unlock (&xcbimagesrc->pool_lock);
 
-  if (xcbimage == NULL) {
-    GST_DEBUG_OBJECT (xcbimagesrc, "creating image (%dx%d)",
-        xcbimagesrc->width, xcbimagesrc->height);
-
-    g_mutex_lock (&xcbimagesrc->x_lock);
-    xcbimage = gst_xcbimageutil_xcbimage_new (xcbimagesrc->xcontext,
-        GST_ELEMENT (xcbimagesrc), xcbimagesrc->width, xcbimagesrc->height,
-        (BufferReturnFunc) (gst_xcbimage_src_return_buf));
-    if (xcbimage == NULL) {
+  ret = gst_buffer_pool_acquire_buffer (xcbimagesrc->image_pool, &xcbimage,
+      NULL);
+  if (ret != GST_FLOW_OK) {
+    /* Flushing is the pool being deactivated under us; not an error */
+    if (ret != GST_FLOW_FLUSHING)
       GST_ELEMENT_ERROR (xcbimagesrc, RESOURCE, WRITE, (NULL),
           ("could not create a %dx%d xcbimage", xcbimagesrc->width,
               xcbimagesrc->height));
-      g_mutex_unlock (&xcbimagesrc->x_lock);
-      return NULL;
-    }
+    return ret;
+  }
+
+  gst_xcbimage_src_clear_damage (xcbimage);
+  *image = xcbimage;
+  return GST_FLOW_OK;
+}
+
+/* Retrieve an XcbImageSrcBuffer and populate it from the window */
+static GstFlowReturn
+gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc,
+    GstBuffer ** image)
+{
+  GstBuffer *xcbimage = NULL;
+  GstMetaXcbImage *meta;
+  GstFlowReturn ret;
 
-    g_mutex_unlock (&xcbimagesrc->x_lock);
+#ifdef HAVE_XCB_SHM
+  if (xcbimagesrc->xcb) {
+    /* Any failure has been posted already */
+    return gst_xcb_capture_frame (xcbimagesrc->xcb, image);
   }
+#endif
 
-  g_return_val_if_fail (GST_IS_XCBIMAGE_SRC (xcbimagesrc), NULL);
+  ret = gst_xcbimage_src_acquire_image (xcbimagesrc, &xcbimage);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  g_return_val_if_fail (GST_IS_XCBIMAGE_SRC (xcbimagesrc), GST_FLOW_ERROR);
 
   meta = GST_META_XCBIMAGE_GET (xcbimage);
 
@@ -613,6 +616,9 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
                   startx, starty, width, height, AllPlanes, ZPixmap,
                   meta->ximage, startx - xcbimagesrc->startx,
                   starty - xcbimagesrc->starty);
+              gst_xcbimage_src_add_damage (xcbimage,
+                  startx - xcbimagesrc->startx, starty - xcbimagesrc->starty,
+                  width, height);
             }
           } else {
 
@@ -624,6 +630,8 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
                 rects[i].x, rects[i].y,
                 rects[i].width, rects[i].height,
                 AllPlanes, ZPixmap, meta->ximage, rects[i].x, rects[i].y);
+            gst_xcbimage_src_add_damage (xcbimage, rects[i].x, rects[i].y,
+                rects[i].width, rects[i].height);
           }
         }
         XFree (rects);
@@ -778,31 +786,35 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
       }
 
       if (cursor_in_image) {
+        XFixesCursorImage *ci = xcbimagesrc->cursor_image;
+        gint bypp = xcbimagesrc->xcontext->bpp / 8;
+        gint endx = MIN (startx + iwidth,
+            (gint) (xcbimagesrc->startx + xcbimagesrc->width));
+        gint endy = MIN (starty + iheight,
+            (gint) (xcbimagesrc->starty + xcbimagesrc->height));
+
         GST_DEBUG_OBJECT (xcbimagesrc, "Cursor is in image so trying to draw it");
-        for (i = 0; i < count; i++)
-          xcbimagesrc->cursor_image->pixels[i] =
-              GUINT_TO_LE (xcbimagesrc->cursor_image->pixels[i]);
-        /* copy those pixels across */
-        for (j = starty;
-            j < starty + iheight
-            && j < xcbimagesrc->starty + xcbimagesrc->height; j++) {
-          for (i = startx;
-              i < startx + iwidth
-              && i < xcbimagesrc->startx + xcbimagesrc->width; i++) {
-            guint8 *src, *dest;
-
-            src =
-                (guint8 *) & (xcbimagesrc->cursor_image->pixels[((j -
-                            cy) * xcbimagesrc->cursor_image->width + (i - cx))]);
-            dest =
-                (guint8 *) & (meta->ximage->data[((j -
-                            xcbimagesrc->starty) * xcbimagesrc->width + (i -
-                            xcbimagesrc->startx)) *
-                    (xcbimagesrc->xcontext->bpp / 8)]);
-
-            composite_pixel (xcbimagesrc->xcontext, (guint8 *) dest,
-                (guint8 *) src);
-          }
+        if (!xcbimageutil_cursor_is_current (&xcbimagesrc->cursor,
+                ci->cursor_serial)) {
+          /* Xlib hands out the pixels as longs */
+          guint32 *argb = g_new (guint32, count);
+
+          for (i = 0; i < count; i++)
+            argb[i] = ci->pixels[i];
+          xcbimageutil_cursor_set (xcbimagesrc->xcontext, &xcbimagesrc->cursor,
+              ci->cursor_serial, ci->width, ci->height, argb);
+          g_free (argb);
+        }
+
+        startx = MAX (startx, (gint) xcbimagesrc->startx);
+        starty = MAX (starty, (gint) xcbimagesrc->starty);
+        for (j = starty; j < endy && startx < endx; j++) {
+          guint8 *dest = (guint8 *) & (meta->ximage->data[(j -
+                      xcbimagesrc->starty) * meta->ximage->bytes_per_line +
+                  (startx - xcbimagesrc->startx) * bypp]);
+
+          xcbimageutil_cursor_blend_row (xcbimagesrc->xcontext,
+              &xcbimagesrc->cursor, startx - cx, j - cy, dest, endx - startx);
         }
       }
     }
@@ -819,28 +831,211 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
     GST_LOG_OBJECT (xcbimagesrc, "reffing current buffer for last_ximage");
   }
 #endif
-  return xcbimage;
+  *image = xcbimage;
+  return GST_FLOW_OK;
+}
+
+/* Next damage meta on @buffer after @state */
+static GstVideoRegionOfInterestMeta *
+gst_xcbimage_src_next_damage (GstBuffer * buffer, gpointer * state)
+{
+  GstVideoRegionOfInterestMeta *roi;
+
+  while ((roi = (GstVideoRegionOfInterestMeta *)
+          gst_buffer_iterate_meta_filtered (buffer, state,
+              GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)))
+    if (roi->roi_type == GST_XCBIMAGE_SRC_DAMAGE_QUARK)
+      return roi;
+
+  return NULL;
 }
 
+/* Retrieve an empty buffer for converted frames from the negotiated pool */
 static GstFlowReturn
-gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
+gst_xcbimage_src_acquire_output (GstXcbImageSrc * s, GstBuffer ** out)
+{
+  GstBuffer *buffer = NULL;
+  GstBufferPool *pool;
+  GstFlowReturn ret = GST_FLOW_ERROR;
+
+  pool = gst_base_src_get_buffer_pool (GST_BASE_SRC (s));
+  if (pool) {
+    ret = gst_buffer_pool_acquire_buffer (pool, &buffer, NULL);
+    gst_object_unref (pool);
+  }
+
+  if (ret != GST_FLOW_OK) {
+    if (ret != GST_FLOW_FLUSHING)
+      GST_ELEMENT_ERROR (s, RESOURCE, WRITE, (NULL),
+          ("could not allocate a converted frame"));
+    return ret;
+  }
+
+  *out = buffer;
+  return GST_FLOW_OK;
+}
+
+/* The previous converted frame, if nobody downstream holds it any more,
+ * so that it can be patched in place. Our reference is handed over. */
+static GstBuffer *
+gst_xcbimage_src_take_last_output (GstXcbImageSrc * s)
+{
+  GstBuffer *last = s->last_output;
+
+  if (GST_MINI_OBJECT_REFCOUNT_VALUE (last) == 1 &&
+      gst_buffer_is_all_memory_writable (last)) {
+    s->last_output = NULL;
+    return last;
+  }
+
+  return NULL;
+}
+
+/* Convert the part of @frame covering the @width x @height rectangle at
+ * @x,@y of the captured image, and record it as changed in @out */
+static void
+gst_xcbimage_src_convert_damage (GstXcbImageSrc * s, GstMetaXcbImage * meta,
+    GstVideoFrame * frame, GstBuffer * out, gint x, gint y, gint width,
+    gint height)
+{
+  gint scale = s->out_scale;
+  gint x0, y0, x1, y1;
+
+  /* Chroma is shared by 2x2 output pixels, so whole blocks of them */
+  x0 = (x / scale) & ~1;
+  y0 = (y / scale) & ~1;
+  x1 = MIN ((((x + width + scale - 1) / scale) + 1) & ~1,
+      GST_VIDEO_INFO_WIDTH (&s->out_info));
+  y1 = MIN ((((y + height + scale - 1) / scale) + 1) & ~1,
+      GST_VIDEO_INFO_HEIGHT (&s->out_info));
+  if (x1 <= x0 || y1 <= y0)
+    return;
+
+  gst_xcb_convert_rect (s->conv, meta, frame, x0, y0, x1 - x0, y1 - y0);
+  gst_xcbimage_src_add_damage (out, x0, y0, x1 - x0, y1 - y0);
+}
+
+/* Turn @image into a frame in the negotiated format, converting only what
+ * changed if there's a previous frame to start from. Takes @image. */
+static GstFlowReturn
+gst_xcbimage_src_convert (GstXcbImageSrc * s, GstBuffer * image,
+    GstBuffer ** outbuf)
+{
+  GstMetaXcbImage *meta = GST_META_XCBIMAGE_GET (image);
+  GstVideoRegionOfInterestMeta *roi;
+  GstVideoFrame frame, last;
+  GstBuffer *out = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gpointer state = NULL;
+
+  if (s->last_output && GST_BUFFER_FLAG_IS_SET (image, GST_BUFFER_FLAG_GAP)) {
+    /* Nothing to convert. Hand out the same frame again. */
+    gst_buffer_unref (image);
+    out = gst_xcbimage_src_take_last_output (s);
+    if (!out)
+      out = gst_buffer_copy (s->last_output);
+    gst_xcbimage_src_clear_damage (out);
+    GST_BUFFER_FLAGS (out) = GST_BUFFER_FLAG_GAP | GST_BUFFER_FLAG_DROPPABLE;
+    if (!s->last_output)
+      s->last_output = gst_buffer_ref (out);
+    *outbuf = out;
+    return GST_FLOW_OK;
+  }
+
+  if (s->last_output && gst_xcbimage_src_next_damage (image, &state)) {
+    out = gst_xcbimage_src_take_last_output (s);
+    if (out) {
+      GST_LOG_OBJECT (s, "Patching last converted frame in place");
+      gst_xcbimage_src_clear_damage (out);
+      GST_BUFFER_FLAGS (out) = 0;
+      if (!gst_video_frame_map (&frame, &s->out_info, out, GST_MAP_WRITE))
+        goto map_failed;
+    } else {
+      ret = gst_xcbimage_src_acquire_output (s, &out);
+      if (ret != GST_FLOW_OK)
+        goto done;
+      if (!gst_video_frame_map (&frame, &s->out_info, out, GST_MAP_WRITE))
+        goto map_failed;
+      if (!gst_video_frame_map (&last, &s->out_info, s->last_output,
+              GST_MAP_READ)) {
+        gst_video_frame_unmap (&frame);
+        goto map_failed;
+      }
+      GST_LOG_OBJECT (s, "Copying from last converted frame");
+      gst_video_frame_copy (&frame, &last);
+      gst_video_frame_unmap (&last);
+    }
+
+    state = NULL;
+    while ((roi = gst_xcbimage_src_next_damage (image, &state)))
+      gst_xcbimage_src_convert_damage (s, meta, &frame, out, roi->x, roi->y,
+          roi->w, roi->h);
+    gst_video_frame_unmap (&frame);
+  } else {
+    ret = gst_xcbimage_src_acquire_output (s, &out);
+    if (ret != GST_FLOW_OK)
+      goto done;
+    if (!gst_video_frame_map (&frame, &s->out_info, out, GST_MAP_WRITE))
+      goto map_failed;
+    gst_xcb_convert_rect (s->conv, meta, &frame, 0, 0,
+        GST_VIDEO_INFO_WIDTH (&s->out_info),
+        GST_VIDEO_INFO_HEIGHT (&s->out_info));
+    gst_video_frame_unmap (&frame);
+  }
+
+  if (s->use_damage && out != s->last_output) {
+    if (s->last_output)
+      gst_buffer_unref (s->last_output);
+    s->last_output = gst_buffer_ref (out);
+  }
+
+done:
+  gst_buffer_unref (image);
+  *outbuf = out;
+  return ret;
+
+  /* ERRORS */
+map_failed:
+  {
+    GST_ELEMENT_ERROR (s, RESOURCE, WRITE, (NULL),
+        ("could not map a converted frame"));
+    gst_buffer_unref (out);
+    out = NULL;
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+}
+
+/* Capture a frame, in the negotiated format */
+static GstFlowReturn
+gst_xcbimage_src_grab (GstXcbImageSrc * s, GstBuffer ** buf)
+{
+  GstBuffer *image = NULL;
+  GstFlowReturn ret;
+
+  ret = gst_xcbimage_src_xcbimage_get (s, &image);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  if (!s->conv) {
+    *buf = image;
+    return GST_FLOW_OK;
+  }
+
+  return gst_xcbimage_src_convert (s, image, buf);
+}
+
+/* Wait until it's time for the next frame at the negotiated rate. Returns
+ * its timestamp and duration. */
+static GstFlowReturn
+gst_xcbimage_src_wait_next_frame (GstXcbImageSrc * s, GstClockTime * ts,
+    GstClockTime * duration)
 {
-  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
-  GstBuffer *image;
   GstClockTime base_time;
   GstClockTime next_capture_ts;
   GstClockTime dur;
   gint64 next_frame_no;
 
-  if (!gst_xcbimage_src_recalc (s)) {
-    GST_ELEMENT_ERROR (s, RESOURCE, FAILED,
-        (_("Changing resolution at runtime is not yet supported.")), (NULL));
-    return GST_FLOW_ERROR;
-  }
-
-  if (s->fps_n <= 0 || s->fps_d <= 0)
-    return GST_FLOW_NOT_NEGOTIATED;     /* FPS must be > 0 */
-
   /* Now, we might need to wait for the next multiple of the fps
    * before capturing */
 
@@ -906,9 +1101,225 @@ gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
   s->last_frame_no = next_frame_no;
   GST_OBJECT_UNLOCK (s);
 
-  image = gst_xcbimage_src_xcbimage_get (s);
-  if (!image)
+  *ts = next_capture_ts;
+  *duration = dur;
+  return GST_FLOW_OK;
+}
+
+/* A frame to hand out in place of @old, which create() never took, and
+ * @image, which was captured after it. Whatever changed in @old has to
+ * be recorded as changed in the frame which replaces it. */
+static GstBuffer *
+gst_xcbimage_src_merge_skipped (GstXcbImageSrc * s, GstBuffer * old,
+    GstBuffer * image)
+{
+  GstVideoRegionOfInterestMeta *roi;
+  gpointer state = NULL;
+
+  /* Nothing happened since; the one we have already will do */
+  if (GST_BUFFER_FLAG_IS_SET (image, GST_BUFFER_FLAG_GAP)) {
+    gst_buffer_unref (image);
+    return old;
+  }
+
+  /* Either @old changed nothing, or @image changed everything */
+  if (GST_BUFFER_FLAG_IS_SET (old, GST_BUFFER_FLAG_GAP) ||
+      !gst_xcbimage_src_next_damage (image, &state)) {
+    gst_buffer_unref (old);
+    return image;
+  }
+
+  /* The capture engine may still hold @image as its previous frame, in
+   * which case this copies it; but only when create() has fallen behind */
+  image = gst_buffer_make_writable (image);
+
+  state = NULL;
+  roi = gst_xcbimage_src_next_damage (old, &state);
+  if (!roi) {
+    GST_LOG_OBJECT (s, "Skipped frame changed completely");
+    gst_xcbimage_src_clear_damage (image);
+  }
+  for (; roi; roi = gst_xcbimage_src_next_damage (old, &state))
+    gst_xcbimage_src_add_damage (image, roi->x, roi->y, roi->w, roi->h);
+
+  gst_buffer_unref (old);
+  return image;
+}
+
+/* Capture each frame as soon as it's due, keeping only the latest */
+static gpointer
+gst_xcbimage_src_capture_thread (gpointer data)
+{
+  GstXcbImageSrc *s = data;
+
+  GST_DEBUG_OBJECT (s, "Capture thread started");
+
+  while (TRUE) {
+    GstBuffer *image = NULL;
+    GstClockTime ts, dur;
+    GstFlowReturn ret;
+    gboolean running;
+
+    /* Nothing is wanted until the flush is over */
+    g_mutex_lock (&s->ahead_lock);
+    while (s->ahead_flushing && s->ahead_running)
+      g_cond_wait (&s->ahead_cond, &s->ahead_lock);
+    running = s->ahead_running;
+    g_mutex_unlock (&s->ahead_lock);
+    if (!running)
+      break;
+
+    ret = gst_xcbimage_src_wait_next_frame (s, &ts, &dur);
+    if (ret == GST_FLOW_OK)
+      ret = gst_xcbimage_src_grab (s, &image);
+
+    g_mutex_lock (&s->ahead_lock);
+    if (!s->ahead_running) {
+      g_mutex_unlock (&s->ahead_lock);
+      if (image)
+        gst_buffer_unref (image);
+      break;
+    }
+
+    /* unlock() woke the clock wait, or the pools are flushing, or a
+     * flush began while this frame was being captured */
+    if (ret == GST_FLOW_FLUSHING || s->ahead_flushing) {
+      g_mutex_unlock (&s->ahead_lock);
+      if (image)
+        gst_buffer_unref (image);
+      continue;
+    }
+
+    if (ret != GST_FLOW_OK) {
+      s->ahead_ret = ret;
+      g_cond_signal (&s->ahead_cond);
+      g_mutex_unlock (&s->ahead_lock);
+      break;
+    }
+
+    if (s->ahead_frame) {
+      GstBuffer *old = s->ahead_frame;
+
+      GST_LOG_OBJECT (s, "Frame at %" GST_TIME_FORMAT " was never taken",
+          GST_TIME_ARGS (s->ahead_ts));
+      image = gst_xcbimage_src_merge_skipped (s, old, image);
+      if (image == old) {
+        /* Still showing the same thing, for longer */
+        dur += ts - s->ahead_ts;
+        ts = s->ahead_ts;
+      }
+    }
+    s->ahead_frame = image;
+    s->ahead_ts = ts;
+    s->ahead_dur = dur;
+    g_cond_signal (&s->ahead_cond);
+    g_mutex_unlock (&s->ahead_lock);
+  }
+
+  GST_DEBUG_OBJECT (s, "Capture thread stopped");
+  return NULL;
+}
+
+static void
+gst_xcbimage_src_stop_capture_thread (GstXcbImageSrc * s)
+{
+  GThread *thread;
+
+  g_mutex_lock (&s->ahead_lock);
+  thread = s->ahead_thread;
+  s->ahead_thread = NULL;
+  s->ahead_running = FALSE;
+  g_cond_broadcast (&s->ahead_cond);
+  g_mutex_unlock (&s->ahead_lock);
+
+  if (thread) {
+    GST_OBJECT_LOCK (s);
+    if (s->clock_id)
+      gst_clock_id_unschedule (s->clock_id);
+    GST_OBJECT_UNLOCK (s);
+    g_thread_join (thread);
+  }
+
+  g_mutex_lock (&s->ahead_lock);
+  if (s->ahead_frame)
+    gst_buffer_unref (s->ahead_frame);
+  s->ahead_frame = NULL;
+  s->ahead_ret = GST_FLOW_OK;
+  g_mutex_unlock (&s->ahead_lock);
+}
+
+/* Hand over the latest frame from the capture thread, starting it first
+ * if need be, and waiting for a frame only if none has been captured
+ * since the last one was taken */
+static GstFlowReturn
+gst_xcbimage_src_take_frame (GstXcbImageSrc * s, GstBuffer ** image,
+    GstClockTime * ts, GstClockTime * dur)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&s->ahead_lock);
+  if (!s->ahead_thread && s->ahead_ret == GST_FLOW_OK) {
+    s->ahead_running = TRUE;
+    s->ahead_thread = g_thread_new ("xcbimagesrc-capture",
+        gst_xcbimage_src_capture_thread, s);
+  }
+
+  while (!s->ahead_frame && !s->ahead_flushing && s->ahead_ret == GST_FLOW_OK)
+    g_cond_wait (&s->ahead_cond, &s->ahead_lock);
+
+  if (s->ahead_flushing) {
+    ret = GST_FLOW_FLUSHING;
+  } else if (s->ahead_frame) {
+    *image = s->ahead_frame;
+    *ts = s->ahead_ts;
+    *dur = s->ahead_dur;
+    s->ahead_frame = NULL;
+  } else {
+    ret = s->ahead_ret;
+  }
+  g_mutex_unlock (&s->ahead_lock);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
+{
+  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
+  GstBuffer *image;
+  GstClockTime next_capture_ts;
+  GstClockTime dur;
+  GstFlowReturn ret;
+
+  if (!gst_xcbimage_src_recalc (s)) {
+    GST_ELEMENT_ERROR (s, RESOURCE, FAILED,
+        (_("Changing resolution at runtime is not yet supported.")), (NULL));
     return GST_FLOW_ERROR;
+  }
+
+  if (s->fps_n <= 0 || s->fps_d <= 0)
+    return GST_FLOW_NOT_NEGOTIATED;     /* FPS must be > 0 */
+
+again:
+  if (s->capture_ahead) {
+    ret = gst_xcbimage_src_take_frame (s, &image, &next_capture_ts, &dur);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  } else {
+    ret = gst_xcbimage_src_wait_next_frame (s, &next_capture_ts, &dur);
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    ret = gst_xcbimage_src_grab (s, &image);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  if (s->drop_unchanged && GST_BUFFER_FLAG_IS_SET (image, GST_BUFFER_FLAG_GAP)) {
+    GST_LOG_OBJECT (s, "Nothing changed; skipping frame");
+    gst_buffer_unref (image);
+    goto again;
+  }
 
   *buf = image;
   GST_BUFFER_DTS (*buf) = GST_CLOCK_TIME_NONE;
@@ -966,6 +1377,15 @@ gst_xcbimage_src_set_property (GObject * object, guint prop_id,
       g_free (src->xname);
       src->xname = g_strdup (g_value_get_string (value));
       break;
+    case PROP_DROP_UNCHANGED:
+      src->drop_unchanged = g_value_get_boolean (value);
+      break;
+    case PROP_CAPTURE_AHEAD:
+      src->capture_ahead = g_value_get_boolean (value);
+      break;
+    case PROP_DOWNSCALE:
+      src->downscale = g_value_get_uint (value);
+      break;
     default:
       break;
   }
@@ -1012,59 +1432,70 @@ gst_xcbimage_src_get_property (GObject * object, guint prop_id,
     case PROP_XNAME:
       g_value_set_string (value, src->xname);
       break;
+    case PROP_DROP_UNCHANGED:
+      g_value_set_boolean (value, src->drop_unchanged);
+      break;
+    case PROP_CAPTURE_AHEAD:
+      g_value_set_boolean (value, src->capture_ahead);
+      break;
+    case PROP_DOWNSCALE:
+      g_value_set_uint (value, src->downscale);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
-static void
-gst_xcbimage_src_clear_bufpool (GstXcbImageSrc * xcbimagesrc)
-{
-  g_mutex_lock (&xcbimagesrc->pool_lock);
-  while (xcbimagesrc->buffer_pool != NULL) {
-    GstBuffer *xcbimage = xcbimagesrc->buffer_pool->data;
-
-    gst_xcbimage_buffer_free (xcbimage);
-
-    xcbimagesrc->buffer_pool = g_slist_delete_link (xcbimagesrc->buffer_pool,
-        xcbimagesrc->buffer_pool);
-  }
-  g_mutex_unlock (&xcbimagesrc->pool_lock);
-}
-
-static void
-gst_xcbimage_src_dispose (GObject * object)
-{
-  /* Drop references in the buffer_pool */
-  gst_xcbimage_src_clear_bufpool (GST_XCBIMAGE_SRC (object));
-
-  G_OBJECT_CLASS (parent_class)->dispose (object);
-}
-
 static void
 gst_xcbimage_src_finalize (GObject * object)
 {
   GstXcbImageSrc *src = GST_XCBIMAGE_SRC (object);
 
+#ifdef HAVE_XCB_SHM
+  if (src->xcb)
+    gst_xcb_capture_free (src->xcb);
+#endif
+  if (src->conv)
+    gst_xcb_convert_free (src->conv);
   if (src->xcontext)
     xcbimageutil_xcontext_clear (src->xcontext);
 
   g_free (src->xname);
-  g_mutex_clear (&src->pool_lock);
   g_mutex_clear (&src->x_lock);
+  g_mutex_clear (&src->ahead_lock);
+  g_cond_clear (&src->ahead_cond);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+/* The format of the pixels on the screen */
+static GstVideoFormat
+gst_xcbimage_src_native_format (GstXContext * xcontext)
+{
+  guint32 alpha_mask;
+
+  /* extrapolate alpha mask */
+  if (xcontext->depth == 32) {
+    alpha_mask = ~(xcontext->r_mask_output
+        | xcontext->g_mask_output | xcontext->b_mask_output);
+  } else {
+    alpha_mask = 0;
+  }
+
+  return gst_video_format_from_masks (xcontext->depth, xcontext->bpp,
+      xcontext->endianness, xcontext->r_mask_output,
+      xcontext->g_mask_output, xcontext->b_mask_output, alpha_mask);
+}
+
 static GstCaps *
 gst_xcbimage_src_get_caps (GstBaseSrc * bs, GstCaps * filter)
 {
   GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
   GstXContext *xcontext;
   gint width, height;
-  GstVideoFormat format;
-  guint32 alpha_mask;
+  gint scale = s->downscale;
+  GstCaps *caps;
 
   if ((!s->xcontext) && (!gst_xcbimage_src_open_display (s, s->display_name)))
     return gst_pad_get_pad_template_caps (GST_BASE_SRC (s)->srcpad);
@@ -1115,26 +1546,38 @@ gst_xcbimage_src_get_caps (GstBaseSrc * bs, GstCaps * filter)
   }
   GST_DEBUG ("width = %d, height=%d", width, height);
 
-  /* extrapolate alpha mask */
-  if (xcontext->depth == 32) {
-    alpha_mask = ~(xcontext->r_mask_output
-        | xcontext->g_mask_output | xcontext->b_mask_output);
-  } else {
-    alpha_mask = 0;
+  caps = gst_caps_new_empty ();
+
+  /* What an encoder wants, if we can make it, at whole 2x2 chroma blocks */
+  if (gst_xcb_convert_supported (xcontext) &&
+      width / scale >= 2 && height / scale >= 2) {
+    static const GstVideoFormat yuv[] = { GST_VIDEO_FORMAT_I420,
+      GST_VIDEO_FORMAT_NV12
+    };
+    gint i;
+
+    for (i = 0; i < G_N_ELEMENTS (yuv); i++)
+      gst_caps_append_structure (caps, gst_structure_new ("video/x-raw",
+              "format", G_TYPE_STRING, gst_video_format_to_string (yuv[i]),
+              "width", G_TYPE_INT, (width / scale) & ~1,
+              "height", G_TYPE_INT, (height / scale) & ~1,
+              "framerate", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT, G_MAXINT, 1,
+              "pixel-aspect-ratio", GST_TYPE_FRACTION, xcontext->par_n,
+              xcontext->par_d, "colorimetry", G_TYPE_STRING, "bt601",
+              "chroma-site", G_TYPE_STRING, "jpeg", NULL));
   }
 
-  format =
-      gst_video_format_from_masks (xcontext->depth, xcontext->bpp,
-      xcontext->endianness, xcontext->r_mask_output,
-      xcontext->g_mask_output, xcontext->b_mask_output, alpha_mask);
+  if (scale == 1 || gst_caps_is_empty (caps))
+    gst_caps_append_structure (caps, gst_structure_new ("video/x-raw",
+            "format", G_TYPE_STRING,
+            gst_video_format_to_string (gst_xcbimage_src_native_format
+                (xcontext)), "width", G_TYPE_INT, width,
+            "height", G_TYPE_INT, height,
+            "framerate", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT, G_MAXINT, 1,
+            "pixel-aspect-ratio", GST_TYPE_FRACTION, xcontext->par_n,
+            xcontext->par_d, NULL));
 
-  return gst_caps_new_simple ("video/x-raw",
-      "format", G_TYPE_STRING, gst_video_format_to_string (format),
-      "width", G_TYPE_INT, width,
-      "height", G_TYPE_INT, height,
-      "framerate", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT, G_MAXINT, 1,
-      "pixel-aspect-ratio", GST_TYPE_FRACTION, xcontext->par_n,
-      xcontext->par_d, NULL);
+  return caps;
 }
 
 static gboolean
@@ -1143,17 +1586,46 @@ gst_xcbimage_src_set_caps (GstBaseSrc * bs, GstCaps * caps)
   GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
   GstStructure *structure;
   const GValue *new_fps;
+  GstVideoInfo info;
+  gint scale;
 
   /* If not yet opened, disallow setcaps until later */
   if (!s->xcontext)
     return FALSE;
 
-  /* The only thing that can change is the framerate downstream wants */
   structure = gst_caps_get_structure (caps, 0);
   new_fps = gst_structure_get_value (structure, "framerate");
   if (!new_fps)
     return FALSE;
 
+  if (!gst_video_info_from_caps (&info, caps))
+    return FALSE;
+
+  /* Nothing may capture while the conversion changes */
+  gst_xcbimage_src_stop_capture_thread (s);
+  if (s->last_output)
+    gst_buffer_unref (s->last_output);
+  s->last_output = NULL;
+  if (s->conv)
+    gst_xcb_convert_free (s->conv);
+  s->conv = NULL;
+
+  if (GST_VIDEO_INFO_FORMAT (&info) !=
+      gst_xcbimage_src_native_format (s->xcontext)) {
+    scale = s->downscale;
+    if (!gst_xcb_convert_supported (s->xcontext) ||
+        GST_VIDEO_INFO_WIDTH (&info) * scale > s->width ||
+        GST_VIDEO_INFO_HEIGHT (&info) * scale > s->height) {
+      GST_WARNING_OBJECT (s, "can't convert to %" GST_PTR_FORMAT, caps);
+      return FALSE;
+    }
+    s->conv = gst_xcb_convert_new (s->xcontext, &info, scale);
+    s->out_scale = scale;
+    GST_DEBUG_OBJECT (s, "converting to %s, shrinking by %d",
+        GST_VIDEO_INFO_NAME (&info), scale);
+  }
+  s->out_info = info;
+
   /* Store this FPS for use when generating buffers */
   s->fps_n = gst_value_get_fraction_numerator (new_fps);
   s->fps_d = gst_value_get_fraction_denominator (new_fps);
@@ -1163,6 +1635,165 @@ gst_xcbimage_src_set_caps (GstBaseSrc * bs, GstCaps * caps)
   return TRUE;
 }
 
+static void
+gst_xcbimage_src_clear_image_pool (GstXcbImageSrc * s)
+{
+  if (s->image_pool) {
+    gst_buffer_pool_set_active (s->image_pool, FALSE);
+    gst_object_unref (s->image_pool);
+  }
+  s->image_pool = NULL;
+}
+
+/* A pool of images for @caps, with @size, @min and @max updated to what
+ * it settled on */
+static GstBufferPool *
+gst_xcbimage_src_new_image_pool (GstXcbImageSrc * s, GstCaps * caps,
+    gboolean video_meta, guint * size, guint * min, guint * max)
+{
+  GstBufferPool *pool;
+  GstStructure *config;
+
+  pool = gst_xcbimage_buffer_pool_new (s);
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, *size, *min, *max);
+  if (video_meta)
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_ELEMENT_ERROR (s, RESOURCE, SETTINGS, (NULL),
+        ("could not configure image buffer pool"));
+    gst_object_unref (pool);
+    return NULL;
+  }
+
+  /* The pool settled on the real size of an image */
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, size, min, max);
+  gst_structure_free (config);
+
+  return pool;
+}
+
+/* Downstream gets our own pool when it takes the screen's format, since
+ * only that can hand out images the server writes into. When converting,
+ * we capture into a pool of our own and convert into whatever downstream
+ * offered, or a plain video pool. */
+static gboolean
+gst_xcbimage_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bsrc);
+  GstBufferPool *pool = NULL;
+  GstStructure *config;
+  GstCaps *caps;
+  GstVideoInfo info;
+  guint size = 0, min = 0, max = 0;
+  gboolean update, video_meta;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps || !gst_video_info_from_caps (&info, caps))
+    return FALSE;
+
+  /* Nothing may capture while the pools change */
+  gst_xcbimage_src_stop_capture_thread (s);
+  gst_xcbimage_src_clear_image_pool (s);
+  if (s->last_output)
+    gst_buffer_unref (s->last_output);
+  s->last_output = NULL;
+
+  update = gst_query_get_n_allocation_pools (query) > 0;
+  if (update)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+  video_meta = gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE,
+      NULL);
+
+  /* One frame being captured, one waiting for create() and one
+   * downstream */
+  if (s->capture_ahead) {
+    min = MAX (min, 3);
+    if (max)
+      max = MAX (max, min);
+  }
+
+  if (s->conv) {
+    GstVideoInfo native;
+    GstCaps *native_caps;
+    guint isize = 0, imin = 2, imax = 0;
+
+    /* The image being captured, and the last one to patch */
+    gst_video_info_set_format (&native,
+        gst_xcbimage_src_native_format (s->xcontext), s->width, s->height);
+    native_caps = gst_video_info_to_caps (&native);
+    isize = GST_VIDEO_INFO_SIZE (&native);
+    s->image_pool = gst_xcbimage_src_new_image_pool (s, native_caps, FALSE,
+        &isize, &imin, &imax);
+    gst_caps_unref (native_caps);
+    if (!s->image_pool)
+      goto error;
+    if (!gst_buffer_pool_set_active (s->image_pool, TRUE)) {
+      GST_ELEMENT_ERROR (s, RESOURCE, SETTINGS, (NULL),
+          ("could not activate image buffer pool"));
+      goto error;
+    }
+
+    if (!pool)
+      pool = gst_video_buffer_pool_new ();
+    size = MAX (size, GST_VIDEO_INFO_SIZE (&info));
+
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    if (video_meta && gst_buffer_pool_has_option (pool,
+            GST_BUFFER_POOL_OPTION_VIDEO_META))
+      gst_buffer_pool_config_add_option (config,
+          GST_BUFFER_POOL_OPTION_VIDEO_META);
+    if (!gst_buffer_pool_set_config (pool, config)) {
+      /* Take what the pool suggested instead, if it will do */
+      config = gst_buffer_pool_get_config (pool);
+      if (!gst_buffer_pool_config_validate_params (config, caps, size, min,
+              max)) {
+        gst_structure_free (config);
+        goto config_failed;
+      }
+      if (!gst_buffer_pool_set_config (pool, config))
+        goto config_failed;
+    }
+  } else {
+    if (pool)
+      gst_object_unref (pool);
+
+    size = GST_VIDEO_INFO_SIZE (&info);
+    pool = gst_xcbimage_src_new_image_pool (s, caps, video_meta, &size, &min,
+        &max);
+    if (!pool)
+      return FALSE;
+    s->image_pool = gst_object_ref (pool);
+  }
+
+  if (update)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+  gst_object_unref (pool);
+
+  return GST_BASE_SRC_CLASS (parent_class)->decide_allocation (bsrc, query);
+
+  /* ERRORS */
+config_failed:
+  {
+    GST_ELEMENT_ERROR (s, RESOURCE, SETTINGS, (NULL),
+        ("could not configure buffer pool for converted frames"));
+    goto error;
+  }
+error:
+  {
+    gst_xcbimage_src_clear_image_pool (s);
+    if (pool)
+      gst_object_unref (pool);
+    return FALSE;
+  }
+}
+
 static GstCaps *
 gst_xcbimage_src_fixate (GstBaseSrc * bsrc, GstCaps * caps)
 {
@@ -1191,7 +1822,6 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
 
   gc->set_property = gst_xcbimage_src_set_property;
   gc->get_property = gst_xcbimage_src_get_property;
-  gc->dispose = gst_xcbimage_src_dispose;
   gc->finalize = gst_xcbimage_src_finalize;
 
   g_object_class_install_property (gc, PROP_DISPLAY_NAME,
@@ -1279,6 +1909,38 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
       g_param_spec_string ("xname", "Window name",
           "Window name to capture from", NULL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstXcbImageSrc:drop-unchanged:
+   *
+   * Don't output frames which are identical to the previous one. Otherwise
+   * they are output with the GAP and DROPPABLE flags set.
+   */
+  g_object_class_install_property (gc, PROP_DROP_UNCHANGED,
+      g_param_spec_boolean ("drop-unchanged", "Drop unchanged frames",
+          "Skip frames identical to the previous one (needs use-damage)",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstXcbImageSrc:capture-ahead:
+   *
+   * Capture frames on a separate thread as soon as each is due, so that
+   * the time the X server takes doesn't show up as jitter in the output.
+   * Each buffer is then the latest complete frame. Set before starting.
+   */
+  g_object_class_install_property (gc, PROP_CAPTURE_AHEAD,
+      g_param_spec_boolean ("capture-ahead", "Capture ahead",
+          "Capture frames on a separate thread, at the negotiated framerate",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstXcbImageSrc:downscale:
+   *
+   * Shrink the output by this factor in each direction, averaging each
+   * block of pixels. Only I420 and NV12 are offered when it's more than 1.
+   * Set before starting.
+   */
+  g_object_class_install_property (gc, PROP_DOWNSCALE,
+      g_param_spec_uint ("downscale", "Downscale",
+          "Factor to shrink the output by, converting to I420 or NV12",
+          1, 8, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_set_static_metadata (ec, "XcbImage video source",
       "Source/Video",
@@ -1291,9 +1953,11 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
   bc->fixate = gst_xcbimage_src_fixate;
   bc->get_caps = gst_xcbimage_src_get_caps;
   bc->set_caps = gst_xcbimage_src_set_caps;
+  bc->decide_allocation = gst_xcbimage_src_decide_allocation;
   bc->start = gst_xcbimage_src_start;
   bc->stop = gst_xcbimage_src_stop;
   bc->unlock = gst_xcbimage_src_unlock;
+  bc->unlock_stop = gst_xcbimage_src_unlock_stop;
   push_class->create = gst_xcbimage_src_create;
 }
 
@@ -1303,8 +1967,9 @@ gst_xcbimage_src_init (GstXcbImageSrc * xcbimagesrc)
   gst_base_src_set_format (GST_BASE_SRC (xcbimagesrc), GST_FORMAT_TIME);
   gst_base_src_set_live (GST_BASE_SRC (xcbimagesrc), TRUE);
 
-  g_mutex_init (&xcbimagesrc->pool_lock);
   g_mutex_init (&xcbimagesrc->x_lock);
+  g_mutex_init (&xcbimagesrc->ahead_lock);
+  g_cond_init (&xcbimagesrc->ahead_cond);
   xcbimagesrc->show_pointer = TRUE;
   xcbimagesrc->use_damage = TRUE;
   xcbimagesrc->startx = 0;
@@ -1312,6 +1977,7 @@ gst_xcbimage_src_init (GstXcbImageSrc * xcbimagesrc)
   xcbimagesrc->endx = 0;
   xcbimagesrc->endy = 0;
   xcbimagesrc->remote = FALSE;
+  xcbimagesrc->downscale = 1;
 }
 
 static gboolean
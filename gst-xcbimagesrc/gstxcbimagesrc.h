@@ -21,6 +21,7 @@
 
 #include <gst/gst.h>
 #include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
 #include "xcbimageutil.h"
 
 #ifdef HAVE_XFIXES
@@ -72,10 +73,6 @@ struct _GstXcbImageSrc
   /* Protect X Windows calls */
   GMutex  x_lock;
 
-  /* Gathered pool of emitted buffers */
-  GMutex  pool_lock;
-  GSList *buffer_pool;
-
   /* XFixes and XDamage support */
   gboolean have_xfixes;
   gboolean have_xdamage;
@@ -91,9 +88,46 @@ struct _GstXcbImageSrc
   /* whether to use remote friendly calls */
   gboolean remote;
 
+  /* whether to skip frames identical to the previous one */
+  gboolean drop_unchanged;
+
+  /* Capture thread, and the latest frame it captured for create() */
+  gboolean capture_ahead;
+  GThread *ahead_thread;
+  GMutex ahead_lock;
+  GCond ahead_cond;
+  gboolean ahead_running;
+  gboolean ahead_flushing;
+  GstFlowReturn ahead_ret;
+  GstBuffer *ahead_frame;
+  GstClockTime ahead_ts;
+  GstClockTime ahead_dur;
+
+  /* Integer factor to shrink the output by when converting it */
+  guint downscale;
+
+  /* The negotiated output, and the conversion to it from the screen's own
+   * format when it's anything else */
+  GstVideoInfo out_info;
+  gint out_scale;
+  struct _GstXcbConvert *conv;
+
+  /* Pool the screen is captured into; the negotiated one unless
+   * converting */
+  GstBufferPool *image_pool;
+
+  /* The last converted frame, patched with what changed since */
+  GstBuffer *last_output;
+
+#ifdef HAVE_XCB_SHM
+  /* Native XCB capture engine, used in preference to Xlib */
+  struct _GstXcbCapture *xcb;
+#endif
+
 #ifdef HAVE_XFIXES
   int fixes_event_base;
   XFixesCursorImage *cursor_image;
+  GstXCursor cursor;
 #endif
 #ifdef HAVE_XDAMAGE
   Damage damage;
@@ -109,6 +143,19 @@ struct _GstXcbImageSrcClass
   GstPushSrcClass parent_class;
 };
 
+/* roi_type of the GstVideoRegionOfInterestMeta attached to each buffer for
+ * every rectangle which changed since the previous one. A buffer without
+ * any has changed completely, unless it is flagged GST_BUFFER_FLAG_GAP, in
+ * which case it is identical to the previous buffer. */
+#define GST_XCBIMAGE_SRC_DAMAGE_QUARK (g_quark_from_static_string ("damage"))
+
+/* For xcbcapture.c */
+GstFlowReturn gst_xcbimage_src_acquire_image (GstXcbImageSrc * xcbimagesrc,
+    GstBuffer ** image);
+void gst_xcbimage_src_clear_damage (GstBuffer * buffer);
+void gst_xcbimage_src_add_damage (GstBuffer * buffer, guint x, guint y,
+    guint width, guint height);
+
 G_END_DECLS
 
 #endif /* __GST_XCBIMAGE_SRC_H__ */
@@ -0,0 +1,492 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Capture engine which talks XCB directly, rather than going through
+ * Xlib's locking and event queue for every frame.
+ *
+ * Full frames are read with xcb_shm_get_image() straight into the
+ * buffer's own SHM segment. With damage tracking, only the damaged
+ * rectangles (and wherever the cursor was drawn last time) are fetched
+ * again, each recorded as a region of interest meta on the buffer. If
+ * downstream has finished with the previous frame, it is patched in
+ * place; otherwise it has to be copied first. A frame in which nothing
+ * changed at all is the previous one again, flagged as a GAP.
+ *
+ * All the requests for a frame are sent before we wait for any of the
+ * replies, so the server works on the image while we're still dealing
+ * with the cursor and the damage.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "xcbcapture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_XCB_DAMAGE
+#include <xcb/damage.h>
+#include <xcb/xfixes.h>
+#endif
+
+#ifdef HAVE_XCB_SHM
+
+GST_DEBUG_CATEGORY_EXTERN (gst_debug_xcbimage_src);
+#define GST_CAT_DEFAULT gst_debug_xcbimage_src
+
+/* Past this many damaged rectangles, just grab the whole thing */
+#define MAX_RECTS 64
+
+struct _GstXcbCapture
+{
+  GstXcbImageSrc *src;
+  xcb_connection_t *conn;
+
+#ifdef HAVE_XCB_DAMAGE
+  gboolean have_xfixes;
+  xcb_damage_damage_t damage;
+  xcb_xfixes_region_t region;
+  guint8 damage_event;
+
+  /* Where the cursor was drawn into the last frame, in window
+   * co-ordinates. Zero width if it wasn't. */
+  xcb_rectangle_t cursor_rect;
+  gint16 cursor_x, cursor_y;
+
+  /* The cursor image, ready for drawing */
+  GstXCursor cursor;
+#endif
+
+  /* The previous frame, which damaged frames are patched from */
+  GstBuffer *last;
+};
+
+GstXcbCapture *
+gst_xcb_capture_new (GstXcbImageSrc * src)
+{
+  GstXcbCapture *cap = g_new0 (GstXcbCapture, 1);
+
+  cap->src = src;
+  cap->conn = src->xcontext->conn;
+
+#ifdef HAVE_XCB_DAMAGE
+  if (xcb_get_extension_data (cap->conn, &xcb_xfixes_id)->present) {
+    xcb_xfixes_query_version_reply_t *ver;
+
+    /* Regions need XFixes 2 */
+    ver = xcb_xfixes_query_version_reply (cap->conn,
+        xcb_xfixes_query_version (cap->conn, 4, 0), NULL);
+    cap->have_xfixes = ver && ver->major_version >= 2;
+    free (ver);
+  }
+
+  if (cap->have_xfixes &&
+      xcb_get_extension_data (cap->conn, &xcb_damage_id)->present) {
+    const xcb_query_extension_reply_t *ext =
+        xcb_get_extension_data (cap->conn, &xcb_damage_id);
+    xcb_damage_query_version_reply_t *ver;
+
+    ver = xcb_damage_query_version_reply (cap->conn,
+        xcb_damage_query_version (cap->conn, 1, 1), NULL);
+    if (ver) {
+      cap->damage = xcb_generate_id (cap->conn);
+      xcb_damage_create (cap->conn, cap->damage, src->xwindow,
+          XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+      cap->region = xcb_generate_id (cap->conn);
+      xcb_xfixes_create_region (cap->conn, cap->region, 0, NULL);
+      cap->damage_event = ext->first_event + XCB_DAMAGE_NOTIFY;
+      free (ver);
+      GST_DEBUG_OBJECT (src, "Using XCB damage extension");
+    }
+  }
+#endif
+
+  GST_DEBUG_OBJECT (src, "Using XCB capture (%s)",
+      src->xcontext->use_xcb_shm ? "SHM" : "GetImage");
+  return cap;
+}
+
+void
+gst_xcb_capture_reset (GstXcbCapture * cap)
+{
+  if (cap->last)
+    gst_buffer_unref (cap->last);
+  cap->last = NULL;
+#ifdef HAVE_XCB_DAMAGE
+  cap->cursor_rect.width = 0;
+#endif
+}
+
+void
+gst_xcb_capture_free (GstXcbCapture * cap)
+{
+  gst_xcb_capture_reset (cap);
+
+#ifdef HAVE_XCB_DAMAGE
+  xcbimageutil_cursor_clear (&cap->cursor);
+  if (cap->damage)
+    xcb_damage_destroy (cap->conn, cap->damage);
+  if (cap->region)
+    xcb_xfixes_destroy_region (cap->conn, cap->region);
+  xcb_flush (cap->conn);
+#endif
+
+  g_free (cap);
+}
+
+/* Clip @r, in window co-ordinates, to the area we capture */
+static gboolean
+clip_rect (GstXcbImageSrc * src, xcb_rectangle_t * r)
+{
+  gint x1 = MAX (r->x, (gint) src->startx);
+  gint y1 = MAX (r->y, (gint) src->starty);
+  gint x2 = MIN (r->x + r->width, (gint) src->startx + src->width);
+  gint y2 = MIN (r->y + r->height, (gint) src->starty + src->height);
+
+  if (x2 <= x1 || y2 <= y1)
+    return FALSE;
+
+  r->x = x1;
+  r->y = y1;
+  r->width = x2 - x1;
+  r->height = y2 - y1;
+  return TRUE;
+}
+
+/* Read each of @rects into the image over the socket, all requests first */
+static gboolean
+fetch_rects (GstXcbCapture * cap, GstMetaXcbImage * meta,
+    const xcb_rectangle_t * rects, gint n_rects)
+{
+  GstXcbImageSrc *src = cap->src;
+  xcb_get_image_cookie_t cookies[MAX_RECTS + 1];
+  gint bypp = src->xcontext->bpp / 8;
+  gboolean ret = TRUE;
+  gint i, row;
+
+  g_return_val_if_fail (n_rects <= MAX_RECTS + 1, FALSE);
+
+  for (i = 0; i < n_rects; i++)
+    cookies[i] = xcb_get_image (cap->conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+        src->xwindow, rects[i].x, rects[i].y, rects[i].width,
+        rects[i].height, ~0);
+
+  for (i = 0; i < n_rects; i++) {
+    xcb_generic_error_t *err = NULL;
+    xcb_get_image_reply_t *reply;
+    const guint8 *data;
+    guint8 *dest;
+    gint stride;
+
+    reply = xcb_get_image_reply (cap->conn, cookies[i], &err);
+    if (!reply) {
+      GST_WARNING_OBJECT (src, "GetImage %dx%d@%d,%d failed: %d",
+          rects[i].width, rects[i].height, rects[i].x, rects[i].y,
+          err ? err->error_code : -1);
+      free (err);
+      ret = FALSE;
+      continue;
+    }
+
+    data = xcb_get_image_data (reply);
+    stride = xcb_get_image_data_length (reply) / rects[i].height;
+    dest = meta->data + (rects[i].y - src->starty) * meta->stride +
+        (rects[i].x - src->startx) * bypp;
+
+    for (row = 0; row < rects[i].height; row++)
+      memcpy (dest + row * meta->stride, data + row * stride,
+          rects[i].width * bypp);
+    free (reply);
+  }
+
+  return ret;
+}
+
+static gboolean
+capture_full (GstXcbCapture * cap, GstMetaXcbImage * meta)
+{
+  GstXcbImageSrc *src = cap->src;
+  xcb_shm_get_image_reply_t *reply;
+  xcb_generic_error_t *err = NULL;
+  xcb_rectangle_t r;
+
+  if (!meta->shmseg) {
+    r.x = src->startx;
+    r.y = src->starty;
+    r.width = src->width;
+    r.height = src->height;
+    return fetch_rects (cap, meta, &r, 1);
+  }
+
+  reply = xcb_shm_get_image_reply (cap->conn,
+      xcb_shm_get_image (cap->conn, src->xwindow, src->startx, src->starty,
+          src->width, src->height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP,
+          meta->shmseg, 0), &err);
+  if (!reply) {
+    GST_WARNING_OBJECT (src, "ShmGetImage failed: %d",
+        err ? err->error_code : -1);
+    free (err);
+    return FALSE;
+  }
+  free (reply);
+  return TRUE;
+}
+
+#ifdef HAVE_XCB_DAMAGE
+/* Returns TRUE if any damage has been reported since we last looked */
+static gboolean
+drain_events (GstXcbCapture * cap)
+{
+  xcb_generic_event_t *ev;
+  gboolean damaged = FALSE;
+
+  while ((ev = xcb_poll_for_event (cap->conn))) {
+    if ((ev->response_type & 0x7f) == cap->damage_event)
+      damaged = TRUE;
+    else if (ev->response_type == 0)
+      GST_DEBUG_OBJECT (cap->src, "X error %d",
+          ((xcb_generic_error_t *) ev)->error_code);
+    free (ev);
+  }
+
+  return damaged;
+}
+
+static gboolean
+cursor_changed (GstXcbCapture * cap,
+    xcb_xfixes_get_cursor_image_reply_t * cursor)
+{
+  if (!cursor)
+    return cap->cursor_rect.width != 0;
+
+  return cursor->cursor_serial != cap->cursor.serial ||
+      cursor->x != cap->cursor_x || cursor->y != cap->cursor_y;
+}
+
+static void
+draw_cursor (GstXcbCapture * cap, GstMetaXcbImage * meta,
+    xcb_xfixes_get_cursor_image_reply_t * cursor)
+{
+  GstXcbImageSrc *src = cap->src;
+  gint bypp = src->xcontext->bpp / 8;
+  xcb_rectangle_t r;
+  gint cx, cy, j;
+
+  if (!xcbimageutil_cursor_is_current (&cap->cursor, cursor->cursor_serial))
+    xcbimageutil_cursor_set (src->xcontext, &cap->cursor,
+        cursor->cursor_serial, cursor->width, cursor->height,
+        xcb_xfixes_get_cursor_image_cursor_image (cursor));
+  cap->cursor_x = cursor->x;
+  cap->cursor_y = cursor->y;
+
+  /* Top left of the cursor, in window co-ordinates */
+  cx = cursor->x - cursor->xhot - src->x;
+  cy = cursor->y - cursor->yhot - src->y;
+
+  r.x = cx;
+  r.y = cy;
+  r.width = cursor->width;
+  r.height = cursor->height;
+  if (!clip_rect (src, &r))
+    return;
+
+  for (j = r.y; j < r.y + r.height; j++)
+    xcbimageutil_cursor_blend_row (src->xcontext, &cap->cursor, r.x - cx,
+        j - cy, meta->data + (j - src->starty) * meta->stride +
+        (r.x - src->startx) * bypp, r.width);
+
+  cap->cursor_rect = r;
+}
+
+/* The previous frame, if nobody downstream holds it or its memory any
+ * more, so that it can be patched in place rather than copied. Our own
+ * reference is handed over with it, leaving it writable. */
+static GstBuffer *
+take_last (GstXcbCapture * cap)
+{
+  GstBuffer *last = cap->last;
+
+  if (GST_MINI_OBJECT_REFCOUNT_VALUE (last) == 1 &&
+      gst_buffer_is_all_memory_writable (last)) {
+    cap->last = NULL;
+    return last;
+  }
+
+  return NULL;
+}
+#endif
+
+/* Capture a frame, into a new image or by patching the previous one. Any
+ * error has been posted on the element by the time this returns. */
+GstFlowReturn
+gst_xcb_capture_frame (GstXcbCapture * cap, GstBuffer ** image)
+{
+  GstXcbImageSrc *src = cap->src;
+  GstBuffer *xcbimage = NULL;
+  GstMetaXcbImage *meta;
+  GstFlowReturn ret;
+  gboolean ok;
+#ifdef HAVE_XCB_DAMAGE
+  xcb_xfixes_get_cursor_image_cookie_t cursor_cookie = { 0 };
+  xcb_xfixes_fetch_region_cookie_t region_cookie = { 0 };
+  xcb_xfixes_get_cursor_image_reply_t *cursor = NULL;
+  xcb_rectangle_t rects[MAX_RECTS + 1];
+  gint n_rects = 0, i;
+  gboolean want_cursor, damaged = FALSE, incremental = FALSE;
+
+  /* Send everything we need before waiting for any of it */
+  want_cursor = src->show_pointer && cap->have_xfixes;
+  if (want_cursor)
+    cursor_cookie = xcb_xfixes_get_cursor_image (cap->conn);
+
+  if (cap->damage && src->use_damage && cap->last) {
+    meta = GST_META_XCBIMAGE_GET (cap->last);
+    incremental = meta->width == src->width && meta->height == src->height;
+  }
+
+  if (cap->damage) {
+    damaged = drain_events (cap);
+    if (!incremental) {
+      /* We're about to grab it all; forget what came before */
+      xcb_damage_subtract (cap->conn, cap->damage, XCB_NONE, XCB_NONE);
+    } else if (damaged) {
+      xcb_damage_subtract (cap->conn, cap->damage, XCB_NONE, cap->region);
+      region_cookie = xcb_xfixes_fetch_region (cap->conn, cap->region);
+    }
+  }
+
+  if (want_cursor)
+    cursor = xcb_xfixes_get_cursor_image_reply (cap->conn, cursor_cookie,
+        NULL);
+
+  if (incremental && damaged) {
+    xcb_xfixes_fetch_region_reply_t *reply;
+
+    reply = xcb_xfixes_fetch_region_reply (cap->conn, region_cookie, NULL);
+    if (reply) {
+      xcb_rectangle_t *r = xcb_xfixes_fetch_region_rectangles (reply);
+      gint n = xcb_xfixes_fetch_region_rectangles_length (reply);
+
+      for (i = 0; i < n && n_rects < MAX_RECTS; i++) {
+        rects[n_rects] = r[i];
+        if (clip_rect (src, &rects[n_rects]))
+          n_rects++;
+      }
+      if (i < n) {
+        GST_LOG_OBJECT (src, "Too much damage; capturing full frame");
+        incremental = FALSE;
+      }
+      free (reply);
+    } else {
+      incremental = FALSE;
+    }
+  }
+
+  if (incremental && !n_rects && !cursor_changed (cap, cursor)) {
+    /* Nothing to do. Hand out the same pixels again. */
+    xcbimage = take_last (cap);
+    if (!xcbimage)
+      xcbimage = gst_buffer_copy (cap->last);
+    gst_xcbimage_src_clear_damage (xcbimage);
+    GST_BUFFER_FLAGS (xcbimage) =
+        GST_BUFFER_FLAG_GAP | GST_BUFFER_FLAG_DROPPABLE;
+    if (!cap->last)
+      cap->last = gst_buffer_ref (xcbimage);
+    free (cursor);
+    *image = xcbimage;
+    return GST_FLOW_OK;
+  }
+
+  if (incremental) {
+    /* The cursor is redrawn from scratch, over what's really there */
+    if (cap->cursor_rect.width)
+      rects[n_rects++] = cap->cursor_rect;
+
+    xcbimage = take_last (cap);
+    if (xcbimage) {
+      GST_LOG_OBJECT (src, "Patching last frame in place");
+      meta = GST_META_XCBIMAGE_GET (xcbimage);
+      gst_xcbimage_src_clear_damage (xcbimage);
+      GST_BUFFER_FLAGS (xcbimage) = 0;
+    } else {
+      ret = gst_xcbimage_src_acquire_image (src, &xcbimage);
+      if (ret != GST_FLOW_OK)
+        goto out;
+      meta = GST_META_XCBIMAGE_GET (xcbimage);
+      GST_LOG_OBJECT (src, "Copying from last frame, size %" G_GSIZE_FORMAT,
+          meta->size);
+      memcpy (meta->data, GST_META_XCBIMAGE_GET (cap->last)->data,
+          meta->size);
+    }
+
+    GST_LOG_OBJECT (src, "Capturing %d damaged rectangles", n_rects);
+    ok = fetch_rects (cap, meta, rects, n_rects);
+    for (i = 0; i < n_rects; i++)
+      gst_xcbimage_src_add_damage (xcbimage, rects[i].x - src->startx,
+          rects[i].y - src->starty, rects[i].width, rects[i].height);
+  } else
+#endif
+  {
+    ret = gst_xcbimage_src_acquire_image (src, &xcbimage);
+    if (ret != GST_FLOW_OK)
+      goto out;
+    meta = GST_META_XCBIMAGE_GET (xcbimage);
+    ok = capture_full (cap, meta);
+  }
+
+#ifdef HAVE_XCB_DAMAGE
+  cap->cursor_rect.width = 0;
+  if (cursor) {
+    draw_cursor (cap, meta, cursor);
+    if (incremental && cap->cursor_rect.width)
+      gst_xcbimage_src_add_damage (xcbimage,
+          cap->cursor_rect.x - src->startx, cap->cursor_rect.y - src->starty,
+          cap->cursor_rect.width, cap->cursor_rect.height);
+  }
+#endif
+
+  if (!ok) {
+    GST_ELEMENT_ERROR (src, RESOURCE, READ, (NULL),
+        ("could not capture a %dx%d image", src->width, src->height));
+    gst_buffer_unref (xcbimage);
+    ret = GST_FLOW_ERROR;
+    goto out;
+  }
+
+#ifdef HAVE_XCB_DAMAGE
+  if (cap->damage && src->use_damage && xcbimage != cap->last) {
+    if (cap->last)
+      gst_buffer_unref (cap->last);
+    cap->last = gst_buffer_ref (xcbimage);
+  }
+#endif
+
+  *image = xcbimage;
+  ret = GST_FLOW_OK;
+
+out:
+#ifdef HAVE_XCB_DAMAGE
+  free (cursor);
+#endif
+  return ret;
+}
+
+#endif /* HAVE_XCB_SHM */
@@ -0,0 +1,39 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_XCB_CAPTURE_H__
+#define __GST_XCB_CAPTURE_H__
+
+#include "gstxcbimagesrc.h"
+
+G_BEGIN_DECLS
+
+#ifdef HAVE_XCB_SHM
+
+typedef struct _GstXcbCapture GstXcbCapture;
+
+GstXcbCapture *gst_xcb_capture_new (GstXcbImageSrc * src);
+void gst_xcb_capture_free (GstXcbCapture * cap);
+void gst_xcb_capture_reset (GstXcbCapture * cap);
+GstFlowReturn gst_xcb_capture_frame (GstXcbCapture * cap, GstBuffer ** image);
+
+#endif /* HAVE_XCB_SHM */
+
+G_END_DECLS
+
+#endif /* __GST_XCB_CAPTURE_H__ */
@@ -0,0 +1,331 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Conversion of captured 8888 screen images to I420 or NV12, optionally
+ * shrinking them by an integer factor on the way, so that an encoder can
+ * take them without a separate videoconvert pass over the whole frame.
+ * The element only asks for the rectangles which changed.
+ *
+ * BT.601 limited range, with each chroma sample the average of a 2x2
+ * block. The rows are done four pixels at a time with SSE2 where the
+ * compiler targets it; the scalar code does the rest, and gives the same
+ * results.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "xcbconvert.h"
+
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* (x + Y_BIAS) >> 8 is the luma for a dot product x, and
+ * (x + C_BIAS) >> 9 the chroma for one over two pixels */
+#define Y_BIAS (128 + (16 << 8))
+#define C_BIAS (256 + (128 << 9))
+
+struct _GstXcbConvert
+{
+  GstVideoFormat format;
+  gint scale;
+
+  /* BT.601 coefficients for each byte of two pixels */
+  gint16 coef_y[8];
+  gint16 coef_u[8];
+  gint16 coef_v[8];
+
+  /* Two rows of the shrunken image, when scaling */
+  guint8 *scratch[2];
+};
+
+gboolean
+gst_xcb_convert_supported (GstXContext * xcontext)
+{
+  return xcontext->format.is_8888;
+}
+
+static void
+set_coefs (gint16 * coef, const GstXPixelFormat * fmt, gint r, gint g, gint b)
+{
+  gint i;
+
+  for (i = 0; i < 8; i += 4) {
+    coef[i + fmt->r_shift / 8] = r;
+    coef[i + fmt->g_shift / 8] = g;
+    coef[i + fmt->b_shift / 8] = b;
+    coef[i + fmt->a_shift / 8] = 0;
+  }
+}
+
+GstXcbConvert *
+gst_xcb_convert_new (GstXContext * xcontext, const GstVideoInfo * out_info,
+    gint scale)
+{
+  GstXcbConvert *conv;
+
+  g_return_val_if_fail (gst_xcb_convert_supported (xcontext), NULL);
+  g_return_val_if_fail (GST_VIDEO_INFO_FORMAT (out_info) ==
+      GST_VIDEO_FORMAT_I420
+      || GST_VIDEO_INFO_FORMAT (out_info) == GST_VIDEO_FORMAT_NV12, NULL);
+
+  conv = g_new0 (GstXcbConvert, 1);
+  conv->format = GST_VIDEO_INFO_FORMAT (out_info);
+  conv->scale = MAX (scale, 1);
+
+  set_coefs (conv->coef_y, &xcontext->format, 66, 129, 25);
+  set_coefs (conv->coef_u, &xcontext->format, -38, -74, 112);
+  set_coefs (conv->coef_v, &xcontext->format, 112, -94, -18);
+
+  if (conv->scale > 1) {
+    conv->scratch[0] = g_malloc (GST_VIDEO_INFO_WIDTH (out_info) * 4);
+    conv->scratch[1] = g_malloc (GST_VIDEO_INFO_WIDTH (out_info) * 4);
+  }
+
+  return conv;
+}
+
+void
+gst_xcb_convert_free (GstXcbConvert * conv)
+{
+  g_free (conv->scratch[0]);
+  g_free (conv->scratch[1]);
+  g_free (conv);
+}
+
+static inline gint
+dot (const gint16 * coef, const guint8 * p)
+{
+  return coef[0] * p[0] + coef[1] * p[1] + coef[2] * p[2] + coef[3] * p[3];
+}
+
+#if defined (__SSE2__)
+/* [a0 b0 a1 b1] [a2 b2 a3 b3] -> [a0+b0 a1+b1 a2+b2 a3+b3] */
+static inline __m128i
+hadd_pairs (__m128i lo, __m128i hi)
+{
+  lo = _mm_shuffle_epi32 (lo, _MM_SHUFFLE (3, 1, 2, 0));
+  hi = _mm_shuffle_epi32 (hi, _MM_SHUFFLE (3, 1, 2, 0));
+  return _mm_add_epi32 (_mm_unpacklo_epi64 (lo, hi),
+      _mm_unpackhi_epi64 (lo, hi));
+}
+
+/* Four 8888 pixels -> [p0+p1 | p2+p3], each byte widened to 16 bits */
+static inline __m128i
+sum_pairs (__m128i p)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i lo = _mm_unpacklo_epi8 (p, zero);
+  __m128i hi = _mm_unpackhi_epi8 (p, zero);
+
+  lo = _mm_add_epi16 (lo, _mm_srli_si128 (lo, 8));
+  hi = _mm_add_epi16 (hi, _mm_srli_si128 (hi, 8));
+  return _mm_unpacklo_epi64 (lo, hi);
+}
+#endif
+
+static void
+convert_y_row (const GstXcbConvert * conv, guint8 * y, const guint8 * src,
+    gint n)
+{
+  gint i = 0;
+
+#if defined (__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i coef = _mm_loadu_si128 ((const __m128i *) conv->coef_y);
+  const __m128i bias = _mm_set1_epi32 (Y_BIAS);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128 ((const __m128i *) (src + i * 4));
+    __m128i sum;
+    gint32 out;
+
+    sum = hadd_pairs (_mm_madd_epi16 (_mm_unpacklo_epi8 (p, zero), coef),
+        _mm_madd_epi16 (_mm_unpackhi_epi8 (p, zero), coef));
+    sum = _mm_srai_epi32 (_mm_add_epi32 (sum, bias), 8);
+    sum = _mm_packs_epi32 (sum, sum);
+    out = _mm_cvtsi128_si32 (_mm_packus_epi16 (sum, sum));
+    memcpy (y + i, &out, 4);
+  }
+#endif
+
+  for (; i < n; i++)
+    y[i] = (dot (conv->coef_y, src + i * 4) + Y_BIAS) >> 8;
+}
+
+/* One row of chroma from two rows of @n pixels. @step is the distance
+ * between samples in @u and @v: 1 for I420, 2 for NV12. */
+static void
+convert_uv_row (const GstXcbConvert * conv, guint8 * u, guint8 * v,
+    gint step, const guint8 * s0, const guint8 * s1, gint n)
+{
+  gint i = 0, k;
+
+#if defined (__SSE2__)
+  const __m128i coef_u = _mm_loadu_si128 ((const __m128i *) conv->coef_u);
+  const __m128i coef_v = _mm_loadu_si128 ((const __m128i *) conv->coef_v);
+  const __m128i bias = _mm_set1_epi32 (C_BIAS);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a0, a1, us, vs, uv;
+
+    a0 = sum_pairs (_mm_avg_epu8 (_mm_loadu_si128 ((const __m128i *)
+                (s0 + i * 4)), _mm_loadu_si128 ((const __m128i *)
+                (s1 + i * 4))));
+    a1 = sum_pairs (_mm_avg_epu8 (_mm_loadu_si128 ((const __m128i *)
+                (s0 + i * 4 + 16)), _mm_loadu_si128 ((const __m128i *)
+                (s1 + i * 4 + 16))));
+
+    us = hadd_pairs (_mm_madd_epi16 (a0, coef_u), _mm_madd_epi16 (a1, coef_u));
+    vs = hadd_pairs (_mm_madd_epi16 (a0, coef_v), _mm_madd_epi16 (a1, coef_v));
+    us = _mm_srai_epi32 (_mm_add_epi32 (us, bias), 9);
+    vs = _mm_srai_epi32 (_mm_add_epi32 (vs, bias), 9);
+
+    /* U0 U1 U2 U3 V0 V1 V2 V3 */
+    uv = _mm_packus_epi16 (_mm_packs_epi32 (us, vs), _mm_setzero_si128 ());
+    if (step == 1) {
+      gint32 out = _mm_cvtsi128_si32 (uv);
+
+      memcpy (u + i / 2, &out, 4);
+      out = _mm_cvtsi128_si32 (_mm_srli_si128 (uv, 4));
+      memcpy (v + i / 2, &out, 4);
+    } else {
+      _mm_storel_epi64 ((__m128i *) (u + i),
+          _mm_unpacklo_epi8 (uv, _mm_srli_si128 (uv, 4)));
+    }
+  }
+#endif
+
+  for (; i < n; i += 2) {
+    gint su = 0, sv = 0;
+
+    for (k = 0; k < 4; k++) {
+      /* Averaged down, then summed across, like the SIMD path */
+      gint q = ((s0[i * 4 + k] + s1[i * 4 + k] + 1) >> 1) +
+          ((s0[i * 4 + 4 + k] + s1[i * 4 + 4 + k] + 1) >> 1);
+
+      su += conv->coef_u[k] * q;
+      sv += conv->coef_v[k] * q;
+    }
+    u[(i / 2) * step] = (su + C_BIAS) >> 9;
+    v[(i / 2) * step] = (sv + C_BIAS) >> 9;
+  }
+}
+
+/* Shrink @n blocks of @scale x @scale pixels, from rows @stride apart,
+ * into a row of @n pixels */
+static void
+downscale_row (const GstXcbConvert * conv, guint8 * dest, const guint8 * src,
+    gint stride, gint n)
+{
+  gint scale = conv->scale;
+  gint area = scale * scale;
+  gint i = 0, j, k, c;
+
+  if (scale == 2) {
+#if defined (__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+      const guint8 *p = src + i * 8;
+      __m128i a0 = _mm_avg_epu8 (_mm_loadu_si128 ((const __m128i *) p),
+          _mm_loadu_si128 ((const __m128i *) (p + stride)));
+      __m128i a1 = _mm_avg_epu8 (_mm_loadu_si128 ((const __m128i *) (p + 16)),
+          _mm_loadu_si128 ((const __m128i *) (p + stride + 16)));
+      __m128 f0 = _mm_castsi128_ps (a0), f1 = _mm_castsi128_ps (a1);
+      __m128i even = _mm_castps_si128 (_mm_shuffle_ps (f0, f1,
+              _MM_SHUFFLE (2, 0, 2, 0)));
+      __m128i odd = _mm_castps_si128 (_mm_shuffle_ps (f0, f1,
+              _MM_SHUFFLE (3, 1, 3, 1)));
+
+      _mm_storeu_si128 ((__m128i *) (dest + i * 4), _mm_avg_epu8 (even, odd));
+    }
+#endif
+    /* Rounded the same way as the SIMD path */
+    for (; i < n; i++) {
+      const guint8 *p = src + i * 8;
+
+      for (c = 0; c < 4; c++)
+        dest[i * 4 + c] = (((p[c] + p[stride + c] + 1) >> 1) +
+            ((p[4 + c] + p[stride + 4 + c] + 1) >> 1) + 1) >> 1;
+    }
+    return;
+  }
+
+  for (; i < n; i++) {
+    guint sum[4] = { 0, 0, 0, 0 };
+
+    for (j = 0; j < scale; j++) {
+      const guint8 *p = src + j * stride + i * scale * 4;
+
+      for (k = 0; k < scale * 4; k++)
+        sum[k & 3] += p[k];
+    }
+    for (c = 0; c < 4; c++)
+      dest[i * 4 + c] = (sum[c] + area / 2) / area;
+  }
+}
+
+/* Convert the @width x @height rectangle at @x,@y of the output, all even,
+ * from @image into @frame */
+void
+gst_xcb_convert_rect (GstXcbConvert * conv, GstMetaXcbImage * image,
+    GstVideoFrame * frame, gint x, gint y, gint width, gint height)
+{
+  gint scale = conv->scale;
+  guint8 *ydata = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+  gint ystride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0);
+  guint8 *udata = GST_VIDEO_FRAME_PLANE_DATA (frame, 1);
+  gint ustride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 1);
+  gint row;
+
+  for (row = y; row < y + height; row += 2) {
+    const guint8 *s0, *s1;
+    guint8 *u, *v;
+    gint step;
+
+    s0 = image->data + row * scale * image->stride + x * scale * 4;
+    if (scale > 1) {
+      downscale_row (conv, conv->scratch[0], s0, image->stride, width);
+      downscale_row (conv, conv->scratch[1], s0 + scale * image->stride,
+          image->stride, width);
+      s0 = conv->scratch[0];
+      s1 = conv->scratch[1];
+    } else {
+      s1 = s0 + image->stride;
+    }
+
+    convert_y_row (conv, ydata + row * ystride + x, s0, width);
+    convert_y_row (conv, ydata + (row + 1) * ystride + x, s1, width);
+
+    if (conv->format == GST_VIDEO_FORMAT_I420) {
+      u = udata + row / 2 * ustride + x / 2;
+      v = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (frame, 2) +
+          row / 2 * GST_VIDEO_FRAME_PLANE_STRIDE (frame, 2) + x / 2;
+      step = 1;
+    } else {
+      u = udata + row / 2 * ustride + x;
+      v = u + 1;
+      step = 2;
+    }
+    convert_uv_row (conv, u, v, step, s0, s1, width);
+  }
+}
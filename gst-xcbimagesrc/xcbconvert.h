@@ -0,0 +1,39 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_XCB_CONVERT_H__
+#define __GST_XCB_CONVERT_H__
+
+#include <gst/video/video.h>
+
+#include "xcbimageutil.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstXcbConvert GstXcbConvert;
+
+gboolean gst_xcb_convert_supported (GstXContext * xcontext);
+GstXcbConvert *gst_xcb_convert_new (GstXContext * xcontext,
+    const GstVideoInfo * out_info, gint scale);
+void gst_xcb_convert_free (GstXcbConvert * conv);
+void gst_xcb_convert_rect (GstXcbConvert * conv, GstMetaXcbImage * image,
+    GstVideoFrame * frame, gint x, gint y, gint width, gint height);
+
+G_END_DECLS
+
+#endif /* __GST_XCB_CONVERT_H__ */
@@ -0,0 +1,240 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Buffer pool of images the X server can write into directly, offered to
+ * downstream in the ALLOCATION query. Each buffer carries a GstVideoMeta
+ * with the image's real stride if downstream asked for one, so that it
+ * can work on the pixels where they are.
+ *
+ * The images are the size of the capture area when the pool was
+ * configured. One that comes back after the capture area changed, or
+ * with its memory replaced, is destroyed rather than recycled.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "xcbimagepool.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_debug_xcbimage_src);
+#define GST_CAT_DEFAULT gst_debug_xcbimage_src
+
+#define gst_xcbimage_buffer_pool_parent_class parent_class
+G_DEFINE_TYPE (GstXcbImageBufferPool, gst_xcbimage_buffer_pool,
+    GST_TYPE_BUFFER_POOL);
+
+static const gchar **
+xcbimage_buffer_pool_get_options (GstBufferPool * pool)
+{
+  static const gchar *options[] = { GST_BUFFER_POOL_OPTION_VIDEO_META,
+    NULL
+  };
+
+  return options;
+}
+
+static gboolean
+xcbimage_buffer_pool_set_config (GstBufferPool * pool, GstStructure * config)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstXcbImageSrc *src = xpool->src;
+  GstCaps *caps;
+  guint size, min, max;
+
+  if (!gst_buffer_pool_config_get_params (config, &caps, &size, &min, &max))
+    goto wrong_config;
+
+  if (caps == NULL)
+    goto no_caps;
+
+  if (!gst_video_info_from_caps (&xpool->info, caps))
+    goto wrong_caps;
+
+  if (!src->xcontext)
+    goto no_display;
+
+  xpool->width = GST_VIDEO_INFO_WIDTH (&xpool->info);
+  xpool->height = GST_VIDEO_INFO_HEIGHT (&xpool->info);
+  xpool->stride = xcbimageutil_image_stride (src->xcontext, xpool->width);
+  xpool->add_metavideo = gst_buffer_pool_config_has_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+  if (!xpool->add_metavideo &&
+      xpool->stride != GST_VIDEO_INFO_PLANE_STRIDE (&xpool->info, 0))
+    GST_WARNING_OBJECT (pool, "downstream can't take a stride of %d, "
+        "rather than %d", xpool->stride,
+        GST_VIDEO_INFO_PLANE_STRIDE (&xpool->info, 0));
+
+  /* The pool checks returning buffers against this */
+  size = xpool->stride * xpool->height;
+
+  GST_DEBUG_OBJECT (pool, "%dx%d images, stride %d, size %u, video meta %d",
+      xpool->width, xpool->height, xpool->stride, size, xpool->add_metavideo);
+
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+
+  return GST_BUFFER_POOL_CLASS (parent_class)->set_config (pool, config);
+
+  /* ERRORS */
+wrong_config:
+  {
+    GST_WARNING_OBJECT (pool, "invalid config");
+    return FALSE;
+  }
+no_caps:
+  {
+    GST_WARNING_OBJECT (pool, "no caps in config");
+    return FALSE;
+  }
+wrong_caps:
+  {
+    GST_WARNING_OBJECT (pool,
+        "failed getting geometry from caps %" GST_PTR_FORMAT, caps);
+    return FALSE;
+  }
+no_display:
+  {
+    GST_WARNING_OBJECT (pool, "no display to allocate images on");
+    return FALSE;
+  }
+}
+
+static GstFlowReturn
+xcbimage_buffer_pool_alloc (GstBufferPool * pool, GstBuffer ** buffer,
+    GstBufferPoolAcquireParams * params)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstXcbImageSrc *src = xpool->src;
+  GstVideoInfo *info = &xpool->info;
+  GstMetaXcbImage *meta;
+  GstBuffer *xcbimage;
+
+  g_mutex_lock (&src->x_lock);
+  if (src->xcontext)
+    xcbimage = gst_xcbimageutil_xcbimage_new (src->xcontext,
+        GST_ELEMENT (src), xpool->width, xpool->height);
+  else
+    xcbimage = NULL;
+  g_mutex_unlock (&src->x_lock);
+
+  if (!xcbimage) {
+    GST_WARNING_OBJECT (pool, "could not create a %dx%d image",
+        xpool->width, xpool->height);
+    return GST_FLOW_ERROR;
+  }
+
+  meta = GST_META_XCBIMAGE_GET (xcbimage);
+  GST_LOG_OBJECT (pool, "allocated image %p, stride %d", xcbimage,
+      meta->stride);
+
+  if (xpool->add_metavideo) {
+    gsize offset[GST_VIDEO_MAX_PLANES] = { 0, };
+    gint stride[GST_VIDEO_MAX_PLANES] = { 0, };
+
+    stride[0] = meta->stride;
+    gst_buffer_add_video_meta_full (xcbimage, GST_VIDEO_FRAME_FLAG_NONE,
+        GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+        GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info),
+        offset, stride);
+  }
+
+  *buffer = xcbimage;
+  return GST_FLOW_OK;
+}
+
+static void
+xcbimage_buffer_pool_free (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GstXcbImageSrc *src = GST_XCBIMAGE_BUFFER_POOL_CAST (pool)->src;
+
+  GST_LOG_OBJECT (pool, "destroying image %p", buffer);
+
+  g_mutex_lock (&src->x_lock);
+  gst_xcbimageutil_xcbimage_destroy (src->xcontext, buffer);
+  g_mutex_unlock (&src->x_lock);
+
+  GST_BUFFER_POOL_CLASS (parent_class)->free_buffer (pool, buffer);
+}
+
+static void
+xcbimage_buffer_pool_release (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstMetaXcbImage *meta = GST_META_XCBIMAGE_GET (buffer);
+
+  /* Only an image of the current size, still holding its own pixels, is
+   * any use to us again */
+  if (!meta || meta->width != xpool->width || meta->height != xpool->height
+      || gst_buffer_n_memory (buffer) != 1
+      || gst_buffer_peek_memory (buffer, 0)->size != meta->size) {
+    GST_DEBUG_OBJECT (pool, "not recycling image %p", buffer);
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+  }
+
+  GST_BUFFER_POOL_CLASS (parent_class)->release_buffer (pool, buffer);
+}
+
+static void
+gst_xcbimage_buffer_pool_finalize (GObject * object)
+{
+  GstXcbImageBufferPool *pool = GST_XCBIMAGE_BUFFER_POOL_CAST (object);
+
+  GST_LOG_OBJECT (pool, "finalize XcbImage buffer pool %p", pool);
+
+  gst_object_unref (pool->src);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_xcbimage_buffer_pool_class_init (GstXcbImageBufferPoolClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
+
+  gobject_class->finalize = gst_xcbimage_buffer_pool_finalize;
+
+  gstbufferpool_class->get_options = xcbimage_buffer_pool_get_options;
+  gstbufferpool_class->set_config = xcbimage_buffer_pool_set_config;
+  gstbufferpool_class->alloc_buffer = xcbimage_buffer_pool_alloc;
+  gstbufferpool_class->free_buffer = xcbimage_buffer_pool_free;
+  gstbufferpool_class->release_buffer = xcbimage_buffer_pool_release;
+}
+
+static void
+gst_xcbimage_buffer_pool_init (GstXcbImageBufferPool * pool)
+{
+  /* nothing to do here */
+}
+
+GstBufferPool *
+gst_xcbimage_buffer_pool_new (GstXcbImageSrc * src)
+{
+  GstXcbImageBufferPool *pool;
+
+  g_return_val_if_fail (GST_IS_XCBIMAGE_SRC (src), NULL);
+
+  pool = g_object_new (GST_TYPE_XCBIMAGE_BUFFER_POOL, NULL);
+  pool->src = gst_object_ref (src);
+
+  GST_LOG_OBJECT (pool, "new XcbImage buffer pool %p", pool);
+
+  return GST_BUFFER_POOL_CAST (pool);
+}
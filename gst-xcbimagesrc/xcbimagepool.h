@@ -0,0 +1,71 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_XCBIMAGE_POOL_H__
+#define __GST_XCBIMAGE_POOL_H__
+
+#include <gst/video/gstvideopool.h>
+
+#include "gstxcbimagesrc.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstXcbImageBufferPool GstXcbImageBufferPool;
+typedef struct _GstXcbImageBufferPoolClass GstXcbImageBufferPoolClass;
+
+#define GST_TYPE_XCBIMAGE_BUFFER_POOL      (gst_xcbimage_buffer_pool_get_type())
+#define GST_IS_XCBIMAGE_BUFFER_POOL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_XCBIMAGE_BUFFER_POOL))
+#define GST_XCBIMAGE_BUFFER_POOL(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_XCBIMAGE_BUFFER_POOL, GstXcbImageBufferPool))
+#define GST_XCBIMAGE_BUFFER_POOL_CAST(obj) ((GstXcbImageBufferPool*)(obj))
+
+/**
+ * GstXcbImageBufferPool:
+ * @src: the element whose display the images belong to
+ * @info: the video format of the configured caps
+ * @width: the width in pixels of the images allocated
+ * @height: the height in pixels of the images allocated
+ * @stride: the length in bytes of each row of the images allocated
+ * @add_metavideo: whether to put a #GstVideoMeta on each buffer
+ *
+ * Hands out buffers backed by images shared with the X server, where it
+ * supports that, and takes them back only if they still fit.
+ */
+struct _GstXcbImageBufferPool
+{
+  GstBufferPool bufferpool;
+
+  GstXcbImageSrc *src;
+
+  GstVideoInfo info;
+  gint width, height;
+  gint stride;
+  gboolean add_metavideo;
+};
+
+struct _GstXcbImageBufferPoolClass
+{
+  GstBufferPoolClass parent_class;
+};
+
+GType gst_xcbimage_buffer_pool_get_type (void);
+
+GstBufferPool *gst_xcbimage_buffer_pool_new (GstXcbImageSrc * src);
+
+G_END_DECLS
+
+#endif /* __GST_XCBIMAGE_POOL_H__ */
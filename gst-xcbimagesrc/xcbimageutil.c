@@ -17,6 +17,10 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             /* for memfd_create() */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -26,6 +30,18 @@
 #include <X11/Xlib-xcb.h>
 #include <xcb/shm.h>
 
+#ifdef HAVE_XCB_SHM
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 GType
 gst_meta_xcbimage_api_get_type (void)
 {
@@ -50,9 +66,14 @@ gst_meta_xcbimage_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
   emeta->SHMInfo.shmaddr = ((void *) -1);
   emeta->SHMInfo.shmid = -1;
   emeta->SHMInfo.readOnly = TRUE;
+#endif
+#ifdef HAVE_XCB_SHM
+  emeta->shmseg = 0;
+  emeta->shm_is_fd = FALSE;
 #endif
   emeta->width = emeta->height = emeta->size = 0;
-  emeta->return_func = NULL;
+  emeta->data = NULL;
+  emeta->stride = 0;
 
   return TRUE;
 }
@@ -106,6 +127,10 @@ xcbimageutil_xcontext_get (GstElement * parent, const gchar * display_name)
     return NULL;
   }
   xcontext->conn = get_xcb_connection (xcontext->disp);
+#if defined(HAVE_XCB_SHM) && defined(HAVE_XCB_DAMAGE)
+  /* The XCB capture engine reads damage events itself */
+  XSetEventQueueOwner (xcontext->disp, XCBOwnsEventQueue);
+#endif
   xcontext->screen = xcb_setup_roots_iterator (xcb_get_setup (xcontext->conn)).data;
   // TODO
   xcontext->visual = DefaultVisualOfScreen (DefaultScreenOfDisplay (xcontext->disp));
@@ -137,8 +162,10 @@ xcbimageutil_xcontext_get (GstElement * parent, const gchar * display_name)
 
   /* We get bpp value corresponding to our running depth */
   for (i = 0; i < nb_formats; i++) {
-    if (px_formats[i].depth == xcontext->depth)
+    if (px_formats[i].depth == xcontext->depth) {
       xcontext->bpp = px_formats[i].bits_per_pixel;
+      xcontext->scanline_pad = px_formats[i].scanline_pad;
+    }
   }
 
   XFree (px_formats);
@@ -158,6 +185,24 @@ xcbimageutil_xcontext_get (GstElement * parent, const gchar * display_name)
   }
 #endif /* HAVE_XSHM */
 
+#ifdef HAVE_XCB_SHM
+  /* MIT-SHM 1.2 lets us hand the server a memfd instead of a SysV segment */
+  if (xcb_get_extension_data (xcontext->conn, &xcb_shm_id)->present) {
+    xcb_shm_query_version_reply_t *ver;
+
+    ver = xcb_shm_query_version_reply (xcontext->conn,
+        xcb_shm_query_version (xcontext->conn), NULL);
+    if (ver) {
+      xcontext->use_xcb_shm = TRUE;
+      xcontext->xcb_shm_fd = ver->major_version > 1 ||
+          (ver->major_version == 1 && ver->minor_version >= 2);
+      GST_DEBUG ("xcbimageutil is using XCB SHM %d.%d",
+          ver->major_version, ver->minor_version);
+      free (ver);
+    }
+  }
+#endif /* HAVE_XCB_SHM */
+
   /* our caps system handles 24/32bpp RGB as big-endian. */
   if ((xcontext->bpp == 24 || xcontext->bpp == 32) &&
       xcontext->endianness == G_LITTLE_ENDIAN) {
@@ -176,6 +221,8 @@ xcbimageutil_xcontext_get (GstElement * parent, const gchar * display_name)
     xcontext->b_mask_output = xcontext->visual->blue_mask;
   }
 
+  xcbimageutil_pixel_format_init (xcontext);
+
   return xcontext;
 }
 
@@ -246,58 +293,347 @@ xcbimageutil_calculate_pixel_aspect_ratio (GstXContext * xcontext)
   GST_DEBUG ("set xcontext PAR to %d/%d\n", xcontext->par_n, xcontext->par_d);
 }
 
-static gboolean
-gst_xcbimagesrc_buffer_dispose (GstBuffer * xcbimage)
+/* The channel of packed pixel @p at @shift */
+#define PIXEL_CHANNEL(p, shift, max) (((p) >> (shift)) & (max))
+
+/* x / 255 without dividing, exact for x up to 255 * 255 */
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+static guint
+mask_shift (guint32 mask)
 {
-  GstElement *parent;
-  GstMetaXcbImage *meta;
-  gboolean ret = TRUE;
+  guint shift = 0;
 
-  meta = GST_META_XCBIMAGE_GET (xcbimage);
+  while (!(mask & (1u << shift)))
+    shift++;
+  return shift;
+}
 
-  parent = meta->parent;
-  if (parent == NULL) {
-    g_warning ("XcbImageSrcBuffer->xcbimagesrc == NULL");
-    goto beach;
+/* Work out the layout of screen pixels from the visual's masks */
+static void
+xcbimageutil_pixel_format_init (GstXContext * xcontext)
+{
+  GstXPixelFormat *fmt = &xcontext->format;
+  Visual *visual = xcontext->visual;
+  guint used = 0;
+
+  memset (fmt, 0, sizeof (*fmt));
+  fmt->bypp = xcontext->bpp / 8;
+
+  if (!visual->red_mask || !visual->green_mask || !visual->blue_mask ||
+      (xcontext->bpp != 8 && xcontext->bpp != 16 && xcontext->bpp != 32)) {
+    GST_DEBUG ("Can't draw cursor at %d bpp", xcontext->bpp);
+    return;
   }
 
-  if (meta->return_func)
-    ret = meta->return_func (parent, xcbimage);
+  fmt->r_shift = mask_shift (visual->red_mask);
+  fmt->g_shift = mask_shift (visual->green_mask);
+  fmt->b_shift = mask_shift (visual->blue_mask);
+  fmt->r_max = visual->red_mask >> fmt->r_shift;
+  fmt->g_max = visual->green_mask >> fmt->g_shift;
+  fmt->b_max = visual->blue_mask >> fmt->b_shift;
+  fmt->supported = TRUE;
+
+  if (xcontext->bpp != 32 || fmt->r_max != 0xff || fmt->g_max != 0xff ||
+      fmt->b_max != 0xff || fmt->r_shift % 8 || fmt->g_shift % 8 ||
+      fmt->b_shift % 8)
+    return;
+
+  used = (1 << fmt->r_shift / 8) | (1 << fmt->g_shift / 8) |
+      (1 << fmt->b_shift / 8);
+  for (fmt->a_shift = 0; used & (1 << fmt->a_shift / 8); fmt->a_shift += 8);
+  fmt->is_8888 = TRUE;
+
+  GST_DEBUG ("Pixels are 8888, with the spare byte at bit %d", fmt->a_shift);
+}
 
-beach:
+gboolean
+xcbimageutil_cursor_is_current (const GstXCursor * cursor, gulong serial)
+{
+  return cursor->pixels && cursor->serial == serial;
+}
+
+/* Take a copy of a new cursor image @argb, as handed out by XFixes. That
+ * is premultiplied already, so for 8888 screens it only needs its
+ * channels moving to where the screen has them. */
+void
+xcbimageutil_cursor_set (GstXContext * xcontext, GstXCursor * cursor,
+    gulong serial, gint width, gint height, const guint32 * argb)
+{
+  const GstXPixelFormat *fmt = &xcontext->format;
+  gint i, n = width * height;
+
+  xcbimageutil_cursor_clear (cursor);
+
+  cursor->serial = serial;
+  cursor->width = width;
+  cursor->height = height;
+
+  if (!fmt->is_8888) {
+    cursor->pixels = g_new (guint32, n);
+    memcpy (cursor->pixels, argb, n * sizeof (guint32));
+    return;
+  }
+
+  cursor->pixels = g_new (guint32, n);
+  cursor->inv_alpha = g_new (guint32, n);
+  for (i = 0; i < n; i++) {
+    guint32 p = argb[i];
+    guint32 a = p >> 24;
+
+    cursor->pixels[i] = GUINT32_TO_LE (PIXEL_CHANNEL (p, 16, 0xff) <<
+        fmt->r_shift | PIXEL_CHANNEL (p, 8, 0xff) << fmt->g_shift |
+        PIXEL_CHANNEL (p, 0, 0xff) << fmt->b_shift | a << fmt->a_shift);
+    cursor->inv_alpha[i] = (0xff - a) * 0x01010101;
+  }
+}
+
+void
+xcbimageutil_cursor_clear (GstXCursor * cursor)
+{
+  g_free (cursor->pixels);
+  g_free (cursor->inv_alpha);
+  memset (cursor, 0, sizeof (*cursor));
+}
+
+/* Blend one premultiplied ARGB pixel @argb over the screen pixel at @dest */
+static void
+blend_pixel (const GstXPixelFormat * fmt, guint8 * dest, guint32 argb)
+{
+  guint32 inv = 0xff - (argb >> 24);
+  guint32 color, dr, dg, db;
+
+  switch (fmt->bypp) {
+    case 1:
+      color = *dest;
+      break;
+    case 2:
+      color = GUINT16_FROM_LE (*(guint16 *) dest);
+      break;
+    default:
+      color = GUINT32_FROM_LE (*(guint32 *) dest);
+      break;
+  }
+
+  dr = PIXEL_CHANNEL (color, fmt->r_shift, fmt->r_max) * 0xff / fmt->r_max;
+  dg = PIXEL_CHANNEL (color, fmt->g_shift, fmt->g_max) * 0xff / fmt->g_max;
+  db = PIXEL_CHANNEL (color, fmt->b_shift, fmt->b_max) * 0xff / fmt->b_max;
+
+  dr = MIN (DIV255 (dr * inv) + PIXEL_CHANNEL (argb, 16, 0xff), 0xff);
+  dg = MIN (DIV255 (dg * inv) + PIXEL_CHANNEL (argb, 8, 0xff), 0xff);
+  db = MIN (DIV255 (db * inv) + PIXEL_CHANNEL (argb, 0, 0xff), 0xff);
+
+  color = DIV255 (dr * fmt->r_max) << fmt->r_shift |
+      DIV255 (dg * fmt->g_max) << fmt->g_shift |
+      DIV255 (db * fmt->b_max) << fmt->b_shift;
+
+  switch (fmt->bypp) {
+    case 1:
+      *dest = color;
+      break;
+    case 2:
+      *(guint16 *) dest = GUINT16_TO_LE (color);
+      break;
+    default:
+      *(guint32 *) dest = GUINT32_TO_LE (color);
+      break;
+  }
+}
+
+/* Each byte of @d scaled by the same byte of @inv, plus that of @s */
+static inline guint32
+blend_8888 (guint32 d, guint32 s, guint32 inv)
+{
+  guint32 ret = 0, x;
+  gint shift;
+
+  for (shift = 0; shift < 32; shift += 8) {
+    x = DIV255 (PIXEL_CHANNEL (d, shift, 0xff) *
+        PIXEL_CHANNEL (inv, shift, 0xff)) + PIXEL_CHANNEL (s, shift, 0xff);
+    ret |= MIN (x, 0xff) << shift;
+  }
   return ret;
 }
 
+/* Four pixels at a time where we can, then the rest one by one */
+static void
+blend_row_8888 (guint32 * dest, const guint32 * src, const guint32 * inv,
+    gint n)
+{
+  gint i = 0;
+
+#if defined (__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i half = _mm_set1_epi16 (128);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i d = _mm_loadu_si128 ((const __m128i *) (dest + i));
+    __m128i s = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (inv + i));
+    __m128i lo, hi;
+
+    lo = _mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero),
+        _mm_unpacklo_epi8 (a, zero));
+    hi = _mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero),
+        _mm_unpackhi_epi8 (a, zero));
+    lo = _mm_add_epi16 (lo, half);
+    hi = _mm_add_epi16 (hi, half);
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, _mm_srli_epi16 (lo, 8)), 8);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, _mm_srli_epi16 (hi, 8)), 8);
+    d = _mm_adds_epu8 (_mm_packus_epi16 (lo, hi), s);
+    _mm_storeu_si128 ((__m128i *) (dest + i), d);
+  }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+  for (; i + 4 <= n; i += 4) {
+    uint8x16_t d = vld1q_u8 ((const uint8_t *) (dest + i));
+    uint8x16_t s = vld1q_u8 ((const uint8_t *) (src + i));
+    uint8x16_t a = vld1q_u8 ((const uint8_t *) (inv + i));
+    uint16x8_t lo = vmull_u8 (vget_low_u8 (d), vget_low_u8 (a));
+    uint16x8_t hi = vmull_u8 (vget_high_u8 (d), vget_high_u8 (a));
+
+    d = vcombine_u8 (vraddhn_u16 (lo, vrshrq_n_u16 (lo, 8)),
+        vraddhn_u16 (hi, vrshrq_n_u16 (hi, 8)));
+    vst1q_u8 ((uint8_t *) (dest + i), vqaddq_u8 (d, s));
+  }
+#endif
+
+  for (; i < n; i++)
+    dest[i] = blend_8888 (dest[i], src[i], inv[i]);
+}
+
+/* Blend @n pixels of @cursor, from (@x, @y) rightwards, over @dest */
 void
-gst_xcbimage_buffer_free (GstBuffer * xcbimage)
+xcbimageutil_cursor_blend_row (GstXContext * xcontext,
+    const GstXCursor * cursor, gint x, gint y, guint8 * dest, gint n)
 {
-  GstMetaXcbImage *meta;
+  const GstXPixelFormat *fmt = &xcontext->format;
+  gint offset = y * cursor->width + x;
+  gint i;
 
-  meta = GST_META_XCBIMAGE_GET (xcbimage);
+  if (fmt->is_8888) {
+    blend_row_8888 ((guint32 *) dest, cursor->pixels + offset,
+        cursor->inv_alpha + offset, n);
+    return;
+  }
+
+  if (!fmt->supported)
+    return;
+
+  for (i = 0; i < n; i++, dest += fmt->bypp)
+    blend_pixel (fmt, dest, cursor->pixels[offset + i]);
+}
+
+/* The length in bytes of a row of a @width pixel image, padded the way
+ * the server pads the images it sends us */
+gint
+xcbimageutil_image_stride (GstXContext * xcontext, gint width)
+{
+  gint pad = xcontext->scanline_pad ? xcontext->scanline_pad : 32;
+
+  return (width * xcontext->bpp + pad - 1) / pad * pad / 8;
+}
+
+#ifdef HAVE_XCB_SHM
+/* Allocate the image in a segment shared with the server, preferably a
+ * memfd, so that xcb_shm_get_image() can write straight into it */
+static gboolean
+xcbimageutil_xcb_shm_alloc (GstXContext * xcontext, GstMetaXcbImage * meta)
+{
+  xcb_generic_error_t *err;
+  xcb_shm_seg_t seg;
+  void *addr;
+  int shmid;
+
+  meta->stride = xcbimageutil_image_stride (xcontext, meta->width);
+  meta->size = meta->stride * meta->height;
+  seg = xcb_generate_id (xcontext->conn);
+
+#ifdef HAVE_MEMFD_CREATE
+  if (xcontext->xcb_shm_fd) {
+    int fd = memfd_create ("xcbimagesrc", MFD_CLOEXEC);
+
+    if (fd >= 0) {
+      addr = MAP_FAILED;
+      if (ftruncate (fd, meta->size) == 0)
+        addr = mmap (NULL, meta->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+      if (addr == MAP_FAILED) {
+        close (fd);
+      } else {
+        /* XCB closes the fd once it has been sent */
+        err = xcb_request_check (xcontext->conn,
+            xcb_shm_attach_fd_checked (xcontext->conn, seg, fd, FALSE));
+        if (!err) {
+          meta->shmseg = seg;
+          meta->shm_is_fd = TRUE;
+          meta->data = addr;
+          return TRUE;
+        }
+        free (err);
+        munmap (addr, meta->size);
+      }
+    }
+    GST_DEBUG ("memfd SHM failed; falling back to SysV");
+    xcontext->xcb_shm_fd = FALSE;
+  }
+#endif /* HAVE_MEMFD_CREATE */
 
-  /* make sure it is not recycled */
-  meta->width = -1;
-  meta->height = -1;
-  gst_buffer_unref (xcbimage);
+  shmid = shmget (IPC_PRIVATE, meta->size, IPC_CREAT | 0600);
+  if (shmid == -1)
+    return FALSE;
+
+  addr = shmat (shmid, NULL, 0);
+  if (addr == ((void *) -1)) {
+    shmctl (shmid, IPC_RMID, NULL);
+    return FALSE;
+  }
+
+  err = xcb_request_check (xcontext->conn,
+      xcb_shm_attach_checked (xcontext->conn, seg, shmid, FALSE));
+
+  /* The segment goes away once both of us have detached */
+  shmctl (shmid, IPC_RMID, NULL);
+
+  if (err) {
+    free (err);
+    shmdt (addr);
+    return FALSE;
+  }
+
+  meta->shmseg = seg;
+  meta->shm_is_fd = FALSE;
+  meta->data = addr;
+  return TRUE;
 }
+#endif /* HAVE_XCB_SHM */
 
 /* This function handles GstXcbImageSrcBuffer creation depending on XShm availability */
 GstBuffer *
 gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
-    GstElement * parent, int width, int height, BufferReturnFunc return_func)
+    GstElement * parent, int width, int height)
 {
   GstBuffer *xcbimage = NULL;
   GstMetaXcbImage *meta;
   gboolean succeeded = FALSE;
 
   xcbimage = gst_buffer_new ();
-  GST_MINI_OBJECT_CAST (xcbimage)->dispose =
-      (GstMiniObjectDisposeFunction) gst_xcbimagesrc_buffer_dispose;
 
   meta = GST_META_XCBIMAGE_ADD (xcbimage);
   meta->width = width;
   meta->height = height;
 
+#ifdef HAVE_XCB_SHM
+  if (xcontext->use_xcb_shm) {
+    if (xcbimageutil_xcb_shm_alloc (xcontext, meta))
+      goto got_image;
+
+    /* Probably a remote display. Retry without SHM */
+    GST_WARNING_OBJECT (parent,
+        "could not attach a %dx%d XCB SHM image", meta->width, meta->height);
+    xcontext->use_xcb_shm = FALSE;
+  }
+#endif /* HAVE_XCB_SHM */
+
 #ifdef HAVE_XSHM
   meta->SHMInfo.shmaddr = ((void *) -1);
   meta->SHMInfo.shmid = -1;
@@ -343,7 +679,8 @@ gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
     meta->ximage = XCreateImage (xcontext->disp,
         xcontext->visual,
         xcontext->depth,
-        ZPixmap, 0, NULL, meta->width, meta->height, xcontext->bpp, 0);
+        ZPixmap, 0, NULL, meta->width, meta->height,
+        xcontext->scanline_pad ? xcontext->scanline_pad : 32, 0);
     if (!meta->ximage)
       goto beach;
 
@@ -353,18 +690,24 @@ gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
 
     XSync (xcontext->disp, FALSE);
   }
+  meta->data = (guint8 *) meta->ximage->data;
+  meta->stride = meta->ximage->bytes_per_line;
+
+#ifdef HAVE_XCB_SHM
+got_image:
+#endif
   succeeded = TRUE;
 
   gst_buffer_append_memory (xcbimage,
-      gst_memory_new_wrapped (GST_MEMORY_FLAG_NO_SHARE, meta->ximage->data,
+      gst_memory_new_wrapped (GST_MEMORY_FLAG_NO_SHARE, meta->data,
           meta->size, 0, meta->size, NULL, NULL));
 
   /* Keep a ref to our src */
   meta->parent = gst_object_ref (parent);
-  meta->return_func = return_func;
 beach:
   if (!succeeded) {
-    gst_xcbimage_buffer_free (xcbimage);
+    gst_xcbimageutil_xcbimage_destroy (xcontext, xcbimage);
+    gst_buffer_unref (xcbimage);
     xcbimage = NULL;
   }
 
@@ -379,6 +722,23 @@ gst_xcbimageutil_xcbimage_destroy (GstXContext * xcontext, GstBuffer * xcbimage)
 
   meta = GST_META_XCBIMAGE_GET (xcbimage);
 
+#ifdef HAVE_XCB_SHM
+  if (meta->shmseg) {
+    /* Without an xcontext the server has already forgotten the segment */
+    if (xcontext) {
+      xcb_shm_detach (xcontext->conn, meta->shmseg);
+      xcb_flush (xcontext->conn);
+    }
+    if (meta->shm_is_fd)
+      munmap (meta->data, meta->size);
+    else
+      shmdt (meta->data);
+    meta->shmseg = 0;
+    meta->data = NULL;
+    goto beach;
+  }
+#endif /* HAVE_XCB_SHM */
+
   /* We might have some buffers destroyed after changing state to NULL */
   if (!xcontext)
     goto beach;
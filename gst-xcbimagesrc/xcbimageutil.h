@@ -22,11 +22,11 @@
 
 #include <gst/gst.h>
 
-#ifdef HAVE_XSHM
+#if defined(HAVE_XSHM) || defined(HAVE_XCB_SHM)
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#endif /* HAVE_XSHM */
+#endif /* HAVE_XSHM || HAVE_XCB_SHM */
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -36,6 +36,9 @@
 #endif /* HAVE_XSHM */
 
 #include <xcb/xcb.h>
+#ifdef HAVE_XCB_SHM
+#include <xcb/shm.h>
+#endif /* HAVE_XCB_SHM */
 
 #include <string.h>
 #include <math.h>
@@ -43,10 +46,58 @@
 G_BEGIN_DECLS
 
 typedef struct _GstXContext GstXContext;
+typedef struct _GstXPixelFormat GstXPixelFormat;
+typedef struct _GstXCursor GstXCursor;
 typedef struct _GstXWindow GstXWindow;
 typedef struct _GstXcbImage GstXcbImage;
 typedef struct _GstMetaXcbImage GstMetaXcbImage;
 
+/**
+ * GstXPixelFormat:
+ * @supported: whether cursors can be drawn onto pixels of this format
+ * @bypp: the number of bytes per pixel
+ * @r_shift: the lowest bit of the red channel
+ * @g_shift: the lowest bit of the green channel
+ * @b_shift: the lowest bit of the blue channel
+ * @r_max: the largest value of the red channel
+ * @g_max: the largest value of the green channel
+ * @b_max: the largest value of the blue channel
+ * @is_8888: whether pixels are 32 bits with 8 bits for each channel on a
+ * byte boundary, which can be blended a byte at a time
+ * @a_shift: if @is_8888, the lowest bit of the byte not used by any channel
+ *
+ * The layout of a pixel on the screen, worked out once from the visual's
+ * masks rather than for every pixel drawn.
+ */
+struct _GstXPixelFormat {
+  gboolean supported;
+  gint bypp;
+  guint r_shift, g_shift, b_shift;
+  guint32 r_max, g_max, b_max;
+  gboolean is_8888;
+  guint a_shift;
+};
+
+/**
+ * GstXCursor:
+ * @serial: the XFixes serial of the cursor image held
+ * @width: the width in pixels of the cursor image
+ * @height: the height in pixels of the cursor image
+ * @pixels: the premultiplied cursor image. If the screen format is 8888,
+ * laid out as screen pixels; otherwise, as ARGB
+ * @inv_alpha: if the screen format is 8888, 255 minus each pixel's alpha,
+ * repeated in all four bytes
+ *
+ * A cursor image, prepared for blending onto the screen each time it
+ * changes rather than each time it is drawn.
+ */
+struct _GstXCursor {
+  gulong serial;
+  gint width, height;
+  guint32 *pixels;
+  guint32 *inv_alpha;
+};
+
 /* Global X Context stuff */
 /**
  * GstXContext:
@@ -70,6 +121,12 @@ typedef struct _GstMetaXcbImage GstMetaXcbImage;
  * @heightmm ratio
  * @use_xshm: used to known wether of not XShm extension is usable or not even
  * if the Extension is present
+ * @use_xcb_shm: whether images are captured with xcb_shm_get_image() rather
+ * than through Xlib
+ * @xcb_shm_fd: whether the server accepts SHM segments passed as file
+ * descriptors (MIT-SHM 1.2)
+ * @scanline_pad: the scanline padding in bits of images at @depth
+ * @format: the layout of pixels at @depth, for drawing the cursor
  * @caps: the #GstCaps that Display @disp can accept
  *
  * Structure used to store various information collected/calculated for a
@@ -103,6 +160,11 @@ struct _GstXContext {
   guint par_d;                  /* calculated pixel aspect ratio denumerator */
 
   gboolean use_xshm;
+  gboolean use_xcb_shm;
+  gboolean xcb_shm_fd;
+  gint scanline_pad;
+
+  GstXPixelFormat format;
 
   GstCaps *caps;
 };
@@ -130,10 +192,15 @@ GstXContext *xcbimageutil_xcontext_get (GstElement *parent,
 void xcbimageutil_xcontext_clear (GstXContext *xcontext);
 void xcbimageutil_calculate_pixel_aspect_ratio (GstXContext * xcontext);
 
-/* custom xcbimagesrc buffer, copied from xcbimagesink */
+gboolean xcbimageutil_cursor_is_current (const GstXCursor * cursor,
+    gulong serial);
+void xcbimageutil_cursor_set (GstXContext * xcontext, GstXCursor * cursor,
+    gulong serial, gint width, gint height, const guint32 * argb);
+void xcbimageutil_cursor_clear (GstXCursor * cursor);
+void xcbimageutil_cursor_blend_row (GstXContext * xcontext,
+    const GstXCursor * cursor, gint x, gint y, guint8 * dest, gint n);
 
-/* BufferReturnFunc is called when a buffer is finalised */
-typedef gboolean (*BufferReturnFunc) (GstElement *parent, GstBuffer *buf);
+/* custom xcbimagesrc buffer, copied from xcbimagesink */
 
 /**
  * GstMetaXcbimage:
@@ -142,6 +209,9 @@ typedef gboolean (*BufferReturnFunc) (GstElement *parent, GstBuffer *buf);
  * @width: the width in pixels of Xcbimage @xcbimage
  * @height: the height in pixels of Xcbimage @xcbimage
  * @size: the size in bytes of Xcbimage @xcbimage
+ * @data: the pixels, whichever way they were allocated
+ * @stride: the length in bytes of each row of @data
+ * @shmseg: the XCB SHM segment holding @data, if any
  *
  * Extra data attached to buffers containing additional information about an Xcbimage.
  */
@@ -157,10 +227,15 @@ struct _GstMetaXcbImage {
   XShmSegmentInfo SHMInfo;
 #endif /* HAVE_XSHM */
 
+#ifdef HAVE_XCB_SHM
+  xcb_shm_seg_t shmseg;
+  gboolean shm_is_fd;
+#endif /* HAVE_XCB_SHM */
+
   gint width, height;
   size_t size;
-
-  BufferReturnFunc return_func;
+  guint8 *data;
+  gint stride;
 };
 
 GType gst_meta_xcbimage_api_get_type (void);
@@ -168,14 +243,13 @@ const GstMetaInfo * gst_meta_xcbimage_get_info (void);
 #define GST_META_XCBIMAGE_GET(buf) ((GstMetaXcbImage *)gst_buffer_get_meta(buf,gst_meta_xcbimage_api_get_type()))
 #define GST_META_XCBIMAGE_ADD(buf) ((GstMetaXcbImage *)gst_buffer_add_meta(buf,gst_meta_xcbimage_get_info(),NULL))
 
+gint xcbimageutil_image_stride (GstXContext *xcontext, gint width);
+
 GstBuffer *gst_xcbimageutil_xcbimage_new (GstXContext *xcontext,
-  GstElement *parent, int width, int height, BufferReturnFunc return_func);
+  GstElement *parent, int width, int height);
 
 void gst_xcbimageutil_xcbimage_destroy (GstXContext *xcontext, 
   GstBuffer * xcbimage);
-  
-/* Call to manually release a buffer */
-void gst_xcbimage_buffer_free (GstBuffer *xcbimage);
 
 G_END_DECLS 
 
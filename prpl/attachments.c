@@ -149,29 +149,17 @@ static void download_callback(PurpleUtilFetchUrlData *url_data, gpointer user_da
 	deep_free_download_data(data);
 }
 
-ChimeAttachment *extract_attachment(JsonNode *record)
+ChimeAttachment *extract_attachment(ChimeMessage *msg)
 {
-	JsonObject *robj;
-	JsonNode *node;
-	const gchar *msg_id, *filename, *url, *content_type;
-
-	g_return_val_if_fail(record != NULL, NULL);
-	robj = json_node_get_object(record);
-	g_return_val_if_fail(robj != NULL, NULL);
-	node = json_object_get_member(robj, "Attachment");
-	if (!node || json_node_is_null(node))
+	g_return_val_if_fail(msg != NULL, NULL);
+	if (!msg->attachment)
 		return NULL;
 
-	g_return_val_if_fail(parse_string(record, "MessageId", &msg_id), NULL);
-	g_return_val_if_fail(parse_string(node, "FileName", &filename), NULL);
-	g_return_val_if_fail(parse_string(node, "Url", &url), NULL);
-	g_return_val_if_fail(parse_string(node, "ContentType", &content_type), NULL);
-
 	ChimeAttachment *att = g_new0(ChimeAttachment, 1);
-	att->message_id = g_strdup(msg_id);
-	att->filename = g_strdup(filename);
-	att->url = g_strdup(url);
-	att->content_type = g_strdup(content_type);
+	att->message_id = g_strdup(msg->id);
+	att->filename = g_strdup(msg->attachment->filename);
+	att->url = g_strdup(msg->attachment->url);
+	att->content_type = g_strdup(msg->attachment->content_type);
 
 	return att;
 }
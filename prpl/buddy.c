@@ -241,14 +241,7 @@ static void search_im(PurpleConnection *conn, GList *row, gpointer _unused)
 	purple_conversation_present(conv);
 }
 
-struct search_data {
-	PurpleConnection *conn;
-	void *ui_handle;
-	GSList *contacts;
-	guint refresh_id;
-};
-
-static PurpleNotifySearchResults *generate_search_results(GSList *contacts)
+static PurpleNotifySearchResults *new_search_results(void)
 {
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
@@ -265,55 +258,29 @@ static PurpleNotifySearchResults *generate_search_results(GSList *contacts)
 	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM,
 					       search_im);
 
-	gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
-
-	while (contacts) {
-		ChimeContact *contact = contacts->data;
-		GList *row = NULL;
-		row = g_list_append(row, g_strdup(chime_contact_get_display_name(contact)));
-		row = g_list_append(row, g_strdup(chime_contact_get_email(contact)));
-		GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(contact));
-		row = g_list_append(row, g_strdup(_(val->value_nick)));
-		purple_notify_searchresults_row_add(results, row);
-		contacts = contacts->next;
-	}
-
-	g_type_class_unref(klass);
 	return results;
 }
 
-static void search_closed_cb(gpointer _sd)
+static GList *render_search_result(struct chime_results *res, GObject *obj)
 {
-	struct search_data *sd = _sd;
-
-	if (sd->refresh_id)
-		g_source_remove(sd->refresh_id);
-	while (sd->contacts) {
-		ChimeContact *contact = sd->contacts->data;
-		g_signal_handlers_disconnect_matched(contact, G_SIGNAL_MATCH_DATA,
-						     0, 0, NULL, NULL, sd);
-		g_object_unref(contact);
-		sd->contacts = g_slist_remove(sd->contacts, contact);
-	}
-	g_free(sd);
-}
+	ChimeContact *contact = CHIME_CONTACT(obj);
+	gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
+	GList *row = NULL;
 
-static gboolean renew_search_results(gpointer _sd)
-{
-	struct search_data *sd = _sd;
+	row = g_list_append(row, g_strdup(chime_contact_get_display_name(contact)));
+	row = g_list_append(row, g_strdup(chime_contact_get_email(contact)));
+	GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(contact));
+	row = g_list_append(row, g_strdup(_(val->value_nick)));
+	g_type_class_unref(klass);
 
-	PurpleNotifySearchResults *results = generate_search_results(sd->contacts);
-	purple_notify_searchresults_new_rows(sd->conn, results, sd->ui_handle);
+	chime_results_watch(res, contact, contact, "notify::availability");
 
-	sd->refresh_id = 0;
-	return FALSE;
+	return row;
 }
 
-static void on_search_availability(ChimeContact *contact, GParamSpec *ignored, struct search_data *sd)
+static void search_closed_cb(gpointer _res)
 {
-	/* Gather them up to avoid repeatedly redrawing as they come in the first time */
-	if (!sd->refresh_id)
-		sd->refresh_id = g_idle_add(renew_search_results, sd);
+	chime_results_free(_res);
 }
 
 static void search_done(GObject *source, GAsyncResult *result, gpointer _conn)
@@ -328,27 +295,29 @@ static void search_done(GObject *source, GAsyncResult *result, gpointer _conn)
 		return;
 	}
 
-	PurpleNotifySearchResults *results = generate_search_results(contacts);
-
-	struct search_data *sd = g_new0(struct search_data, 1);
-	sd->contacts = contacts;
-	sd->conn = conn;
-	sd->ui_handle = purple_notify_searchresults(conn, _("Chime autocomplete"), _("Search results"),
-						    NULL, results, search_closed_cb, sd);
-	if (!sd->ui_handle) {
+	struct chime_results *res = chime_results_new(conn, new_search_results,
+						      render_search_result, NULL, NULL);
+	GList *objs = NULL;
+	GSList *l;
+	for (l = contacts; l; l = l->next)
+		objs = g_list_prepend(objs, l->data);
+	objs = g_list_reverse(objs);
+	chime_results_set_objects(res, objs);
+	g_list_free(objs);
+	/* The model holds its own references now */
+	g_slist_free_full(contacts, g_object_unref);
+
+	PurpleNotifySearchResults *results = chime_results_build(res);
+	void *handle = purple_notify_searchresults(conn, _("Chime autocomplete"), _("Search results"),
+						   NULL, results, search_closed_cb, res);
+	if (!handle) {
 		purple_notify_error(conn, NULL,
 				    _("Unable to display search results."),
 				    NULL);
-		search_closed_cb(sd);
+		chime_results_free(res);
 		return;
 	}
-	/* Strictly speaking we don't own these now but we know we're single-threaded */
-	while (contacts) {
-		ChimeContact *contact = contacts->data;
-		g_signal_connect(contact, "notify::availability",
-				 G_CALLBACK(on_search_availability), sd);
-		contacts = contacts->next;
-	}
+	chime_results_set_ui_handle(res, handle);
 }
 
 static void user_search_begin(PurpleConnection *conn, const char *query)
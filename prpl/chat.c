@@ -61,6 +61,8 @@ struct chime_chat {
 	ChimeMeeting *meeting;
 	ChimeCall *call;
 	void *participants_ui;
+	GPtrArray *participant_rows;		/* Only while participants_ui is open */
+	GHashTable *participant_row_map;	/* ChimeCallParticipant → row */
 	PurpleMedia *media;
 	gboolean media_connected;
 
@@ -140,15 +142,15 @@ static gchar *parse_outbound_mentions(ChimeRoom *room, const gchar *message)
 }
 
 static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
-				JsonNode *node, time_t msg_time, gboolean new_msg)
+				ChimeMessage *msg, time_t msg_time, gboolean new_msg)
 {
 	struct chime_chat *chat = (struct chime_chat *)msgs;
 	PurpleConnection *conn = chat->conv->account->gc;
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 	int id = purple_conv_chat_get_id(PURPLE_CONV_CHAT(chat->conv));
-	const gchar *content, *sender;
+	const gchar *sender = msg->sender;
 
-	if (!parse_string(node, "Sender", &sender))
+	if (!sender)
 		return;
 
 	const gchar *from = _("Unknown sender");
@@ -164,7 +166,7 @@ static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 		msg_flags = PURPLE_MESSAGE_RECV;
 	}
 
-	ChimeAttachment *att = extract_attachment(node);
+	ChimeAttachment *att = extract_attachment(msg);
 	if (att) {
 		AttachmentContext *ctx = g_new(AttachmentContext, 1);
 		ctx->conn = conn;
@@ -180,8 +182,8 @@ static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 	if (!new_msg)
 		msg_flags |= PURPLE_MESSAGE_DELAYED;
 
-	if (parse_string(node, "Content", &content)) {
-		gchar *escaped = g_markup_escape_text(content, -1);
+	if (msg->content) {
+		gchar *escaped = g_markup_escape_text(msg->content, -1);
 
 		gchar *parsed = NULL;
 		if (CHIME_IS_ROOM(chat->m.obj)) {
@@ -250,10 +252,135 @@ static void open_participant_im(PurpleConnection *conn, GList *row, gpointer _ch
 	}
 }
 
-static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participants)
+/*
+ * While the participants dialog is open we keep the rendered strings for
+ * each row, in display order. Volume changes arrive as deltas through
+ * "participants-updated", and only the rows they name are re-rendered.
+ * libpurple still wants the whole table each time, but that's just a
+ * matter of copying the strings.
+ */
+struct participant_row {
+	ChimeCallParticipant *p;
+	GList *cols;
+};
+
+/* Only our own receive quality is known, so it goes on our own row */
+static gchar *format_audio_stats(const ChimeCallAudioStats *stats)
+{
+	if (!stats)
+		return g_strdup("");
+
+	if (stats->rtt_ms < 0)
+		return g_strdup_printf(_("MOS %.1f, %.1f%% loss, %.0fms jitter"),
+				       stats->mos, stats->loss_percent, stats->jitter_ms);
+
+	return g_strdup_printf(_("MOS %.1f, %.1f%% loss, %.0fms jitter, %.0fms RTT"),
+			       stats->mos, stats->loss_percent, stats->jitter_ms,
+			       stats->rtt_ms);
+}
+
+static gboolean participant_is_self(struct chime_chat *chat, ChimeCallParticipant *p)
+{
+	ChimeConnection *cxn = PURPLE_CHIME_CXN(chat->conv->account->gc);
+
+	return !g_strcmp0(p->participant_id, chime_connection_get_profile_id(cxn));
+}
+
+static GList *render_participant(struct chime_chat *chat, ChimeCallParticipant *p)
+{
+	gpointer klass = g_type_class_ref(CHIME_TYPE_CALL_PARTICIPATION_STATUS);
+	GList *row = NULL;
+
+	row = g_list_append(row, g_strdup(p->full_name));
+	GEnumValue *val = g_enum_get_value(klass, p->status);
+	row = g_list_append(row, g_strdup(_(val->value_nick)));
+	g_type_class_unref(klass);
+
+	const gchar *screen_icon;
+	if (p->shared_screen == CHIME_SHARED_SCREEN_VIEWING)
+		screen_icon = "👁";
+	else if (p->shared_screen == CHIME_SHARED_SCREEN_PRESENTING)
+		screen_icon = "🗔";
+	else
+		screen_icon = "";
+	row = g_list_append(row, g_strdup(screen_icon));
+
+	const gchar *vol_icon;
+	if (p->status != CHIME_PARTICIPATION_PRESENT)
+		vol_icon = "";
+	else if (p->volume == -128)
+		vol_icon = "🔇";
+	else if (p->volume < -64)
+		vol_icon = "🔈";
+	else if (p->volume < -32)
+		vol_icon = "🔉";
+	else
+		vol_icon = "🔊";
+	row = g_list_append(row, g_strdup(vol_icon));
+
+	const gchar *video_or_phone_icon;
+	if (p->video_present == TRUE)
+		video_or_phone_icon = "🎥";
+	else if (p->pots == TRUE)
+		video_or_phone_icon = "📞";
+	else
+		video_or_phone_icon = "";
+	row = g_list_append(row, g_strdup(video_or_phone_icon));
+
+	if (participant_is_self(chat, p))
+		row = g_list_append(row, format_audio_stats(chime_call_get_audio_stats(chat->call)));
+	else
+		row = g_list_append(row, g_strdup(""));
+
+	return row;
+}
+
+static gint participant_row_sort(gconstpointer a, gconstpointer b)
+{
+	const struct participant_row *ra = *(struct participant_row * const *)a;
+	const struct participant_row *rb = *(struct participant_row * const *)b;
+
+	return participant_sort(ra->p, rb->p);
+}
+
+static void free_participant_row(gpointer _row)
+{
+	struct participant_row *row = _row;
+
+	g_list_free_full(row->cols, g_free);
+	g_free(row);
+}
+
+static void clear_participant_rows(struct chime_chat *chat)
+{
+	g_clear_pointer(&chat->participant_row_map, g_hash_table_destroy);
+	g_clear_pointer(&chat->participant_rows, g_ptr_array_unref);
+}
+
+/* Returns TRUE if anything visible changed */
+static gboolean rerender_participant_row(struct chime_chat *chat, struct participant_row *row)
+{
+	GList *cols = render_participant(chat, row->p), *a, *b;
+
+	for (a = cols, b = row->cols; a && b; a = a->next, b = b->next) {
+		if (strcmp(a->data, b->data))
+			break;
+	}
+	if (!a && !b) {
+		g_list_free_full(cols, g_free);
+		return FALSE;
+	}
+
+	g_list_free_full(row->cols, g_free);
+	row->cols = cols;
+	return TRUE;
+}
+
+static PurpleNotifySearchResults *generate_sr_participants(struct chime_chat *chat)
 {
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
+	guint i;
 
 	column = purple_notify_searchresults_column_new(_("Name"));
 	purple_notify_searchresults_column_add(results, column);
@@ -265,66 +392,31 @@ static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participa
 	purple_notify_searchresults_column_add(results, column);
 	column = purple_notify_searchresults_column_new("📞/🎥");
 	purple_notify_searchresults_column_add(results, column);
+	column = purple_notify_searchresults_column_new(_("Quality"));
+	purple_notify_searchresults_column_add(results, column);
 
 	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, open_participant_im);
 
-	gpointer klass = g_type_class_ref(CHIME_TYPE_CALL_PARTICIPATION_STATUS);
+	for (i = 0; i < chat->participant_rows->len; i++) {
+		struct participant_row *row = g_ptr_array_index(chat->participant_rows, i);
+		GList *cols = NULL, *l;
 
-	GList *pl = g_hash_table_get_values(participants);
-	pl = g_list_sort(pl, participant_sort);
-	while (pl) {
-		ChimeCallParticipant *p = pl->data;
-		GList *row = NULL;
-		row = g_list_append(row, g_strdup(p->full_name));
-		GEnumValue *val = g_enum_get_value(klass, p->status);
-		row = g_list_append(row, g_strdup(_(val->value_nick)));
-
-		const gchar *screen_icon;
-		if (p->shared_screen == CHIME_SHARED_SCREEN_VIEWING)
-			screen_icon = "👁";
-		else if (p->shared_screen == CHIME_SHARED_SCREEN_PRESENTING)
-			screen_icon = "🗔";
-		else
-			screen_icon = "";
-		row = g_list_append(row, g_strdup(screen_icon));
-
-		const gchar *vol_icon;
-		if (p->status != CHIME_PARTICIPATION_PRESENT)
-			vol_icon = "";
-		else if (p->volume == -128)
-			vol_icon = "🔇";
-		else if (p->volume < -64)
-			vol_icon = "🔈";
-		else if (p->volume < -32)
-			vol_icon = "🔉";
-		else
-			vol_icon = "🔊";
-		row = g_list_append(row, g_strdup(vol_icon));
-
-		const gchar *video_or_phone_icon;
-		if (p->video_present == TRUE)
-			video_or_phone_icon = "🎥";
-		else if (p->pots == TRUE)
-			video_or_phone_icon = "📞";
-		else
-			video_or_phone_icon = "";
-		row = g_list_append(row, g_strdup(video_or_phone_icon));
-
-		purple_notify_searchresults_row_add(results, row);
-
-		pl = g_list_remove(pl, p);
+		/* libpurple frees the rows it's given */
+		for (l = row->cols; l; l = l->next)
+			cols = g_list_prepend(cols, g_strdup(l->data));
+		purple_notify_searchresults_row_add(results, g_list_reverse(cols));
 	}
-	g_type_class_unref(klass);
 
 	return results;
-
 }
+
 static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat);
 
 static void participants_closed_cb(gpointer _chat)
 {
 	struct chime_chat *chat = _chat;
 	chat->participants_ui = NULL;
+	clear_participant_rows(chat);
 	g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
 					     0, 0, NULL, G_CALLBACK(on_call_participants), chat);
 }
@@ -361,6 +453,63 @@ static void call_media_changed(PurpleMedia *media, PurpleMediaState state, const
 }
 
 
+static gboolean is_element_from(GstObject *obj, const gchar *factory_name)
+{
+	GstElementFactory *factory;
+
+	if (!GST_IS_ELEMENT(obj))
+		return FALSE;
+
+	factory = gst_element_get_factory(GST_ELEMENT(obj));
+	return factory && !strcmp(GST_OBJECT_NAME(factory), factory_name);
+}
+
+static gint is_rtpbin(gconstpointer _value, gconstpointer unused)
+{
+	const GValue *value = _value;
+
+	return is_element_from(g_value_get_object(value), "rtpbin") ? 0 : 1;
+}
+
+/*
+ * Our own jitter buffer already plays audio out on a steady clock, with
+ * no gaps in the sequence numbers, so the rtpbin in the conference which
+ * contains our appsrc has nothing left to smooth. Left at its default,
+ * its jitter buffer would just add another 200ms of latency.
+ *
+ * Only the conference which holds our appsrc is searched. Everyone's
+ * media shares the same pipeline, and any other rtpbin in it belongs
+ * to some other session.
+ */
+static void shrink_rtpbin_latency(GstElement *appsrc)
+{
+	GstObject *bin = gst_object_get_parent(GST_OBJECT(appsrc));
+	GstIterator *iter;
+	GValue value = G_VALUE_INIT;
+
+	while (bin && !is_element_from(bin, "fsrtpconference")) {
+		GstObject *parent = gst_object_get_parent(bin);
+
+		gst_object_unref(bin);
+		bin = parent;
+	}
+	if (!bin) {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "No conference found for call audio\n");
+		return;
+	}
+
+	iter = gst_bin_iterate_recurse(GST_BIN(bin));
+	if (gst_iterator_find_custom(iter, is_rtpbin, &value, NULL)) {
+		/* Just enough to absorb scheduling noise */
+		g_object_set(g_value_get_object(&value), "latency", 20, NULL);
+		g_value_unset(&value);
+	} else {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "No rtpbin found for call audio\n");
+	}
+	gst_iterator_free(iter);
+	gst_object_unref(bin);
+}
+
 /* Set up Pidgin media streams while it's connecting... */
 static void call_media_setup(ChimeCall *call, struct chime_chat *chat)
 {
@@ -435,6 +584,7 @@ static void call_media_setup(ChimeCall *call, struct chime_chat *chat)
 	gst_app_src_set_max_bytes(GST_APP_SRC(appsrc), 100);
 	gst_app_src_set_stream_type(GST_APP_SRC(appsrc), GST_APP_STREAM_TYPE_STREAM);
 	chime_call_install_gst_app_callbacks(chat->call, GST_APP_SRC(appsrc), GST_APP_SINK(appsink));
+	shrink_rtpbin_latency(appsrc);
 	g_object_unref(appsrc);
 	g_object_unref(appsink);
 
@@ -469,9 +619,9 @@ static void on_audio_state(ChimeCall *call, ChimeAudioState audio_state,
 	}
 }
 
-static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat)
+static void show_participant_rows(struct chime_chat *chat)
 {
-	PurpleNotifySearchResults *results = generate_sr_participants(participants);
+	PurpleNotifySearchResults *results = generate_sr_participants(chat);
 	PurpleConnection *conn = chat->conv->account->gc;
 
 	if (!chat->participants_ui) {
@@ -483,6 +633,76 @@ static void on_call_participants(ChimeCall *call, GHashTable *participants, stru
 	}
 }
 
+/* The whole roster, which may have gained people or changed their status */
+static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat)
+{
+	GHashTableIter iter;
+	gpointer p;
+
+	clear_participant_rows(chat);
+	chat->participant_rows = g_ptr_array_new_full(g_hash_table_size(participants),
+						      free_participant_row);
+	chat->participant_row_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	g_hash_table_iter_init(&iter, participants);
+	while (g_hash_table_iter_next(&iter, NULL, &p)) {
+		struct participant_row *row = g_new0(struct participant_row, 1);
+
+		row->p = p;
+		row->cols = render_participant(chat, p);
+		g_ptr_array_add(chat->participant_rows, row);
+		g_hash_table_insert(chat->participant_row_map, p, row);
+	}
+	g_ptr_array_sort(chat->participant_rows, participant_row_sort);
+
+	show_participant_rows(chat);
+}
+
+/* Volume changes only, which don't affect the ordering */
+static void on_call_participants_updated(ChimeCall *call, GPtrArray *updated, struct chime_chat *chat)
+{
+	gboolean changed = FALSE;
+	guint i;
+
+	if (!chat->participants_ui || !chat->participant_row_map)
+		return;
+
+	/* Most volume changes don't move it into a different icon */
+	for (i = 0; i < updated->len; i++) {
+		struct participant_row *row = g_hash_table_lookup(chat->participant_row_map,
+								  g_ptr_array_index(updated, i));
+		if (row && rerender_participant_row(chat, row))
+			changed = TRUE;
+	}
+
+	if (changed)
+		show_participant_rows(chat);
+}
+
+static void on_call_audio_stats(ChimeCall *call, const ChimeCallAudioStats *stats,
+				struct chime_chat *chat)
+{
+	guint i;
+
+	purple_debug(PURPLE_DEBUG_INFO, "chime",
+		     "Call quality: MOS %.2f, %u/%u frames lost (%.1f%%), jitter %.1fms, RTT %.0fms\n",
+		     stats->mos, stats->frames_lost, stats->frames_received + stats->frames_lost,
+		     stats->loss_percent, stats->jitter_ms, stats->rtt_ms);
+
+	if (!chat->participants_ui || !chat->participant_rows)
+		return;
+
+	for (i = 0; i < chat->participant_rows->len; i++) {
+		struct participant_row *row = g_ptr_array_index(chat->participant_rows, i);
+
+		if (participant_is_self(chat, row->p)) {
+			if (rerender_participant_row(chat, row))
+				show_participant_rows(chat);
+			break;
+		}
+	}
+}
+
 static void on_room_membership(ChimeRoom *room, ChimeRoomMember *member, struct chime_chat *chat)
 {
 	const gchar *who = chime_contact_get_email(member->contact);
@@ -604,6 +824,8 @@ static void share_screen(gpointer _chat, PurpleMediaElementInfo *info)
 	}
 
 	gchar *sinkname = g_strdup_printf("chime_screen_sink_%p", chat->call);
+	/* The source is whatever was picked; xcbimagesrc can give vp8enc its
+	 * I420 directly, leaving videoconvert with nothing to do. */
 	gchar *sinkpipe = g_strdup_printf("videorate drop-only=1 max-rate=3 ! videoconvert ! vp8enc min-quantizer=15 max-quantizer=25 target-bitrate=256000 deadline=1 ! appsink name=%s async=false", sinkname);
 	PurpleMediaCandidate *cand =
 		purple_media_candidate_new(NULL, 1,
@@ -835,6 +1057,7 @@ void chime_destroy_chat(struct chime_chat *chat)
 			purple_notify_close(PURPLE_NOTIFY_SEARCHRESULTS, chat->participants_ui);
 			chat->participants_ui = NULL;
 		}
+		clear_participant_rows(chat);
 
 		g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_DATA,
 						     0, 0, NULL, NULL, chat);
@@ -861,7 +1084,7 @@ void chime_destroy_chat(struct chime_chat *chat)
 	purple_debug(PURPLE_DEBUG_INFO, "chime", "Destroyed chat %p\n", chat);
 }
 
-static void on_group_conv_msg(ChimeConversation *conv, JsonNode *node, PurpleConnection *conn);
+static void on_group_conv_msg(ChimeConversation *conv, ChimeMessage *msg, PurpleConnection *conn);
 
 static void on_chat_name(ChimeObject *obj, GParamSpec *ignored, struct chime_chat *chat)
 {
@@ -871,7 +1094,7 @@ static void on_chat_name(ChimeObject *obj, GParamSpec *ignored, struct chime_cha
 		purple_conversation_set_name(chat->conv, name);
 }
 
-struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, ChimeObject *obj, JsonNode *first_msg, ChimeMeeting *meeting)
+struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, ChimeObject *obj, ChimeMessage *first_msg, ChimeMeeting *meeting)
 {
 	if (!obj)
 		return NULL;
@@ -921,7 +1144,9 @@ struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, Ch
 			g_signal_connect(chat->call, "screen-state", G_CALLBACK(on_screen_state), chat);
 			g_signal_connect(chat->call, "audio-state", G_CALLBACK(on_audio_state), chat);
 			g_signal_connect(chat->call, "participants-changed", G_CALLBACK(on_call_participants), chat);
+			g_signal_connect(chat->call, "participants-updated", G_CALLBACK(on_call_participants_updated), chat);
 			g_signal_connect(chat->call, "new-presenter", G_CALLBACK(on_call_presenter), chat);
+			g_signal_connect(chat->call, "audio-stats", G_CALLBACK(on_call_audio_stats), chat);
 
 			/* We'll probably miss the first audio-state signal when it
 			 * starts connecting. Set up the call media now if needed. */
@@ -933,13 +1158,13 @@ struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, Ch
 	return chat;
 }
 
-static void on_group_conv_msg(ChimeConversation *conv, JsonNode *node, PurpleConnection *conn)
+static void on_group_conv_msg(ChimeConversation *conv, ChimeMessage *msg, PurpleConnection *conn)
 {
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 	struct chime_chat *chat = g_hash_table_lookup(pc->chats_by_room, conv);
 
 	if (!chat)
-		chat = do_join_chat(conn, pc->cxn, CHIME_OBJECT(conv), node, NULL);
+		chat = do_join_chat(conn, pc->cxn, CHIME_OBJECT(conv), msg, NULL);
 }
 
 void chime_purple_join_chat(PurpleConnection *conn, GHashTable *data)
@@ -1044,13 +1269,13 @@ void purple_chime_destroy_chats(PurpleConnection *conn)
 	g_clear_pointer(&pc->mention_regex, g_regex_unref);
 }
 
-static void on_chime_room_mentioned(ChimeConnection *cxn, ChimeObject *obj, JsonNode *node, PurpleConnection *conn)
+static void on_chime_room_mentioned(ChimeConnection *cxn, ChimeObject *obj, ChimeMessage *msg, PurpleConnection *conn)
 {
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 	struct chime_chat *chat = g_hash_table_lookup(pc->chats_by_room, obj);
 
 	if (!chat)
-		chat = do_join_chat(conn, cxn, obj, node, NULL);
+		chat = do_join_chat(conn, cxn, obj, msg, NULL);
 }
 
 static void on_chime_new_room(ChimeConnection *cxn, ChimeRoom *room, PurpleConnection *conn)
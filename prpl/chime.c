@@ -43,7 +43,7 @@ static gboolean chime_purple_plugin_load(PurplePlugin *plugin)
 			       purple_marshal_VOID__POINTER_POINTER_POINTER, NULL, 3,
 	/* conv */	       purple_value_new(PURPLE_TYPE_SUBTYPE, PURPLE_SUBTYPE_CONVERSATION),
 	/* outbound? */	       purple_value_new(PURPLE_TYPE_BOOLEAN),
-	/* Message node */     purple_value_new(PURPLE_TYPE_POINTER));
+	/* ChimeMessage */     purple_value_new(PURPLE_TYPE_POINTER));
 
 	purple_signal_register(plugin, "chime-conv-membership",
 			       purple_marshal_VOID__POINTER_POINTER, NULL, 2,
@@ -250,6 +250,7 @@ static void chime_purple_login(PurpleAccount *account)
 	purple_chime_init_conversations(conn);
 	purple_chime_init_chats(conn);
 	purple_chime_init_messages(conn);
+	purple_chime_init_search(conn);
 
 	pc->cxn = chime_connection_new(purple_account_get_username(account),
 				       server, devtoken, token);
@@ -296,6 +297,7 @@ static void chime_purple_close(PurpleConnection *conn)
 	purple_chime_destroy_messages(conn);
 	purple_chime_destroy_conversations(conn);
 	purple_chime_destroy_chats(conn);
+	purple_chime_destroy_search(conn);
 
 	chime_connection_disconnect(pc->cxn);
 	g_clear_object(&pc->cxn);
@@ -481,6 +483,10 @@ static GList *chime_purple_plugin_actions(PurplePlugin *plugin,
 				       chime_purple_user_search);
 	acts = g_list_append(acts, act);
 
+	act = purple_plugin_action_new(_("Message search..."),
+				       chime_purple_message_search);
+	acts = g_list_append(acts, act);
+
 	act = purple_plugin_action_new(_("Schedule meeting (Personal PIN)..."),
 				       chime_purple_schedule_personal);
 	acts = g_list_append(acts, act);
@@ -535,6 +541,10 @@ static void chime_purple_init_plugin(PurplePlugin *plugin)
 	opt = purple_account_option_string_new(_("Token"), "token", NULL);
 	opts = g_list_append(opts, opt);
 
+	opt = purple_account_option_bool_new(_("Keep a local search index of messages"),
+					     "search-history", FALSE);
+	opts = g_list_append(opts, opt);
+
 	chime_prpl_info.protocol_options = opts;
 
 #ifndef HAVE_CHAT_SEND_FILE
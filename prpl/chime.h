@@ -22,6 +22,7 @@
 
 #include <dbus-server.h>
 #include <prpl.h>
+#include <notify.h>
 
 #include <libsoup/soup.h>
 #include <json-glib/json-glib.h>
@@ -43,14 +44,15 @@ struct purple_chime {
 	GHashTable *live_chats;
 	int chat_id;
 
-	void *convlist_handle;
-	guint convlist_refresh_id;
+	struct chime_results *convlist;
 
 	void *joinable_handle;
 	guint joinable_refresh_id;
 
 	/* Allow pin_join to abort a 'joinable meetings' popup */
 	GSList *pin_joins;
+
+	struct chime_search *search;
 };
 
 #define PURPLE_CHIME_CXN(conn) (CHIME_CONNECTION(((struct purple_chime *)purple_connection_get_protocol_data(conn))->cxn))
@@ -104,7 +106,7 @@ int chime_purple_chat_send(PurpleConnection *conn, int id, const char *message,
 char *chime_purple_cb_real_name(PurpleConnection *conn, int id, const char *who);
 void on_chime_new_group_conv(ChimeConnection *cxn, ChimeConversation *conv, PurpleConnection *conn);
 void chime_purple_chat_invite(PurpleConnection *conn, int id, const char *message, const char *who);
-struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, ChimeObject *obj, JsonNode *first_msg, ChimeMeeting *meeting);
+struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, ChimeObject *obj, ChimeMessage *first_msg, ChimeMeeting *meeting);
 void chime_purple_chat_join_audio(struct chime_chat *chat);
 GList *chime_purple_chat_menu(PurpleChat *chat);
 char *chime_purple_get_cb_alias(PurpleConnection *conn, int id, const gchar *who);
@@ -125,7 +127,7 @@ extern PurpleDBusBinding chime_purple_dbus_bindings[];
 struct chime_msgs;
 
 typedef void (*chime_msg_cb)(ChimeConnection *cxn, struct chime_msgs *msgs,
-			     JsonNode *node, time_t tm, gboolean new_msg);
+			     ChimeMessage *msg, time_t tm, gboolean new_msg);
 struct chime_msgs {
 	PurpleConnection *conn;
 	ChimeObject *obj;
@@ -142,10 +144,40 @@ struct chime_msgs {
 void fetch_messages(ChimeConnection *cxn, struct chime_msgs *msgs, const gchar *next_token);
 void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs);
 void cleanup_msgs(struct chime_msgs *msgs);
-void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj, chime_msg_cb cb, const gchar *name, JsonNode *first_msg);
+void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj, chime_msg_cb cb, const gchar *name, ChimeMessage *first_msg);
 void purple_chime_init_messages(PurpleConnection *conn);
 void purple_chime_destroy_messages(PurpleConnection *conn);
 
+/* search.c */
+struct chime_search;
+
+void purple_chime_init_search(PurpleConnection *conn);
+void purple_chime_destroy_search(PurpleConnection *conn);
+void chime_search_add_message(PurpleConnection *conn, ChimeObject *obj, ChimeMessage *msg);
+void chime_purple_message_search(PurplePluginAction *action);
+
+/* results.c */
+struct chime_results;
+
+typedef PurpleNotifySearchResults *(*chime_results_new_fn)(void);
+typedef GList *(*chime_results_row_fn)(struct chime_results *res, GObject *obj);
+typedef void (*chime_results_order_fn)(struct chime_results *res);
+
+struct chime_results *chime_results_new(PurpleConnection *conn,
+					chime_results_new_fn new_results,
+					chime_results_row_fn render_row,
+					chime_results_order_fn reorder,
+					gpointer user_data);
+void chime_results_free(struct chime_results *res);
+void chime_results_close(struct chime_results *res);
+void chime_results_set_ui_handle(struct chime_results *res, void *ui_handle);
+gpointer chime_results_get_user_data(struct chime_results *res);
+void chime_results_set_objects(struct chime_results *res, GList *objs);
+void chime_results_watch(struct chime_results *res, gpointer row_obj,
+			 gpointer instance, const gchar *detailed_signal);
+void chime_results_queue_update(struct chime_results *res);
+PurpleNotifySearchResults *chime_results_build(struct chime_results *res);
+
 /* attachments.c */
 
 /*
@@ -171,7 +203,7 @@ typedef struct _AttachmentContext {
 	int chat_id; /* -1 for IM */
 } AttachmentContext;
 
-ChimeAttachment *extract_attachment(JsonNode *record);
+ChimeAttachment *extract_attachment(ChimeMessage *msg);
 
 void download_attachment(ChimeConnection *cxn, ChimeAttachment *att, AttachmentContext *ctx);
 void chime_send_file(PurpleConnection *gc, const char *who, const char *filename);
@@ -36,17 +36,15 @@ struct chime_im {
 
 /* Called for all deliveries of incoming conversation messages, at startup and later */
 static void do_conv_deliver_msg(ChimeConnection *cxn, struct chime_msgs *m,
-				JsonNode *record, time_t msg_time, gboolean new_msg)
+				ChimeMessage *msg, time_t msg_time, gboolean new_msg)
 {
 	struct chime_im *im = (struct chime_im *)m;
-	const gchar *sender, *message;
-	gint64 sys;
-	if (!parse_string(record, "Sender", &sender) ||
-	    !parse_int(record, "IsSystemMessage", &sys))
+	const gchar *sender = msg->sender;
+	if (!sender)
 		return;
 
 	PurpleMessageFlags flags = 0;
-	if (sys)
+	if (msg->is_system)
 		flags |= PURPLE_MESSAGE_SYSTEM;
 	if (!new_msg)
 		flags |= PURPLE_MESSAGE_DELAYED;
@@ -61,7 +59,7 @@ static void do_conv_deliver_msg(ChimeConnection *cxn, struct chime_msgs *m,
 			from = chime_contact_get_email(who);
 	}
 
-	ChimeAttachment *att = extract_attachment(record);
+	ChimeAttachment *att = extract_attachment(msg);
 	if (att) {
 		AttachmentContext *ctx = g_new(AttachmentContext, 1);
 		ctx->conn = im->m.conn;
@@ -75,8 +73,8 @@ static void do_conv_deliver_msg(ChimeConnection *cxn, struct chime_msgs *m,
 
 	// Download messages don't have 'content' but normal messages do.
 	// if you receive one, parse it:
-	if (parse_string(record, "Content", &message)) {
-		gchar *escaped = g_markup_escape_text(message, -1);
+	if (msg->content) {
+		gchar *escaped = g_markup_escape_text(msg->content, -1);
 
 		/* Process markdown */
 		if (g_str_has_prefix(escaped, "/md") && (escaped[3] == ' ' || escaped[3] == '\n')) {
@@ -104,7 +102,7 @@ static void do_conv_deliver_msg(ChimeConnection *cxn, struct chime_msgs *m,
 			purple_conversation_write(pconv, NULL, escaped,
 					flags | PURPLE_MESSAGE_SEND, msg_time);
 			purple_signal_emit(purple_connection_get_prpl(account->gc),
-					"chime-got-convmsg", pconv, TRUE, record);
+					"chime-got-convmsg", pconv, TRUE, msg);
 		} else {
 			serv_got_im(im->m.conn, email, escaped, flags | PURPLE_MESSAGE_RECV,
 						msg_time);
@@ -117,7 +115,7 @@ static void do_conv_deliver_msg(ChimeConnection *cxn, struct chime_msgs *m,
 			if (pconv) {
 				purple_conversation_update(pconv, PURPLE_CONV_UPDATE_UNSEEN);
 				purple_signal_emit(purple_connection_get_prpl(im->m.conn),
-								   "chime-got-convmsg", pconv, FALSE, record);
+								   "chime-got-convmsg", pconv, FALSE, msg);
 			}
 
 		}
@@ -178,7 +176,7 @@ static gboolean is_group_conv(ChimeConnection *cxn, ChimeConversation *conv, Chi
 	return FALSE;
 }
 
-static void refresh_convlist(ChimeObject *obj, GParamSpec *pspec, PurpleConnection *conn);
+static void refresh_convlist(PurpleConnection *conn);
 
 void on_chime_new_conversation(ChimeConnection *cxn, ChimeConversation *conv, PurpleConnection *conn)
 {
@@ -186,7 +184,7 @@ void on_chime_new_conversation(ChimeConnection *cxn, ChimeConversation *conv, Pu
 	ChimeContact *peer = NULL;
 
 	/* If we are displaying the Recent Connections dialog, update it. */
-	refresh_convlist(NULL, NULL, conn);
+	refresh_convlist(conn);
 
 	if (is_group_conv(cxn, conv, &peer)) {
 		on_chime_new_group_conv(cxn, conv, conn);
@@ -405,30 +403,17 @@ int chime_purple_send_im(PurpleConnection *gc, const char *who, const char *mess
 	return 0;
 }
 
-static void unsub_conv_object(ChimeConnection *cxn, ChimeObject *obj, PurpleConnection *conn)
+static void convlist_closed_cb(gpointer _res)
 {
-	g_signal_handlers_disconnect_matched(obj, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-					     G_CALLBACK(refresh_convlist), conn);
-}
-
-static void convlist_closed_cb(gpointer _conn)
-{
-	PurpleConnection *conn = _conn;
+	struct chime_results *res = _res;
+	PurpleConnection *conn = chime_results_get_user_data(res);
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 
-	if (!pc)
-		return;
-
-	if (pc->convlist_refresh_id) {
-		g_source_remove(pc->convlist_refresh_id);
-		pc->convlist_refresh_id = 0;
-	}
-	pc->convlist_handle = NULL;
-
-	/* Unsubscribe from all the signals that were updating the dialog contents */
-	chime_connection_foreach_conversation(PURPLE_CHIME_CXN(conn), (void *)unsub_conv_object, conn);
-	chime_connection_foreach_contact(PURPLE_CHIME_CXN(conn), (void *)unsub_conv_object, conn);
+	if (pc && pc->convlist == res)
+		pc->convlist = NULL;
 
+	/* This drops all the signals that were updating the dialog contents */
+	chime_results_free(res);
 }
 
 static void open_im_conv(PurpleConnection *conn, GList *row, gpointer _unused)
@@ -451,21 +436,26 @@ static void open_im_conv(PurpleConnection *conn, GList *row, gpointer _unused)
 	}
 }
 
-static gint compare_conv_date(ChimeConversation *a, ChimeConversation *b)
-{
-	return g_strcmp0(chime_conversation_get_updated_on(b),
-			 chime_conversation_get_updated_on(a));
-}
-
 static void insert_conv(ChimeConnection *cxn, ChimeConversation *conv, gpointer _convs)
 {
 	GList **convs = _convs;
 
 	/* We don't ref it as we'll use it immediately before anything else can happen */
-	*convs = g_list_insert_sorted(*convs, conv, (GCompareFunc) compare_conv_date);
+	*convs = g_list_prepend(*convs, conv);
 }
 
-static PurpleNotifySearchResults *generate_recent_convs(PurpleConnection *conn)
+static void order_recent_convs(struct chime_results *res)
+{
+	PurpleConnection *conn = chime_results_get_user_data(res);
+	GList *convs = NULL;
+
+	chime_connection_foreach_recent_conversation(PURPLE_CHIME_CXN(conn), insert_conv, &convs);
+	convs = g_list_reverse(convs);
+	chime_results_set_objects(res, convs);
+	g_list_free(convs);
+}
+
+static PurpleNotifySearchResults *new_recent_convs(void)
 {
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
@@ -479,63 +469,43 @@ static PurpleNotifySearchResults *generate_recent_convs(PurpleConnection *conn)
 
 	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, open_im_conv);
 
-	GList *convs = NULL;
-	chime_connection_foreach_conversation(PURPLE_CHIME_CXN(conn), insert_conv, &convs);
-
-	gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
-
-	while (convs) {
-		ChimeConversation *conv = convs->data;
-		convs = g_list_delete_link(convs, convs);
+	return results;
+}
 
-		GList *row = NULL;
-		row = g_list_append(row, g_strdup(chime_conversation_get_name(conv)));
-		row = g_list_append(row, g_strdup(chime_conversation_get_updated_on(conv)));
+static GList *render_recent_conv(struct chime_results *res, GObject *obj)
+{
+	PurpleConnection *conn = chime_results_get_user_data(res);
+	ChimeConversation *conv = CHIME_CONVERSATION(obj);
+	GList *row = NULL;
 
-		ChimeContact *peer = NULL;
-		if (is_group_conv(PURPLE_CHIME_CXN(conn), conv, &peer)) {
-			row = g_list_append(row, g_strdup("(N/A)"));
-		} else {
-			GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(peer));
-			row = g_list_append(row, g_strdup(_(val->value_nick)));
-			g_signal_handlers_disconnect_matched(peer, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-						     G_CALLBACK(refresh_convlist), conn);
-			g_signal_connect(peer, "notify::availability", G_CALLBACK(refresh_convlist), conn);
-			g_object_unref(peer);
-		}
+	row = g_list_append(row, g_strdup(chime_conversation_get_name(conv)));
+	row = g_list_append(row, g_strdup(chime_conversation_get_updated_on(conv)));
 
-		purple_notify_searchresults_row_add(results, row);
+	ChimeContact *peer = NULL;
+	if (is_group_conv(PURPLE_CHIME_CXN(conn), conv, &peer)) {
+		row = g_list_append(row, g_strdup("(N/A)"));
+	} else {
+		gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
+		GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(peer));
+		row = g_list_append(row, g_strdup(_(val->value_nick)));
+		g_type_class_unref(klass);
 
-		g_signal_handlers_disconnect_matched(conv, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-						     G_CALLBACK(refresh_convlist), conn);
-		g_signal_connect(conv, "notify::name", G_CALLBACK(refresh_convlist), conn);
-		g_signal_connect(conv, "notify::updated_on", G_CALLBACK(refresh_convlist), conn);
+		chime_results_watch(res, conv, peer, "notify::availability");
+		g_object_unref(peer);
 	}
 
-	g_type_class_unref(klass);
-	return results;
-}
-
-static gboolean update_convlist(gpointer _conn)
-{
-	PurpleConnection *conn = _conn;
-	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	chime_results_watch(res, conv, conv, "notify::name");
+	chime_results_watch(res, conv, conv, "notify::updated-on");
 
-	PurpleNotifySearchResults *results = generate_recent_convs(conn);
-	purple_notify_searchresults_new_rows(conn, results, pc->convlist_handle);
-
-	pc->convlist_refresh_id = 0;
-	return FALSE;
+	return row;
 }
 
-static void refresh_convlist(ChimeObject *obj, GParamSpec *pspec, PurpleConnection *conn)
+static void refresh_convlist(PurpleConnection *conn)
 {
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 
-	if (!pc->convlist_handle || pc->convlist_refresh_id)
-		return;
-
-	pc->convlist_refresh_id = g_idle_add(update_convlist, conn);
+	if (pc->convlist)
+		chime_results_queue_update(pc->convlist);
 }
 
 void chime_purple_recent_conversations(PurplePluginAction *action)
@@ -543,24 +513,28 @@ void chime_purple_recent_conversations(PurplePluginAction *action)
 	PurpleConnection *conn = (PurpleConnection *) action->context;
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 
-	if (pc->convlist_handle) {
-		if (!pc->convlist_refresh_id)
-			pc->convlist_refresh_id = g_idle_add(update_convlist, conn);
+	if (pc->convlist) {
+		chime_results_queue_update(pc->convlist);
 		return;
 	}
 
-	PurpleNotifySearchResults *results = generate_recent_convs(conn);
-	pc->convlist_handle = purple_notify_searchresults(conn, _("Recent Chime Conversations"),
-							  _("Recent conversations:"),
-							  conn->account->username, results,
-							  convlist_closed_cb, conn);
-	if (!pc->convlist_handle) {
+	struct chime_results *res = chime_results_new(conn, new_recent_convs,
+						      render_recent_conv,
+						      order_recent_convs, conn);
+	PurpleNotifySearchResults *results = chime_results_build(res);
+	void *handle = purple_notify_searchresults(conn, _("Recent Chime Conversations"),
+						   _("Recent conversations:"),
+						   conn->account->username, results,
+						   convlist_closed_cb, res);
+	if (!handle) {
 		purple_notify_error(conn, NULL,
 				    _("Unable to display recent conversations."),
 				    NULL);
-		convlist_closed_cb(conn);
+		chime_results_free(res);
 		return;
 	}
+	chime_results_set_ui_handle(res, handle);
+	pc->convlist = res;
 }
 
 static void im_destroy(gpointer _im)
@@ -616,6 +590,6 @@ void purple_chime_destroy_conversations(PurpleConnection *conn)
 	g_clear_pointer(&pc->ims_by_email, g_hash_table_destroy);
 	g_clear_pointer(&pc->ims_by_profile_id, g_hash_table_destroy);
 
-	if (pc->convlist_handle)
-		convlist_closed_cb(conn);
+	if (pc->convlist)
+		chime_results_close(pc->convlist);
 }
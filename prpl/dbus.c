@@ -42,7 +42,34 @@ chime_add_joinable_meeting_DBUS(DBusMessage *message_DBUS, DBusError *error_DBUS
 	return reply_DBUS;
 }
 
+static DBusMessage*
+chime_search_messages_DBUS(DBusMessage *message_DBUS, DBusError *error_DBUS) {
+	DBusMessage *reply_DBUS;
+	dbus_int32_t account_ID;
+	PurpleAccount *account;
+	const char *query;
+	const char *sender;
+	dbus_int64_t after;
+	dbus_int64_t before;
+	gchar **RESULT;
+	dbus_message_get_args(message_DBUS, error_DBUS, DBUS_TYPE_INT32, &account_ID, DBUS_TYPE_STRING, &query, DBUS_TYPE_STRING, &sender, DBUS_TYPE_INT64, &after, DBUS_TYPE_INT64, &before, DBUS_TYPE_INVALID);
+	CHECK_ERROR(error_DBUS);
+	PURPLE_DBUS_ID_TO_POINTER(account, account_ID, PurpleAccount, error_DBUS);
+	if (!account || !account->protocol_id || strcmp(account->protocol_id, "prpl-chime")) {
+		dbus_set_error(error_DBUS, "im.pidgin.purple.InvalidHandle",
+			       "PurpleAccount object with ID = %i is not a Chime account", account_ID);
+		return NULL;
+	}
+	sender = (sender && sender[0]) ? sender : NULL;
+	RESULT = chime_search_messages(account, query, sender, after, before);
+	reply_DBUS = dbus_message_new_method_return (message_DBUS);
+	dbus_message_append_args(reply_DBUS, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &RESULT, g_strv_length(RESULT), DBUS_TYPE_INVALID);
+	g_strfreev(RESULT);
+	return reply_DBUS;
+}
+
 PurpleDBusBinding chime_purple_dbus_bindings[] = {
 	{"ChimeAddJoinableMeeting", "in\0i\0account\0in\0s\0pin\0", chime_add_joinable_meeting_DBUS},
+	{"ChimeSearchMessages", "in\0i\0account\0in\0s\0query\0in\0s\0sender\0in\0x\0after\0in\0x\0before\0out\0as\0RESULT\0", chime_search_messages_DBUS},
 	{NULL, NULL, NULL}
 };
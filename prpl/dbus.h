@@ -28,3 +28,20 @@ extern PurpleDBusBinding chime_purple_dbus_bindings[];
  */
 DBUS_EXPORT void chime_add_joinable_meeting(PurpleAccount *account,
 					    const gchar *pin);
+
+/**
+ * ChimeSearchMessages - Search locally stored message history
+ *
+ * Every word in the query must match the start of a word in the message.
+ * Results are newest first, each as "time\twhere\tsender\tmessage".
+ *
+ * @param account   (in) libpurple account
+ * @param query     (in) words to search for
+ * @param sender    (in) sender email or profile ID, or empty for any
+ * @param after     (in) only messages sent at or after this UNIX time, or 0
+ * @param before    (in) only messages sent before this UNIX time, or 0
+ */
+DBUS_EXPORT gchar **chime_search_messages(PurpleAccount *account,
+					  const gchar *query,
+					  const gchar *sender,
+					  gint64 after, gint64 before);
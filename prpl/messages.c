@@ -46,35 +46,19 @@ static gboolean is_msg_unseen(GQueue *q, const gchar *id)
 	return TRUE;
 }
 
-struct msg_sort {
-	gint64 tm;
-	const gchar *id;
-	JsonNode *node;
-};
-
 static gint compare_ms(gconstpointer _a, gconstpointer _b)
 {
-	const struct msg_sort *a = _a;
-	const struct msg_sort *b = _b;
+	const ChimeMessage *a = _a;
+	const ChimeMessage *b = _b;
 
-	return a->tm > b->tm;
+	return a->created_ms > b->created_ms;
 }
 
-static int insert_queued_msg(gpointer _id, gpointer _node, gpointer _list)
+static int insert_queued_msg(gpointer _id, gpointer _msg, gpointer _list)
 {
-	const gchar *str;
 	GList **l = _list;
 
-	if (parse_string(_node, "CreatedOn", &str)) {
-		struct msg_sort *ms = g_new0(struct msg_sort, 1);
-		if (!iso8601_to_ms(str, &ms->tm)) {
-			g_free(ms);
-			return TRUE;
-		}
-		ms->node = json_node_ref(_node);
-		ms->id = _id;
-		*l = g_list_insert_sorted(*l, ms, compare_ms);
-	}
+	*l = g_list_insert_sorted(*l, chime_message_ref(_msg), compare_ms);
 	return TRUE;
 }
 
@@ -86,32 +70,27 @@ void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
 	g_hash_table_foreach_remove(msgs->msg_gather, insert_queued_msg, &l);
 
 	while (l) {
-		struct msg_sort *ms = l->data;
-		const gchar *id = ms->id;
-		JsonNode *node = ms->node;
+		ChimeMessage *msg = l->data;
 		gboolean seen_one = FALSE;
 
-		l = g_list_remove(l, ms);
+		l = g_list_remove(l, msg);
 
-		if (is_msg_unseen(msgs->seen_msgs, id)) {
+		if (is_msg_unseen(msgs->seen_msgs, msg->id)) {
 			gboolean new_msg = FALSE;
 			/* Only treat it as a new message if it is the last one,
 			 * and it was sent within the last day */
-			if (!l && !msgs->fetch_until && (ms->tm / 1000) + 86400 < time(NULL))
+			if (!l && !msgs->fetch_until && (msg->created_ms / 1000) + 86400 < time(NULL))
 				new_msg = TRUE;
 
 			seen_one = TRUE;
-			msgs->cb(cxn, msgs, node, ms->tm / 1000, new_msg);
+			msgs->cb(cxn, msgs, msg, msg->created_ms / 1000, new_msg);
 		}
-		g_free(ms);
 
 		/* Last message, note down the received time */
-		if (!l && !msgs->msgs_failed && seen_one) {
-			const gchar *tm;
-			if (parse_string(node, "CreatedOn", &tm))
-				chime_update_last_msg(cxn, msgs, tm, id);
-		}
-		json_node_unref(node);
+		if (!l && !msgs->msgs_failed && seen_one)
+			chime_update_last_msg(cxn, msgs, msg->created_on, msg->id);
+
+		chime_message_unref(msg);
 	}
 
 	if (!msgs->fetch_until)
@@ -119,68 +98,46 @@ void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
 }
 
 
-static gboolean msg_newer_than(JsonNode *new, const gchar *old_date)
+static gboolean msg_newer_than(ChimeMessage *new, const gchar *old_date)
 {
-	const gchar *new_updated = NULL;
+	gint64 old_ms;
 
-	if (!parse_string(new, "UpdatedOn", &new_updated))
+	if (!iso8601_to_ms(old_date, &old_ms))
 		return FALSE;
 
-	gint64 old_ms, new_ms;
-	if (!iso8601_to_ms(new_updated, &new_ms) ||
-	    !iso8601_to_ms(old_date, &old_ms))
-		return FALSE;
-
-	return new_ms > old_ms;
+	return new->updated_ms > old_ms;
 }
 
-static gboolean msg_newer(JsonNode *new, JsonNode *old)
+static void on_message_received(ChimeObject *obj, ChimeMessage *msg, struct chime_msgs *msgs)
 {
-	const gchar *old_updated = NULL;
-
-	if (!parse_string(old, "UpdatedOn", &old_updated))
-		return TRUE;
+	ChimeConnection *cxn = PURPLE_CHIME_CXN(msgs->conn);
 
-	return msg_newer_than(new, old_updated);
-}
+	chime_search_add_message(msgs->conn, obj, msg);
 
-static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_msgs *msgs)
-{
-	ChimeConnection *cxn = PURPLE_CHIME_CXN(msgs->conn);
-	const gchar *id;
-	if (!parse_string(node, "MessageId", &id))
-		return;
 	if (msgs->msg_gather) {
 		/* If we're still fetching ancient messages and a new message comes
 		 * in, then ignore it. We'll fetch it again when our fetch reaches
 		 * the present day. */
-		if (msgs->fetch_until && msg_newer_than(node, msgs->fetch_until))
+		if (msgs->fetch_until && msg_newer_than(msg, msgs->fetch_until))
 			return;
 
 		/* Still gathering messages. Add to the table, to avoid dupes */
-		JsonNode *old_node = g_hash_table_lookup(msgs->msg_gather, id);
-		if (old_node) {
-			if (!msg_newer(node, old_node))
+		ChimeMessage *old_msg = g_hash_table_lookup(msgs->msg_gather, msg->id);
+		if (old_msg) {
+			if (msg->updated_ms <= old_msg->updated_ms)
 				return;
 			/* Remove first because the key belongs to the value */
-			g_hash_table_remove(msgs->msg_gather, id);
+			g_hash_table_remove(msgs->msg_gather, msg->id);
 		}
-		g_hash_table_insert(msgs->msg_gather, (gchar *)id, json_node_ref(node));
+		g_hash_table_insert(msgs->msg_gather, (gchar *)msg->id, chime_message_ref(msg));
 		return;
 	}
-	const gchar *created;
-	if (!parse_string(node, "CreatedOn", &created))
-		return;
-
-	gint64 created_ms;
-	if (!iso8601_to_ms(created, &created_ms))
-		return;
 
 	if (!msgs->msgs_failed)
-		chime_update_last_msg(cxn, msgs, created, id);
+		chime_update_last_msg(cxn, msgs, msg->created_on, msg->id);
 
-	if (is_msg_unseen(msgs->seen_msgs, id))
-		msgs->cb(cxn, msgs, node, created_ms / 1000, TRUE);
+	if (is_msg_unseen(msgs->seen_msgs, msg->id))
+		msgs->cb(cxn, msgs, msg, msg->created_ms / 1000, TRUE);
 }
 
 /* Once the message fetching is complete, we can play the fetched messages in order */
@@ -260,13 +217,13 @@ static void on_last_sent_updated(ChimeObject *obj, GParamSpec *ignored, struct c
 
 		chime_connection_fetch_messages_async(PURPLE_CHIME_CXN(msgs->conn), obj, NULL, msgs->last_seen, NULL, fetch_msgs_cb, msgs);
 		msgs->msgs_done = FALSE;
-		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
+		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)chime_message_unref);
 	}
 
 	g_free(last_sent);
 }
 
-void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj, chime_msg_cb cb, const gchar *name, JsonNode *first_msg)
+void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj, chime_msg_cb cb, const gchar *name, ChimeMessage *first_msg)
 {
 	msgs->conn = conn;
 	msgs->obj = g_object_ref(obj);
@@ -333,7 +290,7 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 	}
 
 	if (!msgs->msgs_done || !msgs->members_done)
-		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
+		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)chime_message_unref);
 
 	if (first_msg)
 		on_message_received(obj, first_msg, msgs);
@@ -0,0 +1,242 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <glib/gi18n.h>
+
+#include <notify.h>
+
+#include "chime.h"
+
+/*
+ * Search result dialogs (recent conversations, contact autocomplete) used
+ * to regenerate every row from scratch whenever anything changed, and to
+ * disconnect and reconnect all their notify:: handlers each time. Here we
+ * keep the rendered column strings for each row, keyed by the object it
+ * shows, and only re-render the rows which have actually changed.
+ *
+ * libpurple only lets us replace the whole table at once, so we still
+ * hand it a complete set of rows. But change notifications are coalesced
+ * so that a presence storm results in one update, not hundreds.
+ */
+
+#define RESULTS_COALESCE_MS 100
+
+struct results_watch {
+	gpointer instance;
+	const gchar *signal;	/* Interned */
+	gulong handler_id;
+};
+
+struct results_row {
+	struct chime_results *res;
+	GObject *obj;
+	GList *cols;		/* Rendered strings, owned */
+	GArray *watches;
+	gboolean dirty;
+};
+
+struct chime_results {
+	PurpleConnection *conn;
+	void *ui_handle;
+
+	chime_results_new_fn new_results;
+	chime_results_row_fn render_row;
+	chime_results_order_fn reorder;
+	gpointer user_data;
+
+	GPtrArray *rows;	/* In display order */
+	GHashTable *rows_by_obj;
+	guint flush_id;
+};
+
+static void free_row(gpointer _row)
+{
+	struct results_row *row = _row;
+	guint i;
+
+	for (i = 0; i < row->watches->len; i++) {
+		struct results_watch *w = &g_array_index(row->watches, struct results_watch, i);
+
+		g_signal_handler_disconnect(w->instance, w->handler_id);
+		g_object_unref(w->instance);
+	}
+	g_array_free(row->watches, TRUE);
+	g_list_free_full(row->cols, g_free);
+	g_object_unref(row->obj);
+	g_free(row);
+}
+
+struct chime_results *chime_results_new(PurpleConnection *conn,
+					chime_results_new_fn new_results,
+					chime_results_row_fn render_row,
+					chime_results_order_fn reorder,
+					gpointer user_data)
+{
+	struct chime_results *res = g_new0(struct chime_results, 1);
+
+	res->conn = conn;
+	res->new_results = new_results;
+	res->render_row = render_row;
+	res->reorder = reorder;
+	res->user_data = user_data;
+	res->rows = g_ptr_array_new();
+	res->rows_by_obj = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						 NULL, free_row);
+	return res;
+}
+
+void chime_results_free(struct chime_results *res)
+{
+	if (res->flush_id)
+		g_source_remove(res->flush_id);
+	g_ptr_array_free(res->rows, TRUE);
+	g_hash_table_destroy(res->rows_by_obj);
+	g_free(res);
+}
+
+/* Closes the dialog, whose close callback is expected to free @res */
+void chime_results_close(struct chime_results *res)
+{
+	if (res->ui_handle)
+		purple_notify_close(PURPLE_NOTIFY_SEARCHRESULTS, res->ui_handle);
+	else
+		chime_results_free(res);
+}
+
+void chime_results_set_ui_handle(struct chime_results *res, void *ui_handle)
+{
+	res->ui_handle = ui_handle;
+}
+
+gpointer chime_results_get_user_data(struct chime_results *res)
+{
+	return res->user_data;
+}
+
+/* Objects are borrowed; the model takes its own reference to any it keeps. */
+void chime_results_set_objects(struct chime_results *res, GList *objs)
+{
+	GHashTable *old = res->rows_by_obj;
+
+	res->rows_by_obj = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						 NULL, free_row);
+	g_ptr_array_set_size(res->rows, 0);
+
+	for (; objs; objs = objs->next) {
+		GObject *obj = objs->data;
+		struct results_row *row;
+
+		if (g_hash_table_lookup(res->rows_by_obj, obj))
+			continue;
+
+		row = g_hash_table_lookup(old, obj);
+		if (row) {
+			g_hash_table_steal(old, obj);
+		} else {
+			row = g_new0(struct results_row, 1);
+			row->res = res;
+			row->obj = g_object_ref(obj);
+			row->watches = g_array_new(FALSE, FALSE, sizeof(struct results_watch));
+			row->dirty = TRUE;
+		}
+		g_hash_table_insert(res->rows_by_obj, obj, row);
+		g_ptr_array_add(res->rows, row);
+	}
+
+	/* Anything left over has gone away, along with its signal handlers */
+	g_hash_table_destroy(old);
+}
+
+static gboolean results_flush(gpointer _res)
+{
+	struct chime_results *res = _res;
+
+	res->flush_id = 0;
+
+	if (res->ui_handle)
+		purple_notify_searchresults_new_rows(res->conn,
+						     chime_results_build(res),
+						     res->ui_handle);
+	return FALSE;
+}
+
+void chime_results_queue_update(struct chime_results *res)
+{
+	if (!res->flush_id)
+		res->flush_id = g_timeout_add(RESULTS_COALESCE_MS, results_flush, res);
+}
+
+static void on_watch_notify(GObject *instance, GParamSpec *pspec, struct results_row *row)
+{
+	row->dirty = TRUE;
+	chime_results_queue_update(row->res);
+}
+
+/*
+ * Called from the render_row callback to say that the row for @row_obj
+ * depends on @instance, and should be re-rendered when @detailed_signal
+ * (which must be a notify:: signal) fires on it. Connects only once.
+ */
+void chime_results_watch(struct chime_results *res, gpointer row_obj,
+			 gpointer instance, const gchar *detailed_signal)
+{
+	struct results_row *row = g_hash_table_lookup(res->rows_by_obj, row_obj);
+	const gchar *signal = g_intern_string(detailed_signal);
+	struct results_watch w;
+	guint i;
+
+	g_return_if_fail(row);
+	g_return_if_fail(g_str_has_prefix(signal, "notify::"));
+
+	for (i = 0; i < row->watches->len; i++) {
+		struct results_watch *old = &g_array_index(row->watches, struct results_watch, i);
+
+		if (old->instance == instance && old->signal == signal)
+			return;
+	}
+
+	w.instance = g_object_ref(instance);
+	w.signal = signal;
+	w.handler_id = g_signal_connect(instance, signal, G_CALLBACK(on_watch_notify), row);
+	g_array_append_val(row->watches, w);
+}
+
+/* Re-render any stale rows, then give libpurple a fresh copy of them all. */
+PurpleNotifySearchResults *chime_results_build(struct chime_results *res)
+{
+	PurpleNotifySearchResults *results = res->new_results();
+	guint i;
+
+	if (res->reorder)
+		res->reorder(res);
+
+	for (i = 0; i < res->rows->len; i++) {
+		struct results_row *row = g_ptr_array_index(res->rows, i);
+		GList *cols = NULL, *l;
+
+		if (row->dirty) {
+			g_list_free_full(row->cols, g_free);
+			row->cols = res->render_row(res, row->obj);
+			row->dirty = FALSE;
+		}
+
+		/* libpurple frees the rows it's given */
+		for (l = row->cols; l; l = l->next)
+			cols = g_list_prepend(cols, g_strdup(l->data));
+		purple_notify_searchresults_row_add(results, g_list_reverse(cols));
+	}
+
+	return results;
+}
@@ -0,0 +1,989 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <prpl.h>
+#include <debug.h>
+#include <notify.h>
+#include <request.h>
+
+#include "chime.h"
+#include "dbus.h"
+
+/*
+ * Local full-text search over message history.
+ *
+ * This is opt-in, through the "search-history" account setting, since it
+ * keeps a plaintext copy of every message on disk. When enabled, every
+ * message which passes through on_message_received() is appended to an
+ * on-disk log, so history survives a restart without having to be
+ * fetched from the server again. The log is replayed at login, and
+ * documents are added to an inverted index (term → ascending list of
+ * document numbers) from an idle handler, a few milliseconds at a time,
+ * so neither replay nor indexing ever holds up the main loop. Queries
+ * only see what has been indexed so far.
+ *
+ * Message bodies are only held in memory until they have been both
+ * indexed and written to the log; after that, results are read back
+ * from the log by offset. Edited messages are appended again, so once
+ * enough of the log is superseded it is rewritten in the background.
+ *
+ * Terms are kept in a GSequence sorted by term as well as in a hash
+ * table, so that every query term can be matched as a prefix with a
+ * binary search followed by a short linear walk.
+ */
+
+/* Maximum time (µs) to spend in each idle callback */
+#define SEARCH_IDLE_BUDGET 4000
+/* Terms longer than this (in bytes) are truncated */
+#define SEARCH_MAX_TERM 48
+#define SEARCH_MAX_RESULTS 200
+/* Rewrite the log when this many of its lines, and at least a quarter
+ * of them, have been superseded by later edits */
+#define SEARCH_COMPACT_MIN 256
+
+struct search_doc {
+	gchar *msg_id;
+	const gchar *obj_id;	/* Interned */
+	const gchar *sender;	/* Interned */
+	gint64 created_ms;
+	gint64 updated_ms;
+	gchar *content;		/* Until both indexed and written */
+	goffset offset;		/* Of our line in the log, or -1 */
+	guint32 len;
+	gboolean indexed;
+	gboolean superseded;
+};
+
+struct search_term {
+	gchar *term;
+	GArray *postings;	/* guint32 document numbers, ascending */
+};
+
+struct compact_pos {
+	goffset offset;
+	guint32 len;		/* 0 if not copied */
+};
+
+struct chime_search {
+	PurpleConnection *conn;
+
+	GPtrArray *docs;
+	GHashTable *by_msg_id;	/* msg_id → document number + 1 */
+	guint indexed;		/* docs[0..indexed) are in the index */
+
+	GHashTable *terms;
+	GSequence *term_seq;
+
+	gchar *log_path;
+	GIOChannel *replay;
+	goffset replay_offset;
+	goffset replay_end;
+	FILE *log;		/* Opened "a+"; we read results back from it */
+	goffset log_size;
+	GPtrArray *unwritten;	/* Documents not yet in the log */
+	guint superseded;	/* Log lines which have been superseded */
+
+	FILE *compact;		/* Rewriting the log without superseded lines */
+	gchar *compact_path;
+	guint compact_next, compact_end;
+	goffset compact_size;
+	GArray *compact_pos;	/* struct compact_pos for docs[0..compact_next) */
+
+	guint idle_id;
+};
+
+static void free_doc(gpointer _doc)
+{
+	struct search_doc *doc = _doc;
+
+	g_free(doc->msg_id);
+	g_free(doc->content);
+	g_free(doc);
+}
+
+/* Once a document is both in the index and in the log, we can drop the
+ * copy of its content. Without a log, it has to stay in memory. */
+static void maybe_drop_content(struct search_doc *doc)
+{
+	if (doc->indexed && doc->offset >= 0) {
+		g_free(doc->content);
+		doc->content = NULL;
+	}
+}
+
+/* Replace any invalid UTF-8 with U+FFFD, which both D-Bus and GTK+
+ * will reject or choke on. */
+static gchar *sanitise_utf8(const gchar *str)
+{
+	const gchar *end;
+
+	if (g_utf8_validate(str, -1, &end))
+		return g_strdup(str);
+
+	GString *out = g_string_sized_new(strlen(str));
+	do {
+		g_string_append_len(out, str, end - str);
+		g_string_append_unichar(out, 0xfffd);
+		str = end + 1;
+	} while (!g_utf8_validate(str, -1, &end));
+	g_string_append(out, str);
+
+	return g_string_free(out, FALSE);
+}
+
+static void free_term(gpointer _term)
+{
+	struct search_term *t = _term;
+
+	g_free(t->term);
+	g_array_free(t->postings, TRUE);
+	g_free(t);
+}
+
+/* Never returns 0, so g_sequence_search() always lands on the first term
+ * which is lexically >= the key. */
+static gint term_lower_bound(gconstpointer _a, gconstpointer _b, gpointer unused)
+{
+	const struct search_term *a = _a, *b = _b;
+
+	return strcmp(a->term, b->term) >= 0 ? 1 : -1;
+}
+
+static gint term_cmp(gconstpointer _a, gconstpointer _b, gpointer unused)
+{
+	const struct search_term *a = _a, *b = _b;
+
+	return strcmp(a->term, b->term);
+}
+
+/* Split text into normalised, case-folded words. */
+static GPtrArray *tokenize(const gchar *text)
+{
+	GPtrArray *words = g_ptr_array_new_with_free_func(g_free);
+	gchar *norm = g_utf8_normalize(text, -1, G_NORMALIZE_ALL);
+	if (!norm)
+		return words;
+
+	gchar *folded = g_utf8_casefold(norm, -1);
+	g_free(norm);
+
+	const gchar *p = folded, *start = NULL;
+	while (1) {
+		gunichar c = g_utf8_get_char(p);
+
+		if (c && g_unichar_isalnum(c)) {
+			if (!start)
+				start = p;
+		} else if (start) {
+			gsize len = p - start;
+			if (len > SEARCH_MAX_TERM) {
+				const gchar *end = g_utf8_find_prev_char(start, start + SEARCH_MAX_TERM + 1);
+				len = end - start;
+			}
+			g_ptr_array_add(words, g_strndup(start, len));
+			start = NULL;
+		}
+		if (!c)
+			break;
+		p = g_utf8_next_char(p);
+	}
+	g_free(folded);
+	return words;
+}
+
+static void index_doc(struct chime_search *s, guint32 docnr)
+{
+	struct search_doc *doc = g_ptr_array_index(s->docs, docnr);
+	GPtrArray *words;
+	guint i;
+
+	doc->indexed = TRUE;
+	if (doc->superseded || !doc->content)
+		return;
+
+	words = tokenize(doc->content);
+
+	for (i = 0; i < words->len; i++) {
+		const gchar *word = g_ptr_array_index(words, i);
+		struct search_term *t = g_hash_table_lookup(s->terms, word);
+
+		if (!t) {
+			t = g_new0(struct search_term, 1);
+			t->term = g_strdup(word);
+			t->postings = g_array_new(FALSE, FALSE, sizeof(guint32));
+			g_hash_table_insert(s->terms, t->term, t);
+			g_sequence_insert_sorted(s->term_seq, t, term_cmp, NULL);
+		}
+
+		/* Documents are indexed in order, so a repeated word in the
+		 * same document can only ever be the last entry. */
+		if (!t->postings->len ||
+		    g_array_index(t->postings, guint32, t->postings->len - 1) != docnr)
+			g_array_append_val(t->postings, docnr);
+	}
+	g_ptr_array_unref(words);
+
+	maybe_drop_content(doc);
+}
+
+/* Escape tabs, newlines and backslashes but leave UTF-8 alone */
+static void log_escape(GString *str, const gchar *text)
+{
+	for (; *text; text++) {
+		switch (*text) {
+		case '\\': g_string_append(str, "\\\\"); break;
+		case '\t': g_string_append(str, "\\t"); break;
+		case '\n': g_string_append(str, "\\n"); break;
+		case '\r': g_string_append(str, "\\r"); break;
+		default: g_string_append_c(str, *text);
+		}
+	}
+}
+
+static gchar *log_unescape(const gchar *text)
+{
+	GString *str = g_string_sized_new(strlen(text));
+
+	for (; *text; text++) {
+		if (*text != '\\' || !text[1]) {
+			g_string_append_c(str, *text);
+			continue;
+		}
+		switch (*++text) {
+		case 't': g_string_append_c(str, '\t'); break;
+		case 'n': g_string_append_c(str, '\n'); break;
+		case 'r': g_string_append_c(str, '\r'); break;
+		default: g_string_append_c(str, *text);
+		}
+	}
+	return g_string_free(str, FALSE);
+}
+
+static gboolean search_idle(gpointer _s);
+
+static void kick_idle(struct chime_search *s)
+{
+	if (!s->idle_id)
+		s->idle_id = g_idle_add_full(G_PRIORITY_LOW, search_idle, s, NULL);
+}
+
+/* Returns the new document, or NULL if we already had the same or a
+ * newer version of the message. @offset is -1 if it isn't in the log. */
+static struct search_doc *add_doc(struct chime_search *s, const gchar *msg_id,
+				  const gchar *obj_id, const gchar *sender,
+				  gint64 created_ms, gint64 updated_ms,
+				  const gchar *content, goffset offset, gsize len)
+{
+	struct search_doc *old_doc = NULL;
+	guint old = GPOINTER_TO_UINT(g_hash_table_lookup(s->by_msg_id, msg_id));
+	if (old) {
+		old_doc = g_ptr_array_index(s->docs, old - 1);
+		if (updated_ms <= old_doc->updated_ms)
+			return NULL;
+	}
+
+	struct search_doc *doc = g_new0(struct search_doc, 1);
+	doc->msg_id = g_strdup(msg_id);
+	doc->obj_id = g_intern_string(obj_id);
+	doc->sender = g_intern_string(sender);
+	doc->created_ms = created_ms;
+	doc->updated_ms = updated_ms;
+	doc->content = g_strdup(content);
+	doc->offset = offset;
+	doc->len = len;
+
+	g_ptr_array_add(s->docs, doc);
+	g_hash_table_replace(s->by_msg_id, doc->msg_id, GUINT_TO_POINTER(s->docs->len));
+
+	if (old_doc) {
+		/* Only its place in the posting lists remains */
+		old_doc->superseded = TRUE;
+		if (old_doc->offset >= 0)
+			s->superseded++;
+		g_clear_pointer(&old_doc->msg_id, g_free);
+		g_clear_pointer(&old_doc->content, g_free);
+	}
+
+	kick_idle(s);
+	return doc;
+}
+
+void chime_search_add_message(PurpleConnection *conn, ChimeObject *obj, ChimeMessage *msg)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	struct chime_search *s = pc->search;
+
+	if (!s || !msg->sender || !msg->content)
+		return;
+
+	struct search_doc *doc = add_doc(s, msg->id, chime_object_get_id(obj), msg->sender,
+					 msg->created_ms, msg->updated_ms, msg->content, -1, 0);
+	if (doc)
+		g_ptr_array_add(s->unwritten, doc);
+}
+
+static void format_line(GString *str, struct search_doc *doc, const gchar *content)
+{
+	g_string_append_printf(str, "%s\t%s\t%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t",
+			       doc->msg_id, doc->obj_id, doc->sender,
+			       doc->created_ms, doc->updated_ms);
+	log_escape(str, content);
+	g_string_append_c(str, '\n');
+}
+
+static void replay_line(struct chime_search *s, gchar *line, gsize len)
+{
+	/* A corrupted line is dropped at the next compaction */
+	if (!g_utf8_validate(line, len, NULL))
+		return;
+
+	gchar **fields = g_strsplit(g_strchomp(line), "\t", 6);
+
+	if (g_strv_length(fields) == 6) {
+		gchar *content = log_unescape(fields[5]);
+		add_doc(s, fields[0], fields[1], fields[2],
+			g_ascii_strtoll(fields[3], NULL, 10),
+			g_ascii_strtoll(fields[4], NULL, 10), content,
+			s->replay_offset, len);
+		g_free(content);
+	}
+	g_strfreev(fields);
+}
+
+/* Read a line back from the log, returning its raw fields */
+static gchar **read_log_line(struct chime_search *s, FILE *f, goffset offset, guint32 len)
+{
+	gchar *buf = g_malloc(len + 1);
+	gchar **fields = NULL;
+
+	if (!fseek(f, offset, SEEK_SET) && fread(buf, len, 1, f) == 1) {
+		buf[len] = 0;
+		fields = g_strsplit(g_strchomp(buf), "\t", 6);
+		if (g_strv_length(fields) != 6)
+			g_clear_pointer(&fields, g_strfreev);
+	}
+	g_free(buf);
+	return fields;
+}
+
+/* Returns valid UTF-8, even if the log has been corrupted under us */
+static gchar *doc_content(struct chime_search *s, struct search_doc *doc)
+{
+	gchar *content = NULL;
+
+	if (doc->content)
+		return sanitise_utf8(doc->content);
+
+	if (s->log && doc->offset >= 0) {
+		gchar **fields = read_log_line(s, s->log, doc->offset, doc->len);
+		if (fields && !strcmp(fields[0], doc->msg_id)) {
+			gchar *raw = log_unescape(fields[5]);
+			content = sanitise_utf8(raw);
+			g_free(raw);
+		}
+		g_strfreev(fields);
+	}
+	if (!content) {
+		purple_debug(PURPLE_DEBUG_WARNING, "chime", "Failed to read message %s from %s\n",
+			     doc->msg_id, s->log_path);
+		content = g_strdup("");
+	}
+	return content;
+}
+
+static void close_log(struct chime_search *s)
+{
+	purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to write %s: %s\n",
+		     s->log_path, g_strerror(errno));
+	fclose(s->log);
+	s->log = NULL;
+}
+
+static void flush_log(struct chime_search *s)
+{
+	GString *line;
+	guint i, nr;
+
+	/* While compacting, new messages wait to go into the new log */
+	if (!s->log || s->compact || !s->unwritten->len)
+		return;
+
+	line = g_string_new(NULL);
+	fseek(s->log, 0, SEEK_END);
+	for (nr = 0; nr < s->unwritten->len; nr++) {
+		struct search_doc *doc = g_ptr_array_index(s->unwritten, nr);
+
+		if (doc->superseded)
+			continue;
+
+		g_string_truncate(line, 0);
+		format_line(line, doc, doc->content);
+		if (fwrite(line->str, line->len, 1, s->log) != 1)
+			break;
+
+		doc->offset = s->log_size;
+		doc->len = line->len;
+		s->log_size += line->len;
+	}
+	g_string_free(line, TRUE);
+
+	if (nr < s->unwritten->len || fflush(s->log)) {
+		/* Keep everything in memory instead */
+		for (i = 0; i < s->unwritten->len; i++) {
+			struct search_doc *doc = g_ptr_array_index(s->unwritten, i);
+			doc->offset = -1;
+		}
+		close_log(s);
+	} else {
+		for (i = 0; i < s->unwritten->len; i++)
+			maybe_drop_content(g_ptr_array_index(s->unwritten, i));
+	}
+	g_ptr_array_set_size(s->unwritten, 0);
+}
+
+static void start_compact(struct chime_search *s)
+{
+	s->compact_path = g_strdup_printf("%s.tmp", s->log_path);
+	s->compact = g_fopen(s->compact_path, "w");
+	if (!s->compact) {
+		purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to create %s: %s\n",
+			     s->compact_path, g_strerror(errno));
+		g_clear_pointer(&s->compact_path, g_free);
+		s->superseded = 0;
+		return;
+	}
+
+	purple_debug(PURPLE_DEBUG_INFO, "chime", "Compacting %s: %u of %u messages superseded\n",
+		     s->log_path, s->superseded, s->docs->len);
+	s->compact_next = 0;
+	s->compact_end = s->docs->len;
+	s->compact_size = 0;
+	s->compact_pos = g_array_sized_new(FALSE, FALSE, sizeof(struct compact_pos),
+					   s->compact_end);
+}
+
+static void finish_compact(struct chime_search *s, gboolean ok)
+{
+	guint i;
+
+	if (fclose(s->compact))
+		ok = FALSE;
+	s->compact = NULL;
+
+	if (ok && g_rename(s->compact_path, s->log_path)) {
+		purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to rename %s: %s\n",
+			     s->compact_path, g_strerror(errno));
+		ok = FALSE;
+	}
+
+	s->superseded = 0;
+	if (ok) {
+		/* The old file is gone, so read back from the new one */
+		fclose(s->log);
+		s->log = g_fopen(s->log_path, "a+");
+		s->log_size = s->compact_size;
+
+		for (i = 0; i < s->compact_end; i++) {
+			struct search_doc *doc = g_ptr_array_index(s->docs, i);
+			struct compact_pos *pos = &g_array_index(s->compact_pos, struct compact_pos, i);
+
+			doc->offset = pos->len ? pos->offset : -1;
+			doc->len = pos->len;
+			/* Superseded while the rewrite was in progress */
+			if (doc->superseded && pos->len)
+				s->superseded++;
+		}
+		if (!s->log) {
+			purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to open %s: %s\n",
+				     s->log_path, g_strerror(errno));
+			/* Nothing can be read back now; drop what needed it */
+			for (i = 0; i < s->compact_end; i++) {
+				struct search_doc *doc = g_ptr_array_index(s->docs, i);
+				if (!doc->content)
+					doc->superseded = TRUE;
+				doc->offset = -1;
+			}
+		}
+	} else {
+		/* Leave it until there's even more to gain */
+		g_unlink(s->compact_path);
+	}
+
+	g_array_free(s->compact_pos, TRUE);
+	s->compact_pos = NULL;
+	g_clear_pointer(&s->compact_path, g_free);
+}
+
+/* Copy live lines from the old log to the new one. Nothing moves until
+ * finish_compact(), so results are read from the old file until then. */
+static void compact_step(struct chime_search *s, gint64 deadline)
+{
+	GString *line = g_string_new(NULL);
+
+	while (s->compact_next < s->compact_end && g_get_monotonic_time() < deadline) {
+		struct search_doc *doc = g_ptr_array_index(s->docs, s->compact_next++);
+		struct compact_pos pos = { 0, 0 };
+
+		if (!doc->superseded && doc->offset >= 0) {
+			gchar **fields = read_log_line(s, s->log, doc->offset, doc->len);
+			if (!fields) {
+				purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to read %s\n",
+					     s->log_path);
+				finish_compact(s, FALSE);
+				goto out;
+			}
+
+			gchar *content = log_unescape(fields[5]);
+			g_string_truncate(line, 0);
+			format_line(line, doc, content);
+			g_free(content);
+			g_strfreev(fields);
+
+			if (fwrite(line->str, line->len, 1, s->compact) != 1) {
+				purple_debug(PURPLE_DEBUG_ERROR, "chime", "Failed to write %s: %s\n",
+					     s->compact_path, g_strerror(errno));
+				finish_compact(s, FALSE);
+				goto out;
+			}
+			pos.offset = s->compact_size;
+			pos.len = line->len;
+			s->compact_size += line->len;
+		}
+		g_array_append_val(s->compact_pos, pos);
+	}
+
+	if (s->compact_next == s->compact_end)
+		finish_compact(s, !fflush(s->compact));
+ out:
+	g_string_free(line, TRUE);
+}
+
+static gboolean search_idle(gpointer _s)
+{
+	struct chime_search *s = _s;
+	gint64 deadline = g_get_monotonic_time() + SEARCH_IDLE_BUDGET;
+
+	while (s->replay && g_get_monotonic_time() < deadline) {
+		gchar *line = NULL;
+		gsize len = 0;
+		GIOStatus st = G_IO_STATUS_EOF;
+
+		/* Don't replay what we've appended since we started */
+		if (s->replay_offset < s->replay_end)
+			st = g_io_channel_read_line(s->replay, &line, &len, NULL, NULL);
+
+		if (st == G_IO_STATUS_NORMAL) {
+			replay_line(s, line, len);
+			s->replay_offset += len;
+			g_free(line);
+			/* Keep up, so replayed content can be dropped as we go */
+			while (s->indexed < s->docs->len)
+				index_doc(s, s->indexed++);
+		} else if (st != G_IO_STATUS_AGAIN) {
+			purple_debug(PURPLE_DEBUG_INFO, "chime", "Loaded %u messages for search\n",
+				     s->docs->len);
+			g_io_channel_unref(s->replay);
+			s->replay = NULL;
+		}
+	}
+
+	while (s->indexed < s->docs->len && g_get_monotonic_time() < deadline)
+		index_doc(s, s->indexed++);
+
+	if (!s->replay && s->log && !s->compact &&
+	    s->superseded >= SEARCH_COMPACT_MIN && s->superseded * 4 >= s->docs->len)
+		start_compact(s);
+	if (s->compact)
+		compact_step(s, deadline);
+
+	flush_log(s);
+
+	if (s->replay || s->compact || s->indexed < s->docs->len)
+		return TRUE;
+
+	s->idle_id = 0;
+	return FALSE;
+}
+
+static void union_postings(guint32 *bits, struct search_term *t)
+{
+	guint i;
+
+	for (i = 0; i < t->postings->len; i++) {
+		guint32 nr = g_array_index(t->postings, guint32, i);
+		bits[nr / 32] |= 1U << (nr % 32);
+	}
+}
+
+static gint compare_doc_time(gconstpointer _a, gconstpointer _b)
+{
+	const struct search_doc *a = *(struct search_doc **)_a;
+	const struct search_doc *b = *(struct search_doc **)_b;
+
+	if (a->created_ms == b->created_ms)
+		return 0;
+	return a->created_ms < b->created_ms ? 1 : -1;
+}
+
+/* Returns matching documents, newest first. The array does not own them.
+ * Every word in @query must appear (as a prefix of a word) in the message. */
+static GPtrArray *search_query(struct chime_search *s, const gchar *query,
+			       const gchar *sender, gint64 after_ms, gint64 before_ms)
+{
+	GPtrArray *results = g_ptr_array_new();
+	GPtrArray *words = tokenize(query ? : "");
+	guint nr_words = (s->indexed + 31) / 32;
+	guint32 *match = NULL, *bits = NULL;
+	guint i, j;
+
+	/* Documents which are still waiting for the idle handler to index
+	 * them are left out, rather than stalling the main loop. */
+	if (words->len) {
+		match = g_new(guint32, nr_words);
+		bits = g_new(guint32, nr_words);
+		memset(match, 0xff, nr_words * sizeof(guint32));
+	}
+
+	for (i = 0; i < words->len; i++) {
+		struct search_term key = { .term = g_ptr_array_index(words, i) };
+		gsize keylen = strlen(key.term);
+		GSequenceIter *iter = g_sequence_search(s->term_seq, &key, term_lower_bound, NULL);
+
+		memset(bits, 0, nr_words * sizeof(guint32));
+		while (!g_sequence_iter_is_end(iter)) {
+			struct search_term *t = g_sequence_get(iter);
+			if (strncmp(t->term, key.term, keylen))
+				break;
+			union_postings(bits, t);
+			iter = g_sequence_iter_next(iter);
+		}
+		for (j = 0; j < nr_words; j++)
+			match[j] &= bits[j];
+	}
+
+	for (i = 0; i < s->indexed; i++) {
+		struct search_doc *doc;
+
+		if (match && !(match[i / 32] & (1U << (i % 32))))
+			continue;
+
+		doc = g_ptr_array_index(s->docs, i);
+		if (doc->superseded ||
+		    (sender && doc->sender != sender) ||
+		    (after_ms && doc->created_ms < after_ms) ||
+		    (before_ms && doc->created_ms >= before_ms))
+			continue;
+
+		g_ptr_array_add(results, doc);
+	}
+
+	g_ptr_array_sort(results, compare_doc_time);
+	if (results->len > SEARCH_MAX_RESULTS)
+		g_ptr_array_set_size(results, SEARCH_MAX_RESULTS);
+
+	g_free(match);
+	g_free(bits);
+	g_ptr_array_unref(words);
+	return results;
+}
+
+static gboolean search_pending(struct chime_search *s)
+{
+	return s->replay || s->indexed < s->docs->len;
+}
+
+/* Resolve an email address or profile ID to the interned profile ID */
+static const gchar *lookup_sender(ChimeConnection *cxn, const gchar *who)
+{
+	if (!who || !who[0])
+		return NULL;
+
+	ChimeContact *contact = chime_connection_contact_by_email(cxn, who);
+	if (contact)
+		return g_intern_string(chime_contact_get_profile_id(contact));
+
+	return g_intern_string(who);
+}
+
+static const gchar *doc_where(ChimeConnection *cxn, struct search_doc *doc)
+{
+	ChimeRoom *room = chime_connection_room_by_id(cxn, doc->obj_id);
+	if (room)
+		return chime_room_get_name(room);
+
+	ChimeConversation *conv = chime_connection_conversation_by_id(cxn, doc->obj_id);
+	if (conv)
+		return chime_conversation_get_name(conv);
+
+	return doc->obj_id;
+}
+
+static const gchar *doc_from(ChimeConnection *cxn, struct search_doc *doc)
+{
+	if (!strcmp(doc->sender, chime_connection_get_profile_id(cxn)))
+		return chime_connection_get_email(cxn);
+
+	ChimeContact *contact = chime_connection_contact_by_id(cxn, doc->sender);
+	if (contact)
+		return chime_contact_get_email(contact);
+
+	return doc->sender;
+}
+
+static gchar *doc_time(struct search_doc *doc)
+{
+	GDateTime *dt = g_date_time_new_from_unix_local(doc->created_ms / 1000);
+	gchar *str = g_date_time_format(dt, "%Y-%m-%d %H:%M");
+	g_date_time_unref(dt);
+	return str;
+}
+
+static void open_search_result(PurpleConnection *conn, GList *row, gpointer _unused)
+{
+	ChimeConnection *cxn = PURPLE_CHIME_CXN(conn);
+	const gchar *where = g_list_nth_data(row, 1);
+
+	ChimeRoom *room = chime_connection_room_by_name(cxn, where);
+	if (room) {
+		do_join_chat(conn, cxn, CHIME_OBJECT(room), NULL, NULL);
+		return;
+	}
+
+	ChimeConversation *conv = chime_connection_conversation_by_name(cxn, where);
+	if (!conv)
+		return;
+
+	GList *members = chime_conversation_get_members(conv);
+	if (g_list_length(members) == 2) {
+		ChimeContact *peer = members->data;
+		if (!strcmp(chime_connection_get_profile_id(cxn), chime_contact_get_profile_id(peer)))
+			peer = members->next->data;
+
+		PurpleConversation *pconv = purple_conversation_new(PURPLE_CONV_TYPE_IM,
+								   purple_connection_get_account(conn),
+								   chime_contact_get_email(peer));
+		purple_conversation_present(pconv);
+	} else {
+		do_join_chat(conn, cxn, CHIME_OBJECT(conv), NULL, NULL);
+	}
+	g_list_free(members);
+}
+
+static void show_search_results(PurpleConnection *conn, struct chime_search *s,
+				const gchar *query, GPtrArray *docs)
+{
+	ChimeConnection *cxn = PURPLE_CHIME_CXN(conn);
+	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
+	PurpleNotifySearchColumn *column;
+	guint i;
+
+	column = purple_notify_searchresults_column_new(_("When"));
+	purple_notify_searchresults_column_add(results, column);
+	column = purple_notify_searchresults_column_new(_("Where"));
+	purple_notify_searchresults_column_add(results, column);
+	column = purple_notify_searchresults_column_new(_("From"));
+	purple_notify_searchresults_column_add(results, column);
+	column = purple_notify_searchresults_column_new(_("Message"));
+	purple_notify_searchresults_column_add(results, column);
+
+	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, open_search_result);
+
+	for (i = 0; i < docs->len; i++) {
+		struct search_doc *doc = g_ptr_array_index(docs, i);
+		GList *row = NULL;
+
+		row = g_list_append(row, doc_time(doc));
+		row = g_list_append(row, sanitise_utf8(doc_where(cxn, doc)));
+		row = g_list_append(row, sanitise_utf8(doc_from(cxn, doc)));
+		row = g_list_append(row, g_strdelimit(doc_content(s, doc), "\r\n\t", ' '));
+		purple_notify_searchresults_row_add(results, row);
+	}
+
+	gchar *secondary;
+	if (search_pending(s))
+		secondary = g_strdup_printf(_("%u messages matching \"%s\" (still indexing history)"),
+					    docs->len, query);
+	else
+		secondary = g_strdup_printf(_("%u messages matching \"%s\""), docs->len, query);
+	if (!purple_notify_searchresults(conn, _("Chime message search"), _("Search results"),
+					 secondary, results, NULL, NULL))
+		purple_notify_error(conn, NULL, _("Unable to display search results."), NULL);
+	g_free(secondary);
+}
+
+static void message_search_fields(PurpleConnection *conn, PurpleRequestFields *fields)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	const gchar *query = purple_request_fields_get_string(fields, "query");
+	const gchar *from = purple_request_fields_get_string(fields, "from");
+	int days = purple_request_fields_get_integer(fields, "days");
+	gint64 after_ms = 0;
+
+	if (!pc || !pc->search)
+		return;
+
+	if (days > 0)
+		after_ms = (time(NULL) - (gint64)days * 86400) * 1000;
+
+	GPtrArray *docs = search_query(pc->search, query, lookup_sender(pc->cxn, from),
+				       after_ms, 0);
+	show_search_results(conn, pc->search, query ? : "", docs);
+	g_ptr_array_unref(docs);
+}
+
+void chime_purple_message_search(PurplePluginAction *action)
+{
+	PurpleConnection *conn = (PurpleConnection *) action->context;
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	PurpleRequestField *field;
+	PurpleRequestFieldGroup *group;
+	PurpleRequestFields *fields;
+
+	if (!pc->search) {
+		purple_notify_info(conn, _("Chime message search"),
+				   _("Message search is disabled"),
+				   _("Enable \"Keep a local search index of messages\" in the account settings, and reconnect."));
+		return;
+	}
+
+	fields = purple_request_fields_new();
+	group = purple_request_field_group_new(NULL);
+
+	field = purple_request_field_string_new("query", _("Words"), NULL, FALSE);
+	purple_request_field_group_add_field(group, field);
+
+	field = purple_request_field_string_new("from", _("From (email)"), NULL, FALSE);
+	purple_request_field_group_add_field(group, field);
+
+	field = purple_request_field_int_new("days", _("Within last N days (0 for all)"), 0);
+	purple_request_field_group_add_field(group, field);
+
+	purple_request_fields_add_group(fields, group);
+
+	purple_request_fields(conn, _("Chime message search"),
+			      _("Search message history"), NULL, fields,
+			      _("Search"), G_CALLBACK(message_search_fields),
+			      _("Cancel"), NULL, conn->account,
+			      NULL, NULL, conn);
+}
+
+gchar **chime_search_messages(PurpleAccount *account, const gchar *query,
+			      const gchar *sender, gint64 after, gint64 before)
+{
+	PurpleConnection *conn = purple_account_get_connection(account);
+	struct purple_chime *pc = conn ? purple_connection_get_protocol_data(conn) : NULL;
+
+	if (!pc || !pc->search)
+		return g_new0(gchar *, 1);
+
+	GPtrArray *docs = search_query(pc->search, query, lookup_sender(pc->cxn, sender),
+				       after * 1000, before * 1000);
+	gchar **ret = g_new0(gchar *, docs->len + 1);
+	guint i;
+
+	/* D-Bus will disconnect us for sending invalid UTF-8 */
+	for (i = 0; i < docs->len; i++) {
+		struct search_doc *doc = g_ptr_array_index(docs, i);
+		gchar *when = doc_time(doc);
+		gchar *where = sanitise_utf8(doc_where(pc->cxn, doc));
+		gchar *from = sanitise_utf8(doc_from(pc->cxn, doc));
+		gchar *content = g_strdelimit(doc_content(pc->search, doc), "\t", ' ');
+
+		ret[i] = g_strdup_printf("%s\t%s\t%s\t%s", when, where, from, content);
+		g_free(when);
+		g_free(where);
+		g_free(from);
+		g_free(content);
+	}
+	g_ptr_array_unref(docs);
+	return ret;
+}
+
+void purple_chime_init_search(PurpleConnection *conn)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	struct chime_search *s;
+
+	if (!purple_account_get_bool(conn->account, "search-history", FALSE))
+		return;
+
+	s = g_new0(struct chime_search, 1);
+	s->conn = conn;
+	s->docs = g_ptr_array_new_with_free_func(free_doc);
+	s->by_msg_id = g_hash_table_new(g_str_hash, g_str_equal);
+	s->terms = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_term);
+	s->term_seq = g_sequence_new(NULL);
+	s->unwritten = g_ptr_array_new();
+
+	gchar *dir = g_build_filename(purple_user_dir(), "chime",
+				      purple_account_get_username(conn->account), NULL);
+	if (g_mkdir_with_parents(dir, 0700) == -1) {
+		purple_debug(PURPLE_DEBUG_ERROR, "chime", "Could not make dir %s: %s\n",
+			     dir, g_strerror(errno));
+	} else {
+		s->log_path = g_build_filename(dir, "messages.idx", NULL);
+		s->log = g_fopen(s->log_path, "a+");
+		if (!s->log) {
+			purple_debug(PURPLE_DEBUG_ERROR, "chime", "Could not open %s: %s\n",
+				     s->log_path, g_strerror(errno));
+		} else if (!fseek(s->log, 0, SEEK_END) && (s->log_size = ftell(s->log)) > 0) {
+			s->replay = g_io_channel_new_file(s->log_path, "r", NULL);
+			if (s->replay)
+				g_io_channel_set_encoding(s->replay, NULL, NULL);
+			s->replay_end = s->log_size;
+		}
+	}
+	g_free(dir);
+
+	pc->search = s;
+	kick_idle(s);
+}
+
+void purple_chime_destroy_search(PurpleConnection *conn)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	struct chime_search *s = pc->search;
+
+	if (!s)
+		return;
+
+	pc->search = NULL;
+
+	if (s->idle_id)
+		g_source_remove(s->idle_id);
+
+	if (s->compact)
+		finish_compact(s, FALSE);
+	flush_log(s);
+	if (s->log)
+		fclose(s->log);
+	if (s->replay)
+		g_io_channel_unref(s->replay);
+
+	g_sequence_free(s->term_seq);
+	g_hash_table_destroy(s->terms);
+	g_hash_table_destroy(s->by_msg_id);
+	g_ptr_array_unref(s->unwritten);
+	g_ptr_array_unref(s->docs);
+	g_free(s->log_path);
+	g_free(s);
+}
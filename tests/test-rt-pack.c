@@ -0,0 +1,337 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2020 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * The hand-rolled RTMessage encoder and decoder in chime-call-xrp.c must
+ * agree exactly with protobuf-c. Each message here is packed both ways
+ * and the bytes compared, then each encoding is decoded the other way.
+ */
+
+#include "chime-call-audio.h"
+
+#include <string.h>
+
+struct rt_case {
+	RTMessage rt;
+	AudioMessage audio;
+	ClientStatusMessage status;
+	ProfileMessage profile_msgs[2];
+	ProfileMessage *profiles[2];
+};
+
+struct rt_case_desc {
+	const gchar *path;
+	void (*setup)(struct rt_case *c);
+};
+
+static guint8 frame[80];
+
+static void init_case(struct rt_case *c)
+{
+	rtmessage__init(&c->rt);
+	audio_message__init(&c->audio);
+	client_status_message__init(&c->status);
+}
+
+/* What do_send_rt_packet() sends for an encoded frame */
+static void setup_frame(struct rt_case *c)
+{
+	init_case(c);
+	c->rt.audio = &c->audio;
+	c->audio.has_seq = TRUE;
+	c->audio.seq = 0x1234;
+	c->audio.has_sample_time = TRUE;
+	c->audio.sample_time = 0x89abcdef;
+	c->audio.has_audio = TRUE;
+	c->audio.audio.data = frame;
+	c->audio.audio.len = 61;
+	c->audio.has_total_frames_lost = TRUE;
+	c->audio.total_frames_lost = 3;
+	c->audio.has_server_time = TRUE;
+	c->audio.server_time = G_GUINT64_CONSTANT(1600000000123456);
+	c->audio.has_echo_time = TRUE;
+	c->audio.echo_time = G_GUINT64_CONSTANT(1600000000100000);
+	c->audio.has_ntp_time = TRUE;
+	c->audio.ntp_time = G_GUINT64_CONSTANT(1600000000200000);
+}
+
+/* A keepalive has an empty payload, and no server time until we know it */
+static void setup_keepalive(struct rt_case *c)
+{
+	init_case(c);
+	c->rt.audio = &c->audio;
+	c->audio.has_seq = TRUE;
+	c->audio.seq = 0;
+	c->audio.has_sample_time = TRUE;
+	c->audio.sample_time = 0;
+	c->audio.has_audio = TRUE;
+	c->audio.has_total_frames_lost = TRUE;
+	c->audio.has_ntp_time = TRUE;
+	c->audio.ntp_time = 1;
+}
+
+static void setup_client_status(struct rt_case *c)
+{
+	setup_frame(c);
+	c->rt.client_status = &c->status;
+	c->status.has_remote_mute_ack = TRUE;
+	c->status.remote_mute_ack = TRUE;
+	c->status.has_is_recording = TRUE;
+	c->status.is_recording = FALSE;
+}
+
+/* Largest values, and every field the fast path knows about */
+static void setup_extremes(struct rt_case *c)
+{
+	init_case(c);
+	c->rt.has_call_id = TRUE;
+	c->rt.call_id = G_MAXUINT32;
+	c->rt.has_locale_id = TRUE;
+	c->rt.locale_id = 0x80;
+	c->rt.audio = &c->audio;
+	c->audio.has_seq = TRUE;
+	c->audio.seq = 0xffff;
+	c->audio.has_sample_time = TRUE;
+	c->audio.sample_time = G_MAXUINT32;
+	c->audio.has_codec = TRUE;
+	c->audio.codec = 7;
+	c->audio.has_audio = TRUE;
+	c->audio.audio.data = frame;
+	c->audio.audio.len = sizeof(frame);
+	c->audio.has_total_frames_lost = TRUE;
+	c->audio.total_frames_lost = G_MAXUINT32;
+	c->audio.has_flags = TRUE;
+	c->audio.flags = 0x7f;
+	c->audio.has_server_time = TRUE;
+	c->audio.server_time = G_MAXUINT64;
+	c->audio.has_echo_time = TRUE;
+	c->audio.echo_time = 0;
+	c->audio.has_pong = TRUE;
+	c->audio.pong = 0x4000;
+	c->audio.has_client_time = TRUE;
+	c->audio.client_time = 1;
+	c->audio.has_playout_delay = TRUE;
+	c->audio.playout_delay = 60000;
+	c->audio.has_pong_time_offset = TRUE;
+	c->audio.pong_time_offset = 0x200000;
+	c->audio.has_ntp_time = TRUE;
+	c->audio.ntp_time = G_GUINT64_CONSTANT(0x8000000000000000);
+	c->rt.client_status = &c->status;
+	c->status.has_remote_muted = TRUE;
+	c->status.remote_muted = TRUE;
+	c->status.has_is_recording = TRUE;
+	c->status.is_recording = TRUE;
+	c->status.has_remote_mute_ack = TRUE;
+	c->status.remote_mute_ack = TRUE;
+}
+
+static void setup_empty(struct rt_case *c)
+{
+	init_case(c);
+}
+
+/* Profiles only ever come from the server, and only the decoder handles them */
+static void setup_profiles(struct rt_case *c)
+{
+	setup_frame(c);
+	profile_message__init(&c->profile_msgs[0]);
+	c->profile_msgs[0].has_stream_id = TRUE;
+	c->profile_msgs[0].stream_id = 1;
+	c->profile_msgs[0].has_volume = TRUE;
+	c->profile_msgs[0].volume = 42;
+	c->profile_msgs[0].has_signal_strength = TRUE;
+	c->profile_msgs[0].signal_strength = 3;
+	profile_message__init(&c->profile_msgs[1]);
+	c->profile_msgs[1].has_stream_id = TRUE;
+	c->profile_msgs[1].stream_id = 0x10001;
+	c->profile_msgs[1].has_muted = TRUE;
+	c->profile_msgs[1].muted = TRUE;
+	c->profile_msgs[1].has_ntp_timestamp = TRUE;
+	c->profile_msgs[1].ntp_timestamp = 5;
+	c->profiles[0] = &c->profile_msgs[0];
+	c->profiles[1] = &c->profile_msgs[1];
+	c->rt.profiles = c->profiles;
+	c->rt.n_profiles = 2;
+}
+
+#define CHECK_FIELD(a, b, f) do {					\
+		g_assert_cmpint((a)->has_##f, ==, (b)->has_##f);	\
+		if ((a)->has_##f)					\
+			g_assert_cmpuint((a)->f, ==, (b)->f);		\
+	} while (0)
+
+static void assert_audio_equal(const AudioMessage *a, const AudioMessage *b)
+{
+	CHECK_FIELD(a, b, seq);
+	CHECK_FIELD(a, b, sample_time);
+	CHECK_FIELD(a, b, codec);
+	CHECK_FIELD(a, b, total_frames_lost);
+	CHECK_FIELD(a, b, flags);
+	CHECK_FIELD(a, b, server_time);
+	CHECK_FIELD(a, b, echo_time);
+	CHECK_FIELD(a, b, pong);
+	CHECK_FIELD(a, b, client_time);
+	CHECK_FIELD(a, b, playout_delay);
+	CHECK_FIELD(a, b, pong_time_offset);
+	CHECK_FIELD(a, b, ntp_time);
+
+	g_assert_cmpint(a->has_audio, ==, b->has_audio);
+	g_assert_cmpuint(a->audio.len, ==, b->audio.len);
+	if (a->audio.len)
+		g_assert_true(!memcmp(a->audio.data, b->audio.data, a->audio.len));
+}
+
+static void assert_rt_equal(const RTMessage *a, const RTMessage *b)
+{
+	int i;
+
+	CHECK_FIELD(a, b, call_id);
+	CHECK_FIELD(a, b, locale_id);
+
+	g_assert_cmpint(!a->audio, ==, !b->audio);
+	if (a->audio)
+		assert_audio_equal(a->audio, b->audio);
+
+	g_assert_cmpint(!a->client_status, ==, !b->client_status);
+	if (a->client_status) {
+		CHECK_FIELD(a->client_status, b->client_status, remote_muted);
+		CHECK_FIELD(a->client_status, b->client_status, is_recording);
+		CHECK_FIELD(a->client_status, b->client_status, remote_mute_ack);
+	}
+
+	g_assert_cmpuint(a->n_profiles, ==, b->n_profiles);
+	for (i = 0; i < a->n_profiles; i++) {
+		CHECK_FIELD(a->profiles[i], b->profiles[i], stream_id);
+		CHECK_FIELD(a->profiles[i], b->profiles[i], volume);
+		CHECK_FIELD(a->profiles[i], b->profiles[i], muted);
+		CHECK_FIELD(a->profiles[i], b->profiles[i], signal_strength);
+		CHECK_FIELD(a->profiles[i], b->profiles[i], ntp_timestamp);
+	}
+}
+
+/* Both decoders must agree on what @buf says, even when it's mangled */
+static void check_decode(const RTMessage *expected, const guint8 *buf, gsize len)
+{
+	struct chime_rt_rx rx;
+	RTMessage *msg = rtmessage__unpack(NULL, len, buf);
+	gboolean fast = chime_call_xrp_rt_unpack(&rx, len, buf);
+
+	/* The fast path may punt on something protobuf-c would accept,
+	 * but must never accept anything that it wouldn't. */
+	if (fast) {
+		g_assert_nonnull(msg);
+		assert_rt_equal(msg, &rx.rt);
+	}
+	if (expected) {
+		g_assert_nonnull(msg);
+		assert_rt_equal(expected, msg);
+	}
+	if (msg)
+		rtmessage__free_unpacked(msg, NULL);
+}
+
+static void test_pack(gconstpointer data)
+{
+	const struct rt_case_desc *desc = data;
+	struct chime_rt_rx rx;
+	struct rt_case c;
+	gsize len;
+	gssize fast_len;
+	guint8 *fast, *slow;
+
+	desc->setup(&c);
+
+	len = rtmessage__get_packed_size(&c.rt);
+	fast_len = chime_call_xrp_rt_packed_size(&c.rt);
+	g_assert_cmpint(fast_len, ==, len);
+
+	fast = g_malloc0(len + 1);
+	slow = g_malloc0(len + 1);
+	g_assert_cmpuint(chime_call_xrp_rt_pack(&c.rt, fast), ==, len);
+	g_assert_cmpuint(rtmessage__pack(&c.rt, slow), ==, len);
+	g_assert_true(!memcmp(fast, slow, len));
+
+	/* Each encoding, decoded the other way */
+	g_assert_true(chime_call_xrp_rt_unpack(&rx, len, slow));
+	assert_rt_equal(&c.rt, &rx.rt);
+	check_decode(&c.rt, fast, len);
+
+	g_free(fast);
+	g_free(slow);
+}
+
+/* Profiles aren't for the fast encoder, but the fast decoder takes them */
+static void test_profiles(void)
+{
+	struct chime_rt_rx rx;
+	struct rt_case c;
+	gsize len;
+	guint8 *buf;
+
+	setup_profiles(&c);
+	g_assert_cmpint(chime_call_xrp_rt_packed_size(&c.rt), ==, -1);
+
+	len = rtmessage__get_packed_size(&c.rt);
+	buf = g_malloc(len);
+	rtmessage__pack(&c.rt, buf);
+
+	g_assert_true(chime_call_xrp_rt_unpack(&rx, len, buf));
+	assert_rt_equal(&c.rt, &rx.rt);
+	check_decode(&c.rt, buf, len);
+
+	g_free(buf);
+}
+
+static void test_truncated(void)
+{
+	struct rt_case c;
+	gsize len, i;
+	guint8 *buf;
+
+	setup_extremes(&c);
+	len = rtmessage__get_packed_size(&c.rt);
+	buf = g_malloc(len);
+	rtmessage__pack(&c.rt, buf);
+
+	for (i = 0; i < len; i++)
+		check_decode(NULL, buf, i);
+
+	g_free(buf);
+}
+
+static const struct rt_case_desc cases[] = {
+	{ "/xrp/rt/frame", setup_frame },
+	{ "/xrp/rt/keepalive", setup_keepalive },
+	{ "/xrp/rt/client-status", setup_client_status },
+	{ "/xrp/rt/extremes", setup_extremes },
+	{ "/xrp/rt/empty", setup_empty },
+};
+
+int main(int argc, char **argv)
+{
+	guint i;
+
+	for (i = 0; i < sizeof(frame); i++)
+		frame[i] = i * 7 + 1;
+
+	g_test_init(&argc, &argv, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(cases); i++)
+		g_test_add_data_func(cases[i].path, &cases[i], test_pack);
+	g_test_add_func("/xrp/rt/profiles", test_profiles);
+	g_test_add_func("/xrp/rt/truncated", test_truncated);
+
+	return g_test_run();
+}
@@ -0,0 +1,553 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Joins a number of calls to the stand-in server in xrp-server.c and
+ * feeds each one a stream of timestamped RTP frames, which the server
+ * loops back. Even-numbered calls get DTLS; the odd ones are pointed at
+ * a port which never answers, so they fall back to the websocket.
+ *
+ * Reports mouth-to-ear latency (mic appsrc to speaker appsink, through
+ * the transport and the jitter buffer), client CPU per call, packet
+ * rates and allocations per frame. Under 'make check' it also fails if
+ * either transport went unused or too much audio failed to come back.
+ */
+
+#define _GNU_SOURCE	/* For RUSAGE_THREAD */
+
+#include "xrp-server.h"
+#include "chime-connection-private.h"
+#include "chime-call.h"
+
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_MS 20
+#define FRAME_TS 960		/* At the Opus RTP clock rate of 48kHz */
+#define PAYLOAD_LEN 40		/* Roughly what Opus makes of 20ms of speech */
+#define SETUP_TIMEOUT_MS 10000
+#define WARMUP_MS 1000
+#define DRAIN_MS 250
+
+/* Exit status which tells automake the test was skipped */
+#define EXIT_SKIP 77
+
+struct frame_stamp {
+	gint64 sent;
+	guint32 call;
+};
+
+struct bench_call {
+	guint idx;
+	ChimeCall *call;
+	gboolean opened;
+	GstElement *pipeline;
+	GstAppSrc *mic;
+	ChimeAudioState state;
+	guint16 seq;
+	guint32 ts;
+
+	/* Only touched by the speaker's streaming thread until it's stopped */
+	GArray *latencies;	/* µs, for frames sent while measuring */
+	guint concealed;
+	guint misrouted;
+};
+
+static gint n_calls = 4;
+static gint duration = 5;
+
+static struct bench_call *calls;
+static gint measuring;
+static gint64 measure_start, measure_end = G_MAXINT64;
+static guint frames_sent;
+
+#ifdef __GLIBC__
+/*
+ * Count allocations by standing in front of glibc's malloc. The server
+ * thread is left out, so this is what the client (with the GStreamer
+ * elements either side of it) costs.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static gint n_allocs;
+
+static inline void count_alloc(void)
+{
+	if (g_atomic_int_get(&measuring) && !xrp_in_server_thread)
+		g_atomic_int_inc(&n_allocs);
+}
+
+void *malloc(size_t size)
+{
+	count_alloc();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count_alloc();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count_alloc();
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT 1
+#endif
+
+static gint64 process_cpu_us(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * G_USEC_PER_SEC +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static gboolean wake_up(gpointer _unused)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+/* Runs the main context for @ms, or until @done() says otherwise */
+static void run_for(guint ms, gboolean (*done)(void))
+{
+	gint64 end = g_get_monotonic_time() + ms * 1000;
+	guint wake = g_timeout_add(50, wake_up, NULL);
+
+	while (g_get_monotonic_time() < end && !(done && done()))
+		g_main_context_iteration(NULL, TRUE);
+
+	g_source_remove(wake);
+}
+
+static gboolean all_connected(void)
+{
+	int i;
+
+	for (i = 0; i < n_calls; i++) {
+		if (calls[i].state != CHIME_AUDIO_STATE_AUDIO)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void audio_state_cb(ChimeCall *call, int state, const gchar *msg, gpointer _bc)
+{
+	struct bench_call *bc = _bc;
+
+	bc->state = state;
+	if (state == CHIME_AUDIO_STATE_FAILED)
+		fprintf(stderr, "Call %u failed: %s\n", bc->idx, msg);
+}
+
+static GstFlowReturn ear_new_sample(GstAppSink *sink, gpointer _bc)
+{
+	struct bench_call *bc = _bc;
+	GstSample *sample = gst_app_sink_pull_sample(sink);
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	struct frame_stamp stamp;
+	gint64 now = g_get_monotonic_time();
+
+	if (!sample)
+		return GST_FLOW_OK;
+
+	if (!gst_rtp_buffer_map(gst_sample_get_buffer(sample), GST_MAP_READ, &rtp))
+		goto out;
+
+	/* Lost frames come out of the jitter buffer with no payload */
+	if (!gst_rtp_buffer_get_payload_len(&rtp)) {
+		if (g_atomic_int_get(&measuring))
+			bc->concealed++;
+	} else if (gst_rtp_buffer_get_payload_len(&rtp) == PAYLOAD_LEN) {
+		memcpy(&stamp, gst_rtp_buffer_get_payload(&rtp), sizeof(stamp));
+		if (stamp.call != bc->idx) {
+			bc->misrouted++;
+		} else if (stamp.sent >= measure_start && stamp.sent < measure_end) {
+			gint64 latency = now - stamp.sent;
+			g_array_append_val(bc->latencies, latency);
+		}
+	}
+	gst_rtp_buffer_unmap(&rtp);
+ out:
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+static GstAppSinkCallbacks ear_callbacks = {
+	.new_sample = ear_new_sample,
+};
+
+static void push_frame(struct bench_call *bc, gint64 now)
+{
+	GstBuffer *buf = gst_rtp_buffer_new_allocate(PAYLOAD_LEN, 0, 0);
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	struct frame_stamp stamp = { now, bc->idx };
+	guint8 *payload;
+
+	gst_rtp_buffer_map(buf, GST_MAP_WRITE, &rtp);
+	gst_rtp_buffer_set_payload_type(&rtp, 97);
+	gst_rtp_buffer_set_seq(&rtp, bc->seq++);
+	gst_rtp_buffer_set_timestamp(&rtp, bc->ts);
+	bc->ts += FRAME_TS;
+	payload = gst_rtp_buffer_get_payload(&rtp);
+	memset(payload, 0, PAYLOAD_LEN);
+	memcpy(payload, &stamp, sizeof(stamp));
+	gst_rtp_buffer_unmap(&rtp);
+
+	GST_BUFFER_DURATION(buf) = FRAME_MS * GST_MSECOND;
+	gst_app_src_push_buffer(bc->mic, buf);
+}
+
+static gboolean mic_tick(gpointer _unused)
+{
+	gint64 now = g_get_monotonic_time();
+	int i;
+
+	for (i = 0; i < n_calls; i++)
+		push_frame(&calls[i], now);
+	if (g_atomic_int_get(&measuring))
+		frames_sent += n_calls;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static JsonNode *call_node(struct xrp_server *srv, guint idx)
+{
+	JsonBuilder *builder = json_builder_new();
+	gchar *str;
+	JsonNode *node;
+
+	/* Odd calls get a UDP port that swallows the DTLS handshake */
+	guint16 port = (idx & 1) ? xrp_server_get_silent_port(srv) :
+		xrp_server_get_dtls_port(srv);
+
+	json_builder_begin_object(builder);
+
+	str = g_strdup_printf("00000000-0000-0000-0000-%012x", idx);
+	json_builder_set_member_name(builder, "uuid");
+	json_builder_add_string_value(builder, str);
+	g_free(str);
+
+	str = g_strdup_printf("Benchmark call %u", idx);
+	json_builder_set_member_name(builder, "alert_body");
+	json_builder_add_string_value(builder, str);
+	g_free(str);
+
+	str = g_strdup_printf("call_channel_%u", idx);
+	json_builder_set_member_name(builder, "channel");
+	json_builder_add_string_value(builder, str);
+	g_free(str);
+
+	str = g_strdup_printf("roster_channel_%u", idx);
+	json_builder_set_member_name(builder, "roster_channel");
+	json_builder_add_string_value(builder, str);
+	g_free(str);
+
+	str = g_strdup_printf("127.0.0.1:%u", port);
+	json_builder_set_member_name(builder, "media_host");
+	json_builder_add_string_value(builder, str);
+	g_free(str);
+
+	json_builder_set_member_name(builder, "audio_ws_url");
+	json_builder_add_string_value(builder, xrp_server_get_ws_url(srv));
+
+	/* Required, but never used for audio */
+	json_builder_set_member_name(builder, "host");
+	json_builder_add_string_value(builder, "127.0.0.1");
+	json_builder_set_member_name(builder, "mobile_bithub_url");
+	json_builder_add_string_value(builder, "http://127.0.0.1:9");
+	json_builder_set_member_name(builder, "desktop_bithub_url");
+	json_builder_add_string_value(builder, "http://127.0.0.1:9");
+	json_builder_set_member_name(builder, "control_url");
+	json_builder_add_string_value(builder, "http://127.0.0.1:9");
+	json_builder_set_member_name(builder, "stun_server_url");
+	json_builder_add_string_value(builder, "stun:127.0.0.1:9");
+
+	json_builder_set_member_name(builder, "ongoing?");
+	json_builder_add_boolean_value(builder, TRUE);
+	json_builder_set_member_name(builder, "is_recording");
+	json_builder_add_boolean_value(builder, FALSE);
+
+	json_builder_end_object(builder);
+
+	node = json_builder_get_root(builder);
+	g_object_unref(builder);
+	return node;
+}
+
+static gboolean open_call(ChimeConnection *cxn, struct xrp_server *srv, struct bench_call *bc, GError **error)
+{
+	JsonNode *node = call_node(srv, bc->idx);
+	GstElement *rx, *tx, *ear;
+
+	bc->call = chime_connection_parse_call(cxn, node, error);
+	json_node_unref(node);
+	if (!bc->call)
+		return FALSE;
+
+	bc->pipeline = gst_parse_launch("appsrc name=mic format=time is-live=TRUE do-timestamp=TRUE "
+					"caps=application/x-rtp,media=audio,clock-rate=48000,encoding-name=OPUS,payload=97 ! "
+					"appsink name=tx async=false sync=false "
+					"appsrc name=rx format=time do-timestamp=TRUE is-live=TRUE ! "
+					"appsink name=ear async=false sync=false", error);
+	if (!bc->pipeline)
+		return FALSE;
+
+	bc->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+	bc->seq = g_random_int();
+	bc->ts = g_random_int();
+
+	g_signal_connect(bc->call, "audio-state", G_CALLBACK(audio_state_cb), bc);
+	chime_connection_open_call(cxn, bc->call, FALSE);
+	bc->opened = TRUE;
+
+	/* The same settings as the prpl uses for its own appsrc */
+	rx = gst_bin_get_by_name(GST_BIN(bc->pipeline), "rx");
+	gst_app_src_set_size(GST_APP_SRC(rx), -1);
+	gst_app_src_set_max_bytes(GST_APP_SRC(rx), 100);
+	gst_app_src_set_stream_type(GST_APP_SRC(rx), GST_APP_STREAM_TYPE_STREAM);
+
+	tx = gst_bin_get_by_name(GST_BIN(bc->pipeline), "tx");
+	chime_call_install_gst_app_callbacks(bc->call, GST_APP_SRC(rx), GST_APP_SINK(tx));
+
+	ear = gst_bin_get_by_name(GST_BIN(bc->pipeline), "ear");
+	gst_app_sink_set_callbacks(GST_APP_SINK(ear), &ear_callbacks, bc, NULL);
+
+	bc->mic = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(bc->pipeline), "mic"));
+
+	g_object_unref(rx);
+	g_object_unref(tx);
+	g_object_unref(ear);
+
+	gst_element_set_state(bc->pipeline, GST_STATE_PLAYING);
+	return TRUE;
+}
+
+static void close_call(ChimeConnection *cxn, struct bench_call *bc)
+{
+	if (bc->opened) {
+		g_signal_handlers_disconnect_matched(bc->call, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, bc);
+		chime_connection_close_call(cxn, bc->call);
+		bc->opened = FALSE;
+	}
+	if (bc->pipeline) {
+		gst_element_set_state(bc->pipeline, GST_STATE_NULL);
+		if (bc->mic)
+			gst_object_unref(bc->mic);
+		gst_object_unref(bc->pipeline);
+		bc->mic = NULL;
+		bc->pipeline = NULL;
+	}
+}
+
+static gint cmp_gint64(gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static GOptionEntry options[] = {
+	{ "calls", 'n', 0, G_OPTION_ARG_INT, &n_calls, "Number of calls (default 4)", "N" },
+	{ "time", 't', 0, G_OPTION_ARG_INT, &duration, "Seconds to measure for (default 5)", "SECS" },
+	{ NULL }
+};
+
+int main(int argc, char **argv)
+{
+	GOptionContext *opts = g_option_context_new("- loop audio through a local XRP server");
+	GstElementFactory *src_factory, *sink_factory;
+	struct xrp_server_stats s0, s1;
+	struct xrp_server *srv;
+	ChimeConnection *cxn;
+	GError *error = NULL;
+	GArray *all;
+	gint64 cpu0, cpu1, t0, t1, client_cpu;
+	gdouble secs;
+	guint concealed = 0, misrouted = 0;
+	gint allocs0 = 0, allocs1 = 0;
+	guint mic_source;
+	int i, ret = EXIT_FAILURE;
+
+	gst_init(&argc, &argv);
+	g_option_context_add_main_entries(opts, options, NULL);
+	if (!g_option_context_parse(opts, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(opts);
+	if (n_calls < 1 || duration < 1) {
+		fprintf(stderr, "Need at least one call for at least one second\n");
+		return EXIT_FAILURE;
+	}
+
+	src_factory = gst_element_factory_find("appsrc");
+	sink_factory = gst_element_factory_find("appsink");
+	if (src_factory)
+		gst_object_unref(src_factory);
+	if (sink_factory)
+		gst_object_unref(sink_factory);
+	if (!src_factory || !sink_factory) {
+		fprintf(stderr, "GStreamer appsrc/appsink not available; skipping\n");
+		return EXIT_SKIP;
+	}
+
+	srv = xrp_server_new(&error);
+	if (!srv) {
+		fprintf(stderr, "Failed to start server: %s\n", error->message);
+		g_clear_error(&error);
+		return EXIT_FAILURE;
+	}
+	g_setenv("CHIME_DTLS_CAFILE", xrp_server_get_ca_file(srv), TRUE);
+	/* Everything is on loopback; don't let a proxy get in the way */
+	g_unsetenv("http_proxy");
+	g_unsetenv("HTTP_PROXY");
+	g_unsetenv("all_proxy");
+	g_unsetenv("ALL_PROXY");
+
+	cxn = chime_connection_new("xrp-bench@example.com", "http://127.0.0.1:9", NULL, "xrp-bench");
+	chime_init_calls(cxn);
+
+	calls = g_new0(struct bench_call, n_calls);
+	for (i = 0; i < n_calls; i++) {
+		calls[i].idx = i;
+		if (!open_call(cxn, srv, &calls[i], &error)) {
+			fprintf(stderr, "Failed to set up call %d: %s\n", i, error->message);
+			g_clear_error(&error);
+			goto out;
+		}
+	}
+
+	run_for(SETUP_TIMEOUT_MS, all_connected);
+	if (!all_connected()) {
+		for (i = 0; i < n_calls; i++) {
+			if (calls[i].state != CHIME_AUDIO_STATE_AUDIO)
+				fprintf(stderr, "Call %d never connected (state %d)\n", i, calls[i].state);
+		}
+		goto out;
+	}
+
+	/* Let the jitter buffers settle before measuring anything */
+	mic_source = g_timeout_add(FRAME_MS, mic_tick, NULL);
+	run_for(WARMUP_MS, NULL);
+
+	xrp_server_get_stats(srv, &s0);
+	cpu0 = process_cpu_us();
+#ifdef HAVE_ALLOC_COUNT
+	allocs0 = g_atomic_int_get(&n_allocs);
+#endif
+	t0 = measure_start = g_get_monotonic_time();
+	g_atomic_int_set(&measuring, 1);
+
+	run_for(duration * 1000, NULL);
+
+	g_atomic_int_set(&measuring, 0);
+	t1 = measure_end = g_get_monotonic_time();
+#ifdef HAVE_ALLOC_COUNT
+	allocs1 = g_atomic_int_get(&n_allocs);
+#endif
+	cpu1 = process_cpu_us();
+	xrp_server_get_stats(srv, &s1);
+
+	/* Give the last frames time to come back */
+	g_source_remove(mic_source);
+	run_for(DRAIN_MS, NULL);
+
+	for (i = 0; i < n_calls; i++)
+		close_call(cxn, &calls[i]);
+	/* Let the hangups go out */
+	run_for(DRAIN_MS, NULL);
+
+	all = g_array_new(FALSE, FALSE, sizeof(gint64));
+	for (i = 0; i < n_calls; i++) {
+		g_array_append_vals(all, calls[i].latencies->data, calls[i].latencies->len);
+		concealed += calls[i].concealed;
+		misrouted += calls[i].misrouted;
+	}
+	g_array_sort(all, cmp_gint64);
+
+	secs = (t1 - t0) / 1e6;
+	client_cpu = (cpu1 - cpu0) - (s1.cpu_us - s0.cpu_us);
+
+	printf("%d calls (%u DTLS, %u websocket) for %.1fs\n", n_calls,
+	       s1.dtls_calls, s1.ws_calls, secs);
+	if (all->len)
+		printf("  mouth-to-ear: p50 %.1fms, p99 %.1fms, max %.1fms\n",
+		       g_array_index(all, gint64, all->len / 2) / 1000.0,
+		       g_array_index(all, gint64, all->len * 99 / 100) / 1000.0,
+		       g_array_index(all, gint64, all->len - 1) / 1000.0);
+	printf("  delivered: %u of %u frames, %u concealed, %u misrouted\n",
+	       all->len, frames_sent, concealed, misrouted);
+	printf("  client CPU per call: %.2f%% of a core%s\n",
+	       100.0 * client_cpu / (t1 - t0) / n_calls,
+	       s1.cpu_us ? "" : " (including the server)");
+	printf("  packets/s at the server: %.0f in, %.0f out\n",
+	       (s1.packets_in - s0.packets_in) / secs,
+	       (s1.packets_out - s0.packets_out) / secs);
+#ifdef HAVE_ALLOC_COUNT
+	if (frames_sent)
+		printf("  client allocations per frame: %.1f\n",
+		       (gdouble)(allocs1 - allocs0) / frames_sent);
+#endif
+	printf("  data acks %u, hangups %u\n", s1.data_acks, s1.hangups);
+
+	ret = EXIT_SUCCESS;
+	if (n_calls > 1 && (!s1.dtls_calls || !s1.ws_calls)) {
+		fprintf(stderr, "FAIL: expected calls over both DTLS and the websocket\n");
+		ret = EXIT_FAILURE;
+	}
+	if (!s1.data_acks) {
+		fprintf(stderr, "FAIL: no DataMessage was acknowledged\n");
+		ret = EXIT_FAILURE;
+	}
+	if (misrouted) {
+		fprintf(stderr, "FAIL: frames came back on the wrong call\n");
+		ret = EXIT_FAILURE;
+	}
+	if (all->len * 2 < frames_sent) {
+		fprintf(stderr, "FAIL: less than half the audio came back\n");
+		ret = EXIT_FAILURE;
+	}
+	g_array_free(all, TRUE);
+
+ out:
+	for (i = 0; i < n_calls; i++) {
+		close_call(cxn, &calls[i]);
+		if (calls[i].call)
+			g_object_unref(calls[i].call);
+		if (calls[i].latencies)
+			g_array_free(calls[i].latencies, TRUE);
+	}
+	g_free(calls);
+
+	chime_destroy_calls(cxn);
+	g_object_unref(cxn);
+	xrp_server_free(srv);
+	return ret;
+}
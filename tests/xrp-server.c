@@ -0,0 +1,666 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#define _GNU_SOURCE	/* For RUSAGE_THREAD */
+
+#include "xrp-server.h"
+#include "chime-call-audio.h"
+
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
+#include <gnutls/dtls.h>
+
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DTLS_MTU 1196
+
+/* Stream messages go out in this many DataMessages, so that the
+ * client has some reassembly to do */
+#define STREAM_FRAGS 2
+
+struct xrp_peer {
+	struct xrp_server *srv;
+
+	/* Either a websocket... */
+	SoupWebsocketConnection *ws;
+
+	/* ...or a DTLS session, fed one datagram at a time */
+	gnutls_session_t dtls;
+	GSocketAddress *addr;
+	gchar *key;
+	const guint8 *pending;
+	gsize pending_len;
+	gboolean handshaked;
+
+	gboolean authorised;
+	guint32 data_seq;
+	guint32 data_msg_id;
+};
+
+struct xrp_server {
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+
+	/* Startup, and stats requests from other threads */
+	GMutex lock;
+	GCond cond;
+	gboolean ready;
+	GError *error;
+	gboolean stats_ready;
+	struct xrp_server_stats stats_copy;
+
+	/* Everything below is only touched on the server thread */
+	struct xrp_server_stats stats;
+	SoupServer *soup;
+	gchar *ws_url;
+	GList *ws_peers;
+	GSocket *dtls_sock, *silent_sock;
+	guint16 dtls_port, silent_port;
+	GSource *dtls_source;
+	GHashTable *dtls_peers;
+	gnutls_certificate_credentials_t cred;
+	gchar *ca_file;
+	guint8 tx_buf[sizeof(struct xrp_header) + XRP_MAX_PAYLOAD];
+};
+
+__thread gboolean xrp_in_server_thread;
+
+static void peer_send(struct xrp_peer *peer, enum xrp_pkt_type type, const ProtobufCMessage *msg)
+{
+	struct xrp_server *srv = peer->srv;
+	struct xrp_header *hdr = (void *)srv->tx_buf;
+	gsize len = sizeof(*hdr) + protobuf_c_message_get_packed_size(msg);
+
+	g_assert(len <= sizeof(srv->tx_buf));
+	hdr->type = htons(type);
+	hdr->len = htons(len);
+	protobuf_c_message_pack(msg, (void *)(hdr + 1));
+
+	if (peer->ws)
+		soup_websocket_connection_send_binary(peer->ws, hdr, len);
+	else
+		gnutls_record_send(peer->dtls, hdr, len);
+	srv->stats.packets_out++;
+}
+
+/* Introduce a (fictitious) other participant, as a fragmented StreamMessage */
+static void send_streams(struct xrp_peer *peer)
+{
+	StreamIdInfo info = STREAM_ID_INFO__INIT;
+	StreamIdInfo *infos[1] = { &info };
+	StreamMessage smsg = STREAM_MESSAGE__INIT;
+	guint8 buf[256];
+	struct xrp_header *hdr = (void *)buf;
+	gsize len, frag, offset;
+
+	info.has_stream_id = TRUE;
+	info.stream_id = 1;
+	info.profile_id = (char *)"xrp-server-echo";
+	smsg.n_streams = 1;
+	smsg.streams = infos;
+
+	len = sizeof(*hdr) + stream_message__get_packed_size(&smsg);
+	g_assert(len <= sizeof(buf));
+	hdr->type = htons(XRP_STREAM_MESSAGE);
+	hdr->len = htons(len);
+	stream_message__pack(&smsg, (void *)(hdr + 1));
+
+	frag = (len + STREAM_FRAGS - 1) / STREAM_FRAGS;
+	for (offset = 0; offset < len; offset += frag) {
+		DataMessage dmsg = DATA_MESSAGE__INIT;
+
+		dmsg.has_seq = TRUE;
+		dmsg.seq = peer->data_seq++;
+		dmsg.has_msg_id = TRUE;
+		dmsg.msg_id = peer->data_msg_id;
+		dmsg.has_msg_len = TRUE;
+		dmsg.msg_len = len;
+		dmsg.has_offset = TRUE;
+		dmsg.offset = offset;
+		dmsg.has_data = TRUE;
+		dmsg.data.data = buf + offset;
+		dmsg.data.len = MIN(frag, len - offset);
+		peer_send(peer, XRP_DATA_MESSAGE, &dmsg.base);
+	}
+	peer->data_msg_id++;
+}
+
+static void handle_auth(struct xrp_peer *peer, const guint8 *pkt, gsize len)
+{
+	struct xrp_server *srv = peer->srv;
+	AuthMessage *msg = auth_message__unpack(NULL, len, pkt);
+	AuthMessage reply = AUTH_MESSAGE__INIT;
+
+	if (!msg)
+		return;
+
+	reply.has_message_type = TRUE;
+	if (msg->message_type == AUTH_MESSAGE_TYPE__REQUEST) {
+		reply.message_type = AUTH_MESSAGE_TYPE__RESPONSE;
+		reply.has_authorized = TRUE;
+		reply.authorized = TRUE;
+		peer_send(peer, XRP_AUTH_MESSAGE, &reply.base);
+
+		if (!peer->authorised) {
+			peer->authorised = TRUE;
+			if (peer->ws)
+				srv->stats.ws_calls++;
+			else
+				srv->stats.dtls_calls++;
+			send_streams(peer);
+		}
+	} else if (msg->message_type == AUTH_MESSAGE_TYPE__HANGUP) {
+		reply.message_type = AUTH_MESSAGE_TYPE__FINISH;
+		peer_send(peer, XRP_AUTH_MESSAGE, &reply.base);
+		srv->stats.hangups++;
+	}
+
+	auth_message__free_unpacked(msg, NULL);
+}
+
+/*
+ * Every RT message gets an answer carrying our clock, so the client can
+ * measure the round trip. Any audio in it goes straight back, keeping
+ * its sequence number and timestamp.
+ */
+static void handle_rt(struct xrp_peer *peer, const guint8 *pkt, gsize len)
+{
+	RTMessage *msg = rtmessage__unpack(NULL, len, pkt);
+	RTMessage reply = RTMESSAGE__INIT;
+	AudioMessage audio = AUDIO_MESSAGE__INIT;
+
+	if (!msg)
+		return;
+
+	if (!peer->authorised || !msg->audio)
+		goto out;
+
+	audio.has_server_time = TRUE;
+	audio.server_time = g_get_real_time();
+	if (msg->audio->has_server_time) {
+		audio.has_echo_time = TRUE;
+		audio.echo_time = msg->audio->server_time;
+	}
+	if (msg->audio->has_audio && msg->audio->audio.len) {
+		audio.has_seq = TRUE;
+		audio.seq = msg->audio->seq;
+		audio.has_sample_time = TRUE;
+		audio.sample_time = msg->audio->sample_time;
+		audio.has_audio = TRUE;
+		audio.audio = msg->audio->audio;
+	}
+	reply.audio = &audio;
+	peer_send(peer, XRP_RT_MESSAGE, &reply.base);
+
+ out:
+	rtmessage__free_unpacked(msg, NULL);
+}
+
+static void handle_packet(struct xrp_peer *peer, const guint8 *pkt, gsize len)
+{
+	const struct xrp_header *hdr = (const void *)pkt;
+
+	peer->srv->stats.packets_in++;
+
+	if (len < sizeof(*hdr) || ntohs(hdr->len) != len)
+		return;
+
+	pkt += sizeof(*hdr);
+	len -= sizeof(*hdr);
+
+	switch (ntohs(hdr->type)) {
+	case XRP_AUTH_MESSAGE:
+		handle_auth(peer, pkt, len);
+		break;
+	case XRP_RT_MESSAGE:
+		handle_rt(peer, pkt, len);
+		break;
+	case XRP_DATA_MESSAGE:
+		/* Nothing we send needs resending, so acks are just counted */
+		peer->srv->stats.data_acks++;
+		break;
+	}
+}
+
+static void free_ws_peer(struct xrp_peer *peer)
+{
+	g_signal_handlers_disconnect_matched(G_OBJECT(peer->ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, peer);
+	g_object_unref(peer->ws);
+	g_free(peer);
+}
+
+static void ws_message(SoupWebsocketConnection *ws, gint type, GBytes *message, gpointer _peer)
+{
+	gsize len;
+	gconstpointer data = g_bytes_get_data(message, &len);
+
+	handle_packet(_peer, data, len);
+}
+
+static void ws_closed(SoupWebsocketConnection *ws, gpointer _peer)
+{
+	struct xrp_peer *peer = _peer;
+
+	peer->srv->ws_peers = g_list_remove(peer->srv->ws_peers, peer);
+	free_ws_peer(peer);
+}
+
+static void ws_handler(SoupServer *server, SoupWebsocketConnection *ws, const char *path,
+		       SoupClientContext *client, gpointer _srv)
+{
+	struct xrp_server *srv = _srv;
+	struct xrp_peer *peer = g_new0(struct xrp_peer, 1);
+
+	peer->srv = srv;
+	peer->ws = g_object_ref(ws);
+	g_signal_connect(ws, "message", G_CALLBACK(ws_message), peer);
+	g_signal_connect(ws, "closed", G_CALLBACK(ws_closed), peer);
+	srv->ws_peers = g_list_prepend(srv->ws_peers, peer);
+}
+
+static ssize_t dtls_push(gnutls_transport_ptr_t ptr, const void *data, size_t len)
+{
+	struct xrp_peer *peer = ptr;
+	gssize ret = g_socket_send_to(peer->srv->dtls_sock, peer->addr, data, len, NULL, NULL);
+
+	if (ret < 0) {
+		gnutls_transport_set_errno(peer->dtls, EIO);
+		return -1;
+	}
+	return ret;
+}
+
+static ssize_t dtls_pull(gnutls_transport_ptr_t ptr, void *data, size_t len)
+{
+	struct xrp_peer *peer = ptr;
+
+	if (!peer->pending) {
+		gnutls_transport_set_errno(peer->dtls, EAGAIN);
+		return -1;
+	}
+
+	len = MIN(len, peer->pending_len);
+	memcpy(data, peer->pending, len);
+	peer->pending = NULL;
+	return len;
+}
+
+static int dtls_pull_timeout(gnutls_transport_ptr_t ptr, unsigned int ms)
+{
+	struct xrp_peer *peer = ptr;
+
+	return peer->pending ? 1 : 0;
+}
+
+static void free_dtls_peer(gpointer _peer)
+{
+	struct xrp_peer *peer = _peer;
+
+	gnutls_deinit(peer->dtls);
+	g_object_unref(peer->addr);
+	g_free(peer->key);
+	g_free(peer);
+}
+
+static struct xrp_peer *dtls_peer(struct xrp_server *srv, GSocketAddress *addr)
+{
+	GInetSocketAddress *inet = G_INET_SOCKET_ADDRESS(addr);
+	gchar *host = g_inet_address_to_string(g_inet_socket_address_get_address(inet));
+	gchar *key = g_strdup_printf("%s:%u", host, g_inet_socket_address_get_port(inet));
+	struct xrp_peer *peer;
+
+	g_free(host);
+	peer = g_hash_table_lookup(srv->dtls_peers, key);
+	if (peer) {
+		g_free(key);
+		return peer;
+	}
+
+	peer = g_new0(struct xrp_peer, 1);
+	peer->srv = srv;
+	peer->addr = g_object_ref(addr);
+	peer->key = key;
+
+	gnutls_init(&peer->dtls, GNUTLS_SERVER|GNUTLS_DATAGRAM|GNUTLS_NONBLOCK);
+	gnutls_set_default_priority(peer->dtls);
+	gnutls_credentials_set(peer->dtls, GNUTLS_CRD_CERTIFICATE, srv->cred);
+	gnutls_transport_set_ptr(peer->dtls, peer);
+	gnutls_transport_set_push_function(peer->dtls, dtls_push);
+	gnutls_transport_set_pull_function(peer->dtls, dtls_pull);
+	gnutls_transport_set_pull_timeout_function(peer->dtls, dtls_pull_timeout);
+	gnutls_dtls_set_mtu(peer->dtls, DTLS_MTU);
+
+	g_hash_table_insert(srv->dtls_peers, peer->key, peer);
+	return peer;
+}
+
+/* Loopback doesn't lose packets, so there's no retransmission timer */
+static gboolean dtls_readable(GSocket *sock, GIOCondition cond, gpointer _srv)
+{
+	struct xrp_server *srv = _srv;
+	guint8 buf[2048], pkt[2048];
+	GSocketAddress *addr;
+	gssize len;
+
+	while ((len = g_socket_receive_from(sock, &addr, (gchar *)buf, sizeof(buf), NULL, NULL)) >= 0) {
+		struct xrp_peer *peer = dtls_peer(srv, addr);
+		ssize_t ret;
+
+		g_object_unref(addr);
+
+		peer->pending = buf;
+		peer->pending_len = len;
+
+		if (!peer->handshaked) {
+			ret = gnutls_handshake(peer->dtls);
+			if (!ret)
+				peer->handshaked = TRUE;
+		} else {
+			while ((ret = gnutls_record_recv(peer->dtls, pkt, sizeof(pkt))) > 0)
+				handle_packet(peer, pkt, ret);
+		}
+		peer->pending = NULL;
+
+		if (ret < 0 && gnutls_error_is_fatal(ret))
+			g_hash_table_remove(srv->dtls_peers, peer->key);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static GSocket *udp_socket(GSocketAddress *addr, guint16 *port, GError **error)
+{
+	GSocket *sock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+				     G_SOCKET_PROTOCOL_UDP, error);
+	GSocketAddress *bound;
+
+	if (!sock)
+		return NULL;
+
+	g_socket_set_blocking(sock, FALSE);
+	if (!g_socket_bind(sock, addr, TRUE, error) ||
+	    !(bound = g_socket_get_local_address(sock, error))) {
+		g_object_unref(sock);
+		return NULL;
+	}
+
+	*port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound));
+	g_object_unref(bound);
+	return sock;
+}
+
+static gboolean server_listen(struct xrp_server *srv, GError **error)
+{
+	GInetAddress *lo = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	GSocketAddress *addr = g_inet_socket_address_new(lo, 0);
+	char *protocols[] = { (char *)"opus-med", NULL };
+	gboolean ret = FALSE;
+	GSList *uris;
+
+	g_object_unref(lo);
+
+	srv->soup = soup_server_new(SOUP_SERVER_SERVER_HEADER, "xrp-server", NULL);
+	soup_server_add_websocket_handler(srv->soup, "/audio", NULL, protocols,
+					  ws_handler, srv, NULL);
+	if (!soup_server_listen(srv->soup, addr, 0, error))
+		goto out;
+
+	uris = soup_server_get_uris(srv->soup);
+	srv->ws_url = g_strdup_printf("ws://127.0.0.1:%u",
+				      soup_uri_get_port(uris->data));
+	g_slist_free_full(uris, (GDestroyNotify)soup_uri_free);
+
+	srv->dtls_sock = udp_socket(addr, &srv->dtls_port, error);
+	if (!srv->dtls_sock)
+		goto out;
+	srv->silent_sock = udp_socket(addr, &srv->silent_port, error);
+	if (!srv->silent_sock)
+		goto out;
+
+	srv->dtls_peers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_dtls_peer);
+	srv->dtls_source = g_socket_create_source(srv->dtls_sock, G_IO_IN, NULL);
+	g_source_set_callback(srv->dtls_source, G_SOURCE_FUNC(dtls_readable), srv, NULL);
+	g_source_attach(srv->dtls_source, srv->context);
+	ret = TRUE;
+
+ out:
+	g_object_unref(addr);
+	return ret;
+}
+
+static void server_teardown(struct xrp_server *srv)
+{
+	g_list_free_full(srv->ws_peers, (GDestroyNotify)free_ws_peer);
+	srv->ws_peers = NULL;
+	g_clear_object(&srv->soup);
+
+	if (srv->dtls_source) {
+		g_source_destroy(srv->dtls_source);
+		g_source_unref(srv->dtls_source);
+	}
+	g_clear_pointer(&srv->dtls_peers, g_hash_table_destroy);
+	g_clear_object(&srv->dtls_sock);
+	g_clear_object(&srv->silent_sock);
+}
+
+static gint64 thread_cpu_us(void)
+{
+#ifdef RUSAGE_THREAD
+	struct rusage ru;
+
+	if (!getrusage(RUSAGE_THREAD, &ru))
+		return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * G_USEC_PER_SEC +
+			ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+	return 0;
+}
+
+static gboolean copy_stats(gpointer _srv)
+{
+	struct xrp_server *srv = _srv;
+
+	g_mutex_lock(&srv->lock);
+	srv->stats_copy = srv->stats;
+	srv->stats_copy.cpu_us = thread_cpu_us();
+	srv->stats_ready = TRUE;
+	g_cond_signal(&srv->cond);
+	g_mutex_unlock(&srv->lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+void xrp_server_get_stats(struct xrp_server *srv, struct xrp_server_stats *stats)
+{
+	g_mutex_lock(&srv->lock);
+	srv->stats_ready = FALSE;
+	g_mutex_unlock(&srv->lock);
+
+	g_main_context_invoke(srv->context, copy_stats, srv);
+
+	g_mutex_lock(&srv->lock);
+	while (!srv->stats_ready)
+		g_cond_wait(&srv->cond, &srv->lock);
+	*stats = srv->stats_copy;
+	g_mutex_unlock(&srv->lock);
+}
+
+static gpointer server_thread(gpointer _srv)
+{
+	struct xrp_server *srv = _srv;
+	GError *error = NULL;
+
+	xrp_in_server_thread = TRUE;
+	g_main_context_push_thread_default(srv->context);
+
+	server_listen(srv, &error);
+
+	g_mutex_lock(&srv->lock);
+	srv->error = error;
+	srv->ready = TRUE;
+	g_cond_signal(&srv->cond);
+	g_mutex_unlock(&srv->lock);
+
+	if (!error)
+		g_main_loop_run(srv->loop);
+
+	server_teardown(srv);
+	g_main_context_pop_thread_default(srv->context);
+	return NULL;
+}
+
+/* A throwaway self-signed certificate for 127.0.0.1, which the client
+ * is told to trust by way of CHIME_DTLS_CAFILE */
+static gboolean make_cert(struct xrp_server *srv, GError **error)
+{
+	gnutls_x509_privkey_t key = NULL;
+	gnutls_x509_crt_t crt = NULL;
+	gnutls_datum_t pem = { NULL, 0 };
+	guint8 ip[4] = { 127, 0, 0, 1 };
+	guint8 serial[8];
+	time_t now = time(NULL);
+	gboolean ret = FALSE;
+	int err, fd;
+
+	gnutls_rnd(GNUTLS_RND_NONCE, serial, sizeof(serial));
+	serial[0] &= 0x7f;
+
+	if ((err = gnutls_x509_privkey_init(&key)) ||
+	    (err = gnutls_x509_privkey_generate(key, GNUTLS_PK_ECDSA,
+						gnutls_sec_param_to_pk_bits(GNUTLS_PK_ECDSA, GNUTLS_SEC_PARAM_MEDIUM),
+						0)) ||
+	    (err = gnutls_x509_crt_init(&crt)) ||
+	    (err = gnutls_x509_crt_set_version(crt, 3)) ||
+	    (err = gnutls_x509_crt_set_serial(crt, serial, sizeof(serial))) ||
+	    (err = gnutls_x509_crt_set_activation_time(crt, now - 3600)) ||
+	    (err = gnutls_x509_crt_set_expiration_time(crt, now + 86400)) ||
+	    (err = gnutls_x509_crt_set_dn_by_oid(crt, GNUTLS_OID_X520_COMMON_NAME, 0,
+						 "127.0.0.1", strlen("127.0.0.1"))) ||
+	    (err = gnutls_x509_crt_set_subject_alt_name(crt, GNUTLS_SAN_IPADDRESS, ip, sizeof(ip),
+							GNUTLS_FSAN_SET)) ||
+	    (err = gnutls_x509_crt_set_key_usage(crt, GNUTLS_KEY_DIGITAL_SIGNATURE)) ||
+	    (err = gnutls_x509_crt_set_key(crt, key)) ||
+	    (err = gnutls_x509_crt_sign2(crt, crt, key, GNUTLS_DIG_SHA256, 0)) ||
+	    (err = gnutls_certificate_allocate_credentials(&srv->cred)) ||
+	    (err = gnutls_certificate_set_x509_key(srv->cred, &crt, 1, key)) ||
+	    (err = gnutls_x509_crt_export2(crt, GNUTLS_X509_FMT_PEM, &pem))) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			    "Failed to create certificate: %s", gnutls_strerror(err));
+		goto out;
+	}
+
+	fd = g_file_open_tmp("xrp-server-XXXXXX.pem", &srv->ca_file, error);
+	if (fd < 0)
+		goto out;
+	close(fd);
+
+	ret = g_file_set_contents(srv->ca_file, (gchar *)pem.data, pem.size, error);
+
+ out:
+	gnutls_free(pem.data);
+	if (crt)
+		gnutls_x509_crt_deinit(crt);
+	if (key)
+		gnutls_x509_privkey_deinit(key);
+	return ret;
+}
+
+struct xrp_server *xrp_server_new(GError **error)
+{
+	struct xrp_server *srv = g_new0(struct xrp_server, 1);
+
+	g_mutex_init(&srv->lock);
+	g_cond_init(&srv->cond);
+
+	if (!make_cert(srv, error)) {
+		xrp_server_free(srv);
+		return NULL;
+	}
+
+	srv->context = g_main_context_new();
+	srv->loop = g_main_loop_new(srv->context, FALSE);
+	srv->thread = g_thread_new("xrp-server", server_thread, srv);
+
+	g_mutex_lock(&srv->lock);
+	while (!srv->ready)
+		g_cond_wait(&srv->cond, &srv->lock);
+	g_mutex_unlock(&srv->lock);
+
+	if (srv->error) {
+		g_propagate_error(error, srv->error);
+		srv->error = NULL;
+		xrp_server_free(srv);
+		return NULL;
+	}
+
+	return srv;
+}
+
+static gboolean quit_loop(gpointer _srv)
+{
+	struct xrp_server *srv = _srv;
+
+	g_main_loop_quit(srv->loop);
+	return G_SOURCE_REMOVE;
+}
+
+void xrp_server_free(struct xrp_server *srv)
+{
+	if (srv->thread) {
+		g_main_context_invoke(srv->context, quit_loop, srv);
+		g_thread_join(srv->thread);
+	}
+	if (srv->loop)
+		g_main_loop_unref(srv->loop);
+	if (srv->context)
+		g_main_context_unref(srv->context);
+	if (srv->cred)
+		gnutls_certificate_free_credentials(srv->cred);
+	if (srv->ca_file) {
+		g_unlink(srv->ca_file);
+		g_free(srv->ca_file);
+	}
+	g_free(srv->ws_url);
+	g_mutex_clear(&srv->lock);
+	g_cond_clear(&srv->cond);
+	g_free(srv);
+}
+
+const gchar *xrp_server_get_ws_url(struct xrp_server *srv)
+{
+	return srv->ws_url;
+}
+
+guint16 xrp_server_get_dtls_port(struct xrp_server *srv)
+{
+	return srv->dtls_port;
+}
+
+guint16 xrp_server_get_silent_port(struct xrp_server *srv)
+{
+	return srv->silent_port;
+}
+
+const gchar *xrp_server_get_ca_file(struct xrp_server *srv)
+{
+	return srv->ca_file;
+}
@@ -0,0 +1,54 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef __XRP_SERVER_H__
+#define __XRP_SERVER_H__
+
+#include <glib.h>
+
+/*
+ * A stand-in for the Chime media server, just enough of one to carry
+ * calls: it authorises everyone, tells each call about one other stream
+ * via a fragmented DataMessage, and echoes any audio straight back. It
+ * listens on 127.0.0.1 for the websocket and for DTLS, with a certificate
+ * made up on the spot, and runs on its own thread.
+ */
+struct xrp_server;
+
+struct xrp_server_stats {
+	guint packets_in, packets_out;
+	guint ws_calls, dtls_calls;	/* Authorised, by transport */
+	guint data_acks;		/* DataMessages from clients */
+	guint hangups;
+	gint64 cpu_us;			/* Server thread; zero if unknown */
+};
+
+struct xrp_server *xrp_server_new(GError **error);
+void xrp_server_free(struct xrp_server *srv);
+
+/* For the call's audio_ws_url, e.g. "ws://127.0.0.1:1234" */
+const gchar *xrp_server_get_ws_url(struct xrp_server *srv);
+guint16 xrp_server_get_dtls_port(struct xrp_server *srv);
+/* Takes DTLS and says nothing, so calls using it end up on the websocket */
+guint16 xrp_server_get_silent_port(struct xrp_server *srv);
+/* The PEM certificate to trust, for CHIME_DTLS_CAFILE */
+const gchar *xrp_server_get_ca_file(struct xrp_server *srv);
+
+void xrp_server_get_stats(struct xrp_server *srv, struct xrp_server_stats *stats);
+
+/* Set on the server's thread, so that its work can be told apart */
+extern __thread gboolean xrp_in_server_thread;
+
+#endif /* __XRP_SERVER_H__ */